@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "animate.h"
+
+static anim_keyframe_t *add(anim_t *anim, const vfd_frame_t *first, const vfd_frame_t *second, uint8_t split)
+{
+	if (anim->count >= ANIM_MAX_KEYFRAMES) return NULL;
+
+	anim_keyframe_t *kf = &anim->kf[anim->count++];
+	kf->first = *first;
+	kf->second = *second;
+	kf->split = split;
+	return kf;
+}
+
+static void crossfade(anim_t *anim, const vfd_frame_t *from, const vfd_frame_t *to)
+{
+	// The new frame gets a growing share of every phase, the old one the rest
+	for (uint8_t level = 1; level < ANIM_LEVELS; level++) {
+		add(anim, to, from, level);
+	}
+}
+
+static void roll(anim_t *anim, const vfd_frame_t *from, const vfd_frame_t *to,
+				 const char *from_str, const char *to_str)
+{
+	uint8_t steps[VFD_TUBES];
+	uint8_t max_steps = 0;
+
+	// Digits count upwards (9 wraps to 0) until they reach the new value
+	for (int t = 0; t < VFD_TUBES; t++) {
+		bool digits = from_str[t] >= '0' && from_str[t] <= '9' && to_str[t] >= '0' && to_str[t] <= '9';
+		steps[t] = digits ? (to_str[t] - from_str[t] + 10) % 10 : 0;
+		if (steps[t] > max_steps) max_steps = steps[t];
+	}
+
+	for (uint8_t j = 1; j < max_steps; j++) {
+		vfd_frame_t frame = *to;
+		for (int t = 0; t < VFD_TUBES; t++) {
+			if (j < steps[t]) {
+				// Keep the old decimal point until the digit lands
+				frame.seg[t] = vfd_glyph('0' + (from_str[t] - '0' + j) % 10) | (from->seg[t] & 1);
+			} else if (steps[t] == 0) {
+				frame.seg[t] = from->seg[t]; // Letters and unchanged tubes switch at the end
+			}
+		}
+		add(anim, &frame, &frame, ANIM_LEVELS);
+	}
+}
+
+static void morph(anim_t *anim, const vfd_frame_t *from, const vfd_frame_t *to)
+{
+	vfd_frame_t frame = *from;
+	bool changed = true;
+
+	// Off first, then on, one segment per tube per keyframe
+	for (int pass = 0; pass < 2; pass++) {
+		changed = true;
+		while (changed) {
+			changed = false;
+			for (int t = 0; t < VFD_TUBES; t++) {
+				uint8_t diff = pass == 0 ? frame.seg[t] & ~to->seg[t] : to->seg[t] & ~frame.seg[t];
+				if (diff) {
+					frame.seg[t] ^= diff & -diff; // Lowest differing segment
+					changed = true;
+				}
+			}
+			if (changed && memcmp(&frame, to, sizeof(frame)) != 0) add(anim, &frame, &frame, ANIM_LEVELS);
+		}
+	}
+}
+
+bool anim_compile(anim_t *anim, anim_type_t type, const vfd_frame_t *from, const vfd_frame_t *to,
+				  const char *from_str, const char *to_str, uint32_t duration_phases)
+{
+	anim->count = 0;
+	anim->next = 0;
+	anim->phases_left = 0;
+	if (memcmp(from, to, sizeof(*from)) == 0) return false;
+
+	switch (type) {
+	case ANIM_CROSSFADE:
+		crossfade(anim, from, to);
+		break;
+	case ANIM_ROLL:
+		roll(anim, from, to, from_str, to_str);
+		break;
+	case ANIM_MORPH:
+		morph(anim, from, to);
+		break;
+	default:
+		break;
+	}
+	if (anim->count == 0) return false;
+
+	// Whole frames only, so both grid phases see every keyframe
+	uint32_t phases = (duration_phases / anim->count) & ~1u;
+	if (phases < 2) phases = 2;
+	if (phases > UINT8_MAX - 1) phases = UINT8_MAX - 1;
+	for (int k = 0; k < anim->count; k++) anim->kf[k].phases = phases;
+
+	return true;
+}
+
+uint32_t anim_load(anim_t *anim, const uint8_t *records, size_t size)
+{
+	uint32_t phases = 0;
+
+	anim->count = 0;
+	anim->next = 0;
+	anim->phases_left = 0;
+	for (size_t off = 0; off + ANIM_RECORD_SIZE <= size; off += ANIM_RECORD_SIZE) {
+		vfd_frame_t frame;
+		memcpy(frame.seg, records + off, VFD_TUBES);
+
+		anim_keyframe_t *kf = add(anim, &frame, &frame, ANIM_LEVELS);
+		if (!kf) break;
+		kf->phases = records[off + VFD_TUBES] ? records[off + VFD_TUBES] : 1;
+		phases += kf->phases;
+	}
+	return phases;
+}
+
+const anim_keyframe_t *anim_tick(anim_t *anim, bool *done)
+{
+	*done = false;
+	if (anim->phases_left > 1) {
+		anim->phases_left--;
+		return NULL;
+	}
+
+	if (anim->next >= anim->count) {
+		*done = true;
+		return NULL;
+	}
+
+	const anim_keyframe_t *kf = &anim->kf[anim->next++];
+	anim->phases_left = kf->phases;
+	return kf;
+}
@@ -0,0 +1,66 @@
+#ifndef MAIN_ANIMATE_H_
+#define MAIN_ANIMATE_H_
+
+/*
+    Digit transition animations.
+
+    A transition is compiled once, when the content changes, into a short list
+    of keyframes. Every keyframe holds two pre-encoded frames and a split
+    point: the first frame is lit for split/ANIM_LEVELS of a mux phase and the
+    second one for the rest. Segments present in both stay fully lit, which is
+    how a crossfade gets its brightness levels out of plain on/off outputs.
+
+    The refresh path replays the list: one counter decrement per phase, a
+    pointer step per keyframe and at most one extra shift-out at the split.
+    That cost is the same for every transition type.
+
+      CROSSFADE  the new content takes over the phase in ANIM_LEVELS steps
+      ROLL       changed digits count up to their new value, slot-machine style
+      MORPH      segments that go away switch off one by one, then the new ones
+                 switch on one by one
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "vfd_driver.h"
+
+#define ANIM_LEVELS			16	// Split resolution within a mux phase
+#define ANIM_MAX_KEYFRAMES	32
+
+typedef enum {
+	ANIM_NONE = 0,
+	ANIM_CROSSFADE,
+	ANIM_ROLL,
+	ANIM_MORPH,
+} anim_type_t;
+
+typedef struct {
+	vfd_frame_t first;		// Lit from the start of the phase...
+	vfd_frame_t second;		// ...and this one from the split on
+	uint8_t split;			// 0..ANIM_LEVELS, ANIM_LEVELS = first only
+	uint8_t phases;			// Mux phases to show the keyframe for
+} anim_keyframe_t;
+
+typedef struct {
+	anim_keyframe_t kf[ANIM_MAX_KEYFRAMES];
+	uint8_t count;
+	uint8_t next;			// Keyframe shown next
+	uint8_t phases_left;	// Phases left of the current keyframe
+} anim_t;
+
+/* Compile a transition from one content to the next. The strings are only used by ROLL.
+ * Returns false (and an empty list) when there is nothing to animate. */
+bool anim_compile(anim_t *anim, anim_type_t type, const vfd_frame_t *from, const vfd_frame_t *to,
+				  const char *from_str, const char *to_str, uint32_t duration_phases);
+
+/* Load a stored animation: records of VFD_TUBES segment bytes and a phase count (ANIM_RECORD_SIZE bytes each).
+ * Returns the length in mux phases, 0 if there was nothing to load. */
+#define ANIM_RECORD_SIZE (VFD_TUBES + 1)
+uint32_t anim_load(anim_t *anim, const uint8_t *records, size_t size);
+
+/* Advance by one mux phase. Returns the keyframe to show from now on when it changed,
+ * *done is set once the transition is over. */
+const anim_keyframe_t *anim_tick(anim_t *anim, bool *done);
+
+#endif /* MAIN_ANIMATE_H_ */
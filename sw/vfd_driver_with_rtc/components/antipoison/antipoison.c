@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "antipoison.h"
+
+void antipoison_build(antipoison_seq_t *seq, const uint32_t usage_s[VFD_TUBES][ANTIPOISON_SEGMENTS],
+					  uint32_t dwell_phases)
+{
+	memset(seq, 0, sizeof(*seq));
+
+	for (int t = 0; t < VFD_TUBES; t++) {
+		// Rank this tube's segments by usage, least used first (insertion sort, 8 entries)
+		uint8_t rank[ANTIPOISON_SEGMENTS];
+		for (int s = 0; s < ANTIPOISON_SEGMENTS; s++) {
+			int i = s;
+			while (i > 0 && usage_s[t][rank[i - 1]] > usage_s[t][s]) {
+				rank[i] = rank[i - 1];
+				i--;
+			}
+			rank[i] = s;
+		}
+
+		// Step k lights every tube's k-th least used segment, bit 7 is segment A
+		for (int k = 0; k < ANTIPOISON_SEGMENTS; k++) {
+			seq->steps[k].frame.seg[t] = 0x80 >> rank[k];
+		}
+	}
+
+	// Least used step gets twice the dwell, falling linearly towards 1x for the most used
+	for (int k = 0; k < ANTIPOISON_SEGMENTS; k++) {
+		uint32_t phases = dwell_phases * (2 * ANTIPOISON_SEGMENTS - k) / ANTIPOISON_SEGMENTS;
+		seq->steps[k].phases = phases ? phases : 1;
+	}
+
+	seq->count = ANTIPOISON_SEGMENTS;
+}
+
+const vfd_frame_t *antipoison_tick(antipoison_seq_t *seq, bool *done)
+{
+	*done = false;
+	if (seq->phases_left > 1) {
+		seq->phases_left--;
+		return NULL;
+	}
+
+	if (seq->next >= seq->count) {
+		*done = true;
+		return NULL;
+	}
+
+	const antipoison_step_t *step = &seq->steps[seq->next++];
+	seq->phases_left = step->phases;
+	return &step->frame;
+}
+
+uint32_t antipoison_phases(const antipoison_seq_t *seq)
+{
+	uint32_t phases = 0;
+	for (int k = 0; k < seq->count; k++) phases += seq->steps[k].phases;
+	return phases;
+}
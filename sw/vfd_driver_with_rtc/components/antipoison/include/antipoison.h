@@ -0,0 +1,45 @@
+#ifndef MAIN_ANTIPOISON_H_
+#define MAIN_ANTIPOISON_H_
+
+/*
+    Cathode anti-poisoning exercise.
+
+    Segments that are rarely lit slowly get coated by material sputtered off
+    the busy ones. The exercise lights every segment of every tube on its own
+    for a while. Each tube's segments are ranked by their odometer reading, the
+    least used segments go first and get up to twice the dwell.
+
+    The whole sequence is encoded up front. Replaying it is one counter
+    decrement per mux phase, plus a pointer step when a segment's dwell is up.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vfd_driver.h"
+
+#define ANTIPOISON_SEGMENTS	8	// A..G, H (decimal point)
+
+typedef struct {
+	vfd_frame_t frame;		// One segment lit per tube
+	uint32_t phases;		// Mux phases to show it for
+} antipoison_step_t;
+
+typedef struct {
+	antipoison_step_t steps[ANTIPOISON_SEGMENTS];
+	uint8_t count;
+	uint8_t next;			// Step shown next
+	uint32_t phases_left;	// Phases left of the current step
+} antipoison_seq_t;
+
+/* Encode the sequence. usage_s holds each segment's lit time (0 = A .. 7 = H), dwell_phases the base dwell. */
+void antipoison_build(antipoison_seq_t *seq, const uint32_t usage_s[VFD_TUBES][ANTIPOISON_SEGMENTS],
+					  uint32_t dwell_phases);
+
+/* Advance by one mux phase. Returns the frame to show from now on when the step changed,
+ * *done is set once the sequence is over. */
+const vfd_frame_t *antipoison_tick(antipoison_seq_t *seq, bool *done);
+
+/* Total length of the sequence in mux phases */
+uint32_t antipoison_phases(const antipoison_seq_t *seq);
+
+#endif /* MAIN_ANTIPOISON_H_ */
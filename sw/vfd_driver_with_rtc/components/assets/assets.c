@@ -0,0 +1,76 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_partition.h"
+#include "esp_crc.h"
+#include "esp_log.h"
+
+#include "assets.h"
+
+#define TAG "ASSETS"
+
+_Static_assert(sizeof(assets_header_t) == 24, "HEADER in pack_assets.py has the same layout");
+
+static const uint8_t *base = NULL;	// Mapped partition, NULL while there are no valid assets
+static esp_partition_mmap_handle_t map_handle;
+
+esp_err_t assets_init(void)
+{
+	const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ASSETS_PARTITION_SUBTYPE, "assets");
+	if (!part) {
+		ESP_LOGW(TAG, "No asset partition, using built-in data");
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	const void *ptr;
+	esp_err_t res = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &map_handle);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not map the asset partition: %d", res);
+		return res;
+	}
+
+	const assets_header_t *hdr = ptr;
+	if (hdr->magic != ASSETS_MAGIC || hdr->format != ASSETS_FORMAT_VERSION) {
+		ESP_LOGW(TAG, "No assets flashed (magic 0x%08" PRIx32 ", format %u)", hdr->magic, hdr->format);
+		res = ESP_ERR_INVALID_VERSION;
+	} else if (hdr->tubes != ASSETS_TUBES) {
+		ESP_LOGE(TAG, "Assets packed for %u tubes, the display has %d", hdr->tubes, ASSETS_TUBES);
+		res = ESP_ERR_NOT_SUPPORTED;
+	} else if (hdr->total_size < sizeof(*hdr) + hdr->count * sizeof(assets_entry_t) || hdr->total_size > part->size) {
+		ESP_LOGE(TAG, "Bad asset size %" PRIu32, hdr->total_size);
+		res = ESP_ERR_INVALID_SIZE;
+	} else if (esp_crc32_le(0, (const uint8_t *)ptr + sizeof(*hdr), hdr->total_size - sizeof(*hdr)) != hdr->crc32) {
+		ESP_LOGE(TAG, "Asset CRC mismatch");
+		res = ESP_ERR_INVALID_CRC;
+	}
+
+	if (res != ESP_OK) {
+		esp_partition_munmap(map_handle);
+		return res;
+	}
+
+	base = ptr;
+	ESP_LOGI(TAG, "Assets version %" PRIu32 ", %u entries, %" PRIu32 " bytes", hdr->version, hdr->count, hdr->total_size);
+	return ESP_OK;
+}
+
+const void *assets_find(asset_type_t type, uint16_t id, size_t *size)
+{
+	if (!base) return NULL;
+
+	const assets_header_t *hdr = (const assets_header_t *)base;
+	const assets_entry_t *dir = (const assets_entry_t *)(base + sizeof(*hdr));
+	for (int i = 0; i < hdr->count; i++) {
+		if (dir[i].type != type || dir[i].id != id) continue;
+		if (dir[i].offset + dir[i].size > hdr->total_size) return NULL; // CRC was fine, but the packer was not
+
+		if (size) *size = dir[i].size;
+		return base + dir[i].offset;
+	}
+	return NULL;
+}
+
+uint32_t assets_version(void)
+{
+	return base ? ((const assets_header_t *)base)->version : 0;
+}
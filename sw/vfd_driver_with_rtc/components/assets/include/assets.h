@@ -0,0 +1,73 @@
+#ifndef MAIN_ASSETS_H_
+#define MAIN_ASSETS_H_
+
+/*
+    Display assets in their own flash partition.
+
+    Fonts, animations and canned messages live in the "assets" data partition
+    and are memory-mapped, so they are used straight from flash without being
+    copied to RAM. The partition can be rewritten without touching the
+    firmware image, see tools/pack_assets.py.
+
+    Layout, all little endian:
+      assets_header_t
+      assets_entry_t[count]	directory
+      payloads				each 4-byte aligned
+
+    The CRC-32 (zlib polynomial) covers everything after the header up to
+    total_size. A partition with a bad magic, format version or CRC, or one
+    packed for a different number of tubes, is ignored and the firmware falls
+    back to its built-in data.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "vfd_topology.h"
+
+#define ASSETS_MAGIC			0x41444656	// "VFDA"
+#define ASSETS_FORMAT_VERSION	2
+#define ASSETS_PARTITION_SUBTYPE 0x40		// First custom data subtype
+
+typedef enum {
+	ASSET_FONT = 1,		// 10 digit glyphs, then 26 letter glyphs (ABCDEFGH)
+	ASSET_ANIM = 2,		// Keyframes of ASSETS_TUBES segment bytes plus a phase count
+	ASSET_MESSAGE = 3,	// NUL terminated string
+} asset_type_t;
+
+#define ASSETS_TUBES		VFD_TUBES	// Animations are packed for one topology, see pack_assets.py --tubes
+#define ASSETS_FONT_SIZE	36
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint16_t format;		// ASSETS_FORMAT_VERSION
+	uint16_t count;			// Directory entries
+	uint32_t version;		// Content version, set by the packer
+	uint32_t total_size;	// Header, directory and payloads
+	uint32_t crc32;			// Over everything after the header
+	uint16_t tubes;			// ASSETS_TUBES the animations were packed for
+	uint16_t reserved;
+} assets_header_t;
+
+typedef struct __attribute__((packed)) {
+	uint16_t type;			// asset_type_t
+	uint16_t id;
+	uint32_t offset;		// From the start of the partition
+	uint32_t size;
+} assets_entry_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t seg[ASSETS_TUBES];
+	uint8_t phases;			// Mux phases to show the keyframe for
+} assets_keyframe_t;
+
+/* Map and validate the asset partition */
+esp_err_t assets_init(void);
+
+/* Payload of an asset, NULL if there is no such asset (or no valid partition) */
+const void *assets_find(asset_type_t type, uint16_t id, size_t *size);
+
+/* Content version of the mapped assets, 0 if there are none */
+uint32_t assets_version(void);
+
+#endif /* MAIN_ASSETS_H_ */
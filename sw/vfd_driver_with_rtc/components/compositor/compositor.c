@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "compositor.h"
+
+typedef struct {
+	char text[VFD_TUBES];	// '\0' = blank tube
+	uint32_t dp;
+	uint32_t mask;
+	int64_t expires_us;		// 0 = no timeout
+	bool visible;
+} layer_state_t;
+
+static portMUX_TYPE comp_lock = portMUX_INITIALIZER_UNLOCKED;
+static layer_state_t layers[COMP_LAYERS];
+static bool dirty = true;	// Something visible changed since the last render
+static comp_stats_t stats;
+
+/* Tubes covered by the visible layers above a layer */
+static uint32_t covered_above(int layer)
+{
+	uint32_t covered = 0;
+	for (int l = layer + 1; l < COMP_LAYERS; l++) {
+		if (layers[l].visible) covered |= layers[l].mask;
+	}
+	return covered;
+}
+
+/* Tubes that look different between two states of a layer */
+static uint32_t changed_tubes(const layer_state_t *a, const layer_state_t *b)
+{
+	uint32_t a_mask = a->visible ? a->mask : 0;
+	uint32_t b_mask = b->visible ? b->mask : 0;
+	uint32_t changed = a_mask ^ b_mask;
+
+	for (int n = 0; n < VFD_TUBES; n++) {
+		uint32_t bit = 1UL << n;
+		if ((a_mask & b_mask & bit) && (a->text[n] != b->text[n] || ((a->dp ^ b->dp) & bit))) changed |= bit;
+	}
+	return changed;
+}
+
+/* Replace a layer, called with comp_lock held */
+static bool update_layer(int layer, const layer_state_t *state)
+{
+	uint32_t shows = changed_tubes(&layers[layer], state) & ~covered_above(layer);
+	layers[layer] = *state;
+	if (shows) dirty = true;
+	return shows != 0;
+}
+
+bool comp_set(comp_layer_t layer, const char *text, uint32_t dp, uint32_t mask, uint32_t timeout_ms, int64_t now_us)
+{
+	if (layer >= COMP_LAYERS) return false;
+
+	layer_state_t state = {
+		.dp = dp,
+		.mask = mask & COMP_MASK_ALL,
+		.expires_us = timeout_ms ? now_us + (int64_t)timeout_ms * 1000 : 0,
+		.visible = true,
+	};
+	memcpy(state.text, text, strnlen(text, VFD_TUBES)); // Not NUL terminated, the rest stays blank
+
+	portENTER_CRITICAL(&comp_lock);
+	bool shows = update_layer(layer, &state);
+	stats.sets++;
+	if (!shows) stats.hidden++;
+	portEXIT_CRITICAL(&comp_lock);
+
+	return shows;
+}
+
+bool comp_clear(comp_layer_t layer)
+{
+	if (layer >= COMP_LAYERS) return false;
+
+	layer_state_t state = {0};
+
+	portENTER_CRITICAL(&comp_lock);
+	bool shows = update_layer(layer, &state);
+	portEXIT_CRITICAL(&comp_lock);
+
+	return shows;
+}
+
+bool comp_visible(comp_layer_t layer)
+{
+	return layer < COMP_LAYERS && layers[layer].visible;
+}
+
+bool comp_render(int64_t now_us, vfd_frame_t *frame, char *text)
+{
+	char chars[VFD_TUBES];
+	uint32_t dp = 0;
+
+	portENTER_CRITICAL(&comp_lock);
+	for (int l = 0; l < COMP_LAYERS; l++) {
+		if (layers[l].visible && layers[l].expires_us && now_us >= layers[l].expires_us) {
+			layer_state_t gone = {0};
+			update_layer(l, &gone);
+			stats.expired++;
+		}
+	}
+
+	if (!dirty) {
+		portEXIT_CRITICAL(&comp_lock);
+		return false;
+	}
+
+	// Top down, every tube takes the first layer that covers it
+	uint32_t todo = COMP_MASK_ALL;
+	memset(chars, 0, sizeof(chars));
+	for (int l = COMP_LAYERS - 1; l >= 0 && todo; l--) {
+		if (!layers[l].visible) continue;
+		uint32_t take = layers[l].mask & todo;
+		for (int n = 0; n < VFD_TUBES; n++) {
+			if (take & (1UL << n)) chars[n] = layers[l].text[n];
+		}
+		dp |= layers[l].dp & take;
+		todo &= ~take;
+	}
+	dirty = false;
+	stats.renders++;
+	portEXIT_CRITICAL(&comp_lock);
+
+	// Glyph lookups outside the lock
+	for (int n = 0; n < VFD_TUBES; n++) {
+		frame->seg[n] = (chars[n] ? vfd_glyph(chars[n]) : 0) | ((dp >> n) & 1);	// H segment is the decimal point
+		if (text) text[n] = chars[n] ? chars[n] : ' ';
+	}
+	if (text) text[VFD_TUBES] = '\0';
+
+	return true;
+}
+
+int64_t comp_next_expiry(void)
+{
+	int64_t next = 0;
+
+	portENTER_CRITICAL(&comp_lock);
+	for (int l = 0; l < COMP_LAYERS; l++) {
+		if (layers[l].visible && layers[l].expires_us && (!next || layers[l].expires_us < next)) next = layers[l].expires_us;
+	}
+	portEXIT_CRITICAL(&comp_lock);
+
+	return next;
+}
+
+void comp_get_stats(comp_stats_t *out)
+{
+	portENTER_CRITICAL(&comp_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&comp_lock);
+}
@@ -0,0 +1,63 @@
+#ifndef MAIN_COMPOSITOR_H_
+#define MAIN_COMPOSITOR_H_
+
+/*
+    Layered display compositor.
+
+    Producers no longer write the display string themselves, each one owns a
+    layer: the clock, rotating info pages, the stopwatch, transient
+    notifications and the menu, in rising priority. A layer holds text, decimal points, the tubes it
+    covers and an optional timeout. Every tube shows the highest visible
+    layer that covers it, or stays blank.
+
+    comp_set() tells whether the change shows through the layers above, and
+    comp_render() only encodes a new frame when something visible changed or
+    a layer timed out. A clock update under a full-screen menu costs nothing
+    past the compare. The caller renders from the esp_timer task and arms a
+    timer for comp_next_expiry(), so nothing is polled in steady state.
+
+    All calls are safe from any task.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vfd_driver.h"
+
+typedef enum {
+	COMP_LAYER_CLOCK = 0,	// Lowest priority
+	COMP_LAYER_INFO,		// Rotating sensor pages
+	COMP_LAYER_TIMER,		// Stopwatch and countdown
+	COMP_LAYER_NOTIFY,		// Transient notifications
+	COMP_LAYER_MENU,
+	COMP_LAYERS
+} comp_layer_t;
+
+#define COMP_MASK_ALL	((uint32_t)((1ULL << VFD_TUBES) - 1))	// Bit 0 = leftmost tube
+
+typedef struct {
+	uint32_t sets;			// comp_set() calls
+	uint32_t hidden;		// ...of which did not show through
+	uint32_t renders;		// Frames encoded
+	uint32_t expired;		// Layers removed by their timeout
+} comp_stats_t;
+
+/* Show text (one character per tube, from the leftmost tube, a short string leaves the rest blank)
+ * with the decimal points in dp on the tubes in mask. timeout_ms = 0 keeps the layer up until cleared.
+ * Returns true when the composed display changes, i.e. the caller should render. */
+bool comp_set(comp_layer_t layer, const char *text, uint32_t dp, uint32_t mask, uint32_t timeout_ms, int64_t now_us);
+
+/* Remove a layer. Returns true when the composed display changes. */
+bool comp_clear(comp_layer_t layer);
+
+bool comp_visible(comp_layer_t layer);
+
+/* Drop timed out layers and, if anything visible changed since the last call, encode the composed
+ * frame and its text (VFD_TUBES + 1 bytes, may be NULL). Returns false and leaves both alone otherwise. */
+bool comp_render(int64_t now_us, vfd_frame_t *frame, char *text);
+
+/* Earliest layer timeout, 0 if no layer has one */
+int64_t comp_next_expiry(void);
+
+void comp_get_stats(comp_stats_t *stats);
+
+#endif /* MAIN_COMPOSITOR_H_ */
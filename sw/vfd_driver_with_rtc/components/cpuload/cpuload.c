@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "cpuload.h"
+
+static portMUX_TYPE cpuload_lock = portMUX_INITIALIZER_UNLOCKED;
+static cpuload_stats_t stats;
+
+// Window start, only touched by cpuload_init() and cpuload_update()
+static uint32_t window_start;
+static uint32_t idle_start[portNUM_PROCESSORS];
+
+static uint32_t idle_runtime(int core)
+{
+	TaskStatus_t status;
+	vTaskGetInfo(xTaskGetIdleTaskHandleForCPU(core), &status, pdFALSE, eInvalid); // No stack scan, no state
+	return status.ulRunTimeCounter;
+}
+
+void cpuload_init(const uint16_t budget_pm[portNUM_PROCESSORS])
+{
+	portENTER_CRITICAL(&cpuload_lock);
+	memset(&stats, 0, sizeof(stats));
+	memcpy(stats.budget_pm, budget_pm, sizeof(stats.budget_pm));
+	portEXIT_CRITICAL(&cpuload_lock);
+
+	for (int core = 0; core < portNUM_PROCESSORS; core++) idle_start[core] = idle_runtime(core);
+	window_start = portGET_RUN_TIME_COUNTER_VALUE();
+}
+
+bool cpuload_update(void)
+{
+	uint32_t idle[portNUM_PROCESSORS];
+	for (int core = 0; core < portNUM_PROCESSORS; core++) idle[core] = idle_runtime(core);
+	uint32_t now = portGET_RUN_TIME_COUNTER_VALUE();
+
+	// The run time counters tick in microseconds (esp_timer) and wrap after 71 minutes, like the window
+	uint32_t window = now - window_start;
+	if (!window) return false;
+	bool over = false;
+
+	portENTER_CRITICAL(&cpuload_lock);
+	stats.window_ms = window / 1000;
+	stats.windows++;
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		uint32_t idle_pm = (uint64_t)(idle[core] - idle_start[core]) * 1000 / window;
+		uint16_t load = idle_pm < 1000 ? 1000 - idle_pm : 0;
+		stats.load_pm[core] = load;
+		if (load > stats.peak_pm[core]) stats.peak_pm[core] = load;
+		if (load > stats.budget_pm[core]) {
+			stats.over_budget[core]++;
+			over = true;
+		}
+		idle_start[core] = idle[core];
+	}
+	portEXIT_CRITICAL(&cpuload_lock);
+
+	window_start = now;
+	return over;
+}
+
+void cpuload_get_stats(cpuload_stats_t *out)
+{
+	portENTER_CRITICAL(&cpuload_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&cpuload_lock);
+}
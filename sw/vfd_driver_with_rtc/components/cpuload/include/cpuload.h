@@ -0,0 +1,41 @@
+#ifndef MAIN_CPULOAD_H_
+#define MAIN_CPULOAD_H_
+
+/*
+    CPU load accounting per core.
+
+    The load of a core over a window is the share of the window its idle
+    task did not run, taken from the FreeRTOS run time counters
+    (FREERTOS_GENERATE_RUN_TIME_STATS). Light sleep counts as idle.
+    cpuload_update() closes the current window and opens the next one; it
+    keeps the peak per core and counts the windows in which a core went over
+    its budget, so a budget can be checked over hours instead of by one
+    snapshot.
+
+    Calls are safe from any task. cpuload_update() from one task only.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+
+#define CPULOAD_NO_BUDGET	1000	// Budget of a core without one, per mille
+
+typedef struct {
+	uint32_t window_ms;								// Length of the last window
+	uint16_t load_pm[portNUM_PROCESSORS];			// Last window, per mille
+	uint16_t peak_pm[portNUM_PROCESSORS];			// Highest window since cpuload_init()
+	uint16_t budget_pm[portNUM_PROCESSORS];
+	uint32_t windows;
+	uint32_t over_budget[portNUM_PROCESSORS];		// Windows above the budget
+} cpuload_stats_t;
+
+/* Open the first window. budget_pm per core, CPULOAD_NO_BUDGET for none. */
+void cpuload_init(const uint16_t budget_pm[portNUM_PROCESSORS]);
+
+/* Close the window, returns true if a core went over its budget in it */
+bool cpuload_update(void);
+
+void cpuload_get_stats(cpuload_stats_t *stats);
+
+#endif /* MAIN_CPULOAD_H_ */
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "dlog.h"
+
+#define TAG "DLOG"
+
+#define RING_SLOTS	CONFIG_DLOG_RING_SLOTS
+#define RING_MASK	(RING_SLOTS - 1)
+#define DRAIN_STACK	(1024*3)	// dlog_print() formats on the stack
+
+_Static_assert((RING_SLOTS & RING_MASK) == 0, "DLOG_RING_SLOTS must be a power of two");
+
+typedef struct {
+	uint32_t head;			// Next slot to write, only moved by the owning core
+	uint32_t tail;			// Next slot to drain, only moved by the drain task
+	uint32_t records;		// Owning core
+	uint32_t dropped;		// Owning core
+	uint32_t high_water;	// Drain task
+	uint64_t put_cycles;	// Owning core, all dlog_put() calls
+	uint32_t put_cycles_max;
+	uint32_t stamp_cycles_max;
+	uint32_t puts;
+	dlog_record_t slot[RING_SLOTS];
+} ring_t;
+
+static ring_t rings[portNUM_PROCESSORS];
+static dlog_sink_t drain_sink;
+static TickType_t drain_ticks;
+static TaskHandle_t drain_task_handle = NULL;
+static StaticTask_t drain_task_buf;
+static StackType_t drain_stack[DRAIN_STACK];
+
+void IRAM_ATTR dlog_put(uint8_t level, const char *tag, const char *fmt, const uint32_t *args, uint32_t nargs)
+{
+	// A task can move to the other core before the mask, its cycle counter is not this one's. Rare, and only the stats suffer.
+	uint32_t start = esp_cpu_get_cycle_count();
+	uint32_t now = (uint32_t)esp_timer_get_time();
+	uint32_t stamped = esp_cpu_get_cycle_count();
+
+	// Only this core writes its ring, masking its interrupts keeps tasks and ISRs on it apart
+	UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+	int core = esp_cpu_get_core_id();
+	ring_t *r = &rings[core];
+	uint32_t head = r->head;
+
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SLOTS) {
+		r->dropped++;
+	} else {
+		dlog_record_t *rec = &r->slot[head & RING_MASK];
+		rec->fmt = fmt;
+		rec->tag = tag;
+		rec->time_us = now;
+		rec->level = level;
+		rec->nargs = nargs;
+		rec->core = core;
+		for (uint32_t i = 0; i < nargs; i++) rec->args[i] = args[i];
+		r->records++;
+		__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	uint32_t cycles = esp_cpu_get_cycle_count() - start;
+	r->put_cycles += cycles;
+	r->puts++;
+	if (cycles > r->put_cycles_max) r->put_cycles_max = cycles;
+	if (stamped - start > r->stamp_cycles_max) r->stamp_cycles_max = stamped - start;
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+int dlog_format(const dlog_record_t *rec, char *buf, size_t size)
+{
+	// Every argument is a 32-bit word, printf ignores the ones the format does not use
+	const uint32_t *a = rec->args;
+	return snprintf(buf, size, rec->fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void dlog_print(const dlog_record_t *rec)
+{
+	static const char letters[] = "NEWIDV";
+	char msg[160];
+	dlog_format(rec, msg, sizeof(msg));
+	esp_log_write(rec->level, rec->tag, "%c (%" PRIu32 ") %s: %s\n",
+				  letters[rec->level < sizeof(letters) - 1 ? rec->level : 0], rec->time_us / 1000, rec->tag, msg);
+}
+
+/* Ring holding the oldest waiting record, NULL if all are empty */
+static ring_t *oldest_ring(void)
+{
+	ring_t *oldest = NULL;
+	uint32_t oldest_us = 0;
+
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		ring_t *r = &rings[core];
+		uint32_t waiting = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+		if (!waiting) continue;
+		if (waiting > r->high_water) r->high_water = waiting;
+
+		uint32_t us = r->slot[r->tail & RING_MASK].time_us;
+		if (!oldest || (int32_t)(us - oldest_us) < 0) {
+			oldest = r;
+			oldest_us = us;
+		}
+	}
+	return oldest;
+}
+
+static void drain_task(void *pvParameters)
+{
+	while (1) {
+		ring_t *r;
+		while ((r = oldest_ring())) {
+			dlog_record_t rec = r->slot[r->tail & RING_MASK];
+			__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE); // The slot may be reused from here on
+			drain_sink(&rec);
+		}
+		vTaskDelay(drain_ticks);
+	}
+}
+
+esp_err_t dlog_start(UBaseType_t priority, BaseType_t core, uint32_t drain_ms, dlog_sink_t sink)
+{
+	if (drain_task_handle) return ESP_ERR_INVALID_STATE;
+
+	drain_sink = sink ? sink : dlog_print;
+	drain_ticks = pdMS_TO_TICKS(drain_ms) ? pdMS_TO_TICKS(drain_ms) : 1;
+	drain_task_handle = xTaskCreateStaticPinnedToCore(drain_task, "dlog", DRAIN_STACK, NULL, priority,
+													  drain_stack, &drain_task_buf, core);
+	if (!drain_task_handle) {
+		ESP_LOGE(TAG, "Could not create the drain task");
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+TaskHandle_t dlog_task(void)
+{
+	return drain_task_handle;
+}
+
+void dlog_get_stats(dlog_stats_t *stats)
+{
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		stats->records[core] = rings[core].records;
+		stats->dropped[core] = rings[core].dropped;
+		stats->high_water[core] = rings[core].high_water;
+		stats->put_cycles_avg[core] = rings[core].puts ? rings[core].put_cycles / rings[core].puts : 0;
+		stats->put_cycles_max[core] = rings[core].put_cycles_max;
+		stats->stamp_cycles_max[core] = rings[core].stamp_cycles_max;
+	}
+}
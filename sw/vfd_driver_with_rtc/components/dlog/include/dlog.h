@@ -0,0 +1,85 @@
+#ifndef MAIN_DLOG_H_
+#define MAIN_DLOG_H_
+
+/*
+    Deferred logging.
+
+    DLOGx() does not format anything at the call site: it stores the format
+    string pointer (the format ID), the tag, a timestamp and up to
+    DLOG_MAX_ARGS raw 32-bit arguments into a ring of the calling core. A
+    ring only has one writer core, so a record is written with the interrupts
+    of that core masked for a few stores, without a lock or a spinlock. Safe
+    from tasks and ISRs (dlog_put() is in IRAM), including the refresh path.
+
+    A low priority drain task empties the rings and passes every record to
+    the sink, which formats it on the device or ships it to the host as is.
+    A full ring drops the record and counts it, the writer never waits.
+    dlog_put() counts its own CPU cycles, see dlog_stats_t.
+
+    Arguments are passed as uint32_t: integers, chars and pointers (cast
+    them). No 64-bit values or floats. %s only with strings that outlive the
+    record, literals and static buffers.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define DLOG_MAX_ARGS	6
+
+typedef struct {
+	const char *fmt;		// Format ID, the address of the format string
+	const char *tag;
+	uint32_t time_us;		// esp_timer time, wraps after 71 minutes
+	uint8_t level;			// esp_log_level_t
+	uint8_t nargs;
+	uint8_t core;
+	uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+/* Called by the drain task for every record, in order per core */
+typedef void (*dlog_sink_t)(const dlog_record_t *rec);
+
+typedef struct {
+	uint32_t records[portNUM_PROCESSORS];	// Written
+	uint32_t dropped[portNUM_PROCESSORS];	// Ring full
+	uint32_t high_water[portNUM_PROCESSORS];	// Most records waiting at a drain
+	uint32_t put_cycles_avg[portNUM_PROCESSORS];	// CPU cycles in dlog_put(), interrupts masked or not
+	uint32_t put_cycles_max[portNUM_PROCESSORS];
+	uint32_t stamp_cycles_max[portNUM_PROCESSORS];	// Of those, reading the timestamp
+} dlog_stats_t;
+
+void dlog_put(uint8_t level, const char *tag, const char *fmt, const uint32_t *args, uint32_t nargs);
+
+#define DLOG_LEVEL(level, tag, fmt, ...) do { \
+		if ((level) <= LOG_LOCAL_LEVEL) { \
+			const uint32_t dlog_args_[] = { __VA_ARGS__ }; \
+			_Static_assert(sizeof(dlog_args_) <= DLOG_MAX_ARGS * sizeof(uint32_t), "Too many DLOG arguments"); \
+			dlog_put((level), (tag), (fmt), dlog_args_, sizeof(dlog_args_) / sizeof(uint32_t)); \
+		} \
+	} while (0)
+
+#define DLOGE(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define DLOGV(tag, fmt, ...) DLOG_LEVEL(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+
+/* Start the drain task on core (or tskNO_AFFINITY). sink NULL = dlog_print(). Records written before are kept. */
+esp_err_t dlog_start(UBaseType_t priority, BaseType_t core, uint32_t drain_ms, dlog_sink_t sink);
+
+/* The drain task, NULL before dlog_start() */
+TaskHandle_t dlog_task(void);
+
+/* Format a record like ESP_LOGx would and write it with esp_log_write() */
+void dlog_print(const dlog_record_t *rec);
+
+/* Format the message of a record, returns what snprintf() returns */
+int dlog_format(const dlog_record_t *rec, char *buf, size_t size);
+
+void dlog_get_stats(dlog_stats_t *stats);
+
+#endif /* MAIN_DLOG_H_ */
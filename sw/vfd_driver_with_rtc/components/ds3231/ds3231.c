@@ -125,3 +125,123 @@ esp_err_t ds3231_get_time(i2c_dev_t *dev, struct tm *time)
 
 	return ESP_OK;
 }
+
+esp_err_t ds3231_enable_squarewave(i2c_dev_t *dev, ds3231_sqwave_freq_t freq)
+{
+	CHECK_ARG(dev);
+
+	uint8_t ctrl;
+
+	esp_err_t res = i2c_dev_read_reg(dev, DS3231_ADDR_CONTROL, &ctrl, 1);
+	if (res != ESP_OK) return res;
+
+	/* INT/SQW pin outputs the square wave while INTCN is cleared */
+	ctrl &= ~(DS3231_CTRL_ALARM_INTS | DS3231_CTRL_SQWAVE_MASK);
+	ctrl |= freq;
+
+	return i2c_dev_write_reg(dev, DS3231_ADDR_CONTROL, &ctrl, 1);
+}
+
+/* Read-modify-write of the bits in mask */
+static esp_err_t update_register(i2c_dev_t *dev, uint8_t reg, uint8_t mask, uint8_t value)
+{
+	uint8_t data;
+
+	esp_err_t res = i2c_dev_read_reg(dev, reg, &data, 1);
+	if (res != ESP_OK) return res;
+
+	data = (data & ~mask) | (value & mask);
+
+	return i2c_dev_write_reg(dev, reg, &data, 1);
+}
+
+/* Day byte of an alarm, the day of the week counts from 1 like the time registers */
+static uint8_t alarm_day(struct tm *time, int option)
+{
+	if (option & 0x10) return DS3231_ALARM_WDAY | dec2bcd(time->tm_wday + 1);
+	return dec2bcd(time->tm_mday);
+}
+
+esp_err_t ds3231_set_alarm(i2c_dev_t *dev, ds3231_alarm_t alarms, struct tm *time1, ds3231_alarm1_rate_t option1,
+						   struct tm *time2, ds3231_alarm2_rate_t option2)
+{
+	CHECK_ARG(dev);
+	CHECK_ARG(alarms != DS3231_ALARM_NONE);
+
+	esp_err_t res = ESP_OK;
+
+	if (alarms & DS3231_ALARM_1)
+	{
+		CHECK_ARG(time1);
+
+		uint8_t data[4];
+		data[0] = dec2bcd(time1->tm_sec) | (option1 & 0x01 ? DS3231_ALARM_NOTSET : 0);
+		data[1] = dec2bcd(time1->tm_min) | (option1 & 0x02 ? DS3231_ALARM_NOTSET : 0);
+		data[2] = dec2bcd(time1->tm_hour) | (option1 & 0x04 ? DS3231_ALARM_NOTSET : 0);
+		data[3] = alarm_day(time1, option1) | (option1 & 0x08 ? DS3231_ALARM_NOTSET : 0);
+
+		res = i2c_dev_write_reg(dev, DS3231_ADDR_ALARM1, data, 4);
+		if (res != ESP_OK) return res;
+	}
+
+	if (alarms & DS3231_ALARM_2)
+	{
+		CHECK_ARG(time2);
+
+		uint8_t data[3];
+		data[0] = dec2bcd(time2->tm_min) | (option2 & 0x01 ? DS3231_ALARM_NOTSET : 0);
+		data[1] = dec2bcd(time2->tm_hour) | (option2 & 0x02 ? DS3231_ALARM_NOTSET : 0);
+		data[2] = alarm_day(time2, option2) | (option2 & 0x04 ? DS3231_ALARM_NOTSET : 0);
+
+		res = i2c_dev_write_reg(dev, DS3231_ADDR_ALARM2, data, 3);
+	}
+
+	return res;
+}
+
+esp_err_t ds3231_get_alarm_flags(i2c_dev_t *dev, ds3231_alarm_t *alarms)
+{
+	CHECK_ARG(dev);
+	CHECK_ARG(alarms);
+
+	uint8_t status;
+
+	esp_err_t res = i2c_dev_read_reg(dev, DS3231_ADDR_STATUS, &status, 1);
+	if (res != ESP_OK) return res;
+
+	*alarms = (ds3231_alarm_t)(status & (DS3231_STAT_ALARM_1 | DS3231_STAT_ALARM_2));
+
+	return ESP_OK;
+}
+
+esp_err_t ds3231_clear_alarm_flags(i2c_dev_t *dev, ds3231_alarm_t alarms)
+{
+	CHECK_ARG(dev);
+
+	uint8_t status;
+
+	esp_err_t res = i2c_dev_read_reg(dev, DS3231_ADDR_STATUS, &status, 1);
+	if (res != ESP_OK) return res;
+
+	/* Writing 0 clears a flag and 1 leaves it alone, so the flags to keep are written as 1: they may have
+	 * been set since the read. EN32kHz keeps its value. DS3231_ALARM_n maps onto DS3231_STAT_ALARM_n. */
+	status = (status | DS3231_STAT_OSCILLATOR | DS3231_STAT_ALARM_1 | DS3231_STAT_ALARM_2) & ~alarms;
+
+	return i2c_dev_write_reg(dev, DS3231_ADDR_STATUS, &status, 1);
+}
+
+esp_err_t ds3231_enable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms)
+{
+	CHECK_ARG(dev);
+
+	/* INTCN routes the alarms to INT/SQW, DS3231_ALARM_n maps onto DS3231_CTRL_ALARMn_INT */
+	return update_register(dev, DS3231_ADDR_CONTROL, DS3231_CTRL_ALARM_INTS | alarms, DS3231_CTRL_ALARM_INTS | alarms);
+}
+
+esp_err_t ds3231_disable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms)
+{
+	CHECK_ARG(dev);
+
+	/* Leaves INTCN set, the pin stays high instead of going back to the square wave */
+	return update_register(dev, DS3231_ADDR_CONTROL, alarms, 0);
+}
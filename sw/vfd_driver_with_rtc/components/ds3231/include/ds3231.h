@@ -38,6 +38,41 @@
 #define DS3231_PM_FLAG      0x20
 #define DS3231_MONTH_MASK   0x1f
 
+#define DS3231_CTRL_SQWAVE_MASK 0x18
+
+typedef enum {
+	DS3231_SQWAVE_1HZ    = 0x00,
+	DS3231_SQWAVE_1024HZ = 0x08,
+	DS3231_SQWAVE_4096HZ = 0x10,
+	DS3231_SQWAVE_8192HZ = 0x18
+} ds3231_sqwave_freq_t;
+
+typedef enum {
+	DS3231_ALARM_NONE = 0,
+	DS3231_ALARM_1    = 1,
+	DS3231_ALARM_2    = 2,
+	DS3231_ALARM_BOTH = 3
+} ds3231_alarm_t;
+
+/* Alarm 1 match modes: bits 0-3 are the A1M1..A1M4 mask bits, bit 4 selects the day of the week over the date */
+typedef enum {
+	DS3231_ALARM1_EVERY_SECOND          = 0x0f,
+	DS3231_ALARM1_MATCH_SEC             = 0x0e,
+	DS3231_ALARM1_MATCH_SECMIN          = 0x0c,
+	DS3231_ALARM1_MATCH_SECMINHOUR      = 0x08,
+	DS3231_ALARM1_MATCH_SECMINHOURDAY   = 0x10,
+	DS3231_ALARM1_MATCH_SECMINHOURDATE  = 0x00
+} ds3231_alarm1_rate_t;
+
+/* Alarm 2 match modes (no seconds, fires at second 00): bits 0-2 are the A2M2..A2M4 mask bits, bit 4 as for alarm 1 */
+typedef enum {
+	DS3231_ALARM2_EVERY_MIN             = 0x07,
+	DS3231_ALARM2_MATCH_MIN             = 0x06,
+	DS3231_ALARM2_MATCH_MINHOUR         = 0x04,
+	DS3231_ALARM2_MATCH_MINHOURDAY      = 0x10,
+	DS3231_ALARM2_MATCH_MINHOURDATE     = 0x00
+} ds3231_alarm2_rate_t;
+
 uint8_t bcd2dec(uint8_t val);
 uint8_t dec2bcd(uint8_t val);
 esp_err_t ds3231_init_desc(i2c_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
@@ -46,5 +81,21 @@ esp_err_t ds3231_get_raw_temp(i2c_dev_t *dev, int16_t *temp);
 esp_err_t ds3231_get_temp_integer(i2c_dev_t *dev, int8_t *temp);
 esp_err_t ds3231_get_temp_float(i2c_dev_t *dev, float *temp);
 esp_err_t ds3231_get_time(i2c_dev_t *dev, struct tm *time);
+esp_err_t ds3231_enable_squarewave(i2c_dev_t *dev, ds3231_sqwave_freq_t freq);
+
+/* Program one or both alarms. Fields a match mode does not compare are ignored, tm_wday counts from Sunday = 0. */
+esp_err_t ds3231_set_alarm(i2c_dev_t *dev, ds3231_alarm_t alarms, struct tm *time1, ds3231_alarm1_rate_t option1,
+						   struct tm *time2, ds3231_alarm2_rate_t option2);
+
+/* Alarms that have fired since their flag was last cleared */
+esp_err_t ds3231_get_alarm_flags(i2c_dev_t *dev, ds3231_alarm_t *alarms);
+
+/* Clear alarm flags, INT is held low until the flags of all enabled alarms are cleared */
+esp_err_t ds3231_clear_alarm_flags(i2c_dev_t *dev, ds3231_alarm_t alarms);
+
+/* Signal alarms on INT (active low). This switches the INT/SQW pin over from the square wave. */
+esp_err_t ds3231_enable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms);
+
+esp_err_t ds3231_disable_alarm_ints(i2c_dev_t *dev, ds3231_alarm_t alarms);
 #endif /* MAIN_DS3231_H_ */
 
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/usb_serial_jtag.h"
+#include "esp_crc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "evstream.h"
+
+#define TAG "EVSTREAM"
+
+#define PAYLOAD_MAX	(sizeof(evstream_hdr_t) + EVSTREAM_MAX_BODY + 4)	// Header, body, CRC-32
+#define FRAME_MAX	(PAYLOAD_MAX + PAYLOAD_MAX / 254 + 2)				// COBS overhead and the delimiter
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+static bool installed = false;
+static uint8_t seq;
+static evstream_stats_t stats;
+
+// Only used with the lock held
+static uint8_t payload[PAYLOAD_MAX];
+static uint8_t frame[FRAME_MAX];
+
+/* Consistent overhead byte stuffing, out holds at least len + len / 254 + 1 bytes */
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t code_at = 0, n = 1;
+	uint8_t code = 1;
+
+	for (size_t i = 0; i < len; i++) {
+		if (in[i]) {
+			out[n++] = in[i];
+			if (++code < 0xff) continue;
+		}
+		// A zero, or a full run of 254 non-zero bytes, ends the block
+		out[code_at] = code;
+		code_at = n++;
+		code = 1;
+	}
+	out[code_at] = code;
+	return n;
+}
+
+esp_err_t evstream_init(void)
+{
+	if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+	if (installed) return ESP_OK;
+
+	usb_serial_jtag_driver_config_t cfg = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
+	cfg.tx_buffer_size = EVSTREAM_TX_BUFFER;
+	esp_err_t res = usb_serial_jtag_driver_install(&cfg);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not install the USB Serial/JTAG driver: %d", res);
+		return res;
+	}
+	installed = true;
+	return ESP_OK;
+}
+
+/* Frame and queue one event, waiting up to wait ticks for room. Called with the lock held. */
+static bool send_locked(evstream_type_t type, const void *body, size_t size, TickType_t wait)
+{
+	evstream_hdr_t hdr = {
+		.type = type,
+		.seq = seq++,
+		.time_ms = (uint32_t)(esp_timer_get_time() / 1000),
+	};
+	memcpy(payload, &hdr, sizeof(hdr));
+	memcpy(payload + sizeof(hdr), body, size);
+	size_t len = sizeof(hdr) + size;
+	uint32_t crc = esp_crc32_le(0, payload, len);
+	memcpy(payload + len, &crc, sizeof(crc)); // Little endian, like the payload
+	len += sizeof(crc);
+
+	size_t n = cobs_encode(payload, len, frame);
+	frame[n++] = 0;
+
+	// The TX ring takes a frame whole or not at all
+	bool sent = usb_serial_jtag_write_bytes(frame, n, wait) == (int)n;
+	if (sent) {
+		stats.frames++;
+		stats.bytes += n;
+	} else {
+		stats.dropped++;
+	}
+	return sent;
+}
+
+bool evstream_send_wait(evstream_type_t type, const void *body, size_t size, TickType_t wait)
+{
+	if (!installed || size > EVSTREAM_MAX_BODY) return false;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool sent = send_locked(type, body, size, wait);
+	xSemaphoreGive(lock);
+
+	return sent;
+}
+
+/* True if a conversion of fmt takes a string */
+static bool has_string_arg(const char *fmt)
+{
+	while ((fmt = strchr(fmt, '%'))) {
+		fmt += strspn(fmt + 1, "-+ #0123456789.hlLqjzt") + 1;
+		if (*fmt == 's') return true;
+		if (*fmt) fmt++;
+	}
+	return false;
+}
+
+/* Send the format of an ID unless it went out recently. Called with the lock held. */
+static bool log_announced(const dlog_record_t *rec)
+{
+	static const char *sent[EVSTREAM_LOG_FORMATS];
+	static int count;
+	static int64_t since_us;
+
+	int64_t now = esp_timer_get_time();
+	if (count == EVSTREAM_LOG_FORMATS || now - since_us > (int64_t)EVSTREAM_LOG_RESEND_S * 1000000) {
+		count = 0;
+		since_us = now;
+	}
+	for (int i = 0; i < count; i++) {
+		if (sent[i] == rec->fmt) return true;
+	}
+
+	uint8_t body[EVSTREAM_MAX_BODY];
+	ev_log_fmt_t ev = { .id = (uint32_t)(uintptr_t)rec->fmt };
+	memcpy(body, &ev, sizeof(ev));
+	size_t room = sizeof(body) - sizeof(ev);
+	int len = snprintf((char *)body + sizeof(ev), room, "%s%c%s", rec->tag, 0, rec->fmt);
+	size_t size = sizeof(ev) + (len < (int)room ? (size_t)len : room - 1) + 1; // A long format is cut, still NUL terminated
+	if (!send_locked(EV_LOG_FMT, body, size, 0)) return false;
+
+	sent[count++] = rec->fmt;
+	return true;
+}
+
+esp_err_t evstream_log(const dlog_record_t *rec)
+{
+	if (!installed) return ESP_ERR_INVALID_STATE;
+	if (has_string_arg(rec->fmt)) return ESP_ERR_NOT_SUPPORTED;
+
+	uint8_t body[sizeof(ev_log_t) + DLOG_MAX_ARGS * sizeof(uint32_t)];
+	ev_log_t ev = {
+		.id = (uint32_t)(uintptr_t)rec->fmt,
+		.time_us = rec->time_us,
+		.level = rec->level,
+		.core = rec->core,
+	};
+	memcpy(body, &ev, sizeof(ev));
+	memcpy(body + sizeof(ev), rec->args, rec->nargs * sizeof(uint32_t));
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool sent = log_announced(rec) && send_locked(EV_LOG, body, sizeof(ev) + rec->nargs * sizeof(uint32_t), 0);
+	xSemaphoreGive(lock);
+
+	return sent ? ESP_OK : ESP_FAIL;
+}
+
+static int log_vprintf(const char *fmt, va_list args)
+{
+	char line[EVSTREAM_MAX_BODY + 1];
+	int len = vsnprintf(line, sizeof(line), fmt, args);
+	if (len <= 0) return len;
+
+	size_t size = len < (int)sizeof(line) ? (size_t)len : sizeof(line) - 1;
+	if (line[size - 1] == '\n') size--; // Frames are lines already
+	evstream_send(EV_TEXT, line, size);
+	return len;
+}
+
+void evstream_capture_logs(void)
+{
+	if (installed) esp_log_set_vprintf(log_vprintf);
+}
+
+void evstream_get_stats(evstream_stats_t *out)
+{
+	if (!lock) {
+		memset(out, 0, sizeof(*out));
+		return;
+	}
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
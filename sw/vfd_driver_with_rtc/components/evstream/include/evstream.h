@@ -0,0 +1,149 @@
+#ifndef MAIN_EVSTREAM_H_
+#define MAIN_EVSTREAM_H_
+
+/*
+    Binary event stream over the USB Serial/JTAG port (J4).
+
+    Structured events (sensor samples, refresh timing histograms, state
+    transitions, deferred log records) are sent as small binary frames
+    instead of formatted text:
+
+      payload	evstream_hdr_t, event body
+      frame		COBS(payload, CRC-32 of payload), 0x00
+
+    COBS leaves no zero byte inside a frame, so a reader that starts late or
+    loses bytes syncs up again on the next delimiter. The CRC-32 is the zlib
+    one, little endian. A sample costs 33 bytes on the wire and no formatting.
+
+    Sending never blocks: a frame that does not fit into the driver's TX
+    buffer (no host listening, or it is behind) is dropped whole and counted.
+    The per-frame sequence number shows the gap on the host. With
+    evstream_capture_logs(), text logs are framed as EV_TEXT so nothing else
+    writes to the port.
+
+    Deferred log records (dlog.h) are sent unformatted: the format ID and the
+    raw arguments. The format string and tag of an ID are sent once as
+    EV_LOG_FMT, and again every EVSTREAM_LOG_RESEND_S so a host that starts
+    late learns them.
+
+    tools/evstream.py decodes a port or a capture. Not callable from ISRs.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "dlog.h"
+
+#define EVSTREAM_MAX_BODY		160
+#define EVSTREAM_TX_BUFFER		2048	// Driver TX ring, a few seconds of events
+#define EVSTREAM_LOG_FORMATS	64		// Format IDs remembered as sent
+#define EVSTREAM_LOG_RESEND_S	60
+
+typedef enum {
+	EV_TEXT = 1,		// Log line, body is the text without the NUL
+	EV_SAMPLE = 2,		// ev_sample_t
+	EV_REFRESH = 3,		// ev_refresh_t
+	EV_STATE = 4,		// ev_state_t
+	EV_LOG = 5,			// ev_log_t, then nargs 32-bit arguments
+	EV_LOG_FMT = 6,		// ev_log_fmt_t, then the tag and the format, both NUL terminated
+	EV_LOAD = 7,		// ev_load_t
+} evstream_type_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t type;		// evstream_type_t
+	uint8_t seq;		// Counts every frame, sent or dropped
+	uint32_t time_ms;	// Since boot
+} evstream_hdr_t;
+
+#define EV_SAMPLE_CHANNELS	4
+
+typedef struct __attribute__((packed)) {
+	uint32_t time;		// Local time, seconds since the epoch
+	uint8_t valid;		// Bit per channel
+	int32_t value[EV_SAMPLE_CHANNELS];	// Channels and units of telemetry_channel_t
+} ev_sample_t;
+
+#define EV_REFRESH_BUCKETS	12
+
+typedef struct __attribute__((packed)) {
+	uint16_t period_us;	// Nominal mux phase
+	uint32_t phases;	// Phases accounted since the last report
+	uint32_t dev_max_us;
+	uint32_t bucket[EV_REFRESH_BUCKETS];	// |phase length - period|: 0, 1, 2-3, 4-7 .. us, the last one open ended
+} ev_refresh_t;
+
+typedef enum {
+	EV_MACHINE_NIGHT = 1,	// nightmode_state_t
+	EV_MACHINE_WATCH = 2,	// 0 clock, 1 stopwatch, 2 countdown
+	EV_MACHINE_RTC = 3,		// 0 answering, 1 lost
+} ev_machine_t;
+
+typedef struct __attribute__((packed)) {
+	uint8_t machine;	// ev_machine_t
+	uint8_t from;
+	uint8_t to;
+} ev_state_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t id;		// Format ID
+	uint32_t time_us;
+	uint8_t level;		// esp_log_level_t
+	uint8_t core;
+} ev_log_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t id;
+} ev_log_fmt_t;
+
+#define EV_LOAD_CORES	2
+
+typedef struct __attribute__((packed)) {
+	uint16_t window_ms;
+	uint16_t load_pm[EV_LOAD_CORES];	// Per mille of the window the core was not idle
+	uint16_t budget_pm[EV_LOAD_CORES];
+	uint32_t over_budget[EV_LOAD_CORES];	// Windows over budget since boot
+} ev_load_t;
+
+typedef struct {
+	uint32_t frames;	// Sent
+	uint32_t dropped;	// TX buffer full
+	uint64_t bytes;		// On the wire, delimiters included
+} evstream_stats_t;
+
+/* Install the USB Serial/JTAG driver */
+esp_err_t evstream_init(void);
+
+/* Frame text logs into the stream instead of printing them on the console */
+void evstream_capture_logs(void);
+
+/* Send an event, waiting up to wait ticks for room in the TX buffer. False if it was dropped.
+ * Other senders wait for the lock meanwhile, only for output a host asked for (the shell). */
+bool evstream_send_wait(evstream_type_t type, const void *body, size_t size, TickType_t wait);
+
+/* Send an event, false if it was dropped */
+static inline bool evstream_send(evstream_type_t type, const void *body, size_t size)
+{
+	return evstream_send_wait(type, body, size, 0);
+}
+
+/* Send a deferred log record. ESP_ERR_NOT_SUPPORTED for a format with %s, the host cannot follow the pointer. */
+esp_err_t evstream_log(const dlog_record_t *rec);
+
+static inline bool evstream_state(ev_machine_t machine, uint8_t from, uint8_t to)
+{
+	ev_state_t ev = { .machine = machine, .from = from, .to = to };
+	return evstream_send(EV_STATE, &ev, sizeof(ev));
+}
+
+/* Bucket of a deviation for ev_refresh_t */
+static inline int evstream_bucket(uint32_t us)
+{
+	int bucket = us ? 32 - __builtin_clz(us) : 0;
+	return bucket < EV_REFRESH_BUCKETS ? bucket : EV_REFRESH_BUCKETS - 1;
+}
+
+void evstream_get_stats(evstream_stats_t *stats);
+
+#endif /* MAIN_EVSTREAM_H_ */
@@ -0,0 +1,310 @@
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "fleet.h"
+
+#define TAG "FLEET"
+
+#define FLEET_STACK		(1024*3)
+#define FLEET_POLL_MS	50		// Receive timeout, the resolution of the protocol's timers
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+static TaskHandle_t fleet_task_handle = NULL;
+static StaticTask_t fleet_task_buf;
+static StackType_t fleet_stack[FLEET_STACK];
+static volatile uint8_t own_quality = FLEET_QUALITY_NONE;
+
+// Protocol state, only changed by the fleet task with the lock held
+static fleet_config_t cfg;
+static int sock = -1;
+static struct sockaddr_in group;
+static fleet_stats_t stats;
+static uint32_t seq;
+static int64_t period_us;
+static int64_t give_up_us;		// Timer value at which the leader is given up, or the listening ends
+static int64_t leader_seen_us;	// Timer value of the leader's last beacon
+static int64_t next_beacon_us;	// Leader
+
+// Follower, all times of the current leader
+static uint32_t beacons;
+static int64_t t1, t2;			// Last beacon: leader time at sending, our time at arrival
+static int64_t t3;				// Pending delay request: our time at sending, 0 if none
+static uint32_t req_seq;
+static int32_t delays[FLEET_DELAY_SAMPLES];
+static int delay_count, delay_next;
+static int window;				// Beacons in the current correction window
+static int64_t best_t1, best_t2, best_timer;
+
+/* True if unit a should lead rather than unit b */
+static bool better(uint8_t qa, uint32_t ida, uint8_t qb, uint32_t idb)
+{
+	if (qa + FLEET_QUALITY_MARGIN < qb) return true;
+	if (qb + FLEET_QUALITY_MARGIN < qa) return false;
+	return ida < idb;
+}
+
+static void send_msg(fleet_msg_type_t type, uint32_t to, uint32_t msg_seq, int64_t time_us)
+{
+	fleet_msg_t m = {
+		.magic = FLEET_MAGIC,
+		.version = FLEET_VERSION,
+		.type = type,
+		.quality = own_quality,
+		.role = stats.role,
+		.id = cfg.id,
+		.to = to,
+		.seq = msg_seq,
+		.time_us = time_us,
+	};
+	sendto(sock, &m, sizeof(m), 0, (struct sockaddr *)&group, sizeof(group));
+}
+
+/* Listen for a leader until FLEET_LOSS_BEACONS pass, then take over after a backoff that differs per unit */
+static void arm_give_up(int64_t timer)
+{
+	give_up_us = timer + FLEET_LOSS_BEACONS * period_us + (int64_t)(cfg.id % 16) * period_us / 16;
+}
+
+static void follow(const fleet_msg_t *m)
+{
+	ESP_LOGI(TAG, "Following %08" PRIx32 ", quality %u", m->id, m->quality);
+	stats.role = FLEET_FOLLOWER;
+	stats.leader = m->id;
+	stats.delay_us = -1;
+	beacons = 0;
+	t3 = 0;
+	delay_count = delay_next = 0;
+	window = 0;
+}
+
+static void lead(int64_t timer, const char *why)
+{
+	ESP_LOGI(TAG, "Leading, %s", why);
+	stats.role = FLEET_LEADER;
+	stats.leader = cfg.id;
+	stats.leader_quality = own_quality;
+	stats.elections++;
+	next_beacon_us = timer;
+}
+
+static void delay_sample(int64_t t4)
+{
+	int64_t d = ((t2 - t1) + (t4 - t3)) / 2;
+	t3 = 0;
+	if (d < 0) d = 0; // Only if the offset moved between the two halves
+	if (d > INT32_MAX) return;
+
+	delays[delay_next] = (int32_t)d;
+	delay_next = (delay_next + 1) % FLEET_DELAY_SAMPLES;
+	if (delay_count < FLEET_DELAY_SAMPLES) delay_count++;
+
+	int32_t min = delays[0];
+	for (int i = 1; i < delay_count; i++) {
+		if (delays[i] < min) min = delays[i];
+	}
+	stats.delay_us = min;
+}
+
+static void beacon(const fleet_msg_t *m, int64_t timer, int64_t now)
+{
+	if (stats.role == FLEET_LEADER) {
+		if (!better(m->quality, m->id, own_quality, cfg.id)) return; // It steps down on our next beacon
+		ESP_LOGI(TAG, "Stepping down");
+		follow(m);
+	} else if (m->id != stats.leader) {
+		// Keep a live leader unless the new one is better
+		bool live = stats.role == FLEET_FOLLOWER && timer - leader_seen_us < 2 * period_us;
+		if (live && !better(m->quality, m->id, stats.leader_quality, stats.leader)) return;
+		follow(m);
+	}
+
+	stats.leader_quality = m->quality;
+	stats.beacons_heard++;
+	leader_seen_us = timer;
+	arm_give_up(timer);
+	t1 = m->time_us;
+	t2 = now;
+
+	// The beacon that came through fastest carries the least queueing
+	if (!window || t2 - t1 < best_t2 - best_t1) {
+		best_t1 = t1;
+		best_t2 = t2;
+		best_timer = timer;
+	}
+	if (++window >= FLEET_WINDOW) {
+		window = 0;
+		if (stats.delay_us >= 0) {
+			int64_t ref = best_t1 + stats.delay_us;
+			stats.offset_us = (int32_t)(ref - best_t2);
+			stats.corrections++;
+			cfg.clock.correct(best_timer, ref);
+		}
+	}
+
+	// Spread the requests of the followers over the beacons
+	if (stats.delay_us < 0 || beacons % FLEET_DELAY_EVERY == cfg.id % FLEET_DELAY_EVERY) {
+		req_seq++;
+		t3 = cfg.clock.now_us();
+		send_msg(FLEET_DELAY_REQ, stats.leader, req_seq, 0);
+	}
+	beacons++;
+}
+
+static void receive(const fleet_msg_t *m, int64_t timer, int64_t now)
+{
+	if (m->id == cfg.id) return; // Our own, looped back
+
+	switch (m->type) {
+	case FLEET_BEACON:
+		beacon(m, timer, now);
+		break;
+
+	case FLEET_DELAY_REQ:
+		if (stats.role == FLEET_LEADER && m->to == cfg.id) send_msg(FLEET_DELAY_RESP, m->id, m->seq, now);
+		break;
+
+	case FLEET_DELAY_RESP:
+		if (m->to == cfg.id && m->id == stats.leader && m->seq == req_seq && t3) delay_sample(m->time_us);
+		break;
+
+	default:
+		stats.bad++;
+		break;
+	}
+}
+
+static void tick(int64_t timer)
+{
+	if (stats.role == FLEET_LEADER) {
+		if (timer < next_beacon_us) return;
+		stats.leader_quality = own_quality;
+		send_msg(FLEET_BEACON, 0, ++seq, cfg.clock.now_us());
+		stats.beacons_sent++;
+		next_beacon_us += period_us;
+		if (next_beacon_us <= timer) next_beacon_us = timer + period_us;
+		return;
+	}
+
+	if (timer >= give_up_us) {
+		lead(timer, stats.leader ? "the leader went silent" : "no leader heard");
+	} else if (stats.role == FLEET_FOLLOWER && better(own_quality, cfg.id, stats.leader_quality, stats.leader)) {
+		lead(timer, "better than the leader");
+	}
+}
+
+static void fleet_task(void *pvParameters)
+{
+	fleet_msg_t m;
+	arm_give_up(cfg.clock.timer_us());
+
+	while (1) {
+		int n = recv(sock, &m, sizeof(m), 0);
+		int64_t timer = cfg.clock.timer_us();
+		int64_t now = cfg.clock.now_us();
+
+		xSemaphoreTake(lock, portMAX_DELAY);
+		if (n == sizeof(m) && m.magic == FLEET_MAGIC && m.version == FLEET_VERSION) {
+			receive(&m, timer, now);
+		} else if (n >= 0) {
+			stats.bad++;
+		}
+		tick(timer);
+		xSemaphoreGive(lock);
+	}
+}
+
+esp_err_t fleet_start(const fleet_config_t *config, UBaseType_t priority, BaseType_t core)
+{
+	if (fleet_task_handle) return ESP_ERR_INVALID_STATE;
+	if (!config->id || !config->beacon_ms) return ESP_ERR_INVALID_ARG;
+	if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+
+	cfg = *config;
+	period_us = (int64_t)cfg.beacon_ms * 1000;
+	stats.role = FLEET_LISTEN;
+	stats.delay_us = -1;
+
+	group.sin_family = AF_INET;
+	group.sin_port = htons(cfg.port);
+	if (!inet_aton(cfg.group, &group.sin_addr)) return ESP_ERR_INVALID_ARG;
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Could not create the socket, errno %d", errno);
+		return ESP_FAIL;
+	}
+
+	// Several instances on one host share the port
+	int one = 1;
+	uint8_t ttl = 1, loop = 1;
+	struct timeval poll = { .tv_usec = FLEET_POLL_MS * 1000 };
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg.port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	struct ip_mreq mreq = {
+		.imr_multiaddr = group.sin_addr,
+		.imr_interface.s_addr = htonl(INADDR_ANY),
+	};
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+		bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &poll, sizeof(poll)) < 0) {
+		ESP_LOGE(TAG, "Could not join %s port %u, errno %d", cfg.group, cfg.port, errno);
+		close(sock);
+		sock = -1;
+		return ESP_FAIL;
+	}
+
+	fleet_task_handle = xTaskCreateStaticPinnedToCore(fleet_task, "fleet", FLEET_STACK, NULL, priority,
+													  fleet_stack, &fleet_task_buf, core);
+	if (!fleet_task_handle) {
+		ESP_LOGE(TAG, "Could not create the fleet task");
+		close(sock);
+		sock = -1;
+		return ESP_ERR_INVALID_ARG;
+	}
+	ESP_LOGI(TAG, "Unit %08" PRIx32 " in group %s port %u", cfg.id, cfg.group, cfg.port);
+	return ESP_OK;
+}
+
+void fleet_set_quality(uint8_t quality)
+{
+	own_quality = quality;
+}
+
+bool fleet_following(void)
+{
+	if (!lock) return false;
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool following = stats.role == FLEET_FOLLOWER;
+	xSemaphoreGive(lock);
+	return following;
+}
+
+void fleet_get_stats(fleet_stats_t *out)
+{
+	if (!lock) {
+		memset(out, 0, sizeof(*out));
+		out->delay_us = -1;
+		return;
+	}
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
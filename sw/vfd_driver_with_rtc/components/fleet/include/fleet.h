@@ -0,0 +1,111 @@
+#ifndef MAIN_FLEET_H_
+#define MAIN_FLEET_H_
+
+/*
+    Fleet time distribution over UDP multicast.
+
+    One unit of a fleet, the leader, sends a beacon every beacon_ms with its
+    time at sending (t1). Followers stamp the arrival (t2) and, right after
+    every FLEET_DELAY_EVERY-th beacon, send a delay request (t3) that the
+    leader stamps on arrival (t4). As in PTP:
+
+      delay  = ((t2 - t1) + (t4 - t3)) / 2
+      offset = t1 + delay - t2
+
+    Wi-Fi only adds delay (contention, the AP's queues), so the path delay
+    is the smallest of the last FLEET_DELAY_SAMPLES, and of every
+    FLEET_WINDOW beacons only the one that arrived earliest is used. It is
+    handed to the clock's correct(), which slews the timebase.
+
+    Election: every message carries the sender's quality (lower is better,
+    the predicted error in ms) and ID. A unit that hears no leader for
+    FLEET_LOSS_BEACONS beacons, plus a backoff derived from its ID, starts
+    beaconing. A unit better than the leader by more than
+    FLEET_QUALITY_MARGIN takes over, and a leader that hears a better one
+    steps down. Within the margin the lower ID wins, so two leaders always
+    settle on one.
+
+    Every message goes to the group, the receivers filter by ID. That keeps
+    both directions on the same path through the AP, and lets several
+    instances share one port on one host: built against the pthread
+    stand-ins in test/host, each with its own ID and a clock of its own,
+    they elect a leader and follow it over loopback (test/test_fleet.c).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define FLEET_MAGIC				0x46444656	// "VFDF"
+#define FLEET_VERSION			1
+#define FLEET_LOSS_BEACONS		4		// Beacons missed before the leader is given up
+#define FLEET_DELAY_EVERY		8		// Delay request after every this many beacons
+#define FLEET_DELAY_SAMPLES		8
+#define FLEET_WINDOW			4		// Beacons per correction
+#define FLEET_QUALITY_MARGIN	8
+#define FLEET_QUALITY_NONE		0xff	// Never synced
+
+typedef enum {
+	FLEET_LISTEN = 0,	// No leader heard yet
+	FLEET_FOLLOWER,
+	FLEET_LEADER,
+} fleet_role_t;
+
+typedef enum {
+	FLEET_BEACON = 1,
+	FLEET_DELAY_REQ = 2,
+	FLEET_DELAY_RESP = 3,
+} fleet_msg_type_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t type;		// fleet_msg_type_t
+	uint8_t quality;	// Sender's
+	uint8_t role;		// Sender's, fleet_role_t
+	uint32_t id;		// Sender
+	uint32_t to;		// Addressee of a delay request or response, 0 for a beacon
+	uint32_t seq;		// Beacon or delay request number, echoed in the response
+	int64_t time_us;	// Beacon: t1. Response: t4. Request: unused.
+} fleet_msg_t;
+
+typedef struct {
+	int64_t (*now_us)(void);		// Fleet time, UTC microseconds since 1970
+	int64_t (*timer_us)(void);		// Free running counter correct() refers to
+	void (*correct)(int64_t timer_us, int64_t ref_us);	// At timer_us, the leader's time was ref_us
+} fleet_clock_t;
+
+typedef struct {
+	const char *group;		// IPv4 multicast address
+	uint16_t port;
+	uint32_t id;			// Unique in the fleet, not 0
+	uint32_t beacon_ms;
+	fleet_clock_t clock;
+} fleet_config_t;
+
+typedef struct {
+	fleet_role_t role;
+	uint32_t leader;		// ID, 0 if none
+	uint8_t leader_quality;
+	int32_t delay_us;		// Path delay in use, -1 before the first measurement
+	int32_t offset_us;		// Last correction handed to the clock
+	uint32_t beacons_sent;
+	uint32_t beacons_heard;	// From the leader
+	uint32_t corrections;
+	uint32_t elections;		// Times this unit became leader
+	uint32_t bad;			// Foreign or malformed datagrams
+} fleet_stats_t;
+
+/* Join the group and run the protocol on a task on core (or tskNO_AFFINITY) */
+esp_err_t fleet_start(const fleet_config_t *cfg, UBaseType_t priority, BaseType_t core);
+
+/* This unit's quality, lower is better. Callable from any task. */
+void fleet_set_quality(uint8_t quality);
+
+/* True while a live leader other than this unit is followed */
+bool fleet_following(void);
+
+void fleet_get_stats(fleet_stats_t *stats);
+
+#endif /* MAIN_FLEET_H_ */
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+
+#include "heapguard.h"
+
+static TaskHandle_t watched[HEAPGUARD_MAX_TASKS];
+static int watched_count;
+static uint32_t watched_cores; // Bit per core
+static volatile bool armed;
+static bool abort_armed;
+
+// Written by the hook, on whichever core allocated
+static uint32_t allocs;
+static uint32_t bytes;
+static uint32_t last_size;
+static char last_task[configMAX_TASK_NAME_LEN];
+
+static inline bool IRAM_ATTR guarded(TaskHandle_t task)
+{
+	if (watched_cores & (1 << esp_cpu_get_core_id())) return true;
+	for (int i = 0; i < watched_count; i++) {
+		if (watched[i] == task) return true;
+	}
+	return false;
+}
+
+#if CONFIG_HEAP_USE_HOOKS
+/* Called by the heap after every successful allocation, overrides the weak default */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+	if (!armed || xPortInIsrContext()) return;
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	if (!guarded(task)) return;
+
+	if (abort_armed) esp_system_abort("Heap allocation after boot by a guarded task, see heapguard.h");
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&bytes, size, __ATOMIC_RELAXED);
+	last_size = size;
+	memcpy(last_task, pcTaskGetName(task), sizeof(last_task)); // The task may be gone when the stats are read
+}
+#endif
+
+void heapguard_watch(TaskHandle_t task)
+{
+	if (task && watched_count < HEAPGUARD_MAX_TASKS) watched[watched_count++] = task;
+}
+
+void heapguard_watch_core(int core)
+{
+	watched_cores |= 1 << core;
+}
+
+void heapguard_arm(bool abort_on_alloc)
+{
+	abort_armed = abort_on_alloc;
+	__atomic_store_n(&armed, true, __ATOMIC_RELEASE);
+}
+
+void heapguard_get_stats(heapguard_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->armed = armed;
+	stats->allocs = allocs;
+	stats->bytes = bytes;
+	stats->last_size = last_size;
+	memcpy(stats->last_task, last_task, sizeof(stats->last_task));
+	stats->last_task[sizeof(stats->last_task) - 1] = 0;
+}
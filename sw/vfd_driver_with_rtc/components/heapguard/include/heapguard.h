@@ -0,0 +1,50 @@
+#ifndef MAIN_HEAPGUARD_H_
+#define MAIN_HEAPGUARD_H_
+
+/*
+    Heap allocation guard.
+
+    Once armed, every heap allocation made by a guarded task (listed with
+    heapguard_watch()) or by any task on a guarded core is counted, and with
+    HEAP_GUARD_ABORT it stops the firmware on the spot, with the task in the
+    panic output. Everything the display, the timekeeping and the storage
+    path need is allocated statically or at boot, so after boot they must
+    not touch the heap at all; a steady stream of small allocations over
+    months is what fragments it.
+
+    Networking (Wi-Fi, lwIP, SNTP) and the shell (esp_console) allocate by
+    design, they run on the other core and are not guarded.
+
+    Uses the heap hooks of ESP-IDF (HEAP_USE_HOOKS). Arm it once every
+    periodic job has run at least once: newlib allocates some buffers on
+    first use (e.g. for formatting floats) and keeps them.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define HEAPGUARD_MAX_TASKS	8
+
+typedef struct {
+	bool armed;
+	uint32_t allocs;		// Guarded allocations since armed
+	uint32_t bytes;
+	uint32_t last_size;
+	char last_task[configMAX_TASK_NAME_LEN];	// Task of the last guarded allocation
+} heapguard_stats_t;
+
+/* Guard a task, call before heapguard_arm() */
+void heapguard_watch(TaskHandle_t task);
+
+/* Guard every task while it runs on core, call before heapguard_arm() */
+void heapguard_watch_core(int core);
+
+/* abort_on_alloc: stop the firmware on the first guarded allocation */
+void heapguard_arm(bool abort_on_alloc);
+
+void heapguard_get_stats(heapguard_stats_t *stats);
+
+#endif /* MAIN_HEAPGUARD_H_ */
@@ -3,14 +3,29 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "driver/i2c.h"
+#include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 
 #include "i2cdev.h"
 
 #define TAG "I2CDEV"
 
+#define RECOVERY_HALF_PERIOD_US 5 // 100 kHz while bit-banging the bus free
+#define CMD_LINK_SIZE I2C_LINK_RECOMMENDED_SIZE(3) // Register write + repeated start read, with room to spare
+#define TIMEOUT_TICKS (pdMS_TO_TICKS(I2CDEV_TIMEOUT) + 1) // +1, the current tick may be about to expire
+
+static SemaphoreHandle_t port_lock[I2C_NUM_MAX];
+static StaticSemaphore_t port_lock_buf[I2C_NUM_MAX];
+static i2c_dev_stats_t port_stats[I2C_NUM_MAX];
+
+// One command link per port is enough, transactions on a port are serialized by port_lock
+static uint8_t cmd_buf[I2C_NUM_MAX][CMD_LINK_SIZE];
+
 esp_err_t i2c_dev_init(i2c_port_t port, int sda, int scl)
 {
 	i2c_config_t i2c_config = {
@@ -22,17 +37,34 @@ esp_err_t i2c_dev_init(i2c_port_t port, int sda, int scl)
 		//.master.clk_speed = 1000000
 		.master.clk_speed = I2C_FREQ_HZ
 	};
+	if (port < 0 || port >= I2C_NUM_MAX) return ESP_ERR_INVALID_ARG;
+	if (!port_lock[port]) port_lock[port] = xSemaphoreCreateMutexStatic(&port_lock_buf[port]);
 	//i2c_param_config(I2C_NUM_0, &i2c_config);
 	//i2c_driver_install(I2C_NUM_0, I2C_MODE_MASTER, 0, 0, 0);
 	i2c_param_config(port, &i2c_config);
 	return i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0);
 }
 
-esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+/* Run a built command link and account its latency */
+static esp_err_t run_cmd(const i2c_dev_t *dev, i2c_cmd_handle_t cmd)
 {
-	if (!dev || !in_data || !in_size) return ESP_ERR_INVALID_ARG;
+	int64_t start = esp_timer_get_time();
+	esp_err_t res = i2c_master_cmd_begin(dev->port, cmd, TIMEOUT_TICKS);
+	uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+	i2c_cmd_link_delete_static(cmd);
+
+	i2c_dev_stats_t *stats = &port_stats[dev->port];
+	stats->last_us = us;
+	stats->total_us += us;
+	if (us > stats->max_us) stats->max_us = us;
+
+	return res;
+}
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+static esp_err_t read_once(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+{
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(cmd_buf[dev->port], CMD_LINK_SIZE);
+	if (!cmd) return ESP_ERR_NO_MEM;
 	if (out_data && out_size)
 	{
 		i2c_master_start(cmd);
@@ -44,29 +76,146 @@ esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_si
 	i2c_master_read(cmd, in_data, in_size, I2C_MASTER_LAST_NACK);
 	i2c_master_stop(cmd);
 
-	esp_err_t res = i2c_master_cmd_begin(dev->port, cmd, I2CDEV_TIMEOUT / portTICK_PERIOD_MS);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not read from device [0x%02x at %d]: %d", dev->addr, dev->port, res);
-	i2c_cmd_link_delete(cmd);
-
-	return res;
+	return run_cmd(dev, cmd);
 }
 
-esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+static esp_err_t write_once(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
 {
-	if (!dev || !out_data || !out_size) return ESP_ERR_INVALID_ARG;
-
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(cmd_buf[dev->port], CMD_LINK_SIZE);
+	if (!cmd) return ESP_ERR_NO_MEM;
 	i2c_master_start(cmd);
 	i2c_master_write_byte(cmd, (dev->addr << 1) | I2C_MASTER_WRITE, true);
 	if (out_reg && out_reg_size)
 		i2c_master_write(cmd, (void *)out_reg, out_reg_size, true);
 	i2c_master_write(cmd, (void *)out_data, out_size, true);
 	i2c_master_stop(cmd);
-	esp_err_t res = i2c_master_cmd_begin(dev->port, cmd, I2CDEV_TIMEOUT / portTICK_PERIOD_MS);
-	if (res != ESP_OK)
-		ESP_LOGE(TAG, "Could not write to device [0x%02x at %d]: %d", dev->addr, dev->port, res);
-	i2c_cmd_link_delete(cmd);
+
+	return run_cmd(dev, cmd);
+}
+
+/* Clock SCL until a slave stuck in the middle of a byte lets go of SDA, then issue a STOP.
+ * Called with the port lock held. */
+static esp_err_t bus_recover(const i2c_dev_t *dev)
+{
+	port_stats[dev->port].recoveries++;
+	i2c_driver_delete(dev->port);
+
+	gpio_config_t GPIO_CONF_BUS = {
+		.pin_bit_mask = (1ULL << dev->sda_io_num) | (1ULL << dev->scl_io_num),
+		.mode = GPIO_MODE_INPUT_OUTPUT_OD,
+		.pull_up_en = GPIO_PULLUP_ENABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type = GPIO_INTR_DISABLE,
+	};
+	gpio_config(&GPIO_CONF_BUS);
+	gpio_set_level(dev->sda_io_num, 1);
+	gpio_set_level(dev->scl_io_num, 1);
+	esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+
+	// Nine clocks get any slave through the rest of its byte and the ACK bit
+	for (int i = 0; i < 9 && !gpio_get_level(dev->sda_io_num); i++) {
+		gpio_set_level(dev->scl_io_num, 0);
+		esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+		gpio_set_level(dev->scl_io_num, 1);
+		esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+	}
+
+	// STOP: SDA rises while SCL is high
+	gpio_set_level(dev->scl_io_num, 0);
+	esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(dev->sda_io_num, 0);
+	esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(dev->scl_io_num, 1);
+	esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(dev->sda_io_num, 1);
+	esp_rom_delay_us(RECOVERY_HALF_PERIOD_US);
+
+	bool released = gpio_get_level(dev->sda_io_num) && gpio_get_level(dev->scl_io_num);
+	esp_err_t res = i2c_dev_init(dev->port, dev->sda_io_num, dev->scl_io_num);
+	if (res != ESP_OK) return res;
+	if (!released) {
+		ESP_LOGE(TAG, "Bus still held low after recovery [SDA %d, SCL %d]", dev->sda_io_num, dev->scl_io_num);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static void count_error(i2c_port_t port, esp_err_t res)
+{
+	if (res == ESP_FAIL) port_stats[port].nacks++;
+	else if (res == ESP_ERR_TIMEOUT) port_stats[port].timeouts++;
+	else port_stats[port].other++;
+}
+
+/* Runs one transaction with bounded retries and exponential backoff.
+ * A timed out transaction usually means a slave holds the bus, so it is recovered before the next attempt. */
+static esp_err_t transfer(const i2c_dev_t *dev, bool read,
+						  const void *out1, size_t out1_size, void *in_or_out2, size_t size2)
+{
+	if (!port_lock[dev->port]) return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(port_lock[dev->port], portMAX_DELAY);
+	i2c_dev_stats_t *stats = &port_stats[dev->port];
+	stats->transactions++;
+
+	esp_err_t res = ESP_FAIL;
+	for (int attempt = 0; attempt <= I2CDEV_MAX_RETRIES; attempt++) {
+		if (attempt > 0) {
+			stats->retries++;
+			TickType_t backoff = pdMS_TO_TICKS(I2CDEV_RETRY_DELAY_MS << (attempt - 1));
+			vTaskDelay(backoff ? backoff : 1);
+		}
+
+		res = read ? read_once(dev, out1, out1_size, in_or_out2, size2)
+				   : write_once(dev, out1, out1_size, in_or_out2, size2);
+		if (res == ESP_OK) break;
+
+		count_error(dev->port, res);
+		if (res == ESP_ERR_TIMEOUT || res == ESP_ERR_INVALID_STATE) bus_recover(dev);
+	}
+
+	if (res != ESP_OK) {
+		stats->failures++;
+		ESP_LOGE(TAG, "Could not %s device [0x%02x at %d] after %d attempts: %d",
+				 read ? "read from" : "write to", dev->addr, dev->port, I2CDEV_MAX_RETRIES + 1, res);
+	}
+	xSemaphoreGive(port_lock[dev->port]);
+
+	return res;
+}
+
+esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size)
+{
+	if (!dev || !in_data || !in_size) return ESP_ERR_INVALID_ARG;
+
+	return transfer(dev, true, out_data, out_size, in_data, in_size);
+}
+
+esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size)
+{
+	if (!dev || !out_data || !out_size) return ESP_ERR_INVALID_ARG;
+
+	return transfer(dev, false, out_reg, out_reg_size, (void *)out_data, out_size);
+}
+
+esp_err_t i2c_dev_bus_recover(const i2c_dev_t *dev)
+{
+	if (!dev || !port_lock[dev->port]) return ESP_ERR_INVALID_ARG;
+
+	xSemaphoreTake(port_lock[dev->port], portMAX_DELAY);
+	esp_err_t res = bus_recover(dev);
+	xSemaphoreGive(port_lock[dev->port]);
 
 	return res;
 }
+
+void i2c_dev_get_stats(i2c_port_t port, i2c_dev_stats_t *stats)
+{
+	if (port < 0 || port >= I2C_NUM_MAX || !port_lock[port]) { // Not set up (yet)
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	xSemaphoreTake(port_lock[port], portMAX_DELAY);
+	*stats = port_stats[port];
+	xSemaphoreGive(port_lock[port]);
+}
@@ -4,7 +4,9 @@
 #include "driver/i2c.h"
 
 #define I2C_FREQ_HZ 400000
-#define I2CDEV_TIMEOUT 1000
+#define I2CDEV_TIMEOUT 20		// Per attempt (ms), a DS3231 time read takes about 250 us at 400 kHz
+#define I2CDEV_MAX_RETRIES 3		// Extra attempts after a failed transaction
+#define I2CDEV_RETRY_DELAY_MS 10	// First backoff, doubles with every retry
 
 typedef struct {
 	i2c_port_t port;	// I2C port number
@@ -14,9 +16,24 @@ typedef struct {
 	uint32_t clk_speed;		// I2C clock frequency for master mode
 } i2c_dev_t;
 
+typedef struct {
+	uint32_t transactions;	// Transactions started, retried ones counted once
+	uint32_t retries;		// Extra attempts made
+	uint32_t nacks;			// Attempts the device did not acknowledge
+	uint32_t timeouts;		// Attempts that timed out, bus busy or stuck
+	uint32_t other;			// Attempts that failed for any other reason
+	uint32_t recoveries;	// Stuck bus recoveries (9 SCL clocks + STOP)
+	uint32_t failures;		// Transactions that failed after all retries
+	uint32_t last_us;		// Duration of the last attempt
+	uint32_t max_us;		// Longest attempt
+	uint64_t total_us;		// Sum of all attempts, divide by transactions + retries for the mean
+} i2c_dev_stats_t;
+
 esp_err_t i2c_dev_init(i2c_port_t port, int sda, int scl);
 esp_err_t i2c_dev_read(const i2c_dev_t *dev, const void *out_data, size_t out_size, void *in_data, size_t in_size);
 esp_err_t i2c_dev_write(const i2c_dev_t *dev, const void *out_reg, size_t out_reg_size, const void *out_data, size_t out_size);
+esp_err_t i2c_dev_bus_recover(const i2c_dev_t *dev);
+void i2c_dev_get_stats(i2c_port_t port, i2c_dev_stats_t *stats);
 inline esp_err_t i2c_dev_read_reg(const i2c_dev_t *dev, uint8_t reg, void *in_data, size_t in_size)
 {
 	return i2c_dev_read(dev, &reg, 1, in_data, in_size);
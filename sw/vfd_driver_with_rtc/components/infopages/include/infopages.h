@@ -0,0 +1,60 @@
+#ifndef MAIN_INFOPAGES_H_
+#define MAIN_INFOPAGES_H_
+
+/*
+    Rotating info pages.
+
+    The display cycles clock -> page -> page -> ... -> clock, every page for
+    its own dwell time. A page is a value source and a formatter: the value is
+    read when the page comes up, and the text is only formatted again when the
+    value moved by at least the page threshold (its display resolution), so a
+    steady reading is formatted once.
+
+    Sensors that need time to measure get a prepare() call lead_ms before
+    their page shows, instead of being polled all the time. The caller owns
+    the timing, pages_peek() tells which page to prepare next.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "vfd_driver.h"
+
+typedef struct {
+	const char *name;
+	uint32_t dwell_ms;						// How long the page stays up, 0 = page off
+	uint32_t lead_ms;						// How long before read() prepare() has to run
+	esp_err_t (*prepare)(void);				// Start a measurement, NULL if read() is enough
+	esp_err_t (*read)(int32_t *value);
+	void (*format)(int32_t value, char *text, uint32_t *dp); // VFD_TUBES characters, decimal points (bit 0 = leftmost)
+	int32_t threshold;						// Smallest change that shows, in units of the value
+
+	// Owned by infopages.c
+	int32_t shown_value;					// Value the text was formatted from
+	bool rendered;
+	char text[VFD_TUBES + 1];
+	uint32_t dp;
+	uint32_t reads;
+	uint32_t failures;
+	uint32_t renders;
+} info_page_t;
+
+typedef struct {
+	info_page_t *pages;
+	uint8_t count;
+	int8_t current;							// -1 = the clock
+	uint32_t clock_ms;						// Time on the clock between rotations
+} info_rotation_t;
+
+void pages_init(info_rotation_t *rot, info_page_t *pages, uint8_t count, uint32_t clock_ms);
+
+/* Move on to the next page and return it, or NULL when the clock is up next. *dwell_ms is how long it stays. */
+info_page_t *pages_advance(info_rotation_t *rot, uint32_t *dwell_ms);
+
+/* The page pages_advance() returns next, NULL for the clock */
+info_page_t *pages_peek(const info_rotation_t *rot);
+
+/* Read the value and format the text if it moved. ESP_OK when page->text can be shown. */
+esp_err_t pages_refresh(info_page_t *page);
+
+#endif /* MAIN_INFOPAGES_H_ */
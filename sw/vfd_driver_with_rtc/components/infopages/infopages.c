@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "infopages.h"
+
+void pages_init(info_rotation_t *rot, info_page_t *pages, uint8_t count, uint32_t clock_ms)
+{
+	memset(rot, 0, sizeof(*rot));
+	rot->pages = pages;
+	rot->count = count;
+	rot->current = -1;
+	rot->clock_ms = clock_ms;
+}
+
+/* Index of the first enabled page after index, -1 when the clock comes first */
+static int8_t next_index(const info_rotation_t *rot, int8_t index)
+{
+	for (int8_t i = index + 1; i < rot->count; i++) {
+		if (rot->pages[i].dwell_ms) return i;
+	}
+	return -1;
+}
+
+info_page_t *pages_advance(info_rotation_t *rot, uint32_t *dwell_ms)
+{
+	rot->current = next_index(rot, rot->current);
+	if (rot->current < 0) {
+		*dwell_ms = rot->clock_ms;
+		return NULL;
+	}
+
+	info_page_t *page = &rot->pages[rot->current];
+	*dwell_ms = page->dwell_ms;
+	return page;
+}
+
+info_page_t *pages_peek(const info_rotation_t *rot)
+{
+	int8_t next = next_index(rot, rot->current);
+	return next < 0 ? NULL : &rot->pages[next];
+}
+
+esp_err_t pages_refresh(info_page_t *page)
+{
+	int32_t value;
+
+	page->reads++;
+	esp_err_t res = page->read(&value);
+	if (res != ESP_OK) {
+		page->failures++;
+		return res;
+	}
+
+	// Below the display resolution the text would come out the same
+	if (page->rendered && abs(value - page->shown_value) < page->threshold) return ESP_OK;
+
+	memset(page->text, ' ', VFD_TUBES);
+	page->text[VFD_TUBES] = '\0';
+	page->dp = 0;
+	page->format(value, page->text, &page->dp);
+	page->shown_value = value;
+	page->rendered = true;
+	page->renders++;
+	return ESP_OK;
+}
@@ -0,0 +1,68 @@
+#ifndef MAIN_MQTTPUB_H_
+#define MAIN_MQTTPUB_H_
+
+/*
+    Batched MQTT publishing of telemetry and device health.
+
+    Every interval_s the network is brought up for one batch window of at
+    most window_s: connect to the broker, publish the health payload and
+    every telemetry sample since the last one the broker acknowledged, then
+    disconnect and release the network. Samples are not queued anywhere
+    else, the telemetry ring (flash and RAM) is the offline queue: the
+    cursor, the time of the last acknowledged sample, is kept in NVS, so a
+    window after an outage or a reset drains the backlog in bulk, as far as
+    the window allows. A broker that refuses the connection ends the window
+    right away.
+
+    Topics and payloads (QoS 1, each message waits for its PUBACK before the
+    next one goes out, so the cursor never passes an unacknowledged sample):
+
+      <topic>/telemetry	{"t":<UTC of the first sample>,"v":[[<s after t>,<rtc temp>,<temp>,<humidity>,<lux>],...]}
+      <topic>/health		the object the health callback writes
+
+    Values are the integers of telemetry_channel_t, a missing reading is
+    null. Subscribe with mosquitto_sub -v -t '<topic>/#' on a local
+    Mosquitto broker to watch the batches.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define MQTTPUB_PAYLOAD_MAX		2048	// One message, about 60 samples
+#define MQTTPUB_TOPIC_MAX		64
+#define MQTTPUB_CONNECT_MS		10000	// Broker connection, within the window
+
+typedef struct {
+	const char *uri;			// Broker, e.g. mqtt://192.168.1.10
+	const char *topic;			// Prefix of the unit's topics
+	uint32_t interval_s;		// Batch cadence
+	uint32_t window_s;			// Longest the network is up per batch
+	int32_t utc_offset_s;		// Telemetry keeps local time, payloads carry UTC
+	uint32_t (*now_s)(void);	// Local time, the cursor starts one interval back on the first run
+	bool (*net_up)(void);		// Bring the network up for a window, false if it is not there
+	void (*net_down)(void);		// Done with it, paired with a successful net_up()
+	int (*health)(char *buf, size_t size);	// Write the health JSON object, returns what snprintf() returns
+} mqttpub_config_t;
+
+typedef struct {
+	uint32_t windows;		// Batch windows opened
+	uint32_t offline;		// Windows without network or broker
+	uint32_t messages;		// Acknowledged
+	uint32_t samples;		// Acknowledged
+	uint32_t backlog;		// Samples left for the next window
+	uint32_t cursor;		// Local time of the last acknowledged sample
+	uint32_t last_window_ms;	// Network up time of the last window
+} mqttpub_stats_t;
+
+/* Create the client and the publishing task on core (or tskNO_AFFINITY) */
+esp_err_t mqttpub_start(const mqttpub_config_t *cfg, UBaseType_t priority, BaseType_t core);
+
+/* Open a batch window now */
+void mqttpub_trigger(void);
+
+void mqttpub_get_stats(mqttpub_stats_t *stats);
+
+#endif /* MAIN_MQTTPUB_H_ */
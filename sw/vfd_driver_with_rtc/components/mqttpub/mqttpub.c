@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+#include "nvs.h"
+#include "esp_log.h"
+
+#include "telemetry.h"
+#include "mqttpub.h"
+
+#define TAG "MQTTPUB"
+
+#define PUB_STACK		(1024*4)
+#define PUB_ACK_MS		5000	// PUBACK of one message
+#define NVS_NAMESPACE	"mqttpub"
+#define NVS_CURSOR		"cursor"
+
+static mqttpub_config_t cfg;
+static esp_mqtt_client_handle_t client;
+static TaskHandle_t pub_task_handle = NULL;
+static StaticTask_t pub_task_buf;
+static StackType_t pub_stack[PUB_STACK];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqttpub_stats_t stats;
+
+// Set by the MQTT event handler, read by the publishing task it wakes
+static volatile bool connected;
+static volatile bool closed;	// Lost or refused, the client does not retry on its own
+static volatile int acked_id = -1;
+static volatile bool triggered;
+
+// Only used by the publishing task
+static char payload[MQTTPUB_PAYLOAD_MAX];
+static char topic[MQTTPUB_TOPIC_MAX];
+
+typedef struct {
+	size_t len;
+	uint32_t first;		// Time of the first sample in the payload
+	uint32_t last;
+	uint32_t count;
+	bool full;
+} batch_t;
+
+static void mqtt_event(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+	esp_mqtt_event_handle_t event = data;
+	switch ((esp_mqtt_event_id_t)id) {
+	case MQTT_EVENT_CONNECTED:
+		connected = true;
+		break;
+	case MQTT_EVENT_DISCONNECTED:
+		connected = false;
+		closed = true;
+		break;
+	case MQTT_EVENT_PUBLISHED:
+		acked_id = event->msg_id;
+		break;
+	default:
+		return;
+	}
+	xTaskNotifyGive(pub_task_handle);
+}
+
+/* Wait until done() holds or the deadline (ticks) passes */
+static bool wait_for(bool (*done)(int), int arg, TickType_t deadline)
+{
+	while (!done(arg)) {
+		int32_t left = (int32_t)(deadline - xTaskGetTickCount());
+		if (left <= 0) return false;
+		ulTaskNotifyTake(pdTRUE, left);
+	}
+	return true;
+}
+
+static bool connect_done(int unused)
+{
+	return connected || closed;
+}
+
+static bool is_acked(int msg_id)
+{
+	return acked_id == msg_id || !connected;
+}
+
+/* Append a sample to the payload, false once it is full */
+static bool add_sample(const telemetry_sample_t *s, void *arg)
+{
+	batch_t *b = arg;
+	char row[80];
+	int n = snprintf(row, sizeof(row), "%s[%" PRIu32, b->count ? "," : "", b->count ? s->time - b->first : 0);
+	for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+		if (s->valid & (1 << ch)) n += snprintf(row + n, sizeof(row) - n, ",%" PRId32, s->value[ch]);
+		else n += snprintf(row + n, sizeof(row) - n, ",null");
+	}
+	n += snprintf(row + n, sizeof(row) - n, "]");
+
+	if (!b->count) {
+		b->first = s->time;
+		b->len = snprintf(payload, sizeof(payload), "{\"t\":%" PRIu32 ",\"v\":[", s->time - cfg.utc_offset_s);
+	}
+	if (b->len + n + 3 > sizeof(payload)) { // Room for the closing ]}
+		b->full = true;
+		return false;
+	}
+	memcpy(payload + b->len, row, n);
+	b->len += n;
+	b->last = s->time;
+	b->count++;
+	return true;
+}
+
+static bool count_sample(const telemetry_sample_t *s, void *arg)
+{
+	return true;
+}
+
+/* Publish one message with QoS 1 and wait for its PUBACK */
+static bool publish(const char *what, int len, TickType_t deadline)
+{
+	snprintf(topic, sizeof(topic), "%s/%s", cfg.topic, what);
+	int msg_id = esp_mqtt_client_publish(client, topic, payload, len, 1, 0);
+	if (msg_id < 0) return false;
+
+	TickType_t ack = xTaskGetTickCount() + pdMS_TO_TICKS(PUB_ACK_MS);
+	if ((int32_t)(ack - deadline) > 0) ack = deadline;
+	return wait_for(is_acked, msg_id, ack) && acked_id == msg_id;
+}
+
+static void save_cursor(uint32_t cursor)
+{
+	nvs_handle_t nvs;
+	if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+	if (nvs_set_u32(nvs, NVS_CURSOR, cursor) == ESP_OK) nvs_commit(nvs);
+	nvs_close(nvs);
+}
+
+static void batch_window(uint32_t *cursor)
+{
+	TickType_t start = xTaskGetTickCount();
+	TickType_t deadline = start + pdMS_TO_TICKS(cfg.window_s * 1000);
+	uint32_t messages = 0, samples = 0;
+	bool drained = false;
+
+	portENTER_CRITICAL(&stats_lock);
+	stats.windows++;
+	portEXIT_CRITICAL(&stats_lock);
+
+	if (!cfg.net_up()) {
+		portENTER_CRITICAL(&stats_lock);
+		stats.offline++;
+		portEXIT_CRITICAL(&stats_lock);
+		return;
+	}
+
+	connected = false;
+	closed = false;
+	acked_id = -1;
+	TickType_t connect = start + pdMS_TO_TICKS(MQTTPUB_CONNECT_MS);
+	if ((int32_t)(connect - deadline) > 0) connect = deadline;
+	if (esp_mqtt_client_start(client) == ESP_OK && wait_for(connect_done, 0, connect) && connected) {
+		int len = cfg.health ? cfg.health(payload, sizeof(payload)) : -1;
+		if (len > 0 && len < (int)sizeof(payload) && publish("health", len, deadline)) messages++;
+
+		// Drain the ring from the cursor on, one acknowledged message at a time
+		while (connected && (int32_t)(deadline - xTaskGetTickCount()) > 0) {
+			batch_t b = {0};
+			telemetry_read(*cursor + 1, UINT32_MAX, add_sample, &b);
+			if (!b.count) {
+				drained = true;
+				break;
+			}
+			b.len += snprintf(payload + b.len, sizeof(payload) - b.len, "]}");
+			if (!publish("telemetry", b.len, deadline)) break;
+			*cursor = b.last;
+			messages++;
+			samples += b.count;
+			if (!b.full) {
+				drained = true;
+				break;
+			}
+		}
+	} else {
+		portENTER_CRITICAL(&stats_lock);
+		stats.offline++;
+		portEXIT_CRITICAL(&stats_lock);
+	}
+	esp_mqtt_client_stop(client);
+	cfg.net_down();
+
+	if (samples) save_cursor(*cursor);
+	uint32_t backlog = drained ? 0 : telemetry_read(*cursor + 1, UINT32_MAX, count_sample, NULL);
+	ESP_LOGI(TAG, "%" PRIu32 " messages, %" PRIu32 " samples, %" PRIu32 " left", messages, samples, backlog);
+
+	portENTER_CRITICAL(&stats_lock);
+	stats.messages += messages;
+	stats.samples += samples;
+	stats.backlog = backlog;
+	stats.cursor = *cursor;
+	stats.last_window_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+	portEXIT_CRITICAL(&stats_lock);
+}
+
+static void pub_task(void *pvParameters)
+{
+	uint32_t cursor = 0;
+	nvs_handle_t nvs;
+	if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+		nvs_get_u32(nvs, NVS_CURSOR, &cursor);
+		nvs_close(nvs);
+	}
+	if (!cursor) cursor = cfg.now_s() - cfg.interval_s; // First run, not the whole history
+
+	while (1) {
+		// Windows on the interval boundaries, or when triggered
+		uint32_t wait_s = cfg.interval_s - cfg.now_s() % cfg.interval_s;
+		TickType_t until = xTaskGetTickCount() + pdMS_TO_TICKS(wait_s * 1000);
+		while ((int32_t)(until - xTaskGetTickCount()) > 0) {
+			ulTaskNotifyTake(pdTRUE, until - xTaskGetTickCount());
+			if (triggered) break;
+		}
+		triggered = false;
+		batch_window(&cursor);
+	}
+}
+
+esp_err_t mqttpub_start(const mqttpub_config_t *config, UBaseType_t priority, BaseType_t core)
+{
+	if (pub_task_handle) return ESP_ERR_INVALID_STATE;
+	if (!config->interval_s || !config->now_s || !config->net_up || !config->net_down) return ESP_ERR_INVALID_ARG;
+	cfg = *config;
+
+	esp_mqtt_client_config_t mqtt_cfg = {
+		.broker.address.uri = cfg.uri,
+		.network.disable_auto_reconnect = true,	// Only inside a window
+		.buffer.out_size = MQTTPUB_PAYLOAD_MAX + MQTTPUB_TOPIC_MAX + 16,
+	};
+	client = esp_mqtt_client_init(&mqtt_cfg);
+	if (!client) return ESP_ERR_NO_MEM;
+	esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event, NULL);
+
+	pub_task_handle = xTaskCreateStaticPinnedToCore(pub_task, "mqttpub", PUB_STACK, NULL, priority,
+													pub_stack, &pub_task_buf, core);
+	if (!pub_task_handle) {
+		ESP_LOGE(TAG, "Could not create the publishing task");
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+void mqttpub_trigger(void)
+{
+	if (!pub_task_handle) return;
+	triggered = true;
+	xTaskNotifyGive(pub_task_handle);
+}
+
+void mqttpub_get_stats(mqttpub_stats_t *out)
+{
+	portENTER_CRITICAL(&stats_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&stats_lock);
+}
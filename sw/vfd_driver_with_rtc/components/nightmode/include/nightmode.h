@@ -0,0 +1,74 @@
+#ifndef MAIN_NIGHTMODE_H_
+#define MAIN_NIGHTMODE_H_
+
+/*
+    Display power state machine.
+
+    Decides how much of the display is powered from the time of day, the
+    ambient light level and button activity:
+      ON         full brightness
+      DIMMED     segments blanked for part of every mux phase
+      BLANKED    outputs cleared through SRCLR, mux timer stopped
+      DEEP_IDLE  blanked long enough that the periodic RTC work is paused too
+
+    A button press always brings the display back for wake_s seconds. The
+    light thresholds have hysteresis and every state is held for at least
+    min_dwell_s, so a passing shadow does not make the tubes flicker.
+
+    The state machine is plain C with no ESP-IDF dependencies, time is passed
+    in, so it can be driven by simulated time on the host.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NIGHTMODE_NO_LIGHT	-1	// Light level when there is no (valid) sensor reading
+
+typedef enum {
+	NIGHTMODE_ON = 0,
+	NIGHTMODE_DIMMED,
+	NIGHTMODE_BLANKED,
+	NIGHTMODE_DEEP_IDLE,
+	NIGHTMODE_STATES
+} nightmode_state_t;
+
+typedef struct {
+	uint16_t night_start_min;	// Minute of the (local) day the night schedule starts
+	uint16_t night_end_min;		// Minute the night schedule ends, may be before the start (wraps midnight)
+	int32_t dim_level;			// Dim below this light level (larger = brighter)
+	int32_t dark_level;			// Blank below this light level
+	int32_t hysteresis;			// Light level margin needed to leave a darker state
+	uint32_t wake_s;			// Display stays up this long after a button press
+	uint32_t deep_idle_s;		// Blanked this long without activity enters deep idle
+	uint32_t min_dwell_s;		// Shortest time a light triggered state is held
+} nightmode_config_t;
+
+typedef struct {
+	nightmode_config_t cfg;
+	nightmode_state_t state;
+	int64_t state_since_s;		// When the current state was entered
+	int64_t last_activity_s;	// Last button press
+	bool dim;					// Light level below dim_level, with hysteresis
+	bool dark;					// Light level below dark_level, with hysteresis
+
+	// Statistics
+	uint32_t transitions;
+	int64_t residency_s[NIGHTMODE_STATES];	// Time spent per state until state_since_s
+} nightmode_t;
+
+/* Start in ON at now_s, counting as activity */
+void nightmode_init(nightmode_t *nm, const nightmode_config_t *cfg, int64_t now_s);
+
+/* Feed the current inputs, returns the state the display should be in.
+ * now_s is local time in seconds since the epoch, light is NIGHTMODE_NO_LIGHT without a sensor. */
+nightmode_state_t nightmode_update(nightmode_t *nm, int64_t now_s, int32_t light, bool activity);
+
+/* Time spent in each state up to now_s */
+void nightmode_residency(const nightmode_t *nm, int64_t now_s, int64_t residency_s[NIGHTMODE_STATES]);
+
+/* Inside the night schedule at now_s */
+bool nightmode_is_night(const nightmode_t *nm, int64_t now_s);
+
+const char *nightmode_state_name(nightmode_state_t state);
+
+#endif /* MAIN_NIGHTMODE_H_ */
@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "nightmode.h"
+
+#define DAY_S 86400
+
+static bool in_night(const nightmode_config_t *cfg, int64_t now_s)
+{
+	if (cfg->night_start_min == cfg->night_end_min) return false; // No schedule
+
+	uint32_t min = (uint32_t)(((now_s % DAY_S) + DAY_S) % DAY_S) / 60;
+	if (cfg->night_start_min < cfg->night_end_min) {
+		return min >= cfg->night_start_min && min < cfg->night_end_min;
+	}
+	return min >= cfg->night_start_min || min < cfg->night_end_min;
+}
+
+/* Below threshold, leaving takes threshold + hysteresis */
+static bool below(bool was_below, int32_t light, int32_t threshold, int32_t hysteresis)
+{
+	return light < (was_below ? threshold + hysteresis : threshold);
+}
+
+static void enter(nightmode_t *nm, nightmode_state_t state, int64_t now_s)
+{
+	if (state == nm->state) return;
+
+	nm->residency_s[nm->state] += now_s - nm->state_since_s;
+	nm->state = state;
+	nm->state_since_s = now_s;
+	nm->transitions++;
+}
+
+void nightmode_init(nightmode_t *nm, const nightmode_config_t *cfg, int64_t now_s)
+{
+	memset(nm, 0, sizeof(*nm));
+	nm->cfg = *cfg;
+	nm->state = NIGHTMODE_ON;
+	nm->state_since_s = now_s;
+	nm->last_activity_s = now_s;
+}
+
+nightmode_state_t nightmode_update(nightmode_t *nm, int64_t now_s, int32_t light, bool activity)
+{
+	const nightmode_config_t *cfg = &nm->cfg;
+
+	if (activity) nm->last_activity_s = now_s;
+	bool awake = now_s - nm->last_activity_s < (int64_t)cfg->wake_s;
+
+	if (light != NIGHTMODE_NO_LIGHT) {
+		nm->dark = below(nm->dark, light, cfg->dark_level, cfg->hysteresis);
+		nm->dim = nm->dark || below(nm->dim, light, cfg->dim_level, cfg->hysteresis);
+	} else {
+		nm->dark = nm->dim = false;
+	}
+
+	nightmode_state_t next;
+	if (awake) {
+		// Someone is looking, but do not glare at them in a dark room
+		next = nm->dim ? NIGHTMODE_DIMMED : NIGHTMODE_ON;
+	} else if (in_night(cfg, now_s) || nm->dark) {
+		bool idle = nm->state >= NIGHTMODE_BLANKED && now_s - nm->state_since_s >= (int64_t)cfg->deep_idle_s;
+		next = (nm->state == NIGHTMODE_DEEP_IDLE || idle) ? NIGHTMODE_DEEP_IDLE : NIGHTMODE_BLANKED;
+	} else {
+		next = nm->dim ? NIGHTMODE_DIMMED : NIGHTMODE_ON;
+	}
+
+	// Buttons act at once, everything else waits out the dwell time
+	bool dwelt = now_s - nm->state_since_s >= (int64_t)cfg->min_dwell_s;
+	if (activity || dwelt || (nm->state == NIGHTMODE_BLANKED && next == NIGHTMODE_DEEP_IDLE)) {
+		enter(nm, next, now_s);
+	}
+
+	return nm->state;
+}
+
+void nightmode_residency(const nightmode_t *nm, int64_t now_s, int64_t residency_s[NIGHTMODE_STATES])
+{
+	for (int i = 0; i < NIGHTMODE_STATES; i++) residency_s[i] = nm->residency_s[i];
+	residency_s[nm->state] += now_s - nm->state_since_s;
+}
+
+bool nightmode_is_night(const nightmode_t *nm, int64_t now_s)
+{
+	return in_night(&nm->cfg, now_s);
+}
+
+const char *nightmode_state_name(nightmode_state_t state)
+{
+	static const char *names[NIGHTMODE_STATES] = {"on", "dimmed", "blanked", "deep-idle"};
+	return state < NIGHTMODE_STATES ? names[state] : "?";
+}
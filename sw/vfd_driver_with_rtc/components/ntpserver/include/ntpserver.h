@@ -0,0 +1,73 @@
+#ifndef MAIN_NTPSERVER_H_
+#define MAIN_NTPSERVER_H_
+
+/*
+    SNTPv4 server (RFC 4330) for the LAN.
+
+    Answers client (mode 3) requests over UDP with the time of a clock
+    function, the disciplined timebase on the device. The stratum, reference
+    ID and root dispersion come from the source set by the owner: one more
+    than the upstream NTP server while synced, and a dispersion that grows
+    from the last upstream sync at the drift rate the RTC showed. Once it
+    passes NTPSERVER_MAX_DISP_US, or before the first sync, replies carry
+    leap indicator 3 and stratum 16 so clients do not follow.
+
+    One task and one socket, requests are answered in arrival order from
+    static buffers, nothing is allocated per request (lwIP still takes a
+    pbuf per datagram). The receive timestamp is taken when a request is
+    read, in a burst a queued request shows the wait as network delay.
+
+    Only POSIX sockets and FreeRTOS are used, so the component also builds
+    on the host against the pthread stand-ins in test/host. make -C test
+    checks ntpserver_reply(), the whole protocol, and a loopback exchange
+    (test/test_ntpserver.c). test/build/ntpserver_host serves gettimeofday()
+    on a port for a standard client, e.g.
+      test/build/ntpserver_host 12300 &
+      chronyd -Q 'server 127.0.0.1 port 12300 iburst maxsamples 4'
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define NTPSERVER_PACKET		48			// Without extension fields or a MAC
+#define NTPSERVER_PRECISION		(-20)		// log2 seconds, the timebase counts microseconds
+#define NTPSERVER_MAX_DISP_US	16000000	// MAXDISP of RFC 5905, unsynchronized beyond
+#define NTPSERVER_STRATUM_NONE	16
+
+typedef struct {
+	uint8_t stratum;		// Ours, 1..15, NTPSERVER_STRATUM_NONE before the first sync
+	uint32_t ref_id;		// IPv4 address of the upstream server, network order
+	int64_t ref_us;			// UTC time of the last upstream sync, microseconds since 1970
+	uint32_t root_delay_us;	// Round trip to the primary reference, as far as known
+	uint32_t root_disp_us;	// Error bound relative to the primary reference at ref_us
+	uint32_t disp_ppb;		// Growth of the error bound after ref_us
+} ntpserver_source_t;
+
+typedef struct {
+	uint32_t requests;		// Datagrams received
+	uint32_t replies;		// Sent
+	uint32_t ignored;		// Too short, not a client request
+	uint32_t unsynced;		// Replies with leap indicator 3
+	uint32_t send_failed;
+} ntpserver_stats_t;
+
+/* UTC time in microseconds since 1970 */
+typedef int64_t (*ntpserver_clock_t)(void);
+
+/* Build the reply to a request received at rx_us and sent at tx_us (UTC). Returns its
+ * length, NTPSERVER_PACKET, or 0 if the request is not answered. */
+size_t ntpserver_reply(const uint8_t *req, size_t len, int64_t rx_us, int64_t tx_us,
+					   const ntpserver_source_t *src, uint8_t *resp);
+
+/* Bind port on every interface and answer from a task on core (or tskNO_AFFINITY) */
+esp_err_t ntpserver_start(uint16_t port, ntpserver_clock_t clock, UBaseType_t priority, BaseType_t core);
+
+/* Set the source the replies describe, callable from any task */
+void ntpserver_set_source(const ntpserver_source_t *src);
+
+void ntpserver_get_stats(ntpserver_stats_t *stats);
+
+#endif /* MAIN_NTPSERVER_H_ */
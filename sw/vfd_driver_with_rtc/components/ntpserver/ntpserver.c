@@ -0,0 +1,184 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "ntpserver.h"
+
+#define TAG "NTPSERVER"
+
+#define SERVER_STACK	(1024*3)
+#define RX_MAX			128			// Extension fields are read and ignored
+#define NTP_UNIX_S		2208988800u	// 1900 to 1970, era 0; the 32-bit seconds wrap on their own in 2036
+#define MODE_CLIENT		3
+#define MODE_SERVER		4
+#define LI_UNSYNCED		3
+#define REFID_INIT		0x494e4954	// "INIT"
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+static ntpserver_source_t source = { .stratum = NTPSERVER_STRATUM_NONE };
+static ntpserver_stats_t stats;
+static ntpserver_clock_t clock_now;
+static int sock = -1;
+static TaskHandle_t server_task_handle = NULL;
+static StaticTask_t server_task_buf;
+static StackType_t server_stack[SERVER_STACK];
+
+// Only used by the server task
+static uint8_t rx_buf[RX_MAX];
+static uint8_t tx_buf[NTPSERVER_PACKET];
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* NTP timestamp, 32.32 fixed point seconds since 1900 */
+static void put_timestamp(uint8_t *p, int64_t unix_us)
+{
+	int64_t s = unix_us / 1000000;
+	int64_t us = unix_us % 1000000;
+	if (us < 0) {
+		s--;
+		us += 1000000;
+	}
+	put32(p, (uint32_t)s + NTP_UNIX_S);
+	put32(p + 4, (uint32_t)(((uint64_t)us << 32) / 1000000));
+}
+
+/* NTP short format, 16.16 fixed point seconds */
+static uint32_t short_format(uint64_t us)
+{
+	uint64_t v = us * 65536 / 1000000;
+	return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+size_t ntpserver_reply(const uint8_t *req, size_t len, int64_t rx_us, int64_t tx_us,
+					   const ntpserver_source_t *src, uint8_t *resp)
+{
+	if (len < NTPSERVER_PACKET) return 0;
+	uint8_t version = (req[0] >> 3) & 7;
+	if ((req[0] & 7) != MODE_CLIENT || version < 1 || version > 4) return 0;
+
+	// Error bound at the time the request came in
+	uint64_t disp_us = src->root_disp_us;
+	if (rx_us > src->ref_us) disp_us += (uint64_t)(rx_us - src->ref_us) * src->disp_ppb / 1000000000;
+	bool synced = src->stratum < NTPSERVER_STRATUM_NONE && src->ref_us && disp_us < NTPSERVER_MAX_DISP_US;
+
+	memset(resp, 0, NTPSERVER_PACKET);
+	resp[0] = (synced ? 0 : LI_UNSYNCED << 6) | version << 3 | MODE_SERVER;
+	resp[1] = synced ? src->stratum : NTPSERVER_STRATUM_NONE;
+	resp[2] = req[2];	// Poll, as the client asked
+	resp[3] = (uint8_t)NTPSERVER_PRECISION;
+	if (synced) {
+		put32(resp + 4, short_format(src->root_delay_us));
+		put32(resp + 8, short_format(disp_us));
+		memcpy(resp + 12, &src->ref_id, 4); // Network order already
+		put_timestamp(resp + 16, src->ref_us);
+	} else {
+		put32(resp + 8, short_format(NTPSERVER_MAX_DISP_US));
+		put32(resp + 12, REFID_INIT);
+	}
+	memcpy(resp + 24, req + 40, 8);	// Originate: the client's transmit timestamp, as it sent it
+	put_timestamp(resp + 32, rx_us);
+	put_timestamp(resp + 40, tx_us);
+	return NTPSERVER_PACKET;
+}
+
+static void server_task(void *pvParameters)
+{
+	while (1) {
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		int n = recvfrom(sock, rx_buf, sizeof(rx_buf), 0, (struct sockaddr *)&from, &from_len);
+		int64_t rx_us = clock_now();
+		if (n < 0) {
+			ESP_LOGW(TAG, "Receive failed, errno %d", errno);
+			vTaskDelay(pdMS_TO_TICKS(1000));
+			continue;
+		}
+
+		xSemaphoreTake(lock, portMAX_DELAY);
+		ntpserver_source_t src = source;
+		stats.requests++;
+		xSemaphoreGive(lock);
+
+		size_t len = ntpserver_reply(rx_buf, n, rx_us, clock_now(), &src, tx_buf);
+		bool sent = len && sendto(sock, tx_buf, len, 0, (struct sockaddr *)&from, from_len) == (int)len;
+
+		xSemaphoreTake(lock, portMAX_DELAY);
+		if (!len) {
+			stats.ignored++;
+		} else if (!sent) {
+			stats.send_failed++;
+		} else {
+			stats.replies++;
+			if (tx_buf[0] >> 6 == LI_UNSYNCED) stats.unsynced++;
+		}
+		xSemaphoreGive(lock);
+	}
+}
+
+esp_err_t ntpserver_start(uint16_t port, ntpserver_clock_t clock, UBaseType_t priority, BaseType_t core)
+{
+	if (server_task_handle) return ESP_ERR_INVALID_STATE;
+	if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+	clock_now = clock;
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Could not create the socket, errno %d", errno);
+		return ESP_FAIL;
+	}
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ESP_LOGE(TAG, "Could not bind port %u, errno %d", port, errno);
+		close(sock);
+		sock = -1;
+		return ESP_FAIL;
+	}
+
+	server_task_handle = xTaskCreateStaticPinnedToCore(server_task, "ntpserver", SERVER_STACK, NULL, priority,
+													   server_stack, &server_task_buf, core);
+	if (!server_task_handle) {
+		ESP_LOGE(TAG, "Could not create the server task");
+		close(sock);
+		sock = -1;
+		return ESP_ERR_INVALID_ARG;
+	}
+	ESP_LOGI(TAG, "Serving time on UDP port %u", port);
+	return ESP_OK;
+}
+
+void ntpserver_set_source(const ntpserver_source_t *src)
+{
+	if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+	xSemaphoreTake(lock, portMAX_DELAY);
+	source = *src;
+	xSemaphoreGive(lock);
+}
+
+void ntpserver_get_stats(ntpserver_stats_t *out)
+{
+	if (!lock) {
+		memset(out, 0, sizeof(*out));
+		return;
+	}
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	xSemaphoreGive(lock);
+}
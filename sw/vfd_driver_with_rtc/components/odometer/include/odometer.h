@@ -0,0 +1,47 @@
+#ifndef MAIN_ODOMETER_H_
+#define MAIN_ODOMETER_H_
+
+/*
+    Segment on-time odometer.
+
+    Counts how long every segment of every tube has been lit, to see how
+    unevenly the cathodes wear. The refresh path does not count anything: the
+    shown frame is accounted once when it is replaced, weighted by how long it
+    was shown and at what brightness. That is a handful of additions per
+    second instead of work on every mux phase.
+
+    Counters are display time at full brightness; the fixed 1 / VFD_GRIDS grid mux duty
+    is left out. They are checkpointed to NVS in batches, at most once per
+    checkpoint period and only when they moved, to spare the flash.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "vfd_topology.h"
+
+#define ODOMETER_TUBES		VFD_TUBES
+#define ODOMETER_SEGMENTS	8	// A..G, H (decimal point)
+
+/* Load the counters from NVS, nvs_flash_init() must have been called */
+esp_err_t odometer_init(void);
+
+/* The frame in segs (ABCDEFGH bytes, tube 0 = leftmost) was lit for lit_us. Callable from the esp_timer task. */
+void odometer_account(const uint8_t segs[ODOMETER_TUBES], uint32_t lit_us);
+
+/* Write the counters to NVS if they moved. Without force, only once the checkpoint period has passed. */
+esp_err_t odometer_checkpoint(bool force);
+
+/* Lit seconds of a segment (0 = A .. 7 = H) */
+uint32_t odometer_get_s(uint8_t tube, uint8_t segment);
+
+/* Copy all counters, in seconds */
+void odometer_snapshot(uint32_t out_s[ODOMETER_TUBES][ODOMETER_SEGMENTS]);
+
+/* Start a tube over after it has been replaced */
+void odometer_reset_tube(uint8_t tube);
+
+/* Log the counters as a table */
+void odometer_dump(void);
+
+#endif /* MAIN_ODOMETER_H_ */
@@ -0,0 +1,133 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "odometer.h"
+
+#define TAG "ODOMETER"
+
+#define NVS_NAMESPACE	"odometer"
+#define NVS_KEY			"seg_s"
+#define CHECKPOINT_US	((int64_t)CONFIG_ODOMETER_CHECKPOINT_MIN * 60 * 1000000)
+
+static portMUX_TYPE odo_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t lit_us[ODOMETER_TUBES][ODOMETER_SEGMENTS];
+static uint32_t saved_s[ODOMETER_TUBES][ODOMETER_SEGMENTS];	// What NVS holds
+static int64_t last_checkpoint_us;
+
+esp_err_t odometer_init(void)
+{
+	nvs_handle_t nvs;
+	esp_err_t res = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+	if (res == ESP_OK) {
+		size_t size = sizeof(saved_s);
+		res = nvs_get_blob(nvs, NVS_KEY, saved_s, &size);
+		if (res == ESP_OK && size != sizeof(saved_s)) res = ESP_ERR_INVALID_SIZE;
+		nvs_close(nvs);
+	}
+
+	if (res != ESP_OK) {
+		// First boot, or a different tube count: start over
+		if (res != ESP_ERR_NVS_NOT_FOUND) ESP_LOGW(TAG, "Discarding stored counters: %d", res);
+		memset(saved_s, 0, sizeof(saved_s));
+	}
+
+	portENTER_CRITICAL(&odo_lock);
+	for (int t = 0; t < ODOMETER_TUBES; t++) {
+		for (int s = 0; s < ODOMETER_SEGMENTS; s++) lit_us[t][s] = (uint64_t)saved_s[t][s] * 1000000;
+	}
+	portEXIT_CRITICAL(&odo_lock);
+
+	last_checkpoint_us = esp_timer_get_time();
+	return ESP_OK;
+}
+
+void odometer_account(const uint8_t segs[ODOMETER_TUBES], uint32_t us)
+{
+	if (us == 0) return;
+
+	portENTER_CRITICAL_SAFE(&odo_lock);
+	for (int t = 0; t < ODOMETER_TUBES; t++) {
+		// Only walk the lit bits, bit 7 is segment A
+		for (uint32_t bits = segs[t]; bits; bits &= bits - 1) {
+			lit_us[t][7 - __builtin_ctz(bits)] += us;
+		}
+	}
+	portEXIT_CRITICAL_SAFE(&odo_lock);
+}
+
+esp_err_t odometer_checkpoint(bool force)
+{
+	int64_t now = esp_timer_get_time();
+	if (!force && now - last_checkpoint_us < CHECKPOINT_US) return ESP_OK;
+	last_checkpoint_us = now;
+
+	uint32_t current_s[ODOMETER_TUBES][ODOMETER_SEGMENTS];
+	odometer_snapshot(current_s);
+	if (memcmp(current_s, saved_s, sizeof(saved_s)) == 0) return ESP_OK; // Display was off, nothing to write
+
+	nvs_handle_t nvs;
+	esp_err_t res = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+	if (res != ESP_OK) return res;
+
+	res = nvs_set_blob(nvs, NVS_KEY, current_s, sizeof(current_s));
+	if (res == ESP_OK) res = nvs_commit(nvs);
+	nvs_close(nvs);
+
+	if (res == ESP_OK) {
+		memcpy(saved_s, current_s, sizeof(saved_s));
+	} else {
+		ESP_LOGE(TAG, "Could not write the counters: %d", res);
+	}
+	return res;
+}
+
+uint32_t odometer_get_s(uint8_t tube, uint8_t segment)
+{
+	if (tube >= ODOMETER_TUBES || segment >= ODOMETER_SEGMENTS) return 0;
+
+	portENTER_CRITICAL(&odo_lock);
+	uint64_t us = lit_us[tube][segment];
+	portEXIT_CRITICAL(&odo_lock);
+
+	return (uint32_t)(us / 1000000);
+}
+
+void odometer_snapshot(uint32_t out_s[ODOMETER_TUBES][ODOMETER_SEGMENTS])
+{
+	portENTER_CRITICAL(&odo_lock);
+	for (int t = 0; t < ODOMETER_TUBES; t++) {
+		for (int s = 0; s < ODOMETER_SEGMENTS; s++) out_s[t][s] = (uint32_t)(lit_us[t][s] / 1000000);
+	}
+	portEXIT_CRITICAL(&odo_lock);
+}
+
+void odometer_reset_tube(uint8_t tube)
+{
+	if (tube >= ODOMETER_TUBES) return;
+
+	portENTER_CRITICAL(&odo_lock);
+	memset(lit_us[tube], 0, sizeof(lit_us[tube]));
+	portEXIT_CRITICAL(&odo_lock);
+
+	odometer_checkpoint(true);
+}
+
+void odometer_dump(void)
+{
+	uint32_t s[ODOMETER_TUBES][ODOMETER_SEGMENTS];
+	odometer_snapshot(s);
+
+	ESP_LOGI(TAG, "Lit hours per segment   A      B      C      D      E      F      G      H");
+	for (int t = 0; t < ODOMETER_TUBES; t++) {
+		ESP_LOGI(TAG, "  tube %d          %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32
+				 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32, t,
+				 s[t][0] / 3600, s[t][1] / 3600, s[t][2] / 3600, s[t][3] / 3600,
+				 s[t][4] / 3600, s[t][5] / 3600, s[t][6] / 3600, s[t][7] / 3600);
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef MAIN_POWER_H_
+#define MAIN_POWER_H_
+
+/*
+    Power management.
+
+    The display only needs a few tens of microseconds of shifting every mux
+    phase, the rest of the time the chip can run at the lowest clock or sit in
+    light sleep. power_init() enables dynamic frequency scaling and automatic
+    light sleep; the CPU is only held at full clock inside the shift-out
+    windows (power_shift_begin/end). The legacy I2C driver holds its own APB
+    lock for the length of every transaction.
+
+    The mux refresh is an esp_timer, which is backed by the hardware systimer.
+    Automatic light sleep wakes the chip early enough for the next alarm, so
+    the refresh timing does not depend on the sleep.
+
+    Time inside each window is accounted, power_report() turns it into duty
+    cycles and an average current estimate. A mux phase is shorter than the
+    idle time light sleep needs, so the chip only sleeps while the display is
+    parked (power_display_muxing(false)). The estimate counts no sleep while
+    multiplexing and is only a range for the parked time, CONFIG_PM_PROFILING
+    adds the measured residency per PM mode.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Rough ESP32-S3 module currents used for the estimate, board level current differs
+#define POWER_CPU_MAX_UA	40000	// CPU at full clock
+#define POWER_APB_MAX_UA	25000	// 80 MHz, waiting on the I2C peripheral
+#define POWER_CPU_MIN_UA	13000	// Lowest DFS clock, awake
+#define POWER_SLEEP_UA		240		// Light sleep
+
+typedef struct {
+	int64_t uptime_us;		// Time since power_init()
+	uint32_t shifts;		// Shift-out windows
+	uint64_t shift_us;		// Time spent in shift-out windows, lock switch included
+	uint32_t shift_max_us;	// Longest shift-out window
+	uint64_t parked_us;		// Time the mux timer was stopped
+	bool managed;			// DFS and light sleep are active
+} power_stats_t;
+
+/* Enable dynamic frequency scaling and automatic light sleep (if configured) */
+esp_err_t power_init(void);
+
+/* Hold the CPU at full clock for a shift-out window. Not reentrant, only the mux callback shifts. */
+void power_shift_begin(void);
+void power_shift_end(void);
+
+/* The mux timer was started (true) or stopped (false), only a parked display lets the chip sleep */
+void power_display_muxing(bool muxing);
+
+void power_get_stats(power_stats_t *stats);
+
+/* Log duty cycle and residency per power state, i2c_us is the time spent in I2C transactions */
+void power_report(uint64_t i2c_us);
+
+#endif /* MAIN_POWER_H_ */
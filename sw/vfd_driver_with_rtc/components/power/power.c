@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "power.h"
+
+#define TAG "POWER"
+
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t start_us;
+static int64_t shift_start_us;
+static int64_t parked_since_us; // 0 while multiplexing
+static power_stats_t stats;
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t shift_lock;
+#endif
+
+esp_err_t power_init(void)
+{
+	start_us = esp_timer_get_time();
+
+#if CONFIG_PM_ENABLE
+	esp_err_t res = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "vfd_shift", &shift_lock);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not create the shift-out PM lock: %d", res);
+		return res;
+	}
+
+	esp_pm_config_t pm_config = {
+		.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+		.min_freq_mhz = CONFIG_POWER_MIN_FREQ_MHZ,
+#if CONFIG_POWER_LIGHT_SLEEP
+		.light_sleep_enable = true,
+#endif
+	};
+	res = esp_pm_configure(&pm_config);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not configure power management: %d", res);
+		return res;
+	}
+
+	stats.managed = true;
+	ESP_LOGI(TAG, "DFS %d-%d MHz, light sleep %s", pm_config.min_freq_mhz, pm_config.max_freq_mhz,
+			 pm_config.light_sleep_enable ? "on" : "off");
+#endif
+	return ESP_OK;
+}
+
+void power_shift_begin(void)
+{
+	shift_start_us = esp_timer_get_time();
+#if CONFIG_PM_ENABLE
+	if (shift_lock) esp_pm_lock_acquire(shift_lock);
+#endif
+}
+
+void power_shift_end(void)
+{
+#if CONFIG_PM_ENABLE
+	if (shift_lock) esp_pm_lock_release(shift_lock);
+#endif
+	uint32_t us = (uint32_t)(esp_timer_get_time() - shift_start_us);
+
+	portENTER_CRITICAL_SAFE(&power_lock);
+	stats.shifts++;
+	stats.shift_us += us;
+	if (us > stats.shift_max_us) stats.shift_max_us = us;
+	portEXIT_CRITICAL_SAFE(&power_lock);
+}
+
+void power_display_muxing(bool muxing)
+{
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL_SAFE(&power_lock);
+	if (muxing && parked_since_us) {
+		stats.parked_us += now - parked_since_us;
+		parked_since_us = 0;
+	} else if (!muxing && !parked_since_us) {
+		parked_since_us = now;
+	}
+	portEXIT_CRITICAL_SAFE(&power_lock);
+}
+
+void power_get_stats(power_stats_t *out)
+{
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL_SAFE(&power_lock);
+	*out = stats;
+	if (parked_since_us) out->parked_us += now - parked_since_us;
+	portEXIT_CRITICAL_SAFE(&power_lock);
+	out->uptime_us = now - start_us;
+}
+
+/* Per mille of the uptime */
+static uint32_t permille(uint64_t us, int64_t uptime_us)
+{
+	return uptime_us > 0 ? (uint32_t)(us * 1000 / uptime_us) : 0;
+}
+
+void power_report(uint64_t i2c_us)
+{
+	power_stats_t st;
+	power_get_stats(&st);
+	if (st.uptime_us <= 0) return;
+
+	uint64_t busy_us = st.shift_us + i2c_us;
+	uint64_t rest_us = (uint64_t)st.uptime_us > busy_us ? st.uptime_us - busy_us : 0;
+	uint64_t parked_us = st.parked_us < rest_us ? st.parked_us : rest_us;
+	uint64_t muxing_us = rest_us - parked_us;
+	uint32_t shift_pm = permille(st.shift_us, st.uptime_us);
+	uint32_t i2c_pm = permille(i2c_us, st.uptime_us);
+	uint32_t muxing_pm = permille(muxing_us, st.uptime_us);
+	uint32_t parked_pm = permille(parked_us, st.uptime_us);
+
+	// Between the windows of a running mux the chip never stays idle long enough to sleep, so that time
+	// is awake at the lowest clock. Only parked time may be light sleep, and without PM_PROFILING we do
+	// not know how much of it was: asleep .. awake at the lowest clock.
+	uint32_t rest_ua = st.managed ? POWER_CPU_MIN_UA : POWER_CPU_MAX_UA;
+	uint64_t fixed = (st.shift_us * POWER_CPU_MAX_UA + i2c_us * POWER_APB_MAX_UA + muxing_us * rest_ua) / st.uptime_us;
+	uint64_t low_ua = fixed + parked_us * (st.managed ? POWER_SLEEP_UA : POWER_CPU_MAX_UA) / st.uptime_us;
+	uint64_t high_ua = fixed + parked_us * rest_ua / st.uptime_us;
+
+	ESP_LOGI(TAG, "Uptime %" PRId64 " s, %s", st.uptime_us / 1000000, st.managed ? "DFS/light sleep" : "unmanaged");
+	ESP_LOGI(TAG, "  shift-out  %3" PRIu32 ".%" PRIu32 " %%  (%" PRIu32 " windows, max %" PRIu32 " us)", shift_pm / 10, shift_pm % 10,
+			 st.shifts, st.shift_max_us);
+	ESP_LOGI(TAG, "  I2C        %3" PRIu32 ".%" PRIu32 " %%", i2c_pm / 10, i2c_pm % 10);
+	ESP_LOGI(TAG, "  muxing     %3" PRIu32 ".%" PRIu32 " %%  (no light sleep, a phase is shorter than the idle time before sleep)",
+			 muxing_pm / 10, muxing_pm % 10);
+	ESP_LOGI(TAG, "  parked     %3" PRIu32 ".%" PRIu32 " %%  (light sleep allowed)", parked_pm / 10, parked_pm % 10);
+	ESP_LOGI(TAG, "  Estimated average current %" PRIu64 "..%" PRIu64 " uA", low_ua, high_ua);
+
+#if CONFIG_PM_PROFILING
+	// Exact residency per PM mode (light sleep, APB min/max, CPU max)
+	esp_pm_dump_locks(stdout);
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef MAIN_SCHEDULER_H_
+#define MAIN_SCHEDULER_H_
+
+/*
+    Cooperative job scheduler.
+
+    One FreeRTOS task runs all periodic and one-shot jobs (LED, sensors, time,
+    UI) as plain callbacks, instead of every job owning a task, a stack and its
+    own wakeups. Jobs live in a three level hierarchical timer wheel (64 slots
+    per level, one RTOS tick per level 0 slot), so adding, cancelling and
+    expiring a job is O(1). Between expiries the task blocks until the next
+    occupied slot, so jobs that fall on the same tick share a single wakeup.
+
+    Jobs must not block for long, every job delays the ones behind it.
+    Jobs are owned by the caller, the scheduler never allocates.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+typedef void (*sched_cb_t)(void *arg);
+
+typedef struct sched_job {
+	struct sched_job *next;	// Wheel slot list, owned by the scheduler
+	struct sched_job *prev;
+	struct sched_job **slot;	// Wheel slot the job is queued in
+	sched_cb_t cb;
+	void *arg;
+	const char *name;
+	TickType_t expires;		// Tick at which the job runs next
+	TickType_t period;		// 0 = one-shot
+	bool armed;
+
+	// Statistics
+	uint32_t runs;
+	uint32_t max_us;		// Longest single run
+} sched_job_t;
+
+#define SCHED_JOB_INIT(cb_, arg_, name_) { .cb = (cb_), .arg = (arg_), .name = (name_) }
+
+typedef struct {
+	uint32_t wakeups;		// Times the scheduler task woke up
+	uint32_t runs;			// Job runs over all jobs
+	uint32_t armed;			// Jobs currently in the wheel
+	uint32_t cascades;		// Higher level slots redistributed
+} sched_stats_t;
+
+/* Create the scheduler task on core (or tskNO_AFFINITY) with the caller's stack of stack_size bytes,
+ * call before adding jobs. Nothing is allocated from the heap. */
+esp_err_t sched_start(StackType_t *stack, uint32_t stack_size, UBaseType_t priority, BaseType_t core);
+
+/* The scheduler task, NULL before sched_start() */
+TaskHandle_t sched_task(void);
+
+/* (Re)arm a job to run after delay_ms and then every period_ms (0 = once). Callable from any task. */
+void sched_add(sched_job_t *job, uint32_t delay_ms, uint32_t period_ms);
+
+/* Disarm a job, safe to call on a job that is not armed */
+void sched_cancel(sched_job_t *job);
+
+void sched_get_stats(sched_stats_t *stats);
+
+#endif /* MAIN_SCHEDULER_H_ */
@@ -0,0 +1,229 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "scheduler.h"
+
+#define TAG "SCHED"
+
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1u << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 3
+#define WHEEL_SPAN   (1u << (WHEEL_BITS * WHEEL_LEVELS)) // 262144 ticks, 43 min at 100 Hz
+
+static sched_job_t *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static TickType_t wheel_now;	// Last tick the wheel has been advanced to
+static sched_stats_t stats;
+static TaskHandle_t sched_task_handle = NULL;
+static StaticTask_t sched_task_buf;
+static portMUX_TYPE sched_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void wheel_unlink(sched_job_t *job)
+{
+	if (job->prev) job->prev->next = job->next;
+	else *job->slot = job->next;
+	if (job->next) job->next->prev = job->prev;
+	job->next = job->prev = NULL;
+	job->slot = NULL;
+}
+
+static void wheel_insert(sched_job_t *job)
+{
+	// Jobs further out than the wheel spans park in the last level 2 slot and get re-sorted on cascade
+	TickType_t at = job->expires;
+	uint32_t delta = at - wheel_now;
+	if (delta >= WHEEL_SPAN) {
+		delta = WHEEL_SPAN - 1;
+		at = wheel_now + delta;
+	}
+
+	int level = delta < WHEEL_SIZE ? 0 : delta < WHEEL_SIZE * WHEEL_SIZE ? 1 : 2;
+	sched_job_t **head = &wheel[level][(at >> (level * WHEEL_BITS)) & WHEEL_MASK];
+
+	job->slot = head;
+	job->prev = NULL;
+	job->next = *head;
+	if (*head) (*head)->prev = job;
+	*head = job;
+}
+
+/* Move every job of a higher level slot down to where it belongs now */
+static void wheel_cascade(int level, uint32_t slot)
+{
+	sched_job_t *job = wheel[level][slot];
+	if (!job) return;
+	wheel[level][slot] = NULL;
+	stats.cascades++;
+
+	while (job) {
+		sched_job_t *next = job->next;
+		wheel_insert(job);
+		job = next;
+	}
+}
+
+static void wheel_advance(void)
+{
+	wheel_now++;
+	if ((wheel_now & WHEEL_MASK) != 0) return;
+
+	uint32_t slot1 = (wheel_now >> WHEEL_BITS) & WHEEL_MASK;
+	if (slot1 == 0) wheel_cascade(2, (wheel_now >> (2 * WHEEL_BITS)) & WHEEL_MASK);
+	wheel_cascade(1, slot1);
+}
+
+/* Does the level 1/2 boundary at tick t (a multiple of WHEEL_SIZE) bring any jobs down? */
+static bool cascade_pending(TickType_t t)
+{
+	uint32_t slot1 = (t >> WHEEL_BITS) & WHEEL_MASK;
+	if (wheel[1][slot1]) return true;
+	return slot1 == 0 && wheel[2][(t >> (2 * WHEEL_BITS)) & WHEEL_MASK];
+}
+
+/* Tick at which the scheduler has to wake up next, false if the wheel is empty */
+static bool next_event(TickType_t *next)
+{
+	if (stats.armed == 0) return false;
+
+	for (uint32_t i = 1; i <= WHEEL_SIZE; i++) {
+		TickType_t t = wheel_now + i;
+		if (wheel[0][t & WHEEL_MASK] || ((t & WHEEL_MASK) == 0 && cascade_pending(t))) {
+			*next = t;
+			return true;
+		}
+	}
+
+	for (int level = 1; level < WHEEL_LEVELS; level++) {
+		TickType_t base = wheel_now & ~((1u << (level * WHEEL_BITS)) - 1);
+		for (uint32_t k = 2; k <= WHEEL_SIZE; k++) {
+			TickType_t t = base + (k << (level * WHEEL_BITS));
+			if (cascade_pending(t)) {
+				*next = t;
+				return true;
+			}
+		}
+	}
+
+	// Only parked far-future jobs left, look again once the wheel has turned
+	*next = wheel_now + (WHEEL_SIZE << WHEEL_BITS);
+	return true;
+}
+
+static void run_job(sched_job_t *job)
+{
+	int64_t start = esp_timer_get_time();
+	job->cb(job->arg);
+	uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+
+	job->runs++;
+	if (us > job->max_us) job->max_us = us;
+}
+
+static void sched_loop(void *pvParameters)
+{
+	while (1) {
+		TickType_t now = xTaskGetTickCount();
+		stats.wakeups++;
+
+		portENTER_CRITICAL(&sched_lock);
+		while (1) {
+			sched_job_t *job = wheel[0][wheel_now & WHEEL_MASK];
+			if (job) {
+				wheel_unlink(job);
+				if (job->period) {
+					// Keep the phase, but drop periods we slept through instead of running them in a burst
+					do {
+						job->expires += job->period;
+					} while ((int32_t)(job->expires - wheel_now) <= 0);
+					wheel_insert(job);
+				} else {
+					job->armed = false;
+					stats.armed--;
+				}
+				stats.runs++;
+				portEXIT_CRITICAL(&sched_lock);
+
+				run_job(job);
+
+				portENTER_CRITICAL(&sched_lock);
+				continue;
+			}
+
+			if (wheel_now == now) break;
+			wheel_advance();
+		}
+
+		TickType_t next;
+		bool pending = next_event(&next);
+		portEXIT_CRITICAL(&sched_lock);
+
+		TickType_t wait = portMAX_DELAY;
+		if (pending) {
+			int32_t ticks = (int32_t)(next - xTaskGetTickCount());
+			if (ticks <= 0) continue;
+			wait = ticks;
+		}
+		ulTaskNotifyTake(pdTRUE, wait);
+	}
+}
+
+esp_err_t sched_start(StackType_t *stack, uint32_t stack_size, UBaseType_t priority, BaseType_t core)
+{
+	if (sched_task_handle) return ESP_ERR_INVALID_STATE;
+
+	wheel_now = xTaskGetTickCount();
+	sched_task_handle = xTaskCreateStaticPinnedToCore(sched_loop, "scheduler", stack_size, NULL, priority,
+													  stack, &sched_task_buf, core);
+	if (!sched_task_handle) {
+		ESP_LOGE(TAG, "Could not create scheduler task");
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
+
+TaskHandle_t sched_task(void)
+{
+	return sched_task_handle;
+}
+
+void sched_add(sched_job_t *job, uint32_t delay_ms, uint32_t period_ms)
+{
+	// Round up, a job must never run early
+	TickType_t delay = (delay_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+	TickType_t period = (period_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+
+	portENTER_CRITICAL(&sched_lock);
+	if (job->armed) wheel_unlink(job);
+	else stats.armed++;
+
+	job->armed = true;
+	job->period = period;
+	job->expires = xTaskGetTickCount() + delay;
+	if ((int32_t)(job->expires - wheel_now) <= 0) job->expires = wheel_now + 1;
+	wheel_insert(job);
+	portEXIT_CRITICAL(&sched_lock);
+
+	if (sched_task_handle && xTaskGetCurrentTaskHandle() != sched_task_handle) {
+		xTaskNotifyGive(sched_task_handle);
+	}
+}
+
+void sched_cancel(sched_job_t *job)
+{
+	portENTER_CRITICAL(&sched_lock);
+	if (job->armed) {
+		wheel_unlink(job);
+		job->armed = false;
+		stats.armed--;
+	}
+	portEXIT_CRITICAL(&sched_lock);
+}
+
+void sched_get_stats(sched_stats_t *out)
+{
+	portENTER_CRITICAL(&sched_lock);
+	*out = stats;
+	portEXIT_CRITICAL(&sched_lock);
+}
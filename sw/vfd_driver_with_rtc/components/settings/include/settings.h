@@ -0,0 +1,47 @@
+#ifndef MAIN_SETTINGS_H_
+#define MAIN_SETTINGS_H_
+
+/*
+    Runtime settings.
+
+    A table of named integer settings, owned by the caller. Every entry points
+    at the variable the firmware reads, initialised to its Kconfig default. A
+    value that was set before is loaded from the "settings" NVS namespace by
+    settings_init(), and settings_set() stores it there, so a change outlives
+    a reset without a rebuild.
+
+    After a change the entry's apply callback runs on the calling task. It
+    should hand the new value over to the task that owns the state rather
+    than touch it directly.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SETTINGS_NAMESPACE	"settings"
+
+typedef struct {
+	const char *name;		// Also the NVS key, at most 15 characters
+	int32_t *value;
+	int32_t min;
+	int32_t max;
+	void (*apply)(void);	// Called after a change, may be NULL
+	const char *help;
+} setting_t;
+
+/* Load the stored values into the table. The table must outlive the module. Call after nvs_flash_init(). */
+esp_err_t settings_init(const setting_t *table, size_t count);
+
+/* ESP_ERR_NOT_FOUND for an unknown name, ESP_ERR_INVALID_ARG out of range */
+esp_err_t settings_set(const char *name, int32_t value);
+
+/* Forget the stored values, the defaults come back after a reset */
+esp_err_t settings_erase(void);
+
+const setting_t *settings_find(const char *name);
+
+/* Entry i of the table, NULL past the end */
+const setting_t *settings_at(size_t i);
+
+#endif /* MAIN_SETTINGS_H_ */
@@ -0,0 +1,78 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "settings.h"
+
+#define TAG "SETTINGS"
+
+static const setting_t *settings;
+static size_t settings_count;
+
+esp_err_t settings_init(const setting_t *table, size_t count)
+{
+	settings = table;
+	settings_count = count;
+
+	nvs_handle_t nvs;
+	esp_err_t res = nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &nvs);
+	if (res == ESP_ERR_NVS_NOT_FOUND) return ESP_OK; // Nothing was ever set
+	if (res != ESP_OK) return res;
+
+	for (size_t i = 0; i < count; i++) {
+		int32_t value;
+		if (nvs_get_i32(nvs, table[i].name, &value) != ESP_OK) continue;
+		if (value < table[i].min || value > table[i].max) {
+			ESP_LOGW(TAG, "Stored %s %" PRId32 " out of range, keeping %" PRId32, table[i].name, value, *table[i].value);
+			continue;
+		}
+		*table[i].value = value;
+	}
+	nvs_close(nvs);
+	return ESP_OK;
+}
+
+const setting_t *settings_find(const char *name)
+{
+	for (size_t i = 0; i < settings_count; i++) {
+		if (!strcmp(settings[i].name, name)) return &settings[i];
+	}
+	return NULL;
+}
+
+const setting_t *settings_at(size_t i)
+{
+	return i < settings_count ? &settings[i] : NULL;
+}
+
+esp_err_t settings_set(const char *name, int32_t value)
+{
+	const setting_t *s = settings_find(name);
+	if (!s) return ESP_ERR_NOT_FOUND;
+	if (value < s->min || value > s->max) return ESP_ERR_INVALID_ARG;
+
+	nvs_handle_t nvs;
+	esp_err_t res = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &nvs);
+	if (res != ESP_OK) return res;
+	res = nvs_set_i32(nvs, s->name, value);
+	if (res == ESP_OK) res = nvs_commit(nvs);
+	nvs_close(nvs);
+	if (res != ESP_OK) return res;
+
+	*s->value = value;
+	if (s->apply) s->apply();
+	return ESP_OK;
+}
+
+esp_err_t settings_erase(void)
+{
+	nvs_handle_t nvs;
+	esp_err_t res = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &nvs);
+	if (res != ESP_OK) return res;
+	res = nvs_erase_all(nvs);
+	if (res == ESP_OK) res = nvs_commit(nvs);
+	nvs_close(nvs);
+	return res;
+}
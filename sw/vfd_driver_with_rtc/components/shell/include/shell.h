@@ -0,0 +1,33 @@
+#ifndef MAIN_SHELL_H_
+#define MAIN_SHELL_H_
+
+/*
+    Command shell on the USB Serial/JTAG port (J4).
+
+    The event stream owns the port's output, so the shell only reads from it:
+    a line typed on the host (tools/evstream.py --shell) is run through
+    esp_console, and whatever the command prints goes back as EV_TEXT frames.
+    The shell task's stdout is redirected into the stream, commands use
+    printf() like on any console.
+
+    Built-in commands:
+      tasks [ms]		run time per task and load per core over ms, stack high water marks
+      heap			free, minimum free and largest block
+      get [name]		settings, see settings.h
+      set <name> <value>
+      defaults		forget the stored settings
+
+    The firmware registers its own commands with esp_console_cmd_register()
+    after shell_start().
+*/
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#define SHELL_LINE_MAX		128
+#define SHELL_MAX_TASKS		32		// Most tasks the tasks command can list
+
+/* Start the shell task on core (or tskNO_AFFINITY), after evstream_init() */
+esp_err_t shell_start(UBaseType_t priority, BaseType_t core);
+
+#endif /* MAIN_SHELL_H_ */
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE // fopencookie()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/usb_serial_jtag.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "evstream.h"
+#include "settings.h"
+#include "shell.h"
+
+#define TAG "SHELL"
+
+#define SHELL_STACK		(1024*4)	// printf() and esp_console_run()
+#define SHELL_OUT_WAIT	pdMS_TO_TICKS(200)	// Per line, the host is listening when it typed a command
+
+static TaskHandle_t shell_task_handle = NULL;
+static StaticTask_t shell_task_buf;
+static StackType_t shell_stack[SHELL_STACK];
+static char out_buf[EVSTREAM_MAX_BODY];
+
+/* Writer of the shell task's stdout, one EV_TEXT frame per line */
+static ssize_t out_write(void *cookie, const char *buf, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		const char *nl = memchr(buf + done, '\n', size - done);
+		size_t len = nl ? (size_t)(nl - (buf + done)) : size - done;
+		size_t skip = nl ? 1 : 0;
+		if (len > EVSTREAM_MAX_BODY) {
+			len = EVSTREAM_MAX_BODY;
+			skip = 0;
+		}
+		evstream_send_wait(EV_TEXT, buf + done, len, SHELL_OUT_WAIT);
+		done += len + skip;
+	}
+	return size;
+}
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static TaskStatus_t task_snap[2][SHELL_MAX_TASKS];
+
+/* Run time counter of a task in the first snapshot, 0 if it did not exist yet */
+static uint32_t task_runtime_before(TaskHandle_t task, UBaseType_t count)
+{
+	for (UBaseType_t i = 0; i < count; i++) {
+		if (task_snap[0][i].xHandle == task) return task_snap[0][i].ulRunTimeCounter;
+	}
+	return 0;
+}
+
+static void print_permille(uint32_t pm)
+{
+	printf(" %3" PRIu32 ".%" PRIu32, pm / 10, pm % 10);
+}
+
+static int cmd_tasks(int argc, char **argv)
+{
+	uint32_t ms = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+	if (ms < 10 || ms > 60000) {
+		printf("Window from 10 to 60000 ms\n");
+		return 1;
+	}
+
+	uint32_t total[2];
+	UBaseType_t before = uxTaskGetSystemState(task_snap[0], SHELL_MAX_TASKS, &total[0]);
+	vTaskDelay(pdMS_TO_TICKS(ms));
+	UBaseType_t after = uxTaskGetSystemState(task_snap[1], SHELL_MAX_TASKS, &total[1]);
+	if (!before || !after) {
+		printf("More than %d tasks\n", SHELL_MAX_TASKS);
+		return 1;
+	}
+
+	// Run time counters tick at the same rate on both cores, so the window is the same for each
+	uint32_t window = total[1] - total[0];
+	if (!window) return 1;
+	uint32_t idle[portNUM_PROCESSORS] = {0};
+
+	printf("%-16s core prio stack   cpu%%\n", "task");
+	for (UBaseType_t i = 0; i < after; i++) {
+		TaskStatus_t *t = &task_snap[1][i];
+		uint32_t run = t->ulRunTimeCounter - task_runtime_before(t->xHandle, before);
+		for (int core = 0; core < portNUM_PROCESSORS; core++) {
+			if (t->xHandle == xTaskGetIdleTaskHandleForCPU(core)) idle[core] = run;
+		}
+
+		BaseType_t core = xTaskGetAffinity(t->xHandle);
+		char core_text[4] = "-";
+		if (core != tskNO_AFFINITY) snprintf(core_text, sizeof(core_text), "%d", (int)core);
+		printf("%-16s %4s %4u %5" PRIu32, t->pcTaskName, core_text, (unsigned)t->uxCurrentPriority,
+			   (uint32_t)t->usStackHighWaterMark);
+		print_permille((uint64_t)run * 1000 / window);
+		printf("\n");
+	}
+
+	printf("load");
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		uint32_t idle_pm = (uint64_t)idle[core] * 1000 / window;
+		printf("  core %d", core);
+		print_permille(idle_pm < 1000 ? 1000 - idle_pm : 0);
+		printf(" %%");
+	}
+	printf(" over %" PRIu32 " ms\n", ms);
+	return 0;
+}
+#endif
+
+static int cmd_heap(int argc, char **argv)
+{
+	printf("heap %u of %u free, %u at least, largest block %u\n",
+		   (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+		   (unsigned)heap_caps_get_total_size(MALLOC_CAP_8BIT),
+		   (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+		   (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+	return 0;
+}
+
+static void print_setting(const setting_t *s)
+{
+	printf("%-16s %8" PRId32 "  [%" PRId32 " .. %" PRId32 "]  %s\n", s->name, *s->value, s->min, s->max, s->help ? s->help : "");
+}
+
+static int cmd_get(int argc, char **argv)
+{
+	if (argc > 1) {
+		const setting_t *s = settings_find(argv[1]);
+		if (!s) {
+			printf("No setting %s\n", argv[1]);
+			return 1;
+		}
+		print_setting(s);
+		return 0;
+	}
+	const setting_t *s;
+	for (size_t i = 0; (s = settings_at(i)); i++) print_setting(s);
+	return 0;
+}
+
+static int cmd_set(int argc, char **argv)
+{
+	if (argc != 3) {
+		printf("set <name> <value>\n");
+		return 1;
+	}
+	char *end;
+	long value = strtol(argv[2], &end, 0);
+	if (*end || end == argv[2]) {
+		printf("Not a number: %s\n", argv[2]);
+		return 1;
+	}
+
+	esp_err_t res = settings_set(argv[1], value);
+	if (res == ESP_ERR_NOT_FOUND) {
+		printf("No setting %s\n", argv[1]);
+	} else if (res == ESP_ERR_INVALID_ARG) {
+		const setting_t *s = settings_find(argv[1]);
+		printf("%s ranges from %" PRId32 " to %" PRId32 "\n", s->name, s->min, s->max);
+	} else if (res != ESP_OK) {
+		printf("Could not store %s: %s\n", argv[1], esp_err_to_name(res));
+	} else {
+		print_setting(settings_find(argv[1]));
+	}
+	return res != ESP_OK;
+}
+
+static int cmd_defaults(int argc, char **argv)
+{
+	esp_err_t res = settings_erase();
+	if (res != ESP_OK) {
+		printf("Could not erase: %s\n", esp_err_to_name(res));
+		return 1;
+	}
+	printf("Stored settings erased, the defaults apply after a reset\n");
+	return 0;
+}
+
+static void shell_run(const char *line)
+{
+	int ret;
+	printf("> %s\n", line);
+	esp_err_t res = esp_console_run(line, &ret);
+	if (res == ESP_ERR_NOT_FOUND) {
+		printf("Unknown command, try help\n");
+	} else if (res == ESP_OK && ret) {
+		printf("Failed (%d)\n", ret);
+	} else if (res != ESP_OK && res != ESP_ERR_INVALID_ARG) { // INVALID_ARG: only whitespace
+		printf("%s\n", esp_err_to_name(res));
+	}
+	fflush(stdout);
+}
+
+static void shell_task(void *pvParameters)
+{
+	// stdout is per task, only this one's goes into the stream
+	cookie_io_functions_t out_io = { .write = out_write };
+	stdout = fopencookie(NULL, "w", out_io);
+	setvbuf(stdout, out_buf, _IOLBF, sizeof(out_buf));
+
+	static char line[SHELL_LINE_MAX];
+	size_t len = 0;
+	bool overflow = false;
+
+	while (1) {
+		uint8_t in[32];
+		int n = usb_serial_jtag_read_bytes(in, sizeof(in), portMAX_DELAY);
+		for (int i = 0; i < n; i++) {
+			char c = in[i];
+			if (c != '\r' && c != '\n') {
+				if (len < sizeof(line) - 1) {
+					line[len++] = c;
+				} else {
+					overflow = true;
+				}
+				continue;
+			}
+
+			line[len] = 0;
+			if (overflow) {
+				printf("Line longer than %d characters\n", SHELL_LINE_MAX - 1);
+				fflush(stdout);
+			} else if (len) {
+				shell_run(line);
+			}
+			len = 0;
+			overflow = false;
+		}
+	}
+}
+
+esp_err_t shell_start(UBaseType_t priority, BaseType_t core)
+{
+	if (shell_task_handle) return ESP_ERR_INVALID_STATE;
+
+	esp_console_config_t cfg = ESP_CONSOLE_CONFIG_DEFAULT();
+	cfg.max_cmdline_length = SHELL_LINE_MAX;
+	cfg.max_cmdline_args = 8;
+	esp_err_t res = esp_console_init(&cfg);
+	if (res != ESP_OK) return res;
+
+	const esp_console_cmd_t cmds[] = {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		{ .command = "tasks", .help = "Run time per task and load per core over a window, stack high water marks in bytes",
+		  .hint = "[ms]", .func = cmd_tasks },
+#endif
+		{ .command = "heap", .help = "Heap usage", .func = cmd_heap },
+		{ .command = "get", .help = "Show the settings", .hint = "[name]", .func = cmd_get },
+		{ .command = "set", .help = "Change and store a setting", .hint = "<name> <value>", .func = cmd_set },
+		{ .command = "defaults", .help = "Forget the stored settings", .func = cmd_defaults },
+	};
+	esp_console_register_help_command();
+	for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) esp_console_cmd_register(&cmds[i]);
+
+	shell_task_handle = xTaskCreateStaticPinnedToCore(shell_task, "shell", SHELL_STACK, NULL, priority,
+													  shell_stack, &shell_task_buf, core);
+	if (!shell_task_handle) {
+		ESP_LOGE(TAG, "Could not create the shell task");
+		return ESP_ERR_INVALID_ARG;
+	}
+	return ESP_OK;
+}
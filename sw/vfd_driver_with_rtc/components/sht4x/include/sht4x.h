@@ -0,0 +1,35 @@
+#ifndef MAIN_SHT4X_H_
+#define MAIN_SHT4X_H_
+
+/*
+    Sensirion SHT4x (SHT45 on the board) humidity and temperature sensor.
+
+    A measurement is started with one command and fetched once it is done,
+    SHT4X_MEAS_MS later. Nothing blocks in between, so the caller can start
+    it ahead of time and fetch the result when it needs it.
+*/
+
+#include <stdint.h>
+#include "driver/i2c.h"
+
+#include "../../i2cdev/include/i2cdev.h"
+
+#define SHT4X_ADDR      0x44 //!< I2C address (SHT45-AD1B)
+
+#define SHT4X_CMD_MEASURE_HIGH  0xFD // High repeatability, no heater
+#define SHT4X_CMD_SERIAL        0x89
+#define SHT4X_MEAS_MS           9    // High repeatability measurement, 8.3 ms max
+
+/* Fill in the descriptor. The bus is installed once, by ds3231_init_desc(). */
+esp_err_t sht4x_init_desc(i2c_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
+
+/* Read the serial number, tells whether the sensor is fitted */
+esp_err_t sht4x_get_serial(i2c_dev_t *dev, uint32_t *serial);
+
+/* Start a measurement, fetch it SHT4X_MEAS_MS later */
+esp_err_t sht4x_start_measurement(i2c_dev_t *dev);
+
+/* Fetch a finished measurement: temperature in 0.01 deg C, relative humidity in 0.01 % */
+esp_err_t sht4x_get_results(i2c_dev_t *dev, int32_t *temp_centi, int32_t *rh_centi);
+
+#endif /* MAIN_SHT4X_H_ */
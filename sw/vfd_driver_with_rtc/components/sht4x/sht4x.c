@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "sht4x.h"
+
+#define CHECK_ARG(ARG) do { if (!ARG) return ESP_ERR_INVALID_ARG; } while (0)
+
+/* CRC-8, polynomial 0x31, init 0xFF, over every 16 bit word */
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+	uint8_t crc = 0xFF;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+	}
+	return crc;
+}
+
+/* Read two CRC protected words */
+static esp_err_t read_words(i2c_dev_t *dev, uint16_t *w0, uint16_t *w1)
+{
+	uint8_t data[6];
+	esp_err_t res = i2c_dev_read(dev, NULL, 0, data, sizeof(data));
+	if (res != ESP_OK) return res;
+	if (crc8(data, 2) != data[2] || crc8(data + 3, 2) != data[5]) return ESP_ERR_INVALID_CRC;
+
+	*w0 = data[0] << 8 | data[1];
+	*w1 = data[3] << 8 | data[4];
+	return ESP_OK;
+}
+
+esp_err_t sht4x_init_desc(i2c_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio)
+{
+	CHECK_ARG(dev);
+
+	dev->port = port;
+	dev->addr = SHT4X_ADDR;
+	dev->sda_io_num = sda_gpio;
+	dev->scl_io_num = scl_gpio;
+	dev->clk_speed = I2C_FREQ_HZ;
+	return ESP_OK;
+}
+
+esp_err_t sht4x_get_serial(i2c_dev_t *dev, uint32_t *serial)
+{
+	CHECK_ARG(dev);
+	CHECK_ARG(serial);
+
+	uint8_t cmd = SHT4X_CMD_SERIAL;
+	esp_err_t res = i2c_dev_write(dev, NULL, 0, &cmd, 1);
+	if (res != ESP_OK) return res;
+	vTaskDelay(pdMS_TO_TICKS(1) + 1);
+
+	uint16_t hi, lo;
+	res = read_words(dev, &hi, &lo);
+	if (res == ESP_OK) *serial = (uint32_t)hi << 16 | lo;
+	return res;
+}
+
+esp_err_t sht4x_start_measurement(i2c_dev_t *dev)
+{
+	CHECK_ARG(dev);
+
+	uint8_t cmd = SHT4X_CMD_MEASURE_HIGH;
+	return i2c_dev_write(dev, NULL, 0, &cmd, 1);
+}
+
+esp_err_t sht4x_get_results(i2c_dev_t *dev, int32_t *temp_centi, int32_t *rh_centi)
+{
+	CHECK_ARG(dev);
+
+	uint16_t t_raw, rh_raw;
+	esp_err_t res = read_words(dev, &t_raw, &rh_raw);
+	if (res != ESP_OK) return res;
+
+	// T = -45 + 175 * raw / 65535, RH = -6 + 125 * raw / 65535 (datasheet, section 4.6)
+	if (temp_centi) *temp_centi = -4500 + (int32_t)(17500LL * t_raw / 65535);
+	if (rh_centi) {
+		int32_t rh = -600 + (int32_t)(12500LL * rh_raw / 65535);
+		*rh_centi = rh < 0 ? 0 : rh > 10000 ? 10000 : rh;
+	}
+	return ESP_OK;
+}
@@ -0,0 +1,64 @@
+#ifndef MAIN_STOPWATCH_H_
+#define MAIN_STOPWATCH_H_
+
+/*
+    Stopwatch and countdown.
+
+    Pure bookkeeping on microsecond timestamps (esp_timer_get_time()), the
+    caller passes the time of every event, so a button press counts at the
+    moment of its edge and not when it is handled. Nothing runs between
+    events; the display refresh asks for the value when it needs it.
+
+    A split freezes the shown time while the watch keeps running and records
+    a lap. A second split releases the display again.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STOPWATCH_MAX_LAPS		16
+#define STOPWATCH_MAX_US		((int64_t)100 * 3600 * 1000000 - 1)	// 99:59:59
+
+typedef enum {
+	STOPWATCH_UP = 0,		// Stopwatch, counts from zero
+	STOPWATCH_DOWN,			// Countdown from the preset
+} stopwatch_dir_t;
+
+typedef struct {
+	stopwatch_dir_t dir;
+	bool running;
+	int64_t started_us;		// Start of the current run
+	int64_t elapsed_us;		// Over the finished runs
+	int64_t preset_us;		// Countdown length
+
+	bool split;				// Display frozen
+	int64_t split_value_us;	// Shown while frozen
+	int64_t lap_start_us;	// Elapsed time at the last lap
+	uint8_t laps;
+	int64_t lap_us[STOPWATCH_MAX_LAPS];	// Lap times, the last STOPWATCH_MAX_LAPS are kept
+} stopwatch_t;
+
+void stopwatch_init(stopwatch_t *sw, stopwatch_dir_t dir, int64_t preset_us);
+
+/* Start or stop at now_us */
+void stopwatch_start_stop(stopwatch_t *sw, int64_t now_us);
+
+/* While running: freeze the display and record a lap, or release a frozen display. Returns true if a lap was recorded. */
+bool stopwatch_split(stopwatch_t *sw, int64_t now_us);
+
+/* Back to zero (the preset for a countdown), stopped */
+void stopwatch_reset(stopwatch_t *sw);
+
+/* Run time so far */
+int64_t stopwatch_elapsed(const stopwatch_t *sw, int64_t now_us);
+
+/* What to show: the elapsed time counting up, the time left counting down, the split while frozen */
+int64_t stopwatch_value(const stopwatch_t *sw, int64_t now_us);
+
+/* A countdown that ran out stops itself, returns true once when it does */
+bool stopwatch_expire(stopwatch_t *sw, int64_t now_us);
+
+/* "MMSScc" below an hour, "HHMMSS" above. Fills 6 characters and the decimal points between the pairs. */
+void stopwatch_format(int64_t value_us, char *text, uint32_t *dp);
+
+#endif /* MAIN_STOPWATCH_H_ */
@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "stopwatch.h"
+
+void stopwatch_init(stopwatch_t *sw, stopwatch_dir_t dir, int64_t preset_us)
+{
+	memset(sw, 0, sizeof(*sw));
+	sw->dir = dir;
+	sw->preset_us = preset_us;
+}
+
+int64_t stopwatch_elapsed(const stopwatch_t *sw, int64_t now_us)
+{
+	int64_t elapsed = sw->elapsed_us;
+	if (sw->running) elapsed += now_us - sw->started_us;
+	return elapsed;
+}
+
+static int64_t shown_value(const stopwatch_t *sw, int64_t elapsed)
+{
+	if (sw->dir == STOPWATCH_UP) return elapsed < STOPWATCH_MAX_US ? elapsed : STOPWATCH_MAX_US;
+	return elapsed < sw->preset_us ? sw->preset_us - elapsed : 0;
+}
+
+int64_t stopwatch_value(const stopwatch_t *sw, int64_t now_us)
+{
+	if (sw->split) return sw->split_value_us;
+	return shown_value(sw, stopwatch_elapsed(sw, now_us));
+}
+
+void stopwatch_start_stop(stopwatch_t *sw, int64_t now_us)
+{
+	if (sw->running) {
+		sw->elapsed_us += now_us - sw->started_us;
+		sw->running = false;
+		sw->split = false; // Stopping shows the final time
+	} else {
+		if (sw->dir == STOPWATCH_DOWN && sw->elapsed_us >= sw->preset_us) return; // Nothing left to count
+		sw->started_us = now_us;
+		sw->running = true;
+	}
+}
+
+bool stopwatch_split(stopwatch_t *sw, int64_t now_us)
+{
+	if (!sw->running) return false;
+
+	if (sw->split) {
+		sw->split = false;
+		return false;
+	}
+
+	int64_t elapsed = stopwatch_elapsed(sw, now_us);
+	sw->split = true;
+	sw->split_value_us = shown_value(sw, elapsed);
+	sw->lap_us[sw->laps % STOPWATCH_MAX_LAPS] = elapsed - sw->lap_start_us;
+	sw->lap_start_us = elapsed;
+	sw->laps++;
+	return true;
+}
+
+void stopwatch_reset(stopwatch_t *sw)
+{
+	stopwatch_init(sw, sw->dir, sw->preset_us);
+}
+
+bool stopwatch_expire(stopwatch_t *sw, int64_t now_us)
+{
+	if (sw->dir != STOPWATCH_DOWN || !sw->running || stopwatch_elapsed(sw, now_us) < sw->preset_us) return false;
+
+	sw->running = false;
+	sw->split = false;
+	sw->elapsed_us = sw->preset_us;
+	return true;
+}
+
+/* Two digits, no division by the format machinery, this runs 100 times a second */
+static void put2(char *text, uint32_t value)
+{
+	text[0] = '0' + value / 10;
+	text[1] = '0' + value % 10;
+}
+
+void stopwatch_format(int64_t value_us, char *text, uint32_t *dp)
+{
+	uint32_t cs = value_us / 10000;
+	uint32_t s = cs / 100;
+
+	if (s < 3600) {
+		put2(text, s / 60);
+		put2(text + 2, s % 60);
+		put2(text + 4, cs % 100);
+	} else {
+		put2(text, s / 3600);
+		put2(text + 2, s / 60 % 60);
+		put2(text + 4, s % 60);
+	}
+	text[6] = '\0';
+	*dp = (1 << 1) | (1 << 3);
+}
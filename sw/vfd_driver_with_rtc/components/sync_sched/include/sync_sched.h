@@ -0,0 +1,77 @@
+#ifndef MAIN_SYNC_SCHED_H_
+#define MAIN_SYNC_SCHED_H_
+
+/*
+    Adaptive NTP sync scheduler.
+
+    Keeps the displayed error inside an error budget while using the radio as
+    little as possible. After every successful sync the measured RTC offset is
+    turned into a drift rate (ppm), and the next sync is placed where the
+    predicted error reaches the budget. Temperature moves away from the one the
+    drift was measured at widen the prediction. Failed syncs back off
+    exponentially, and a clock that keeps landing well inside the budget gets
+    its interval stretched and scheduled syncs skipped.
+
+    The scheduler is plain C with no ESP-IDF dependencies, so the same file can
+    be built on the host to replay recorded drift traces.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	uint32_t error_budget_ms;	// Largest displayed error we are willing to show
+	uint32_t min_interval_s;	// Never sync more often than this
+	uint32_t max_interval_s;	// Always sync at least this often
+	uint32_t retry_base_s;		// First retry delay after a failed sync
+	uint32_t retry_max_s;		// Cap for the exponential backoff
+	float temp_coeff_ppm;		// Extra drift assumed per degree away from the calibration temperature
+	uint8_t stable_count;		// In-budget syncs in a row before the interval is stretched
+} sync_sched_config_t;
+
+typedef enum {
+	SYNC_WAIT = 0,	// Not due yet
+	SYNC_DUE,		// Go and sync now
+	SYNC_SKIP,		// Was due, but the model says the clock is still well inside budget
+} sync_action_t;
+
+typedef struct {
+	sync_sched_config_t cfg;
+	int64_t last_sync_s;	// Time of the last successful sync, 0 = never synced
+	int64_t next_sync_s;	// Time of the next planned sync
+	float drift_ppm;		// Filtered RTC drift, positive = RTC runs fast
+	float jitter_ppm;		// Filtered deviation of single measurements from drift_ppm
+	float drift_temp_c;		// Temperature at which drift_ppm was last measured
+	bool drift_valid;
+	uint32_t retry_s;		// Current backoff, 0 while syncs succeed
+	uint8_t stable_streak;	// Consecutive syncs that landed within a quarter of the budget
+
+	// Statistics
+	uint32_t syncs;
+	uint32_t failures;
+	uint32_t skipped;
+	int32_t worst_error_ms;	// Largest |offset| seen at a sync
+} sync_sched_t;
+
+/* Initialize the scheduler, first sync is due immediately */
+void sync_sched_init(sync_sched_t *s, const sync_sched_config_t *cfg);
+
+/* Decide what to do at time now_s (seconds, any monotonic epoch) */
+sync_action_t sync_sched_check(sync_sched_t *s, int64_t now_s, float temp_c);
+
+/* Report a successful sync. offset_ms is RTC minus reference, measured before the RTC was corrected */
+void sync_sched_success(sync_sched_t *s, int64_t now_s, int32_t offset_ms, float temp_c);
+
+/* Report a failed sync attempt (no network, no NTP answer, ...) */
+void sync_sched_failure(sync_sched_t *s, int64_t now_s);
+
+/* Put off a due sync by delay_s without counting it as a failure, e.g. while another source keeps the time */
+void sync_sched_defer(sync_sched_t *s, int64_t now_s, uint32_t delay_s);
+
+/* Error the model expects the clock to have accumulated at now_s */
+int32_t sync_sched_predicted_error_ms(const sync_sched_t *s, int64_t now_s, float temp_c);
+
+/* Seconds until the next planned sync, 0 if due */
+uint32_t sync_sched_wait_s(const sync_sched_t *s, int64_t now_s);
+
+#endif /* MAIN_SYNC_SCHED_H_ */
@@ -0,0 +1,119 @@
+#include <math.h>
+#include <string.h>
+
+#include "sync_sched.h"
+
+#define UNKNOWN_DRIFT_PPM	5.0f	// DS3231M datasheet accuracy, used until we measured our own part
+#define RESIDUAL_PPM		0.1f	// Floor so a perfect measurement never asks for an infinite interval
+#define RESIDUAL_MS			5		// Error left right after a sync (RTC write alignment, I2C latency)
+#define MIN_DRIFT_WINDOW_S	60		// Shorter windows are dominated by the offset measurement error
+#define PLAN_FRACTION		0.5f	// Plan the next sync where half of the budget is used up...
+#define SKIP_FRACTION		0.75f	// ...but a proven stable clock may run into three quarters of it
+
+static float rate_ppm(const sync_sched_t *s, float temp_c)
+{
+	if (!s->drift_valid) return UNKNOWN_DRIFT_PPM;
+
+	float dt = fabsf(temp_c - s->drift_temp_c);
+	return fabsf(s->drift_ppm) + s->jitter_ppm + s->cfg.temp_coeff_ppm * dt + RESIDUAL_PPM;
+}
+
+static int64_t plan(const sync_sched_t *s, float temp_c, float fraction)
+{
+	float secs = (s->cfg.error_budget_ms * fraction - RESIDUAL_MS) * 1000.0f / rate_ppm(s, temp_c);
+
+	if (secs < s->cfg.min_interval_s) secs = s->cfg.min_interval_s;
+	if (secs > s->cfg.max_interval_s) secs = s->cfg.max_interval_s;
+
+	return s->last_sync_s + (int64_t)secs;
+}
+
+void sync_sched_init(sync_sched_t *s, const sync_sched_config_t *cfg)
+{
+	memset(s, 0, sizeof(*s));
+	s->cfg = *cfg;
+}
+
+sync_action_t sync_sched_check(sync_sched_t *s, int64_t now_s, float temp_c)
+{
+	if (now_s < s->next_sync_s) return SYNC_WAIT;
+
+	// A stable clock may use up more of the budget before we spend radio time on it
+	if (s->retry_s == 0 && s->drift_valid && s->stable_streak >= s->cfg.stable_count) {
+		int64_t relaxed = plan(s, temp_c, SKIP_FRACTION);
+		if (relaxed > now_s) {
+			s->next_sync_s = relaxed;
+			s->skipped++;
+			return SYNC_SKIP;
+		}
+	}
+
+	return SYNC_DUE;
+}
+
+void sync_sched_success(sync_sched_t *s, int64_t now_s, int32_t offset_ms, float temp_c)
+{
+	int64_t elapsed = now_s - s->last_sync_s;
+
+	// The very first sync only gives us a reference, the RTC could have held anything before it
+	if (s->last_sync_s != 0 && elapsed >= MIN_DRIFT_WINDOW_S) {
+		float meas = offset_ms * 1000.0f / (float)elapsed;
+
+		if (!s->drift_valid) {
+			s->drift_ppm = meas;
+			s->jitter_ppm = fabsf(meas) * 0.5f;
+			s->drift_temp_c = temp_c;
+			s->drift_valid = true;
+		} else {
+			float err = meas - s->drift_ppm;
+			s->drift_ppm += 0.5f * err;
+			s->jitter_ppm += 0.25f * (fabsf(err) - s->jitter_ppm);
+			s->drift_temp_c += 0.5f * (temp_c - s->drift_temp_c);
+		}
+
+		int32_t abs_ms = offset_ms < 0 ? -offset_ms : offset_ms;
+		if (abs_ms > s->worst_error_ms) s->worst_error_ms = abs_ms;
+
+		if ((uint32_t)abs_ms <= s->cfg.error_budget_ms / 4) {
+			if (s->stable_streak < UINT8_MAX) s->stable_streak++;
+		} else {
+			s->stable_streak = 0;
+		}
+	}
+
+	s->syncs++;
+	s->retry_s = 0;
+	s->last_sync_s = now_s;
+	s->next_sync_s = plan(s, temp_c, PLAN_FRACTION);
+}
+
+void sync_sched_failure(sync_sched_t *s, int64_t now_s)
+{
+	s->failures++;
+
+	if (s->retry_s == 0) s->retry_s = s->cfg.retry_base_s;
+	else if (s->retry_s < s->cfg.retry_max_s / 2) s->retry_s *= 2;
+	else s->retry_s = s->cfg.retry_max_s;
+
+	s->next_sync_s = now_s + s->retry_s;
+}
+
+void sync_sched_defer(sync_sched_t *s, int64_t now_s, uint32_t delay_s)
+{
+	if (s->next_sync_s < now_s + delay_s) s->next_sync_s = now_s + delay_s;
+}
+
+int32_t sync_sched_predicted_error_ms(const sync_sched_t *s, int64_t now_s, float temp_c)
+{
+	if (s->last_sync_s == 0) return INT32_MAX;
+
+	float ms = (now_s - s->last_sync_s) * rate_ppm(s, temp_c) / 1000.0f + RESIDUAL_MS;
+	return ms > INT32_MAX ? INT32_MAX : (int32_t)ms;
+}
+
+uint32_t sync_sched_wait_s(const sync_sched_t *s, int64_t now_s)
+{
+	if (now_s >= s->next_sync_s) return 0;
+	int64_t wait = s->next_sync_s - now_s;
+	return wait > UINT32_MAX ? UINT32_MAX : (uint32_t)wait;
+}
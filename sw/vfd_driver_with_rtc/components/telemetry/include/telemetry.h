@@ -0,0 +1,110 @@
+#ifndef MAIN_TELEMETRY_H_
+#define MAIN_TELEMETRY_H_
+
+/*
+    Sensor telemetry store.
+
+    One sample per interval (RTC temperature, SHT4x temperature and humidity,
+    light) goes into a RAM ring and is delta encoded into the open block right
+    away. A full block is appended to the "telemetry" data partition, which is
+    used as a ring of fixed size blocks: the write head erases a sector only
+    when it enters it, so every sector is erased once per lap and wears evenly.
+    A block that was torn by a power loss fails its CRC and is skipped.
+
+    Blocks carry a sequence number that never repeats, the block with sequence
+    n lives in slot n modulo the slot count. A time range is found by binary search
+    over the block headers and only the blocks in range are decoded.
+
+    Block layout, little endian:
+      telemetry_block_t		header, base values = first sample
+      payload				one record per sample:
+        uint8_t				bits 0-3: channel changed, a zigzag varint delta follows
+        					bits 4-7: channel missing, no value
+        varint[]			deltas of the changed channels, in channel order
+
+    Samples of a block are interval_s apart. A gap (reboot, sleep, clock set)
+    closes the open block early. The open block only lives in RAM until it
+    fills up or telemetry_flush() is called, a reset loses it.
+
+    Flash writes stall both cores, a sector erase every eight blocks holds up
+    the display refresh for a few tens of milliseconds, like an NVS commit.
+
+    All calls are safe from any task.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define TELEMETRY_PARTITION_SUBTYPE	0x41	// Second custom data subtype, assets use 0x40
+#define TELEMETRY_MAGIC				0x4D4C4554	// "TELM"
+#define TELEMETRY_BLOCK_SIZE		512
+#define TELEMETRY_RING_SAMPLES		256		// Recent samples in RAM, also the most a block holds
+
+typedef enum {
+	TELEMETRY_RTC_TEMP = 0,	// DS3231 die, centi-degrees C (0.25 degree steps)
+	TELEMETRY_TEMP,			// SHT4x, centi-degrees C
+	TELEMETRY_HUMIDITY,		// SHT4x, centi-percent RH
+	TELEMETRY_LUX,			// VEML3235, lux
+	TELEMETRY_CHANNELS
+} telemetry_channel_t;
+
+typedef struct {
+	uint32_t time;			// Local time, seconds since the epoch
+	uint8_t valid;			// Bit per channel, missing readings are left out
+	int32_t value[TELEMETRY_CHANNELS];
+} telemetry_sample_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t seq;			// Block sequence number, slot = seq % slots
+	uint32_t start;			// Time of the first sample
+	uint16_t interval_s;
+	uint16_t count;			// Samples
+	uint16_t payload_size;
+	uint8_t valid;			// Channels in base
+	uint8_t reserved;
+	int32_t base[TELEMETRY_CHANNELS];
+	uint32_t crc32;			// Over the header before this field and the payload
+} telemetry_block_t;
+
+#define TELEMETRY_PAYLOAD_SIZE	(TELEMETRY_BLOCK_SIZE - sizeof(telemetry_block_t))
+
+typedef struct {
+	uint32_t slots;			// Blocks the partition holds
+	uint32_t oldest;		// Sequence of the oldest block still in flash
+	uint32_t next;			// Sequence the next block gets, oldest == next: none yet
+	uint32_t samples;		// Samples added since boot
+	uint32_t dropped;		// Samples in the same interval as the previous one
+	uint32_t blocks;		// Blocks written since boot
+	uint32_t erases;		// Sectors erased since boot
+	uint32_t gaps;			// Blocks closed early by a gap
+	uint32_t errors;		// Flash errors
+	uint64_t payload_bytes;	// Payload written since boot, per sample cost = payload_bytes / samples
+} telemetry_stats_t;
+
+/* Return false to stop reading */
+typedef bool (*telemetry_read_cb_t)(const telemetry_sample_t *sample, void *arg);
+
+/* Find the partition and the newest block in it. Samples are taken every interval_s. */
+esp_err_t telemetry_init(uint32_t interval_s);
+
+/* Add a sample, its time is rounded to the interval. Writes a block when the open one is full. */
+esp_err_t telemetry_add(const telemetry_sample_t *sample);
+
+/* Write the open block, before a deep sleep or a restart */
+esp_err_t telemetry_flush(void);
+
+/* Sequence of the block holding time (the oldest one if time is older), ESP_ERR_NOT_FOUND if there are no blocks */
+esp_err_t telemetry_find(uint32_t time, uint32_t *seq);
+
+/* Decode one block by its sequence number. ESP_ERR_NOT_FOUND if it was overwritten, ESP_ERR_INVALID_CRC if it is torn. */
+esp_err_t telemetry_read_block(uint32_t seq, telemetry_read_cb_t cb, void *arg);
+
+/* Every sample from..to (inclusive), from flash and then from RAM. Returns the number of samples passed to cb. */
+uint32_t telemetry_read(uint32_t from, uint32_t to, telemetry_read_cb_t cb, void *arg);
+
+void telemetry_get_stats(telemetry_stats_t *stats);
+
+#endif /* MAIN_TELEMETRY_H_ */
@@ -0,0 +1,421 @@
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
+#include "esp_log.h"
+
+#include "telemetry.h"
+
+#define TAG "TELEMETRY"
+
+#define SECTOR_SIZE			4096
+#define BLOCKS_PER_SECTOR	(SECTOR_SIZE / TELEMETRY_BLOCK_SIZE)
+#define CHANNELS_ALL		((1 << TELEMETRY_CHANNELS) - 1)
+#define RECORD_MAX			(1 + TELEMETRY_CHANNELS * 5)	// Header byte and a 5 byte varint per channel
+#define CRC_OFFSET			offsetof(telemetry_block_t, crc32)
+
+_Static_assert(SECTOR_SIZE % TELEMETRY_BLOCK_SIZE == 0, "Blocks must not straddle sectors");
+_Static_assert(TELEMETRY_CHANNELS <= 4, "The record header has four channel bits");
+
+static const esp_partition_t *part = NULL;
+static const uint8_t *map;				// Whole partition, memory-mapped
+static esp_partition_mmap_handle_t map_handle;
+static uint32_t slots;
+static uint32_t oldest, next;			// Block sequence numbers, see telemetry_stats_t
+static uint32_t interval;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+static telemetry_stats_t stats;
+
+// Recent samples, ring_count counts every sample ever added
+static telemetry_sample_t ring[TELEMETRY_RING_SAMPLES];
+static uint32_t ring_count;
+
+// The open block, encoded as samples arrive
+static uint8_t open_buf[TELEMETRY_BLOCK_SIZE];
+static telemetry_block_t *const open_hdr = (telemetry_block_t *)open_buf;
+static int32_t open_prev[TELEMETRY_CHANNELS];	// Decoder state after the last record
+static uint32_t open_last;						// Time of the last record
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t varint_put(uint8_t *p, uint32_t v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static bool varint_get(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+		*v |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+/* Encode a sample against prev, which is moved on to it */
+static size_t encode(const telemetry_sample_t *s, int32_t prev[TELEMETRY_CHANNELS], uint8_t *rec)
+{
+	uint8_t changed = 0;
+	size_t n = 1;
+	for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+		if (!(s->valid & (1 << ch)) || s->value[ch] == prev[ch]) continue;
+		changed |= 1 << ch;
+		n += varint_put(rec + n, zigzag(s->value[ch] - prev[ch]));
+		prev[ch] = s->value[ch];
+	}
+	rec[0] = changed | (~s->valid & CHANNELS_ALL) << 4;
+	return n;
+}
+
+static const telemetry_block_t *slot_header(uint32_t seq)
+{
+	return (const telemetry_block_t *)(map + (size_t)(seq % slots) * TELEMETRY_BLOCK_SIZE);
+}
+
+static bool header_ok(const telemetry_block_t *hdr, uint32_t seq)
+{
+	return hdr->magic == TELEMETRY_MAGIC && hdr->seq == seq;
+}
+
+static bool slot_blank(size_t offset)
+{
+	const uint32_t *w = (const uint32_t *)(map + offset);
+	for (int i = 0; i < TELEMETRY_BLOCK_SIZE / 4; i++) {
+		if (w[i] != 0xffffffff) return false;
+	}
+	return true;
+}
+
+/* Seal the open block and append it. Called with the lock held. */
+static esp_err_t write_block(void)
+{
+	telemetry_block_t *hdr = open_hdr;
+	if (hdr->count == 0) return ESP_OK;
+
+	memset(open_buf + sizeof(*hdr) + hdr->payload_size, 0xff, TELEMETRY_PAYLOAD_SIZE - hdr->payload_size);
+	esp_err_t res = ESP_FAIL;
+
+	// At most one retry: a slot that is not blank moves the head to the next sector, which gets erased
+	for (int attempt = 0; attempt < 2; attempt++) {
+		uint32_t slot = next % slots;
+		size_t offset = (size_t)slot * TELEMETRY_BLOCK_SIZE;
+
+		if (slot % BLOCKS_PER_SECTOR == 0) {
+			res = esp_partition_erase_range(part, offset, SECTOR_SIZE);
+			if (res != ESP_OK) break;
+			stats.erases++;
+			// The sector held the oldest blocks of the previous lap
+			if (next + BLOCKS_PER_SECTOR > slots && (int32_t)(oldest - (next + BLOCKS_PER_SECTOR - slots)) < 0) {
+				oldest = next + BLOCKS_PER_SECTOR - slots;
+			}
+		} else if (!slot_blank(offset)) {
+			// Left over from a torn write or erase
+			ESP_LOGW(TAG, "Slot %" PRIu32 " is not blank, skipping to the next sector", slot);
+			next += BLOCKS_PER_SECTOR - slot % BLOCKS_PER_SECTOR;
+			continue;
+		}
+
+		hdr->seq = next;
+		uint32_t crc = esp_crc32_le(0, open_buf, CRC_OFFSET);
+		hdr->crc32 = esp_crc32_le(crc, open_buf + sizeof(*hdr), hdr->payload_size);
+		res = esp_partition_write(part, offset, open_buf, TELEMETRY_BLOCK_SIZE);
+		if (res != ESP_OK) break;
+
+		next++;
+		stats.blocks++;
+		stats.payload_bytes += hdr->payload_size;
+		break;
+	}
+
+	if (res != ESP_OK) {
+		stats.errors++;
+		ESP_LOGE(TAG, "Could not write block %" PRIu32 ": %d", next, res);
+	}
+	hdr->count = 0; // Dropped on an error as well, the samples stay readable from the ring for a while
+	return res;
+}
+
+static void open_block(const telemetry_sample_t *s)
+{
+	telemetry_block_t *hdr = open_hdr;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = TELEMETRY_MAGIC;
+	hdr->start = s->time;
+	hdr->interval_s = interval;
+	hdr->valid = s->valid;
+	for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+		open_prev[ch] = (s->valid & (1 << ch)) ? s->value[ch] : 0;
+		hdr->base[ch] = open_prev[ch];
+	}
+}
+
+esp_err_t telemetry_init(uint32_t interval_s)
+{
+	if (interval_s == 0 || interval_s > UINT16_MAX) return ESP_ERR_INVALID_ARG;
+	interval = interval_s;
+	if (!lock) lock = xSemaphoreCreateMutexStatic(&lock_buf);
+
+	part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TELEMETRY_PARTITION_SUBTYPE, "telemetry");
+	if (!part) {
+		ESP_LOGW(TAG, "No telemetry partition");
+		return ESP_ERR_NOT_FOUND;
+	}
+	slots = part->size / SECTOR_SIZE * BLOCKS_PER_SECTOR;
+	if (slots < 2 * BLOCKS_PER_SECTOR) {
+		part = NULL;
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	const void *ptr;
+	esp_err_t res = esp_partition_mmap(part, 0, (size_t)slots * TELEMETRY_BLOCK_SIZE, ESP_PARTITION_MMAP_DATA, &ptr, &map_handle);
+	if (res != ESP_OK) {
+		ESP_LOGE(TAG, "Could not map the telemetry partition: %d", res);
+		part = NULL;
+		return res;
+	}
+	map = ptr;
+
+	// The newest block is the highest sequence number sitting in its own slot
+	bool found = false;
+	uint32_t newest = 0;
+	for (uint32_t slot = 0; slot < slots; slot++) {
+		const telemetry_block_t *hdr = (const telemetry_block_t *)(map + (size_t)slot * TELEMETRY_BLOCK_SIZE);
+		if (hdr->magic != TELEMETRY_MAGIC || hdr->seq % slots != slot) continue;
+		if (!found || (int32_t)(hdr->seq - newest) > 0) newest = hdr->seq;
+		found = true;
+	}
+
+	oldest = next = 0;
+	if (found) {
+		next = newest + 1;
+		oldest = newest;
+		for (uint32_t n = 1; n < slots; n++) {
+			if (header_ok(slot_header(newest - n), newest - n)) oldest = newest - n;
+		}
+	}
+
+	ESP_LOGI(TAG, "%" PRIu32 " of %" PRIu32 " blocks in use, next %" PRIu32, next - oldest, slots, next);
+	return ESP_OK;
+}
+
+esp_err_t telemetry_add(const telemetry_sample_t *sample)
+{
+	if (!part) return ESP_ERR_INVALID_STATE;
+
+	telemetry_sample_t s = *sample;
+	s.time = (s.time + interval / 2) / interval * interval;
+	s.valid &= CHANNELS_ALL;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (ring_count && s.time == ring[(ring_count - 1) % TELEMETRY_RING_SAMPLES].time) {
+		stats.dropped++;
+		xSemaphoreGive(lock);
+		return ESP_OK;
+	}
+	ring[ring_count++ % TELEMETRY_RING_SAMPLES] = s;
+	stats.samples++;
+
+	esp_err_t res = ESP_OK;
+	telemetry_block_t *hdr = open_hdr;
+	if (hdr->count && s.time != open_last + interval) {
+		stats.gaps++;
+		res = write_block();
+	}
+
+	uint8_t rec[RECORD_MAX];
+	int32_t prev[TELEMETRY_CHANNELS];
+	memcpy(prev, open_prev, sizeof(prev));
+	size_t len = encode(&s, prev, rec);
+
+	if (hdr->count && (hdr->payload_size + len > TELEMETRY_PAYLOAD_SIZE || hdr->count >= TELEMETRY_RING_SAMPLES)) {
+		res = write_block();
+	}
+	if (hdr->count == 0) {
+		open_block(&s);
+		memcpy(prev, open_prev, sizeof(prev));
+		len = encode(&s, prev, rec);
+	}
+
+	memcpy(open_buf + sizeof(*hdr) + hdr->payload_size, rec, len);
+	memcpy(open_prev, prev, sizeof(prev));
+	hdr->payload_size += len;
+	hdr->count++;
+	open_last = s.time;
+	xSemaphoreGive(lock);
+
+	return res;
+}
+
+esp_err_t telemetry_flush(void)
+{
+	if (!part) return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	esp_err_t res = write_block();
+	xSemaphoreGive(lock);
+	return res;
+}
+
+esp_err_t telemetry_find(uint32_t time, uint32_t *seq)
+{
+	if (!part) return ESP_ERR_INVALID_STATE;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (oldest == next) {
+		xSemaphoreGive(lock);
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	// Last block starting at or before time. Torn blocks are stepped over.
+	int64_t lo = oldest, hi = (int64_t)next - 1;
+	uint32_t found = oldest;
+	while (lo <= hi) {
+		int64_t mid = lo + (hi - lo) / 2, m = mid;
+		while (m <= hi && !header_ok(slot_header(m), m)) m++;
+		if (m > hi) {
+			hi = mid - 1;
+		} else if (slot_header(m)->start <= time) {
+			found = m;
+			lo = m + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	xSemaphoreGive(lock);
+
+	*seq = found;
+	return ESP_OK;
+}
+
+/* Copy a block out of flash, it may be erased under the reader otherwise */
+static esp_err_t load_block(uint32_t seq, uint8_t *buf)
+{
+	xSemaphoreTake(lock, portMAX_DELAY);
+	bool present = (int32_t)(seq - oldest) >= 0 && (int32_t)(seq - next) < 0;
+	if (present) memcpy(buf, slot_header(seq), TELEMETRY_BLOCK_SIZE);
+	xSemaphoreGive(lock);
+	if (!present) return ESP_ERR_NOT_FOUND;
+
+	const telemetry_block_t *hdr = (const telemetry_block_t *)buf;
+	if (!header_ok(hdr, seq)) return ESP_ERR_NOT_FOUND;
+	if (hdr->payload_size > TELEMETRY_PAYLOAD_SIZE || hdr->interval_s == 0) return ESP_ERR_INVALID_CRC;
+	uint32_t crc = esp_crc32_le(0, buf, CRC_OFFSET);
+	if (esp_crc32_le(crc, buf + sizeof(*hdr), hdr->payload_size) != hdr->crc32) return ESP_ERR_INVALID_CRC;
+	return ESP_OK;
+}
+
+/* Pass the samples from..to of a loaded block to cb, false once cb stopped or to was passed */
+static bool decode(const uint8_t *buf, uint32_t from, uint32_t to, telemetry_read_cb_t cb, void *arg,
+				   uint32_t *passed, uint32_t *last)
+{
+	const telemetry_block_t *hdr = (const telemetry_block_t *)buf;
+	const uint8_t *p = buf + sizeof(*hdr);
+	const uint8_t *end = p + hdr->payload_size;
+
+	telemetry_sample_t s = { .time = hdr->start };
+	for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) s.value[ch] = hdr->base[ch];
+
+	for (int i = 0; i < hdr->count && p < end; i++, s.time += hdr->interval_s) {
+		uint8_t rec = *p++;
+		for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+			uint32_t delta;
+			if (!(rec & (1 << ch))) continue;
+			if (!varint_get(&p, end, &delta)) return true;
+			s.value[ch] += unzigzag(delta);
+		}
+		s.valid = ~rec >> 4 & CHANNELS_ALL;
+
+		if (s.time > to) return false;
+		*last = s.time;
+		if (s.time < from) continue;
+		(*passed)++;
+		if (!cb(&s, arg)) return false;
+	}
+	return true;
+}
+
+esp_err_t telemetry_read_block(uint32_t seq, telemetry_read_cb_t cb, void *arg)
+{
+	if (!part) return ESP_ERR_INVALID_STATE;
+
+	uint8_t buf[TELEMETRY_BLOCK_SIZE];
+	esp_err_t res = load_block(seq, buf);
+	if (res != ESP_OK) return res;
+
+	uint32_t passed, last;
+	decode(buf, 0, UINT32_MAX, cb, arg, &passed, &last);
+	return ESP_OK;
+}
+
+uint32_t telemetry_read(uint32_t from, uint32_t to, telemetry_read_cb_t cb, void *arg)
+{
+	if (!part || from > to) return 0;
+
+	uint32_t passed = 0, last = 0;
+	uint8_t buf[TELEMETRY_BLOCK_SIZE];
+	uint32_t seq;
+
+	if (telemetry_find(from, &seq) == ESP_OK) {
+		for (;; seq++) {
+			esp_err_t res = load_block(seq, buf);
+			if (res == ESP_ERR_NOT_FOUND && (int32_t)(seq - next) >= 0) break;
+			if (res != ESP_OK) continue;
+			if (!decode(buf, from, to, cb, arg, &passed, &last)) return passed;
+		}
+	}
+
+	// The open block, and whatever did not make it to flash, from the ring
+	uint32_t first = ring_count > TELEMETRY_RING_SAMPLES ? ring_count - TELEMETRY_RING_SAMPLES : 0;
+	for (uint32_t i = first;; i++) {
+		telemetry_sample_t s;
+		xSemaphoreTake(lock, portMAX_DELAY);
+		bool present = i < ring_count && ring_count - i <= TELEMETRY_RING_SAMPLES;
+		if (present) s = ring[i % TELEMETRY_RING_SAMPLES];
+		bool more = i < ring_count;
+		xSemaphoreGive(lock);
+
+		if (!more) break;
+		if (!present || s.time <= last || s.time < from) continue;
+		if (s.time > to) break;
+		last = s.time;
+		passed++;
+		if (!cb(&s, arg)) break;
+	}
+	return passed;
+}
+
+void telemetry_get_stats(telemetry_stats_t *out)
+{
+	if (!lock) {
+		memset(out, 0, sizeof(*out));
+		return;
+	}
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*out = stats;
+	out->slots = slots;
+	out->oldest = oldest;
+	out->next = next;
+	xSemaphoreGive(lock);
+}
@@ -0,0 +1,63 @@
+#ifndef MAIN_TIMEBASE_H_
+#define MAIN_TIMEBASE_H_
+
+/*
+    Disciplined microsecond timebase.
+
+    The free running esp_timer counter is turned into local wall-clock time by
+    a small PLL/FLL:
+      - every DS3231 second edge (SQW interrupt or a polled edge) gives a phase
+        error, the full error is slewed out and a fraction of it trims the
+        frequency estimate;
+      - NTP samples correct the phase and remember how far the RTC edges are
+        off, so the RTC keeps disciplining the timebase towards NTP time.
+
+    Phase corrections are slewed at a bounded rate, so timebase_now_us() never
+    goes backwards. Only errors beyond TIMEBASE_STEP_US are stepped, a step
+    and timebase_set() move it to the new time right away, backwards too.
+
+    All arithmetic is integer and guarded by a spinlock, the edge and sample
+    functions may be called from an ISR.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMEBASE_STEP_US	100000	// Larger phase errors are stepped instead of slewed
+#define TIMEBASE_SLEW_PPM	500		// Largest rate at which phase corrections are applied
+#define TIMEBASE_MAX_PPB	500000	// Frequency correction limit
+
+typedef struct {
+	int32_t freq_ppb;		// Current esp_timer frequency correction
+	int32_t last_error_us;	// Phase error at the last RTC edge or NTP sample
+	int64_t slew_us;		// Phase correction still to be slewed out
+	int32_t rtc_offset_us;	// How far RTC second edges are from NTP seconds
+	uint32_t edges;			// RTC edges processed
+	uint32_t steps;			// Phase steps taken
+	bool valid;				// Set once the timebase has been set
+} timebase_stats_t;
+
+/* Set the timebase: at esp_timer value timer_us the local time was epoch_us */
+void timebase_set(int64_t timer_us, int64_t epoch_us);
+
+/* An RTC second edge was observed at esp_timer value timer_us */
+void timebase_rtc_edge(int64_t timer_us);
+
+/* An NTP (or fleet leader) reference: at esp_timer value timer_us the local time was ref_us */
+void timebase_ntp(int64_t timer_us, int64_t ref_us);
+
+/* The RTC was rewritten on an NTP second boundary, its edges are exact again */
+void timebase_rtc_written(void);
+
+/* Local time in microseconds since the epoch, slewed and monotonic between steps */
+int64_t timebase_now_us(void);
+
+/* esp_timer value at which the timebase reaches epoch_us */
+int64_t timebase_timer_at(int64_t epoch_us);
+
+/* esp_timer value at which the next RTC second edge is expected */
+int64_t timebase_next_rtc_edge(void);
+
+void timebase_get_stats(timebase_stats_t *stats);
+
+#endif /* MAIN_TIMEBASE_H_ */
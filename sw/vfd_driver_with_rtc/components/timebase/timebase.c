@@ -0,0 +1,195 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "timebase.h"
+
+#define FLL_SHIFT 2 // Each edge moves the frequency by a quarter of the measured frequency error
+
+static portMUX_TYPE tb_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct {
+	int64_t anchor_timer;	// esp_timer value of the anchor point
+	int64_t anchor_epoch;	// Timebase value at the anchor point
+	int64_t slew_us;		// Phase correction not yet applied at the anchor point
+	int64_t last_now;		// Last value handed out, keeps timebase_now_us() monotonic between steps
+	int64_t last_edge_timer;
+	int32_t freq_ppb;
+	int32_t last_error_us;
+	int32_t rtc_offset_us;
+	uint32_t edges;
+	uint32_t steps;
+	bool valid;
+} tb;
+
+/* Part of the pending slew that has been applied dt microseconds after the anchor */
+static int64_t slew_part(int64_t dt)
+{
+	if (dt <= 0) return 0;
+
+	int64_t max = dt * TIMEBASE_SLEW_PPM / 1000000;
+	if (tb.slew_us >= 0) return tb.slew_us < max ? tb.slew_us : max;
+	return -tb.slew_us < max ? tb.slew_us : -max;
+}
+
+/* Timebase value (what timebase_now_us() shows) at esp_timer value timer_us */
+static int64_t shown_at(int64_t timer_us)
+{
+	int64_t dt = timer_us - tb.anchor_timer;
+	return tb.anchor_epoch + dt + dt * tb.freq_ppb / 1000000000 + slew_part(dt);
+}
+
+/* Where the timebase is heading once all pending slew has been applied */
+static int64_t target_at(int64_t timer_us)
+{
+	int64_t dt = timer_us - tb.anchor_timer;
+	return tb.anchor_epoch + tb.slew_us + dt + dt * tb.freq_ppb / 1000000000;
+}
+
+static void reanchor(int64_t timer_us)
+{
+	int64_t dt = timer_us - tb.anchor_timer;
+	if (dt <= 0) return;
+
+	int64_t applied = slew_part(dt);
+	tb.anchor_epoch = shown_at(timer_us);
+	tb.anchor_timer = timer_us;
+	tb.slew_us -= applied;
+}
+
+/* Apply a phase error, returns true if it had to be stepped */
+static bool correct(int64_t err)
+{
+	tb.last_error_us = (int32_t)err;
+
+	if (err > TIMEBASE_STEP_US || err < -TIMEBASE_STEP_US) {
+		tb.anchor_epoch += tb.slew_us + err;
+		tb.slew_us = 0;
+		tb.last_now = 0; // A step may go backwards, timebase_now_us() must follow it
+		tb.steps++;
+		return true;
+	}
+
+	tb.slew_us += err;
+	return false;
+}
+
+void timebase_set(int64_t timer_us, int64_t epoch_us)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	tb.anchor_timer = timer_us;
+	tb.anchor_epoch = epoch_us;
+	tb.slew_us = 0;
+	tb.last_now = 0;
+	tb.last_edge_timer = 0;
+	tb.valid = true;
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+}
+
+void timebase_rtc_edge(int64_t timer_us)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	if (tb.valid) {
+		// Edges mark whole RTC seconds, pick the one we are closest to
+		int64_t target = target_at(timer_us) - tb.rtc_offset_us;
+		int64_t sec = (target + 500000) / 1000000;
+		int64_t err = sec * 1000000 - target;
+
+		reanchor(timer_us);
+		bool stepped = correct(err);
+
+		// Pending slew is already in target_at(), so err is what the frequency error built up since the last edge
+		int64_t interval = timer_us - tb.last_edge_timer;
+		if (!stepped && tb.last_edge_timer != 0 && interval > 0) {
+			int64_t freq = tb.freq_ppb + ((err * 1000000000 / interval) >> FLL_SHIFT);
+			if (freq > TIMEBASE_MAX_PPB) freq = TIMEBASE_MAX_PPB;
+			if (freq < -TIMEBASE_MAX_PPB) freq = -TIMEBASE_MAX_PPB;
+			tb.freq_ppb = (int32_t)freq;
+		}
+
+		tb.last_edge_timer = timer_us;
+		tb.edges++;
+	}
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+}
+
+void timebase_ntp(int64_t timer_us, int64_t ref_us)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	if (!tb.valid) {
+		tb.anchor_timer = timer_us;
+		tb.anchor_epoch = ref_us;
+		tb.last_now = 0;
+		tb.valid = true;
+	} else {
+		int64_t err = ref_us - target_at(timer_us);
+		reanchor(timer_us);
+		correct(err);
+		// The RTC edges were disciplining us towards the wrong second by the same amount
+		tb.rtc_offset_us += (int32_t)err;
+	}
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+}
+
+void timebase_rtc_written(void)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	tb.rtc_offset_us = 0;
+	tb.last_edge_timer = 0; // The DS3231 countdown chain restarted, the next interval is not a full second
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+}
+
+int64_t timebase_now_us(void)
+{
+	int64_t timer_us = esp_timer_get_time();
+
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	int64_t now = shown_at(timer_us);
+	if (now < tb.last_now) now = tb.last_now;
+	else tb.last_now = now;
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+
+	return now;
+}
+
+int64_t timebase_timer_at(int64_t epoch_us)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	// shown_at() is piecewise linear with a slope close to 1, two Newton steps are plenty
+	int64_t dt = epoch_us - tb.anchor_epoch;
+	for (int i = 0; i < 2; i++) {
+		dt -= shown_at(tb.anchor_timer + dt) - epoch_us;
+	}
+	int64_t timer_us = tb.anchor_timer + dt;
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+
+	return timer_us;
+}
+
+int64_t timebase_next_rtc_edge(void)
+{
+	int64_t timer_us = esp_timer_get_time();
+
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	int64_t target = target_at(timer_us) - tb.rtc_offset_us;
+	int64_t edge = (target / 1000000 + 1) * 1000000 + tb.rtc_offset_us;
+	// target_at() is linear, invert it directly
+	int64_t x = edge - tb.anchor_epoch - tb.slew_us;
+	int64_t dt = x - x * tb.freq_ppb / (1000000000 + tb.freq_ppb);
+	int64_t edge_timer = tb.anchor_timer + dt;
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+
+	return edge_timer;
+}
+
+void timebase_get_stats(timebase_stats_t *stats)
+{
+	portENTER_CRITICAL_SAFE(&tb_lock);
+	stats->freq_ppb = tb.freq_ppb;
+	stats->last_error_us = tb.last_error_us;
+	stats->slew_us = tb.slew_us;
+	stats->rtc_offset_us = tb.rtc_offset_us;
+	stats->edges = tb.edges;
+	stats->steps = tb.steps;
+	stats->valid = tb.valid;
+	portEXIT_CRITICAL_SAFE(&tb_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef MAIN_VEML3235_H_
+#define MAIN_VEML3235_H_
+
+/*
+    Vishay VEML3235 ambient light sensor.
+
+    Integrates continuously while powered up, a read returns the last
+    finished integration. Set up for 100 ms integration at gain 1. Between
+    readings the sensor can be shut down, it then draws about 0.5 uA.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/i2c.h"
+
+#include "../../i2cdev/include/i2cdev.h"
+
+#define VEML3235_ADDR       0x10 //!< I2C address
+
+#define VEML3235_REG_CONF   0x00
+#define VEML3235_REG_WHITE  0x04
+#define VEML3235_REG_ALS    0x05
+#define VEML3235_REG_ID     0x09
+
+#define VEML3235_CONF_SD    0x0001 // Both shutdown bits have to be cleared to power up
+#define VEML3235_CONF_SD0   0x8000
+#define VEML3235_CONF_IT_100MS (1 << 4)
+#define VEML3235_DEVICE_ID  0x35
+
+#define VEML3235_IT_MS      100
+#define VEML3235_MILLILUX_PER_COUNT 134 // 100 ms, gain 1, digital gain 1
+
+/* Fill in the descriptor. The bus is installed once, by ds3231_init_desc(). */
+esp_err_t veml3235_init_desc(i2c_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio);
+
+/* Check the device ID and configure the sensor, shut down */
+esp_err_t veml3235_init(i2c_dev_t *dev);
+
+/* Power up (the first result is ready VEML3235_IT_MS later) or shut down */
+esp_err_t veml3235_power(i2c_dev_t *dev, bool on);
+
+/* Illuminance of the last integration, in lux */
+esp_err_t veml3235_get_lux(i2c_dev_t *dev, uint32_t *lux);
+
+#endif /* MAIN_VEML3235_H_ */
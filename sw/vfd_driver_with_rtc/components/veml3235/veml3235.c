@@ -0,0 +1,66 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "veml3235.h"
+
+#define CHECK_ARG(ARG) do { if (!ARG) return ESP_ERR_INVALID_ARG; } while (0)
+
+/* Registers are 16 bit, low byte first */
+static esp_err_t read_reg16(i2c_dev_t *dev, uint8_t reg, uint16_t *value)
+{
+	uint8_t data[2];
+	esp_err_t res = i2c_dev_read_reg(dev, reg, data, sizeof(data));
+	if (res == ESP_OK) *value = data[1] << 8 | data[0];
+	return res;
+}
+
+static esp_err_t write_reg16(i2c_dev_t *dev, uint8_t reg, uint16_t value)
+{
+	uint8_t data[2] = { value & 0xff, value >> 8 };
+	return i2c_dev_write_reg(dev, reg, data, sizeof(data));
+}
+
+esp_err_t veml3235_init_desc(i2c_dev_t *dev, i2c_port_t port, gpio_num_t sda_gpio, gpio_num_t scl_gpio)
+{
+	CHECK_ARG(dev);
+
+	dev->port = port;
+	dev->addr = VEML3235_ADDR;
+	dev->sda_io_num = sda_gpio;
+	dev->scl_io_num = scl_gpio;
+	dev->clk_speed = I2C_FREQ_HZ;
+	return ESP_OK;
+}
+
+esp_err_t veml3235_init(i2c_dev_t *dev)
+{
+	CHECK_ARG(dev);
+
+	uint16_t id;
+	esp_err_t res = read_reg16(dev, VEML3235_REG_ID, &id);
+	if (res != ESP_OK) return res;
+	if ((id & 0xff) != VEML3235_DEVICE_ID) return ESP_ERR_NOT_FOUND;
+
+	// Gain and digital gain 1
+	return veml3235_power(dev, false);
+}
+
+esp_err_t veml3235_power(i2c_dev_t *dev, bool on)
+{
+	CHECK_ARG(dev);
+
+	uint16_t conf = VEML3235_CONF_IT_100MS;
+	if (!on) conf |= VEML3235_CONF_SD | VEML3235_CONF_SD0;
+	return write_reg16(dev, VEML3235_REG_CONF, conf);
+}
+
+esp_err_t veml3235_get_lux(i2c_dev_t *dev, uint32_t *lux)
+{
+	CHECK_ARG(dev);
+	CHECK_ARG(lux);
+
+	uint16_t counts;
+	esp_err_t res = read_reg16(dev, VEML3235_REG_ALS, &counts);
+	if (res == ESP_OK) *lux = (uint32_t)counts * VEML3235_MILLILUX_PER_COUNT / 1000;
+	return res;
+}
@@ -32,67 +32,16 @@
 #include "esp_timer.h"
 
 
-// Pin Mapping
-#define SER_LEFT    GPIO_NUM_47
-#define SER_MID     GPIO_NUM_38
-#define SER_RIGHT   GPIO_NUM_21
+#include "vfd_topology.h"
 
-#define SRCLR       GPIO_NUM_35
-#define SRCLK       GPIO_NUM_36
-#define RCLK        GPIO_NUM_37
+/* Pre-encoded display content, one ABCDEFGH segment byte per tube (tube 0 = leftmost) */
+typedef struct {
+    uint8_t seg[VFD_TUBES];
+} vfd_frame_t;
 
-#define DRIVER1     GPIO_NUM_11 //Left Digit pin for muxing
-#define DRIVER2     GPIO_NUM_12 //Right Digit pin for muxing
-
-extern bool mux_select;
+extern uint8_t mux_select;
 extern uint32_t mux_cnt;
 
-static const uint8_t number_map[10] = {
-
-        //ABCDEFGH
-        0b11101110, // 0
-        0b00100100, // 1
-        0b10111010, // 2
-        0b10110110, // 3
-        0b01110100, // 4
-        0b11010110, // 5
-        0b11011110, // 6
-        0b10100100, // 7
-        0b11111110, // 8
-        0b11110110  // 9
-    };
-
-static const uint8_t character_map[26] = {
-
-        //ABCDEFGH
-        0b11111100,  // A
-        0b01011110,  // b
-        0b11001010,  // C
-        0b00111110,  // d
-        0b11011010,  // E
-        0b11011000,  // F
-        0b11001110,  // G
-        0b01111100,  // H
-        0b01001000,  // I
-        0b00101110,  // J
-        0b11011100,  // K
-        0b01001010,  // L
-        0b10001100,  // M
-        0b11101100,  // N
-        0b00011110,  // o
-        0b11111000,  // P
-        0b11110100,  // Q
-        0b00011000,  // r
-        0b11010110,  // S same as 5
-        0b01011010,  // t
-        0b00001110,  // u
-        0b01101110,  // V
-        0b01100010,  // W
-        0b01111100,  // X same as H
-        0b01110110,  // Y
-        0b10111010,  // Z same as 2
-    };
-
 // Functions
 /* Display info about the driver */
 void vfd_info(void); 
@@ -103,18 +52,43 @@ void vfd_init(void);
 /* Update shift register */
 void vfd_update(uint8_t value);
 
-/* Display a number */
+/* Display a number on the middle chain */
 void vfd_value(uint8_t value, bool digit_select);
 
-/* Update shift register */
+/* Update shift register, byte n of value goes to chain n */
 void vfd_update_str(uint32_t value);
 
 /* Display a string */
-void vfd_value_str(const char *input_str, bool digit_select);
+void vfd_value_str(const char *input_str, uint8_t grid);
+
+/* Segments of a character in the current font, 0 for characters it has no glyph for */
+uint8_t vfd_glyph(char character);
+
+/* Use another font: 10 digit and 26 letter glyphs (ABCDEFGH), e.g. mapped from the asset partition.
+ * NULL goes back to the built-in font. The tables must stay valid while they are in use. */
+void vfd_set_font(const uint8_t *digits, const uint8_t *letters);
+
+/* Encode a string (and the decimal points set by vfd_set_dp) into a frame */
+void vfd_encode_str(vfd_frame_t *frame, const char *input_str);
+
+/* Shift out one mux phase (grid) of a pre-encoded frame */
+void vfd_show_frame(const vfd_frame_t *frame, uint8_t grid);
 
 /* Clears the shift register storage*/
 void vfd_clear(void);
 
+/* Clear the outputs until the next phase is shifted out */
+void vfd_blank_outputs(void);
+
+/* Hold the outputs blanked through SRCLR and switch both grids off (true), or release them (false) */
+void vfd_hold_blank(bool blank);
+
+/* Blank the outputs and hold the pins through deep sleep, vfd_init() releases them */
+void vfd_sleep_hold(void);
+
+/* Light the decimal points of the tubes set in mask (bit 0 = leftmost tube) */
+void vfd_set_dp(uint32_t mask);
+
 
 
 
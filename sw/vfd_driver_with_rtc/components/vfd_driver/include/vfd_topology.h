@@ -0,0 +1,65 @@
+#ifndef vfd_topology
+#define vfd_topology
+
+/*
+    Display topology, fixed at compile time.
+
+    The tubes are driven by VFD_CHAINS SN74HC595 chains that share SRCLK, RCLK
+    and SRCLR, each with its own SER pin. Every chain is VFD_CHAIN_TUBES
+    registers long (8 bits per tube), and VFD_GRIDS grid drivers multiplex
+    the chains over that many phases. Tube numbering, left to right:
+
+        tube = (chain * VFD_CHAIN_TUBES + slot) * VFD_GRIDS + grid
+
+    Frames hold logical ABCDEFGH bytes (MSB = A). VFD_SEG_BIT_x gives the
+    register output each segment is wired to; anything but the identity order
+    is translated through a table generated here, one lookup per tube and
+    phase. Everything is a constant, so the refresh path compiles down to
+    the same code a hand-written driver for the board would have.
+
+    Another board provides its own description by defining
+    VFD_TOPOLOGY_HEADER, e.g. -DVFD_TOPOLOGY_HEADER=\"vfd_topology_8tube.h\".
+*/
+
+#ifdef VFD_TOPOLOGY_HEADER
+#include VFD_TOPOLOGY_HEADER
+#else
+
+// VFDClock main board: six IV-22, three chains of one register, two grids
+#define VFD_CHAINS          3
+#define VFD_CHAIN_TUBES     1
+#define VFD_GRIDS           2
+#define VFD_CHAIN_PINS      { GPIO_NUM_47, GPIO_NUM_38, GPIO_NUM_21 } // SER_LEFT, SER_MID, SER_RIGHT
+#define VFD_GRID_PINS       { GPIO_NUM_11, GPIO_NUM_12 } // DRIVER1 (left tubes), DRIVER2 (right tubes)
+
+#define SRCLR       GPIO_NUM_35
+#define SRCLK       GPIO_NUM_36
+#define RCLK        GPIO_NUM_37
+
+#endif
+
+// Segment wiring, register bit 0 is shifted in first and ends up on QH, bit 7 on QA
+#ifndef VFD_SEG_BIT_A
+#define VFD_SEG_BIT_A   7
+#define VFD_SEG_BIT_B   6
+#define VFD_SEG_BIT_C   5
+#define VFD_SEG_BIT_D   4
+#define VFD_SEG_BIT_E   3
+#define VFD_SEG_BIT_F   2
+#define VFD_SEG_BIT_G   1
+#define VFD_SEG_BIT_H   0
+#endif
+
+#define VFD_TUBES       (VFD_CHAINS * VFD_CHAIN_TUBES * VFD_GRIDS)
+#define VFD_TUBE(chain, slot, grid) (((chain) * VFD_CHAIN_TUBES + (slot)) * VFD_GRIDS + (grid))
+
+#define VFD_SEG_IDENTITY (VFD_SEG_BIT_A == 7 && VFD_SEG_BIT_B == 6 && VFD_SEG_BIT_C == 5 && VFD_SEG_BIT_D == 4 && \
+                          VFD_SEG_BIT_E == 3 && VFD_SEG_BIT_F == 2 && VFD_SEG_BIT_G == 1 && VFD_SEG_BIT_H == 0)
+
+// Logical ABCDEFGH byte to register bits
+#define VFD_SEG_MAP(s) ((((s) >> 7 & 1) << VFD_SEG_BIT_A) | (((s) >> 6 & 1) << VFD_SEG_BIT_B) | \
+                        (((s) >> 5 & 1) << VFD_SEG_BIT_C) | (((s) >> 4 & 1) << VFD_SEG_BIT_D) | \
+                        (((s) >> 3 & 1) << VFD_SEG_BIT_E) | (((s) >> 2 & 1) << VFD_SEG_BIT_F) | \
+                        (((s) >> 1 & 1) << VFD_SEG_BIT_G) | (((s) >> 0 & 1) << VFD_SEG_BIT_H))
+
+#endif
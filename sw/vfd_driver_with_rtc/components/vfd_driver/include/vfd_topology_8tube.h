@@ -0,0 +1,23 @@
+#ifndef vfd_topology_8tube
+#define vfd_topology_8tube
+
+/*
+    Eight IV-22 on four grids: the main board's left and middle chains, one
+    register each, with two more grid drivers. Tubes 0..3 are on the left
+    chain and 4..7 on the middle one, grid 0 lights tubes 0 and 4.
+
+      idf.py build -DVFD_TOPOLOGY_HEADER=\"vfd_topology_8tube.h\"
+      python tools/pack_assets.py --tubes 8 ...
+*/
+
+#define VFD_CHAINS          2
+#define VFD_CHAIN_TUBES     1
+#define VFD_GRIDS           4
+#define VFD_CHAIN_PINS      { GPIO_NUM_47, GPIO_NUM_38 } // SER_LEFT, SER_MID
+#define VFD_GRID_PINS       { GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14 }
+
+#define SRCLR       GPIO_NUM_35
+#define SRCLK       GPIO_NUM_36
+#define RCLK        GPIO_NUM_37
+
+#endif
@@ -21,6 +21,75 @@
 
 #include "vfd_driver.h"
 
+// Built-in font, used until an asset font is set
+static const uint8_t number_map[10] = {
+
+        //ABCDEFGH
+        0b11101110, // 0
+        0b00100100, // 1
+        0b10111010, // 2
+        0b10110110, // 3
+        0b01110100, // 4
+        0b11010110, // 5
+        0b11011110, // 6
+        0b10100100, // 7
+        0b11111110, // 8
+        0b11110110  // 9
+    };
+
+static const uint8_t character_map[26] = {
+
+        //ABCDEFGH
+        0b11111100,  // A
+        0b01011110,  // b
+        0b11001010,  // C
+        0b00111110,  // d
+        0b11011010,  // E
+        0b11011000,  // F
+        0b11001110,  // G
+        0b01111100,  // H
+        0b01001000,  // I
+        0b00101110,  // J
+        0b11011100,  // K
+        0b01001010,  // L
+        0b10001100,  // M
+        0b11101100,  // N
+        0b00011110,  // o
+        0b11111000,  // P
+        0b11110100,  // Q
+        0b00011000,  // r
+        0b11010110,  // S same as 5
+        0b01011010,  // t
+        0b00001110,  // u
+        0b01101110,  // V
+        0b01100010,  // W
+        0b01111100,  // X same as H
+        0b01110110,  // Y
+        0b10111010,  // Z same as 2
+    };
+
+static const uint8_t *font_digits = number_map;
+static const uint8_t *font_letters = character_map;
+static uint32_t dp_mask = 0; // Decimal points to light, bit 0 = leftmost tube
+
+static const gpio_num_t chain_pins[VFD_CHAINS] = VFD_CHAIN_PINS;
+static const gpio_num_t grid_pins[VFD_GRIDS] = VFD_GRID_PINS;
+
+_Static_assert(sizeof((gpio_num_t[])VFD_CHAIN_PINS) / sizeof(gpio_num_t) == VFD_CHAINS, "VFD_CHAIN_PINS must list VFD_CHAINS pins");
+_Static_assert(sizeof((gpio_num_t[])VFD_GRID_PINS) / sizeof(gpio_num_t) == VFD_GRIDS, "VFD_GRID_PINS must list VFD_GRIDS pins");
+_Static_assert(VFD_TUBES <= 32, "dp_mask holds one bit per tube");
+
+#if VFD_SEG_IDENTITY
+#define PHYS(s) (s)
+#else
+// Logical segments to register bits for every byte value, built by the preprocessor
+#define SEG_ROW4(n) VFD_SEG_MAP(n), VFD_SEG_MAP(n + 1), VFD_SEG_MAP(n + 2), VFD_SEG_MAP(n + 3)
+#define SEG_ROW16(n) SEG_ROW4(n), SEG_ROW4(n + 4), SEG_ROW4(n + 8), SEG_ROW4(n + 12)
+#define SEG_ROW64(n) SEG_ROW16(n), SEG_ROW16(n + 16), SEG_ROW16(n + 32), SEG_ROW16(n + 48)
+static const uint8_t seg_phys[256] = { SEG_ROW64(0), SEG_ROW64(64), SEG_ROW64(128), SEG_ROW64(192) };
+#define PHYS(s) seg_phys[(s)]
+#endif
+
 void vfd_info(void)
 {
     ESP_LOGI("vfd_info", "IV-22 tube driver based on the SN74HC595 8-bit Shift Register");
@@ -31,13 +100,78 @@ void vfd_clear(void){
     gpio_set_level(SRCLR, 1);
 }
 
+void vfd_blank_outputs(void){
+    vfd_clear();
+    gpio_set_level(RCLK, 1); // Latch the cleared storage to the outputs
+    gpio_set_level(RCLK, 0);
+}
+
+static void grid_select(int8_t grid){
+    // -1 switches all grids off
+    for(uint8_t g = 0; g < VFD_GRIDS; g++){
+        gpio_set_level(grid_pins[g], g == grid);
+    }
+}
+
+void vfd_hold_blank(bool blank){
+    if(blank){
+        gpio_set_level(SRCLR, 0);   // Storage stays cleared while SRCLR is low
+        gpio_set_level(RCLK, 1);
+        gpio_set_level(RCLK, 0);
+        grid_select(-1);            // All grids off
+    }
+    else{
+        gpio_set_level(SRCLR, 1);
+    }
+}
+
+void vfd_sleep_hold(void){
+    vfd_hold_blank(true);
+
+    // SRCLR low keeps the storage cleared, the grids stay off
+    gpio_hold_en(SRCLR);
+    for(uint8_t g = 0; g < VFD_GRIDS; g++){
+        gpio_hold_en(grid_pins[g]);
+    }
+    gpio_deep_sleep_hold_en();
+}
+
+uint8_t vfd_glyph(char character){
+    if (character >= '0' && character <= '9'){
+        return font_digits[character - '0'];
+    }
+    else if (character >= 'a' && character <= 'z'){
+        return font_letters[character - 'a'];
+    }
+    else if (character >= 'A' && character <= 'Z'){
+        return font_letters[character - 'A'];
+    }
+    else if (character == '-'){
+        return 0b00010000;  // D segment
+    }
+    return 0;
+}
+
+void vfd_set_font(const uint8_t *digits, const uint8_t *letters){
+    font_digits = digits ? digits : number_map;
+    font_letters = letters ? letters : character_map;
+}
+
+void vfd_set_dp(uint32_t mask){
+    dp_mask = mask;
+}
+
 void vfd_init(void){
     // GPIO config
     gpio_config_t GPIO_CONF_VFD;
     // Bit mask
-    GPIO_CONF_VFD.pin_bit_mask = (1ULL << SER_LEFT) | (1ULL << SER_MID) | (1ULL << SER_RIGHT) |
-                                 (1ULL << SRCLR) | (1ULL << SRCLK) | (1ULL << RCLK) |
-                                 (1ULL << DRIVER1) | (1ULL << DRIVER2);
+    GPIO_CONF_VFD.pin_bit_mask = (1ULL << SRCLR) | (1ULL << SRCLK) | (1ULL << RCLK);
+    for(uint8_t c = 0; c < VFD_CHAINS; c++){
+        GPIO_CONF_VFD.pin_bit_mask |= 1ULL << chain_pins[c];
+    }
+    for(uint8_t g = 0; g < VFD_GRIDS; g++){
+        GPIO_CONF_VFD.pin_bit_mask |= 1ULL << grid_pins[g];
+    }
     // Pin mode
     GPIO_CONF_VFD.mode = GPIO_MODE_OUTPUT;
     // No pull-up/pull-down resistors.
@@ -45,8 +179,22 @@ void vfd_init(void){
     GPIO_CONF_VFD.pull_down_en = GPIO_PULLDOWN_DISABLE;
     // No interrupt enabled.
     GPIO_CONF_VFD.intr_type = GPIO_INTR_DISABLE;
+    // Release the pins held through deep sleep, see vfd_sleep_hold()
+    for(uint8_t pin = 0; pin < GPIO_NUM_MAX; pin++){
+        if(GPIO_CONF_VFD.pin_bit_mask & (1ULL << pin)){
+            gpio_hold_dis(pin);
+        }
+    }
     // Configure the GPIO with the settings.
     gpio_config(&GPIO_CONF_VFD);
+#if CONFIG_PM_ENABLE
+    // Keep driving the latched phase through automatic light sleep
+    for(uint8_t pin = 0; pin < GPIO_NUM_MAX; pin++){
+        if(GPIO_CONF_VFD.pin_bit_mask & (1ULL << pin)){
+            gpio_sleep_sel_dis(pin);
+        }
+    }
+#endif
 
     vfd_info();
     vfd_clear();
@@ -57,93 +205,103 @@ void vfd_init(void){
 
 
 
-void vfd_update(uint8_t value){
+/* Shift one register (8 bits) into every chain at once, LSB first. Does not latch. */
+static void shift_slot(const uint8_t *bytes){
+    for(uint8_t i = 0; i < 8; i++){
+        for(uint8_t c = 0; c < VFD_CHAINS; c++){
+            gpio_set_level(chain_pins[c], (bytes[c] >> i) & 1);
+        }
 
-    for(uint8_t i = 0; i < sizeof(value) * 8; i++){
+        gpio_set_level(SRCLK, 1); // Tick the shift register storage
+        gpio_set_level(SRCLK, 0);
+    }
+}
 
-        gpio_set_level(SER_MID, value & 1); // Write LSB of value to SER
+static void latch(void){
+    gpio_set_level(RCLK, 1); // Send SR storage to output
+    gpio_set_level(RCLK, 0);
+}
 
-		value >>= 1;
 
-		gpio_set_level(SRCLK, 1); // Tick the shift register storage
-		gpio_set_level(SRCLK, 0);
-    }
 
-    gpio_set_level(RCLK, 1); // Send SR storage to output
-	gpio_set_level(RCLK, 0);
+void vfd_update(uint8_t value){
+    uint8_t bytes[VFD_CHAINS] = {0};
+
+    bytes[VFD_CHAINS / 2] = PHYS(value);
+    shift_slot(bytes);
+    latch();
 }
 
 
 
 void vfd_value(uint8_t value, bool digit_select){
     
-    // Digit mux - DRIVER1 = tens, DRIVER2 = ones
+    // Digit mux - first grid = tens, last grid = ones
     if(digit_select == 0){
-        gpio_set_level(DRIVER1, 0);
-        gpio_set_level(DRIVER2, 1);
+        grid_select(VFD_GRIDS - 1);
 
-        vfd_update(number_map[value % 10]); // Extract ones
+        vfd_update(font_digits[value % 10]); // Extract ones
     }
     else{
-        gpio_set_level(DRIVER1, 1);
-        gpio_set_level(DRIVER2, 0);
+        grid_select(0);
 
-        vfd_update(number_map[value / 10]); // Extract tens
+        vfd_update(font_digits[value / 10]); // Extract tens
     }
     
 }
 
 
 void vfd_update_str(uint32_t value_buf){
+    uint8_t bytes[VFD_CHAINS];
 
-    for(uint8_t i = 0; i < (sizeof(uint8_t) * 8); i++){
-        
-        gpio_set_level(SER_LEFT, value_buf & 1); // Write LSB of value to SER        
-        gpio_set_level(SER_MID, value_buf & (1 << 8));
-        gpio_set_level(SER_RIGHT, value_buf & (1 << 16));
+    for(uint8_t c = 0; c < VFD_CHAINS; c++){
+        bytes[c] = c < 4 ? PHYS((value_buf >> (8 * c)) & 0xff) : 0;
+    }
+    shift_slot(bytes);
+    latch();
+}
 
-        value_buf >>= 1;
 
-        gpio_set_level(SRCLK, 1); // Tick the shift register storage
-		gpio_set_level(SRCLK, 0);
-    }
 
-    gpio_set_level(RCLK, 1); // Send SR storage to output
-	gpio_set_level(RCLK, 0);
-}
+void vfd_encode_str(vfd_frame_t *frame, const char *input_str){
 
+    bool end = false;
 
+    for(uint8_t n = 0; n < VFD_TUBES; n++){
+        end = end || input_str[n] == '\0';   // Tubes past a short string stay blank
+        uint8_t segments = end ? 0 : vfd_glyph(input_str[n]);
 
-void vfd_value_str(const char *input_str, bool position){
-    
-    uint32_t value_buf = 0; // Buffer variable for outputting triplets at once
-
-    for(uint8_t i = 0; i < 3; i++){
-        char character = input_str[2*i + position];
-        
-        if (character >= '0' && character <= '9'){
-            // vfd_update_str(number_map[character - '0'], i);
-            value_buf |= number_map[character - '0'] << (8*i);    // Shift 8*i times depending on if the character is 1st, 2nd or 3rd
-        }
-        else if (character >= 'a' && character <= 'z'){
-            // vfd_update_str(character_map[character - 'a'], i);
-            value_buf |= character_map[character - 'a'] << (8*i);
-        }
-        else if (character >= 'A' && character <= 'Z'){
-            // vfd_update_str(character_map[character - 'A'], i);
-            value_buf |= character_map[character - 'A'] << (8*i);
+        if (dp_mask & (1UL << n)){
+            segments |= 1;  // H segment is the decimal point
         }
 
-        // Digit mux - DRIVER1 = tens, DRIVER2 = ones
-        if(position == 0){  // 0 = left position, 1 = right position
-            gpio_set_level(DRIVER1, 1);
-            gpio_set_level(DRIVER2, 0);
-        }
-        else{
-            gpio_set_level(DRIVER1, 0);
-            gpio_set_level(DRIVER2, 1);
+        frame->seg[n] = segments;
+    }
+}
+
+
+
+void vfd_show_frame(const vfd_frame_t *frame, uint8_t grid){
+
+    grid_select(grid);
+
+    // The first register shifted in ends up at the far end of the chain, so start with the last slot
+    for(int8_t slot = VFD_CHAIN_TUBES - 1; slot >= 0; slot--){
+        uint8_t bytes[VFD_CHAINS];
+
+        for(uint8_t c = 0; c < VFD_CHAINS; c++){
+            bytes[c] = PHYS(frame->seg[VFD_TUBE(c, slot, grid)]);
         }
-    }  
+        shift_slot(bytes);
+    }
+    latch();
+}
+
+
+
+void vfd_value_str(const char *input_str, uint8_t grid){
+    vfd_frame_t frame;
 
-    vfd_update_str(value_buf);
+    vfd_encode_str(&frame, input_str);
+    vfd_show_frame(&frame, grid);
 }
@@ -1,15 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_attr.h"
 #include "esp_sleep.h"
+#include "driver/rtc_io.h"
 #include "nvs_flash.h"
 #include "protocol_examples_common.h"
 #include "esp_sntp.h"
@@ -19,9 +24,38 @@
 #include "sdkconfig.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #include "ds3231.h"
 #include "vfd_driver.h"
+#include "sync_sched.h"
+#include "timebase.h"
+#include "scheduler.h"
+#include "power.h"
+#include "nightmode.h"
+#include "odometer.h"
+#include "antipoison.h"
+#include "animate.h"
+#include "assets.h"
+#include "compositor.h"
+#include "infopages.h"
+#include "sht4x.h"
+#include "veml3235.h"
+#include "stopwatch.h"
+#include "telemetry.h"
+#include "evstream.h"
+#include "dlog.h"
+#include "settings.h"
+#include "shell.h"
+#include "esp_console.h"
+#include "cpuload.h"
+#include "heapguard.h"
+#include "ntpserver.h"
+#include "fleet.h"
+#include "mqttpub.h"
+#include "esp_wifi.h"
+#include "esp_mac.h"
+#include "esp_adc/adc_oneshot.h"
 
 /* Defines */
 #define LED_Power   GPIO_NUM_1 // GPIO pin 1 → LED D4
@@ -30,11 +64,17 @@
 #define BTN2        GPIO_NUM_6
 #define BTN3        GPIO_NUM_7
 #define BTN4        GPIO_NUM_15 // Leftmost button
-#define VFD_REFRESH_PERIOD  8333 // This is half the time (in microseconds) it takes to refresh the whole display, since we are muxing the "tens" digit and the "ones" digit 
+#if CONFIG_BUTTONS_ACTIVE_LOW
+#define BUTTON_PRESSED 0
+#else
+#define BUTTON_PRESSED 1
+#endif
+#define PHOTO_SENSOR GPIO_NUM_16 // Photoresistor divider (Uphoto)
+#define VFD_REFRESH_PERIOD  (16667 / VFD_GRIDS) // Time (in microseconds) one mux phase (grid) is shown, every grid is refreshed at 60 Hz
 								 // 10000*2 = 20000 us = 50 fps
 
 static const char* TAG = "VFDClock";
-bool mux_select = 0;
+uint8_t mux_select = 0;
 uint8_t vfd_display_number = 0;
 char vfd_display_string[] = "000000";
  
@@ -43,6 +83,8 @@ char vfd_display_string[] = "000000";
 #define sntp_setoperatingmode esp_sntp_setoperatingmode
 #define sntp_setservername esp_sntp_setservername
 #define sntp_init esp_sntp_init
+#define sntp_stop esp_sntp_stop
+#define sntp_getserver esp_sntp_getserver
 #endif
 
 #if CONFIG_SET_CLOCK
@@ -57,20 +99,97 @@ char vfd_display_string[] = "000000";
 
 #define IS_DST 1
 #define ONLINE_MODE 1
+#define NET_ALWAYS_ON (CONFIG_SERVE_NTP || CONFIG_FLEET_SYNC) // The network stays connected between syncs
+#define LOCAL_OFFSET_S ((CONFIG_TIMEZONE + IS_DST) * 60 * 60) // RTC keeps local time, NTP gives UTC
+#define SYNC_POLL_S 600 // Re-check the sync schedule at least this often, the temperature may have moved
+#define RTC_HUNT_PERIOD_S 60 // Without the SQW pin, poll for an RTC edge this often
+#define RTC_HUNT_WINDOW_US 20000 // Start polling this long before the expected edge (one tick of slack included)
+#if CONFIG_RTC_SQW_GPIO >= 0 && !CONFIG_RTC_ALARMS
+#define RTC_SQW_EDGES 1 // The 1 Hz square wave on INT/SQW disciplines the timebase
+#else
+#define RTC_SQW_EDGES 0 // No pin, or it signals alarms: poll for RTC edges
+#endif
+#define RTC_LOST_MSG_ID 2 // Asset message shown when the RTC stops answering
+#define STALE_DP_MASK (1UL << (VFD_TUBES - 1)) // Rightmost decimal point marks the shown time as stale
+#define SCHED_STACK_SIZE (1024*4) // Sized for the largest job, getClock with its float logging
+#define RT_CORE CONFIG_RT_CORE // Display refresh and the scheduler jobs
+#define NET_CORE (1 - CONFIG_RT_CORE) // Wi-Fi, NTP, flash writes, shell and log drain
+// The esp_timer task and ISR (display refresh), Wi-Fi, lwIP and the MQTT client are pinned by sdkconfig
+#if CONFIG_RT_CORE == 1
+#if !defined(CONFIG_ESP_TIMER_TASK_AFFINITY_CPU1) || !defined(CONFIG_ESP_TIMER_ISR_AFFINITY_CPU1) || \
+	!defined(CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_0) || !defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0) || \
+	(CONFIG_MQTT_PUBLISH && !defined(CONFIG_MQTT_USE_CORE_0))
+#error "RT_CORE 1: pin the esp_timer task and ISR to CPU1 and Wi-Fi, lwIP and MQTT to CPU0, see sdkconfig.defaults"
+#endif
+#else
+#if !defined(CONFIG_ESP_TIMER_TASK_AFFINITY_CPU0) || !defined(CONFIG_ESP_TIMER_ISR_AFFINITY_CPU0) || \
+	!defined(CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1) || !defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1) || \
+	(CONFIG_MQTT_PUBLISH && !defined(CONFIG_MQTT_USE_CORE_1))
+#error "RT_CORE 0: pin the esp_timer task and ISR to CPU0 and Wi-Fi, lwIP and MQTT to CPU1, see sdkconfig.defaults"
+#endif
+#endif
+#define STORE_STACK_SIZE (1024*3)
+#define CLOCK_STACK_SIZE (1024*4) // setClock, syncClock or diffClock, Wi-Fi bring-up and SNTP on the stack
+#define STACK_MARGIN_MIN 512 // Bytes a static stack should have left at its high water mark
+#define GUARD_REPORT_S 60 // Report guarded heap allocations and low stack margins this often
+#define STORE_QUEUE_LEN 4
+#define STORE_DATA_MAX 32 // Largest argument copied along with deferred flash work
+#define NIGHT_POLL_MS 100 // Button sampling period of the night mode job
+#define NIGHT_LIGHT_EVERY 10 // Sample the light level every this many polls
 
 // static const char *TAG = "DS3213";
 
 RTC_DATA_ATTR static int boot_count = 0;
+RTC_DATA_ATTR static sync_sched_t sync_state; // Survives the deep sleep after the first sync
+RTC_DATA_ATTR static uint32_t ntp_ref_id; // IPv4 address of the NTP server of the last sync, network order
+static TaskHandle_t syncClock_task = NULL;
+static volatile bool sync_forced = false; // The shell asked for a sync now
+static i2c_dev_t rtc_dev; // Shared by all RTC tasks, the I2C driver is only installed once
+static i2c_dev_t sht_dev; // Humidity sensor, same bus
+static i2c_dev_t veml_dev; // Light sensor, same bus
+
+// Static task stacks, nothing a task needs is allocated from the heap
+static StackType_t sched_stack[SCHED_STACK_SIZE];
 
 // Handles
-TaskHandle_t ledBlinkTaskHandle = NULL;
 TaskHandle_t CounterTaskHandle = NULL;
+esp_timer_handle_t second_timer_handle = NULL;
+esp_timer_handle_t mux_timer_handle = NULL;
+esp_timer_handle_t dim_timer_handle = NULL;
+esp_timer_handle_t resume_timer_handle = NULL;
+
+static int32_t notify_ms = CONFIG_NOTIFY_MS; // Setting
+
+// Display power, written by the night mode job and read by the esp_timer callbacks
+static volatile bool display_blanked = false; // mux_callback parks the display on its next phase
+static volatile bool display_idle = false; // second_callback stops re-arming itself
+static volatile uint32_t dim_phase_us = VFD_REFRESH_PERIOD; // How long the segments are lit per phase
+
+// Pre-encoded display content, only touched from the esp_timer task
+static vfd_frame_t display_frame;
+static const vfd_frame_t *shown_frame = &display_frame; // The clock, or a step of the cathode exercise
+static int64_t frame_shown_us; // When shown_frame went up, for the odometer
+esp_timer_handle_t exercise_timer_handle = NULL;
+static antipoison_seq_t exercise; // Built by the exercise job, replayed by mux_callback
+static bool exercise_active = false;
+esp_timer_handle_t split_timer_handle = NULL;
+static anim_t anim; // Compiled by second_callback, replayed by mux_callback
+static const anim_keyframe_t *anim_kf = NULL; // Keyframe being shown, NULL when no transition runs
+static uint8_t split_position; // Mux phase (grid) the split timer shifts the second frame for
+
+esp_timer_handle_t compose_timer_handle = NULL; // Next layer timeout
+esp_timer_handle_t compose_now_timer_handle = NULL; // A producer changed a visible layer
+static volatile uint32_t clock_dp = 0; // Decimal points of the clock layer
 
 
 // Functions
 void time_sync_notification_cb(struct timeval *tv)
 {
 	ESP_LOGI(TAG, "Notification of a time synchronization event");
+	timebase_ntp(esp_timer_get_time(), ((int64_t)tv->tv_sec + LOCAL_OFFSET_S) * 1000000 + tv->tv_usec);
+
+	const ip_addr_t *server = sntp_getserver(0);
+	if (server && IP_IS_V4(server)) ntp_ref_id = ip_2_ip4(server)->addr;
 }
 
 static void initialize_sntp(void)
@@ -84,17 +203,50 @@ static void initialize_sntp(void)
 	sntp_init();
 }
 
-static bool obtain_time(void)
+static SemaphoreHandle_t net_lock; // Created in app_main(), the sync and the MQTT windows share the connection
+static StaticSemaphore_t net_lock_buf;
+static int net_users = 0;
+static bool net_connected = false; // Separate from net_users, with NET_ALWAYS_ON the link outlives its users
+
+/* Connect unless connected already. Pair a true return with network_down(). */
+static bool network_up(void)
 {
-	ESP_ERROR_CHECK( nvs_flash_init() );
-	ESP_ERROR_CHECK( esp_netif_init() );
-	ESP_ERROR_CHECK( esp_event_loop_create_default() );
+	static bool netif_ready = false;
+
+	xSemaphoreTake(net_lock, portMAX_DELAY);
+	// Called again for every scheduled sync, the network stack is only brought up once
+	if (!netif_ready) {
+		ESP_ERROR_CHECK( esp_netif_init() );
+		ESP_ERROR_CHECK( esp_event_loop_create_default() );
+		netif_ready = true;
+	}
 
 	/* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
 	 * Read "Establishing Wi-Fi or Ethernet Connection" section in
 	 * examples/protocols/README.md for more information about this function.
 	 */
-	ESP_ERROR_CHECK(example_connect());
+	if (!net_connected) net_connected = example_connect() == ESP_OK;
+	if (net_connected) net_users++;
+	else ESP_LOGW(TAG, "Could not connect to the network");
+	bool up = net_connected;
+	xSemaphoreGive(net_lock);
+	return up;
+}
+
+/* Disconnect when the last user is done, so the radio can stay off until the next sync or batch */
+static void network_down(void)
+{
+	xSemaphoreTake(net_lock, portMAX_DELAY);
+	if (net_users > 0 && --net_users == 0 && !NET_ALWAYS_ON) {
+		ESP_ERROR_CHECK( example_disconnect() );
+		net_connected = false;
+	}
+	xSemaphoreGive(net_lock);
+}
+
+static bool obtain_time(void)
+{
+	if (!network_up()) return false;
 
 	initialize_sntp();
 
@@ -106,19 +258,88 @@ static bool obtain_time(void)
 		vTaskDelay(2000 / portTICK_PERIOD_MS);
 	}
 
-	ESP_ERROR_CHECK( example_disconnect() );
+	// Stop polling so the radio can stay off until the next scheduled sync
+	sntp_stop();
+	network_down();
 	if (retry == retry_count) return false;
 	return true;
 }
 
+static time_t rtc_to_epoch(const struct tm *rtcinfo)
+{
+	struct tm t = *rtcinfo;
+	t.tm_year -= 1900; // ds3231_get_time returns the full year
+	t.tm_isdst = 0;
+	return mktime(&t);
+}
+
+/* Poll the RTC until its seconds roll over. Returns the new time and the esp_timer value of the edge.
+ * The DS3231 latches its time registers on the I2C START, so the edge lies between the last two reads. */
+static esp_err_t rtc_wait_edge(i2c_dev_t *dev, struct tm *rtcinfo, int64_t *edge_us, int64_t timeout_us)
+{
+	esp_err_t res = ds3231_get_time(dev, rtcinfo);
+	if (res != ESP_OK) return res;
+
+	int last_sec = rtcinfo->tm_sec;
+	int64_t deadline = esp_timer_get_time() + timeout_us;
+	int64_t prev = esp_timer_get_time();
+	int64_t start = prev;
+	do {
+		prev = start;
+		start = esp_timer_get_time();
+		res = ds3231_get_time(dev, rtcinfo);
+		if (res != ESP_OK) return res;
+	} while (rtcinfo->tm_sec == last_sec && start < deadline);
+
+	if (rtcinfo->tm_sec == last_sec) return ESP_ERR_TIMEOUT;
+	*edge_us = (prev + start) / 2;
+	return ESP_OK;
+}
+
+/* Reboot through deep sleep, the next boot starts getClock (and syncClock) */
+static void setClock_sleep(void)
+{
+	odometer_checkpoint(true);
+	// goto deep sleep for deep_sleep_sec seconds
+	const int deep_sleep_sec = 10;
+	ESP_LOGI(pcTaskGetName(0), "Entering deep sleep for %d seconds", deep_sleep_sec);
+	esp_deep_sleep(1000000LL * deep_sleep_sec);
+}
+
 #if ONLINE_MODE
+/* Write the system time to the RTC exactly on a second boundary.
+ * Writing the seconds register restarts the DS3231 countdown chain, so its edge lines up with NTP. */
+static esp_err_t rtc_write_aligned(i2c_dev_t *dev)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	time_t target = tv.tv_sec + 1;
+	if (1000000 - tv.tv_usec < 20000) target++; // Too close, not enough time left to sleep
+
+	// Sleep most of the way, then spin for the last tick
+	int64_t wait_us = (int64_t)(target - tv.tv_sec) * 1000000 - tv.tv_usec;
+	vTaskDelay(pdMS_TO_TICKS((wait_us - 15000) / 1000));
+	do {
+		gettimeofday(&tv, NULL);
+	} while (tv.tv_sec < target);
+
+	time_t local = target + LOCAL_OFFSET_S;
+	struct tm timeinfo;
+	gmtime_r(&local, &timeinfo);
+	timeinfo.tm_year += 1900; // ds3231_set_time expects the full year
+	esp_err_t res = ds3231_set_time(dev, &timeinfo);
+	if (res == ESP_OK) timebase_rtc_written();
+	return res;
+}
+
 void setClock(void *pvParameters)
 {
 	// obtain time over NTP
 	ESP_LOGI(pcTaskGetName(0), "Connecting to WiFi and getting time over NTP.");
 	if(!obtain_time()) {
+		// Keep whatever the RTC holds, syncClock retries with backoff after the reboot
 		ESP_LOGE(pcTaskGetName(0), "Fail to getting time over NTP.");
-		while (1) { vTaskDelay(1); }
+		setClock_sleep();
 	}
 
 	// update 'now' variable with current time
@@ -131,13 +352,6 @@ void setClock(void *pvParameters)
 	strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
 	ESP_LOGI(pcTaskGetName(0), "The current date/time is: %s", strftime_buf);
 
-	// Initialize RTC
-	i2c_dev_t dev;
-	if (ds3231_init_desc(&dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO) != ESP_OK) {
-		ESP_LOGE(pcTaskGetName(0), "Could not init device descriptor.");
-		while (1) { vTaskDelay(1); }
-	}
-
 	ESP_LOGD(pcTaskGetName(0), "timeinfo.tm_sec=%d",timeinfo.tm_sec);
 	ESP_LOGD(pcTaskGetName(0), "timeinfo.tm_min=%d",timeinfo.tm_min);
 	ESP_LOGD(pcTaskGetName(0), "timeinfo.tm_hour=%d",timeinfo.tm_hour);
@@ -146,37 +360,203 @@ void setClock(void *pvParameters)
 	ESP_LOGD(pcTaskGetName(0), "timeinfo.tm_mon=%d",timeinfo.tm_mon);
 	ESP_LOGD(pcTaskGetName(0), "timeinfo.tm_year=%d",timeinfo.tm_year);
 
-	struct tm time = {
-		.tm_year = timeinfo.tm_year + 1900,
-		.tm_mon  = timeinfo.tm_mon,  // 0-based
-		.tm_mday = timeinfo.tm_mday,
-		.tm_hour = timeinfo.tm_hour,
-		.tm_min  = timeinfo.tm_min,
-		.tm_sec  = timeinfo.tm_sec
-	};
-
 	// Save the date and time to RTC
-	if (ds3231_set_time(&dev, &time) != ESP_OK) {
+	if (rtc_write_aligned(&rtc_dev) != ESP_OK) {
 		ESP_LOGE(pcTaskGetName(0), "Could not set time.");
-		while (1) { vTaskDelay(1); }
+		setClock_sleep();
 	}
 	ESP_LOGI(pcTaskGetName(0), "Set initial date time done");
 
-	// goto deep sleep for deep_sleep_sec seconds
-	const int deep_sleep_sec = 10;
-	ESP_LOGI(pcTaskGetName(0), "Entering deep sleep for %d seconds", deep_sleep_sec);
-	esp_deep_sleep(1000000LL * deep_sleep_sec);
+	// First sync is only the reference point for the drift measurement
+	float temp = 25.0f;
+	ds3231_get_temp_float(&rtc_dev, &temp);
+	sync_sched_success(&sync_state, now + 1, 0, temp);
+
+	setClock_sleep();
 }
-#else
-void setClock(void *pvParameters)
+
+#if CONFIG_SET_CLOCK
+/* Return RTC minus system (NTP) time, measured on an RTC second edge.
+ * The DS3231 only has second resolution, sampling the edge gets the offset down to one I2C read. */
+static esp_err_t rtc_measure_offset(i2c_dev_t *dev, int32_t *offset_ms)
 {
-	// Initialize RTC
-	i2c_dev_t dev;
-	if (ds3231_init_desc(&dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO) != ESP_OK) {
-		ESP_LOGE(pcTaskGetName(0), "Could not init device descriptor.");
-		while (1) { vTaskDelay(1); }
+	struct tm rtcinfo;
+	int64_t edge_us;
+	esp_err_t res = rtc_wait_edge(dev, &rtcinfo, &edge_us, 1100000);
+	if (res != ESP_OK) return res;
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	int64_t sys_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (esp_timer_get_time() - edge_us);
+
+	int64_t rtc_utc_us = (int64_t)(rtc_to_epoch(&rtcinfo) - LOCAL_OFFSET_S) * 1000000;
+	*offset_ms = (int32_t)((rtc_utc_us - sys_us) / 1000);
+	return ESP_OK;
+}
+
+static sync_sched_config_t sync_config(void)
+{
+	sync_sched_config_t cfg = {
+		.error_budget_ms = CONFIG_SYNC_ERROR_BUDGET_MS,
+		.min_interval_s  = CONFIG_SYNC_MIN_INTERVAL_S,
+		.max_interval_s  = CONFIG_SYNC_MAX_INTERVAL_S,
+		.retry_base_s    = CONFIG_SYNC_RETRY_BASE_S,
+		.retry_max_s     = CONFIG_SYNC_RETRY_MAX_S,
+		.temp_coeff_ppm  = CONFIG_SYNC_TEMP_COEFF_PPB / 1000.0f,
+		.stable_count    = CONFIG_SYNC_STABLE_COUNT,
+	};
+	return cfg;
+}
+
+#if CONFIG_SERVE_NTP || CONFIG_FLEET_SYNC
+/* UTC from the timebase, which keeps local time */
+static int64_t utc_now_us(void)
+{
+	return timebase_now_us() - (int64_t)LOCAL_OFFSET_S * 1000000;
+}
+#endif
+
+#if CONFIG_SERVE_NTP
+/* One stratum below the upstream server, the error bound grows from the last sync at the RTC's drift */
+static void ntp_source_update(void)
+{
+	ntpserver_source_t src = { .stratum = NTPSERVER_STRATUM_NONE };
+	if (sync_state.last_sync_s) {
+		src.stratum = CONFIG_SERVE_NTP_UPSTREAM_STRATUM + 1;
+		src.ref_id = ntp_ref_id;
+		src.ref_us = (sync_state.last_sync_s - LOCAL_OFFSET_S) * 1000000;
+		src.root_disp_us = CONFIG_SERVE_NTP_UPSTREAM_ERROR_MS * 1000;
+		src.disp_ppb = sync_state.drift_valid ?
+			(uint32_t)((fabsf(sync_state.drift_ppm) + sync_state.jitter_ppm) * 1000) : CONFIG_SERVE_NTP_DRIFT_PPB;
+	}
+	ntpserver_set_source(&src);
+}
+
+static void ntp_server_init(void)
+{
+	if (!network_up()) ESP_LOGW(TAG, "No network yet, the time server answers once a sync connects.");
+	ntp_source_update();
+	if (ntpserver_start(CONFIG_SERVE_NTP_PORT, utc_now_us, CONFIG_PRIO_NTPSERVER, NET_CORE) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not start the time server.");
+	}
+}
+#endif
+
+#if CONFIG_FLEET_SYNC
+/* The leader's UTC time at esp_timer value timer_us, slewed in like an NTP sample */
+static void fleet_correct(int64_t timer_us, int64_t ref_us)
+{
+	timebase_ntp(timer_us, ref_us + (int64_t)LOCAL_OFFSET_S * 1000000);
+}
+
+static bool fleet_follower = false;	// Role at the last check, for the log
+
+static void fleet_init(void)
+{
+	if (!network_up()) ESP_LOGW(TAG, "No network yet, the fleet is joined once a sync connects.");
+	esp_wifi_set_ps(WIFI_PS_NONE); // A dozing station gets multicast only after the next DTIM beacon
+
+	uint8_t mac[6] = {0};
+	esp_read_mac(mac, ESP_MAC_WIFI_STA);
+	const fleet_config_t cfg = {
+		.group = CONFIG_FLEET_GROUP,
+		.port = CONFIG_FLEET_PORT,
+		.id = (uint32_t)mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5],
+		.beacon_ms = CONFIG_FLEET_BEACON_MS,
+		.clock = { .now_us = utc_now_us, .timer_us = esp_timer_get_time, .correct = fleet_correct },
+	};
+	if (fleet_start(&cfg, CONFIG_PRIO_FLEET, NET_CORE) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not join the fleet.");
 	}
+}
+
+/* Predicted error of our time in ms, the unit with the smallest leads */
+static void fleet_quality(int64_t now, float temp)
+{
+	int32_t error_ms = sync_sched_predicted_error_ms(&sync_state, now, temp);
+	if (!sync_state.last_sync_s) error_ms = FLEET_QUALITY_NONE;
+	else if (error_ms >= FLEET_QUALITY_NONE) error_ms = FLEET_QUALITY_NONE - 1;
+	fleet_set_quality(error_ms);
+}
+#endif
+
+/* Keeps the RTC within the error budget, NTP is only asked when the sync scheduler says so */
+void syncClock(void *pvParameters)
+{
+#if CONFIG_SERVE_NTP
+	ntp_server_init();
+#endif
+#if CONFIG_FLEET_SYNC
+	fleet_init();
+#endif
+	while (1) {
+		float temp;
+		struct tm rtcinfo;
+
+		if (ds3231_get_temp_float(&rtc_dev, &temp) != ESP_OK ||
+			ds3231_get_time(&rtc_dev, &rtcinfo) != ESP_OK) {
+			ESP_LOGE(pcTaskGetName(0), "Could not read RTC.");
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SYNC_POLL_S * 1000));
+			continue;
+		}
+		int64_t now = rtc_to_epoch(&rtcinfo);
+
+		sync_action_t action = sync_forced ? SYNC_DUE : sync_sched_check(&sync_state, now, temp);
+		sync_forced = false;
+#if CONFIG_FLEET_SYNC
+		fleet_quality(now, temp);
+		bool following = fleet_following();
+		if (following != fleet_follower) {
+			ESP_LOGI(pcTaskGetName(0), following ? "Following the fleet leader, no NTP syncs" : "Leading the fleet, syncing with NTP");
+			fleet_follower = following;
+		}
+		if (action == SYNC_DUE && following) {
+			// Only the leader asks NTP, the followers take its time. Look again later, the leader may go away.
+			sync_sched_defer(&sync_state, now, SYNC_POLL_S);
+			action = SYNC_WAIT;
+		}
+#endif
+		switch (action) {
+		case SYNC_SKIP:
+			ESP_LOGI(pcTaskGetName(0), "RTC stable, predicted error %"PRId32" ms, skipping sync",
+					 sync_sched_predicted_error_ms(&sync_state, now, temp));
+			break;
+
+		case SYNC_DUE: {
+			int32_t offset_ms;
+			bool synced = obtain_time() &&
+						  rtc_measure_offset(&rtc_dev, &offset_ms) == ESP_OK &&
+						  rtc_write_aligned(&rtc_dev) == ESP_OK;
+			// Connecting and asking NTP can take tens of seconds, the result belongs to the time after it
+			if (ds3231_get_time(&rtc_dev, &rtcinfo) == ESP_OK) now = rtc_to_epoch(&rtcinfo);
+			if (synced) {
+				sync_sched_success(&sync_state, now, offset_ms, temp);
+#if CONFIG_SERVE_NTP
+				ntp_source_update();
+#endif
+				ESP_LOGI(pcTaskGetName(0), "Synced, RTC was off by %"PRId32" ms, drift %.2f ppm, next sync in %"PRIu32" s",
+						 offset_ms, sync_state.drift_ppm, sync_sched_wait_s(&sync_state, now));
+			} else {
+				sync_sched_failure(&sync_state, now);
+				ESP_LOGW(pcTaskGetName(0), "Sync failed, retrying in %"PRIu32" s", sync_state.retry_s);
+			}
+			break;
+		}
+
+		default:
+			break;
+		}
 
+		uint32_t wait_s = sync_sched_wait_s(&sync_state, now);
+		if (wait_s > SYNC_POLL_S) wait_s = SYNC_POLL_S;
+		if (wait_s == 0) wait_s = 1;
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_s * 1000)); // Woken early by the sync command
+	}
+}
+#endif
+#else
+void setClock(void *pvParameters)
+{
 	struct tm time = {
 		.tm_year = 2025,
 		.tm_mon  = 8,  // 0-based
@@ -187,64 +567,104 @@ void setClock(void *pvParameters)
 	};
 
 	// Save the date and time to RTC
-	if (ds3231_set_time(&dev, &time) != ESP_OK) {
+	if (ds3231_set_time(&rtc_dev, &time) != ESP_OK) {
 		ESP_LOGE(pcTaskGetName(0), "Could not set time.");
-		while (1) { vTaskDelay(1); }
+		setClock_sleep();
 	}
 	ESP_LOGI(pcTaskGetName(0), "Set initial date time done");
 
-	// goto deep sleep for deep_sleep_sec seconds
-	const int deep_sleep_sec = 10;
-	ESP_LOGI(pcTaskGetName(0), "Entering deep sleep for %d seconds", deep_sleep_sec);
-	esp_deep_sleep(1000000LL * deep_sleep_sec);
+	setClock_sleep();
 }
 #endif
 
 
-void getClock(void *pvParameters)
+#if !RTC_SQW_EDGES
+/* No SQW interrupt, catch an RTC edge by polling in a narrow window around where we expect it */
+static void rtc_hunt_job(void *arg)
 {
-	// Initialize RTC
-	i2c_dev_t dev;
-	if (ds3231_init_desc(&dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO) != ESP_OK) {
-		ESP_LOGE(pcTaskGetName(0), "Could not init device descriptor.");
-		while (1) { vTaskDelay(1); }
+	struct tm rtcinfo;
+	int64_t edge_us;
+	if (rtc_wait_edge(&rtc_dev, &rtcinfo, &edge_us, 2 * RTC_HUNT_WINDOW_US) == ESP_OK) {
+		timebase_rtc_edge(edge_us);
 	}
+}
 
-	// Initialise the xLastWakeTime variable with the current time.
-	TickType_t xLastWakeTime = xTaskGetTickCount();
+static sched_job_t rtc_hunt = SCHED_JOB_INIT(rtc_hunt_job, NULL, "rtcHunt");
+#endif
 
-	// Get RTC date and time
-	while (1) {
-		float temp;
-		struct tm rtcinfo;
+/* Put text on a layer of the compositor, the display follows within one frame if it shows. Callable from any task. */
+static void display_show(comp_layer_t layer, const char *text, uint32_t dp, uint32_t mask, uint32_t timeout_ms)
+{
+	if (comp_set(layer, text, dp, mask, timeout_ms, esp_timer_get_time())) {
+		esp_timer_start_once(compose_now_timer_handle, 1); // Fails harmlessly if a render is already pending
+	}
+}
 
-		if (ds3231_get_temp_float(&dev, &temp) != ESP_OK) {
-			ESP_LOGE(pcTaskGetName(0), "Could not get temperature.");
-			while (1) { vTaskDelay(1); }
-		}
+/* Take a layer off the compositor. Callable from any task. */
+static void display_clear(comp_layer_t layer)
+{
+	if (comp_clear(layer)) {
+		esp_timer_start_once(compose_now_timer_handle, 1);
+	}
+}
 
-		if (ds3231_get_time(&dev, &rtcinfo) != ESP_OK) {
-			ESP_LOGE(pcTaskGetName(0), "Could not get time.");
-			while (1) { vTaskDelay(1); }
-		}
+/* The RTC stopped answering: mark the free running time as stale, and say so once */
+static void clock_stale(void)
+{
+	if (clock_dp == STALE_DP_MASK) return;
+	clock_dp = STALE_DP_MASK;
+#if CONFIG_EVSTREAM
+	evstream_state(EV_MACHINE_RTC, 0, 1);
+#endif
+
+	size_t size;
+	const char *msg = assets_find(ASSET_MESSAGE, RTC_LOST_MSG_ID, &size);
+	display_show(COMP_LAYER_NOTIFY, msg ? msg : "no rtc", 0, COMP_MASK_ALL, notify_ms);
+}
+
+/* Reads the RTC once per second. The digits are rendered by second_callback on the timebase second boundary. */
+static void getClock_job(void *arg)
+{
+	static int hunt_count = 0;
+	struct tm rtcinfo;
 
-		// vfd_display_number = (uint8_t) rtcinfo.tm_min;
-		sprintf(vfd_display_string, "%02d%02d%02d", rtcinfo.tm_hour, rtcinfo.tm_min, rtcinfo.tm_sec);
+	// i2cdev already retried and recovered the bus. If the RTC is still gone,
+	// keep showing the free running timebase and mark it as stale.
+	// The temperature is read by its info page, when it is about to be shown.
+	if (ds3231_get_time(&rtc_dev, &rtcinfo) != ESP_OK) {
+		ESP_LOGE("getClock", "Could not get time.");
+		clock_stale();
+		return;
+	}
+#if CONFIG_EVSTREAM
+	if (clock_dp) evstream_state(EV_MACHINE_RTC, 1, 0);
+#endif
+	clock_dp = 0;
 
-		ESP_LOGI(pcTaskGetName(0), "%04d-%02d-%02d %02d:%02d:%02d, %.2f deg Cel",
-				 rtcinfo.tm_year, rtcinfo.tm_mon + 1,
-				 rtcinfo.tm_mday, rtcinfo.tm_hour, rtcinfo.tm_min, rtcinfo.tm_sec, temp);
-		vTaskDelayUntil(&xLastWakeTime, 100);
+	DLOGI("getClock", "%04d-%02d-%02d %02d:%02d:%02d",
+		  rtcinfo.tm_year, rtcinfo.tm_mon + 1,
+		  rtcinfo.tm_mday, rtcinfo.tm_hour, rtcinfo.tm_min, rtcinfo.tm_sec);
+
+#if !RTC_SQW_EDGES
+	if (++hunt_count >= RTC_HUNT_PERIOD_S) {
+		hunt_count = 0;
+		int64_t wait_us = timebase_next_rtc_edge() - RTC_HUNT_WINDOW_US - esp_timer_get_time();
+		sched_add(&rtc_hunt, wait_us > 0 ? wait_us / 1000 : 0, 0);
 	}
+#else
+	(void)hunt_count;
+#endif
 }
 
+static sched_job_t getClock = SCHED_JOB_INIT(getClock_job, NULL, "getClock");
+
 void diffClock(void *pvParameters)
 {
 	// obtain time over NTP
 	ESP_LOGI(pcTaskGetName(0), "Connecting to WiFi and getting time over NTP.");
 	if(!obtain_time()) {
 		ESP_LOGE(pcTaskGetName(0), "Fail to getting time over NTP.");
-		while (1) { vTaskDelay(1); }
+		vTaskDelete(NULL);
 	}
 
 	// update 'now' variable with current time
@@ -257,18 +677,11 @@ void diffClock(void *pvParameters)
 	strftime(strftime_buf, sizeof(strftime_buf), "%m-%d-%y %H:%M:%S", &timeinfo);
 	ESP_LOGI(pcTaskGetName(0), "NTP date/time is: %s", strftime_buf);
 
-	// Initialize RTC
-	i2c_dev_t dev;
-	if (ds3231_init_desc(&dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO) != ESP_OK) {
-		ESP_LOGE(pcTaskGetName(0), "Could not init device descriptor.");
-		while (1) { vTaskDelay(1); }
-	}
-
 	// Get RTC date and time
 	struct tm rtcinfo;
-	if (ds3231_get_time(&dev, &rtcinfo) != ESP_OK) {
+	if (ds3231_get_time(&rtc_dev, &rtcinfo) != ESP_OK) {
 		ESP_LOGE(pcTaskGetName(0), "Could not get time.");
-		while (1) { vTaskDelay(1); }
+		vTaskDelete(NULL);
 	}
 	rtcinfo.tm_year = rtcinfo.tm_year - 1900;
 	rtcinfo.tm_isdst = -1;
@@ -316,98 +729,1800 @@ void GPIOConfig(void){
     // Configure the GPIO with the settings.
     gpio_config(&GPIO_CONF_LED);
     gpio_config(&GPIO_CONF_BUTTONS);
+#if CONFIG_PM_ENABLE
+    gpio_sleep_sel_dis(LED_Power); // Keep the LEDs lit through light sleep
+    gpio_sleep_sel_dis(LED_MCU);
+#endif
+}
+
+/* LED Blink job, toggles the MCU LED (D5) */
+static void ledBlink_job(void *arg)
+{
+	static bool led_off = false;
+	gpio_set_level(LED_MCU, led_off);
+	led_off = !led_off;
 }
 
-/* LED Blink Task*/
-void ledBlinkTask(void *pvParameters){
-    // Turn Power LED on when "power is present"
-    gpio_set_level(LED_Power, 0); 
+static sched_job_t ledBlink = SCHED_JOB_INIT(ledBlink_job, NULL, "ledBlink");
 
-    ESP_LOGW("ledBlinkTask", "CORE ID: %d", xPortGetCoreID());
+#if CONFIG_POWER_REPORT_PERIOD_S > 0
+static void powerReport_job(void *arg)
+{
+	i2c_dev_stats_t i2c_stats;
+	i2c_dev_get_stats(I2C_NUM_0, &i2c_stats);
+	power_report(i2c_stats.total_us);
+}
 
-    while(1){
-            // Toggle MCU LED (D5)
-            gpio_set_level(LED_MCU, 0);
-            // ESP_LOGI("ledBlinkTask", "MCU LED on");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
+static sched_job_t powerReport = SCHED_JOB_INIT(powerReport_job, NULL, "powerReport");
+#endif
 
-            gpio_set_level(LED_MCU, 1);
-            // ESP_LOGI("ledBlinkTask", "MCU LED off");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-        }
+/* Flash writes run on the network core. A sector erase takes tens of milliseconds,
+ * the scheduler jobs behind the one that wrote would all be late. */
+typedef struct {
+	void (*fn)(const void *data);
+	uint8_t data[STORE_DATA_MAX];
+} store_work_t;
+
+static QueueHandle_t store_queue = NULL;
+static StaticQueue_t store_queue_buf;
+static uint8_t store_queue_storage[STORE_QUEUE_LEN * sizeof(store_work_t)];
+static StackType_t store_stack[STORE_STACK_SIZE];
+static StaticTask_t store_task_buf;
+static TaskHandle_t store_task_handle = NULL;
+
+static void store_task(void *pvParameters)
+{
+	store_work_t work;
+	while (1) {
+		if (xQueueReceive(store_queue, &work, portMAX_DELAY) == pdTRUE) work.fn(work.data);
+	}
 }
 
-/*Counter Task*/
-// void CounterTask(void *pvParameters){
-//     uint8_t cnt = 0;
-//     while (1){
-        
-//         vfd_display_number = (cnt++) % 100;
+/* Run fn on a copy of data on the storage task, here if the queue is full or not there */
+static void store_defer(void (*fn)(const void *data), const void *data, size_t size)
+{
+	store_work_t work = { .fn = fn };
+	if (size) memcpy(work.data, data, size);
+	if (!store_queue || xQueueSend(store_queue, &work, 0) != pdTRUE) fn(work.data);
+}
 
-//         vTaskDelay(pdMS_TO_TICKS(1000));
-//     }
-// }
+/* Run the queued work here, before a deep sleep */
+static void store_drain(void)
+{
+	store_work_t work;
+	while (store_queue && xQueueReceive(store_queue, &work, 0) == pdTRUE) work.fn(work.data);
+}
 
-/* Timer callbacks */
-void mux_callback(void *param){
-    
-    // vfd_value(vfd_display_number, mux_select);
-	vfd_value_str(vfd_display_string, mux_select);
-    mux_select = !mux_select;
+static void store_init(void)
+{
+	store_queue = xQueueCreateStatic(STORE_QUEUE_LEN, sizeof(store_work_t), store_queue_storage, &store_queue_buf);
+	store_task_handle = xTaskCreateStaticPinnedToCore(store_task, "store", STORE_STACK_SIZE, NULL, CONFIG_PRIO_STORE,
+													  store_stack, &store_task_buf, NET_CORE);
+	if (!store_task_handle) {
+		store_queue = NULL;
+		ESP_LOGE(TAG, "Could not start the storage task, flash is written in place.");
+	}
+}
+
+static void odometer_store(const void *data)
+{
+	odometer_checkpoint(true);
+	odometer_dump();
 }
 
+/* Checkpoint the segment odometer, NVS is only written when the counters moved */
+static void odometer_job(void *arg)
+{
+	store_defer(odometer_store, NULL, 0);
+}
 
+static sched_job_t odometerCheckpoint = SCHED_JOB_INIT(odometer_job, NULL, "odometer");
 
-void app_main()
+#if CONFIG_ANTIPOISON
+/* Milliseconds until the next quiet hour, local time */
+#if !CONFIG_RTC_ALARMS
+static uint32_t exercise_delay_ms(void)
 {
-	++boot_count;
-	ESP_LOGI(TAG, "CONFIG_SCL_GPIO = %d", CONFIG_SCL_GPIO);
-	ESP_LOGI(TAG, "CONFIG_SDA_GPIO = %d", CONFIG_SDA_GPIO);
-	ESP_LOGI(TAG, "CONFIG_TIMEZONE= %d", CONFIG_TIMEZONE);
-	ESP_LOGI(TAG, "Boot count: %d", boot_count);
+	int64_t now_s = timebase_now_us() / 1000000;
+	int64_t wait_s = ((int64_t)CONFIG_ANTIPOISON_HOUR * 3600 - now_s % 86400 + 86400) % 86400;
+	return (wait_s ? wait_s : 86400) * 1000;
+}
+#endif
 
-#if CONFIG_SET_CLOCK
-	// Set clock & Get clock
-	if (boot_count == 1) {
-		xTaskCreate(setClock, "setClock", 1024*4, NULL, 2, NULL);
-	} else {
-		xTaskCreate(getClock, "getClock", 1024*4, NULL, 2, NULL);
+/* Cycles every segment of every tube at the quiet hour, least used first. Started by RTC alarm 1 with RTC_ALARMS. */
+static void exercise_job(void *arg)
+{
+	if (!exercise_active) {
+		uint32_t usage_s[VFD_TUBES][ANTIPOISON_SEGMENTS];
+		odometer_snapshot(usage_s);
+		antipoison_build(&exercise, usage_s, (uint32_t)((int64_t)CONFIG_ANTIPOISON_DWELL_S * 1000000 / VFD_REFRESH_PERIOD));
+		ESP_LOGI("exercise", "Cathode exercise for %" PRIu32 " s",
+				 (uint32_t)((int64_t)antipoison_phases(&exercise) * VFD_REFRESH_PERIOD / 1000000));
+		esp_timer_start_once(exercise_timer_handle, 1);
 	}
+
+#if !CONFIG_RTC_ALARMS
+	sched_add((sched_job_t *)arg, exercise_delay_ms(), 0); // arg is this job, run again tomorrow
 #endif
+}
 
-#if CONFIG_GET_CLOCK
-	// Get clock
-	xTaskCreate(getClock, "getClock", 1024*4, NULL, 2, NULL);
+static sched_job_t antiPoison = SCHED_JOB_INIT(exercise_job, &antiPoison, "antiPoison");
 #endif
 
-#if CONFIG_DIFF_CLOCK
-	// Diff clock
-	xTaskCreate(diffClock, "diffClock", 1024*4, NULL, 2, NULL);
+#if CONFIG_INFO_PAGES || CONFIG_TELEMETRY
+/* The SHT4x and the VEML3235 are shared by the info pages and telemetry, both run on the scheduler task */
+#define SHT_LEAD_MS (SHT4X_MEAS_MS + 1)
+#define VEML_LEAD_MS (VEML3235_IT_MS + 20) // One integration after power up, with margin
+#define SHT_SHARE_US 1000000 // A measurement this recent serves every reader
+#define VEML_PAGE 1 // veml_hold() users
+#define VEML_TELEMETRY 2
+
+static bool sht_present, veml_present;
+static int64_t sht_started_us; // Measurement on its way since, 0 = none
+static int64_t sht_done_us; // When the last results were collected
+static int32_t sht_temp_centi, sht_rh_centi;
+static uint8_t veml_users;
+
+/* Start an SHT4x measurement, unless another reader just started one */
+static esp_err_t sht_start(void)
+{
+	if (!sht_present) return ESP_ERR_NOT_FOUND;
+	int64_t now = esp_timer_get_time();
+	if (sht_started_us && now - sht_started_us < SHT_SHARE_US) return ESP_OK;
+
+	esp_err_t res = sht4x_start_measurement(&sht_dev);
+	sht_started_us = res == ESP_OK ? now : 0;
+	return res;
+}
+
+/* Collect the measurement, SHT_LEAD_MS after sht_start(). A second reader gets the same results. */
+static esp_err_t sht_fetch(int32_t *temp_centi, int32_t *rh_centi)
+{
+	if (sht_started_us) {
+		esp_err_t res = sht4x_get_results(&sht_dev, &sht_temp_centi, &sht_rh_centi);
+		sht_started_us = 0;
+		if (res != ESP_OK) return res;
+		sht_done_us = esp_timer_get_time();
+	} else if (!sht_done_us || esp_timer_get_time() - sht_done_us > SHT_SHARE_US) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	if (temp_centi) *temp_centi = sht_temp_centi;
+	if (rh_centi) *rh_centi = sht_rh_centi;
+	return ESP_OK;
+}
+
+/* The light sensor is powered while any user holds it, results are valid VEML_LEAD_MS after power up */
+static void veml_hold(uint8_t user, bool on)
+{
+	uint8_t was = veml_users;
+	veml_users = on ? was | user : was & ~user;
+	if (veml_present && !was != !veml_users) veml3235_power(&veml_dev, veml_users != 0);
+}
+
+static void sensors_init(void)
+{
+	uint32_t serial;
+	sht4x_init_desc(&sht_dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO);
+	sht_present = sht4x_get_serial(&sht_dev, &serial) == ESP_OK;
+	if (!sht_present) ESP_LOGW(TAG, "No SHT4x.");
+
+	veml3235_init_desc(&veml_dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO);
+	veml_present = veml3235_init(&veml_dev) == ESP_OK;
+	if (!veml_present) ESP_LOGW(TAG, "No VEML3235.");
+}
 #endif
 
-	/* Timer config */
-	const esp_timer_create_args_t mux_timer_args =
-		{
-			.callback = &mux_callback,
-			.name = "Mux Timer Interrupt"};
+#if CONFIG_INFO_PAGES
+/* Info pages, see infopages.h. Values are integers in the display resolution, the formatters place the decimal points. */
+#define INFO_SLACK_MS 200 // The info layer outlives its dwell by this much, the next page replaces it in time
 
-	esp_timer_handle_t mux_timer_handle;
-	esp_timer_create(&mux_timer_args, &mux_timer_handle);
-	esp_timer_start_periodic(mux_timer_handle, VFD_REFRESH_PERIOD);
+static esp_err_t date_read(int32_t *value)
+{
+	time_t sec = timebase_now_us() / 1000000;
+	struct tm timeinfo;
+	gmtime_r(&sec, &timeinfo); // The timebase already runs in local time
+	*value = (timeinfo.tm_year + 1900) * 10000 + (timeinfo.tm_mon + 1) * 100 + timeinfo.tm_mday;
+	return ESP_OK;
+}
 
-	/* Init */
-	GPIOConfig();
-	vfd_init();
+static void date_format(int32_t value, char *text, uint32_t *dp)
+{
+	// DD.MM.YY
+	snprintf(text, VFD_TUBES + 1, "%02d%02d%02d", (int)(value % 100), (int)(value / 100 % 100), (int)(value / 10000 % 100));
+	*dp = (1 << 1) | (1 << 3);
+}
+
+static esp_err_t temp_read(int32_t *value)
+{
+	float temp;
+	esp_err_t res = ds3231_get_temp_float(&rtc_dev, &temp);
+	if (res == ESP_OK) *value = lroundf(temp * 10);
+	return res;
+}
+
+static void temp_format(int32_t value, char *text, uint32_t *dp)
+{
+	// "  21.5C", tenths of a degree
+	int32_t magnitude = value < 0 ? -value : value;
+	char whole[8];
+	snprintf(whole, sizeof(whole), "%s%" PRId32, value < 0 ? "-" : "", magnitude / 10);
+	snprintf(text, VFD_TUBES + 1, "%4s%" PRId32 "C", whole, magnitude % 10);
+	*dp = 1 << 3;
+}
+
+static esp_err_t humidity_prepare(void)
+{
+	return sht_start();
+}
+
+static esp_err_t humidity_read(int32_t *value)
+{
+	int32_t rh_centi;
+	esp_err_t res = sht_fetch(NULL, &rh_centi);
+	if (res == ESP_OK) *value = (rh_centi + 50) / 100;
+	return res;
+}
+
+static void humidity_format(int32_t value, char *text, uint32_t *dp)
+{
+	snprintf(text, VFD_TUBES + 1, "%4" PRId32 "rH", value);
+}
+
+static esp_err_t lux_prepare(void)
+{
+	veml_hold(VEML_PAGE, true);
+	return ESP_OK;
+}
+
+static esp_err_t lux_read(int32_t *value)
+{
+	uint32_t lux;
+	esp_err_t res = veml3235_get_lux(&veml_dev, &lux);
+	veml_hold(VEML_PAGE, false); // Off until the page comes round again
+	if (res == ESP_OK) *value = lux;
+	return res;
+}
+
+static void lux_format(int32_t value, char *text, uint32_t *dp)
+{
+	snprintf(text, VFD_TUBES + 1, "%5" PRId32 "L", value);
+}
+
+static info_page_t info_pages[] = {
+	{ .name = "date", .dwell_ms = CONFIG_INFO_DATE_S * 1000, .read = date_read, .format = date_format, .threshold = 1 },
+	{ .name = "temp", .dwell_ms = CONFIG_INFO_TEMP_S * 1000, .read = temp_read, .format = temp_format, .threshold = 1 },
+	{ .name = "humidity", .dwell_ms = CONFIG_INFO_HUMIDITY_S * 1000, .lead_ms = SHT_LEAD_MS,
+	  .prepare = humidity_prepare, .read = humidity_read, .format = humidity_format, .threshold = 1 },
+	{ .name = "lux", .dwell_ms = CONFIG_INFO_LUX_S * 1000, .lead_ms = VEML_LEAD_MS,
+	  .prepare = lux_prepare, .read = lux_read, .format = lux_format, .threshold = 1 },
+};
+static info_rotation_t info_rot;
+
+static void info_prepare_job(void *arg)
+{
+	info_page_t *next = pages_peek(&info_rot);
+	if (next && next->prepare && next->prepare() != ESP_OK) {
+		ESP_LOGW(TAG, "Could not prepare the %s page.", next->name);
+	}
+}
+
+static sched_job_t infoPrepare = SCHED_JOB_INIT(info_prepare_job, NULL, "infoPrepare");
 
-	/*  FreeRTOS tasks  */
-	xTaskCreate(
-		ledBlinkTask,		// Task func
-		"LED Blink task",	// Task name
-		2048,				// Stack size
-		NULL,				// Task params
-		1,					// Task priority
-		&ledBlinkTaskHandle // Task handle
-	);
+/* Shows the next page (or goes back to the clock) and arms the sensor of the page after it */
+static void info_job(void *arg)
+{
+	uint32_t dwell_ms;
+	info_page_t *page = pages_advance(&info_rot, &dwell_ms);
+
+	if (!page) {
+		display_clear(COMP_LAYER_INFO);
+	} else if (pages_refresh(page) == ESP_OK) {
+		display_show(COMP_LAYER_INFO, page->text, page->dp, COMP_MASK_ALL, dwell_ms + INFO_SLACK_MS);
+	} else {
+		ESP_LOGW(TAG, "Could not read the %s page.", page->name);
+		display_clear(COMP_LAYER_INFO); // The clock stands in for it
+	}
+
+	info_page_t *next = pages_peek(&info_rot);
+	if (next && next->prepare) {
+		uint32_t lead_ms = next->lead_ms < dwell_ms ? next->lead_ms : dwell_ms;
+		sched_add(&infoPrepare, dwell_ms - lead_ms, 0);
+	}
+	sched_add((sched_job_t *)arg, dwell_ms, 0);
+}
+
+static sched_job_t infoPages = SCHED_JOB_INIT(info_job, &infoPages, "infoPages");
+
+/* Pages only rotate while someone can see them */
+static void info_pause(bool pause)
+{
+	if (pause) {
+		sched_cancel(&infoPages);
+		sched_cancel(&infoPrepare);
+		veml_hold(VEML_PAGE, false);
+		display_clear(COMP_LAYER_INFO);
+	} else if (!infoPages.armed) {
+		pages_init(&info_rot, info_pages, sizeof(info_pages) / sizeof(info_pages[0]), CONFIG_INFO_CLOCK_S * 1000);
+		sched_add(&infoPages, CONFIG_INFO_CLOCK_S * 1000, 0);
+	}
+}
+
+/* Call after sensors_init(), pages of missing sensors are left out */
+static void info_init(void)
+{
+	if (!sht_present) info_pages[2].dwell_ms = 0;
+	if (!veml_present) info_pages[3].dwell_ms = 0;
+	info_pause(false);
+}
+#endif
+
+#if CONFIG_TELEMETRY
+/* One telemetry sample per interval, see telemetry.h. The sensors are started one lead time ahead. */
+#define TELEMETRY_LEAD_MS (SHT_LEAD_MS > VEML_LEAD_MS ? SHT_LEAD_MS : VEML_LEAD_MS)
+#if CONFIG_EVSTREAM
+_Static_assert(EV_SAMPLE_CHANNELS == TELEMETRY_CHANNELS, "Samples are streamed as they are stored");
+#endif
+_Static_assert(sizeof(telemetry_sample_t) <= STORE_DATA_MAX, "Samples are copied to the storage task");
+
+static void telemetry_prepare_job(void *arg)
+{
+	sht_start();
+	veml_hold(VEML_TELEMETRY, true);
+	sched_add((sched_job_t *)arg, TELEMETRY_LEAD_MS, 0); // arg is the sample job
+}
+
+static void telemetry_store(const void *data)
+{
+	telemetry_add(data);
+}
+
+static void telemetry_sample_job(void *arg)
+{
+	telemetry_sample_t sample = { .time = timebase_now_us() / 1000000 };
+
+	float rtc_temp;
+	if (ds3231_get_temp_float(&rtc_dev, &rtc_temp) == ESP_OK) {
+		sample.value[TELEMETRY_RTC_TEMP] = lroundf(rtc_temp * 100);
+		sample.valid |= 1 << TELEMETRY_RTC_TEMP;
+	}
+	if (sht_present && sht_fetch(&sample.value[TELEMETRY_TEMP], &sample.value[TELEMETRY_HUMIDITY]) == ESP_OK) {
+		sample.valid |= (1 << TELEMETRY_TEMP) | (1 << TELEMETRY_HUMIDITY);
+	}
+	uint32_t lux;
+	if (veml_present && veml3235_get_lux(&veml_dev, &lux) == ESP_OK) {
+		sample.value[TELEMETRY_LUX] = lux > INT32_MAX ? INT32_MAX : (int32_t)lux;
+		sample.valid |= 1 << TELEMETRY_LUX;
+	}
+	veml_hold(VEML_TELEMETRY, false);
+
+	store_defer(telemetry_store, &sample, sizeof(sample));
+#if CONFIG_EVSTREAM
+	ev_sample_t ev = { .time = sample.time, .valid = sample.valid };
+	for (int ch = 0; ch < EV_SAMPLE_CHANNELS; ch++) ev.value[ch] = sample.value[ch];
+	evstream_send(EV_SAMPLE, &ev, sizeof(ev));
+#endif
+}
+
+static sched_job_t telemetrySample = SCHED_JOB_INIT(telemetry_sample_job, NULL, "telemetry");
+static sched_job_t telemetryPrepare = SCHED_JOB_INIT(telemetry_prepare_job, &telemetrySample, "telemetryPrepare");
+
+/* Sample on the interval boundaries of local time, the samples are stored rounded to them */
+static void telemetry_start(void)
+{
+	if (telemetry_init(CONFIG_TELEMETRY_INTERVAL_S) != ESP_OK) {
+		ESP_LOGE(TAG, "Telemetry off.");
+		return;
+	}
+	uint32_t now_s = timebase_now_us() / 1000000;
+	uint32_t wait_s = CONFIG_TELEMETRY_INTERVAL_S - now_s % CONFIG_TELEMETRY_INTERVAL_S;
+	sched_add(&telemetryPrepare, wait_s * 1000, CONFIG_TELEMETRY_INTERVAL_S * 1000);
+}
+
+#if CONFIG_MQTT_PUBLISH
+static uint32_t local_now_s(void)
+{
+	return timebase_now_us() / 1000000;
+}
+
+/* Device health for the broker, one compact JSON object */
+static int mqtt_health(char *buf, size_t size)
+{
+	timebase_stats_t tb;
+	timebase_get_stats(&tb);
+	i2c_dev_stats_t i2c;
+	i2c_dev_get_stats(I2C_NUM_0, &i2c);
+	wifi_ap_record_t ap = { .rssi = 0 };
+	esp_wifi_sta_get_ap_info(&ap);
+	int32_t sync_age = sync_state.last_sync_s ? (int32_t)(local_now_s() - sync_state.last_sync_s) : -1;
+
+	int n = snprintf(buf, size, "{\"up\":%" PRIu32 ",\"boot\":%d,\"heap\":%u,\"heap_min\":%u,\"ppb\":%" PRId32
+					 ",\"sync_age\":%" PRId32 ",\"i2c_fail\":%" PRIu32 ",\"rssi\":%d",
+					 (uint32_t)(esp_timer_get_time() / 1000000), boot_count,
+					 (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+					 tb.freq_ppb, sync_age, i2c.failures, ap.rssi);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	cpuload_stats_t load;
+	cpuload_get_stats(&load);
+	if (n > 0 && n < (int)size) n += snprintf(buf + n, size - n, ",\"rt_load\":%u", load.load_pm[RT_CORE]);
+#endif
+	if (n > 0 && n < (int)size) n += snprintf(buf + n, size - n, "}");
+	return n;
+}
+
+static void mqtt_init(void)
+{
+	static char topic[MQTTPUB_TOPIC_MAX / 2];
+	uint8_t mac[6] = {0};
+	esp_read_mac(mac, ESP_MAC_WIFI_STA);
+	snprintf(topic, sizeof(topic), "%s/%02x%02x%02x", CONFIG_MQTT_TOPIC, mac[3], mac[4], mac[5]);
+
+	const mqttpub_config_t cfg = {
+		.uri = CONFIG_MQTT_BROKER_URI,
+		.topic = topic,
+		.interval_s = CONFIG_MQTT_INTERVAL_S,
+		.window_s = CONFIG_MQTT_WINDOW_S,
+		.utc_offset_s = LOCAL_OFFSET_S,
+		.now_s = local_now_s,
+		.net_up = network_up,
+		.net_down = network_down,
+		.health = mqtt_health,
+	};
+	if (mqttpub_start(&cfg, CONFIG_PRIO_MQTT, NET_CORE) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not start MQTT publishing.");
+	}
+}
+#endif
+#endif
+
+#if CONFIG_NIGHT_MODE
+static nightmode_t night;
+// Settings, the night mode job picks changes up through nightConfig
+static int32_t night_start_h = CONFIG_NIGHT_START_HOUR;
+static int32_t night_end_h = CONFIG_NIGHT_END_HOUR;
+static int32_t night_dim_level = CONFIG_NIGHT_DIM_LEVEL;
+static int32_t night_dark_level = CONFIG_NIGHT_DARK_LEVEL;
+static int32_t night_hysteresis = CONFIG_NIGHT_HYSTERESIS;
+static int32_t night_dim_duty = CONFIG_NIGHT_DIM_DUTY;
+static int32_t night_wake_s = CONFIG_NIGHT_WAKE_S;
+static adc_oneshot_unit_handle_t photo_adc = NULL;
+static adc_channel_t photo_channel;
+static uint32_t buttons_last;
+static bool getClock_paused = false;
+
+static void photo_init(void)
+{
+	adc_unit_t unit;
+	if (adc_oneshot_io_to_channel(PHOTO_SENSOR, &unit, &photo_channel) != ESP_OK) return;
+
+	adc_oneshot_unit_init_cfg_t unit_cfg = {
+		.unit_id = unit,
+	};
+	if (adc_oneshot_new_unit(&unit_cfg, &photo_adc) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not init the photoresistor ADC.");
+		photo_adc = NULL;
+		return;
+	}
+
+	adc_oneshot_chan_cfg_t chan_cfg = {
+		.atten = ADC_ATTEN_DB_11,
+		.bitwidth = ADC_BITWIDTH_12,
+	};
+	adc_oneshot_config_channel(photo_adc, photo_channel, &chan_cfg);
+}
+
+/* Light level 0..4095, larger = brighter */
+static int32_t photo_read(void)
+{
+	int raw;
+	// GPIO16 is on ADC2, which Wi-Fi borrows while it is up
+	if (!photo_adc || adc_oneshot_read(photo_adc, photo_channel, &raw) != ESP_OK) return NIGHTMODE_NO_LIGHT;
+#if CONFIG_NIGHT_LIGHT_INVERT
+	raw = 4095 - raw;
+#endif
+	return raw;
+}
+
+static uint32_t buttons_read(void)
+{
+	return gpio_get_level(BTN1) | gpio_get_level(BTN2) << 1 | gpio_get_level(BTN3) << 2 | gpio_get_level(BTN4) << 3;
+}
+
+static void display_power_apply(nightmode_state_t from, nightmode_state_t to)
+{
+#if CONFIG_EVSTREAM
+	evstream_state(EV_MACHINE_NIGHT, from, to);
+#endif
+	dim_phase_us = to == NIGHTMODE_DIMMED ? VFD_REFRESH_PERIOD * night_dim_duty / 100 : VFD_REFRESH_PERIOD;
+	display_idle = to == NIGHTMODE_DEEP_IDLE;
+
+	if (to >= NIGHTMODE_BLANKED) {
+		display_blanked = true;
+	} else if (from >= NIGHTMODE_BLANKED) {
+		display_blanked = false;
+		esp_timer_start_once(resume_timer_handle, 1);
+	}
+
+#if CONFIG_INFO_PAGES
+	if (to >= NIGHTMODE_BLANKED) {
+		info_pause(true);
+	} else if (from >= NIGHTMODE_BLANKED) {
+		info_pause(false);
+	}
+#endif
+
+	if (to == NIGHTMODE_DEEP_IDLE) {
+		// Nobody is looking, leave the RTC and the LED alone until a button is pressed
+		getClock_paused = getClock.armed;
+		sched_cancel(&getClock);
+		sched_cancel(&ledBlink);
+		gpio_set_level(LED_MCU, 1);
+	} else if (from == NIGHTMODE_DEEP_IDLE) {
+		if (getClock_paused) sched_add(&getClock, 0, 1000);
+		sched_add(&ledBlink, 0, 1000);
+	}
+}
+
+#if CONFIG_NIGHT_DEEP_SLEEP
+/* Nobody is looking and it is night: sleep until RTC alarm 2 at NIGHT_END_HOUR or a button press */
+static void night_deep_sleep(void)
+{
+	ESP_LOGI("nightMode", "Deep sleep until %02d:00", (int)night_end_h);
+	store_drain();
+	odometer_checkpoint(true);
+#if CONFIG_TELEMETRY
+	telemetry_flush(); // The samples after the next alarm start a new block anyway
+#endif
+	vfd_sleep_hold();
+
+	rtc_gpio_pullup_en(CONFIG_RTC_SQW_GPIO); // INT is open drain, active low
+	rtc_gpio_pulldown_dis(CONFIG_RTC_SQW_GPIO);
+	esp_sleep_enable_ext0_wakeup(CONFIG_RTC_SQW_GPIO, 0);
+	esp_sleep_enable_ext1_wakeup((1ULL << BTN1) | (1ULL << BTN2) | (1ULL << BTN3) | (1ULL << BTN4),
+								 BUTTON_PRESSED ? ESP_EXT1_WAKEUP_ANY_HIGH : ESP_EXT1_WAKEUP_ANY_LOW);
+	esp_deep_sleep_start();
+}
+#endif
+
+/* Samples buttons and light, and moves the display between its power states */
+static void night_job(void *arg)
+{
+	static uint32_t polls = 0;
+	static int32_t light = NIGHTMODE_NO_LIGHT;
+
+	// Any edge counts as activity, the buttons' polarity does not matter
+	uint32_t buttons = buttons_read();
+	bool activity = buttons != buttons_last;
+	buttons_last = buttons;
+
+	if (polls++ % NIGHT_LIGHT_EVERY == 0) {
+		int32_t sample = photo_read();
+		if (sample == NIGHTMODE_NO_LIGHT) {
+			// Keep the last level, a busy ADC does not mean the room went dark
+		} else if (light == NIGHTMODE_NO_LIGHT) {
+			light = sample;
+		} else {
+			light += (sample - light) / 4;
+		}
+	}
+
+	nightmode_state_t from = night.state;
+	nightmode_state_t to = nightmode_update(&night, timebase_now_us() / 1000000, light, activity);
+	if (to != from) {
+		ESP_LOGI("nightMode", "%s -> %s (light %" PRId32 ")", nightmode_state_name(from), nightmode_state_name(to), light);
+		display_power_apply(from, to);
+	}
+
+#if CONFIG_NIGHT_DEEP_SLEEP
+	if (to == NIGHTMODE_DEEP_IDLE && nightmode_is_night(&night, timebase_now_us() / 1000000)) night_deep_sleep();
+#endif
+}
+
+static sched_job_t nightMode = SCHED_JOB_INIT(night_job, NULL, "nightMode");
+
+static nightmode_config_t night_config(void)
+{
+	nightmode_config_t cfg = {
+		.night_start_min = night_start_h * 60,
+		.night_end_min = night_end_h * 60,
+		.dim_level = night_dim_level,
+		.dark_level = night_dark_level,
+		.hysteresis = night_hysteresis,
+		.wake_s = night_wake_s,
+		.deep_idle_s = CONFIG_NIGHT_DEEP_IDLE_S,
+		.min_dwell_s = CONFIG_NIGHT_MIN_DWELL_S,
+	};
+	return cfg;
+}
+
+/* A night setting changed, runs on the scheduler task like the night mode job */
+static void night_config_job(void *arg)
+{
+	night.cfg = night_config();
+	if (night.state == NIGHTMODE_DIMMED) dim_phase_us = VFD_REFRESH_PERIOD * night_dim_duty / 100;
+}
+
+static sched_job_t nightConfig = SCHED_JOB_INIT(night_config_job, NULL, "nightConfig");
+
+static void night_settings_apply(void)
+{
+	sched_add(&nightConfig, 0, 0);
+}
+
+static void night_init(void)
+{
+	nightmode_config_t cfg = night_config();
+	nightmode_init(&night, &cfg, timebase_now_us() / 1000000);
+	photo_init();
+	buttons_last = buttons_read();
+	sched_add(&nightMode, NIGHT_POLL_MS, NIGHT_POLL_MS);
+}
+#endif
+
+/*Counter Task*/
+// void CounterTask(void *pvParameters){
+//     uint8_t cnt = 0;
+//     while (1){
+        
+//         vfd_display_number = (cnt++) % 100;
+
+//         vTaskDelay(pdMS_TO_TICKS(1000));
+//     }
+// }
+
+/* Account the frame shown since frame_shown_us to the odometer. Runs on the esp_timer task. */
+static void frame_account(int64_t now)
+{
+	int64_t dwell = now - frame_shown_us;
+	frame_shown_us = now;
+	if (dwell <= 0 || !esp_timer_is_active(mux_timer_handle)) return; // Parked, nothing was lit
+
+	int64_t lit_us = exercise_active ? dwell : dwell * dim_phase_us / VFD_REFRESH_PERIOD;
+	odometer_account(shown_frame->seg, lit_us > UINT32_MAX ? UINT32_MAX : (uint32_t)lit_us);
+}
+
+#if CONFIG_EVSTREAM
+static portMUX_TYPE refresh_lock = portMUX_INITIALIZER_UNLOCKED;
+static ev_refresh_t refresh_hist; // Phase length deviation, filled by mux_callback and sent by the evRefresh job
+static ev_refresh_t refresh_total; // Sum of the reports since boot, for the shell
+static int64_t refresh_last_us; // Start of the previous phase, 0 = parked
+
+static void refresh_account(int64_t now)
+{
+	if (refresh_last_us) {
+		int64_t dev = now - refresh_last_us - VFD_REFRESH_PERIOD;
+		uint32_t us = dev < 0 ? -dev : dev;
+		portENTER_CRITICAL(&refresh_lock);
+		refresh_hist.bucket[evstream_bucket(us)]++;
+		refresh_hist.phases++;
+		if (us > refresh_hist.dev_max_us) refresh_hist.dev_max_us = us;
+		portEXIT_CRITICAL(&refresh_lock);
+		if (us > VFD_REFRESH_PERIOD / 2) DLOGW(TAG, "Mux phase off by %" PRIu32 " us", us);
+	}
+	refresh_last_us = now;
+}
+
+static void evRefresh_job(void *arg)
+{
+	ev_refresh_t ev;
+	portENTER_CRITICAL(&refresh_lock);
+	ev = refresh_hist;
+	memset(&refresh_hist, 0, sizeof(refresh_hist));
+	refresh_total.phases += ev.phases;
+	if (ev.dev_max_us > refresh_total.dev_max_us) refresh_total.dev_max_us = ev.dev_max_us;
+	for (int i = 0; i < EV_REFRESH_BUCKETS; i++) refresh_total.bucket[i] += ev.bucket[i];
+	portEXIT_CRITICAL(&refresh_lock);
+
+	ev.period_us = VFD_REFRESH_PERIOD;
+	if (ev.phases) evstream_send(EV_REFRESH, &ev, sizeof(ev));
+}
+
+static sched_job_t evRefresh = SCHED_JOB_INIT(evRefresh_job, NULL, "evRefresh");
+
+/* Deferred log records go to the host unformatted, the rest is formatted here */
+static void dlog_sink(const dlog_record_t *rec)
+{
+	esp_err_t res = evstream_log(rec);
+	if (res != ESP_OK && res != ESP_FAIL) dlog_print(rec); // ESP_FAIL was dropped and counted
+}
+#endif
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/* Closes a CPU load window, see cpuload.h */
+static void cpuLoad_job(void *arg)
+{
+	bool over = cpuload_update();
+	cpuload_stats_t st;
+	cpuload_get_stats(&st);
+	if (over) {
+		DLOGW(TAG, "Core %d at %d.%d%%, over its %d%% budget", RT_CORE,
+			  st.load_pm[RT_CORE] / 10, st.load_pm[RT_CORE] % 10, st.budget_pm[RT_CORE] / 10);
+	}
+#if CONFIG_EVSTREAM
+	_Static_assert(EV_LOAD_CORES == portNUM_PROCESSORS, "One load per core");
+	ev_load_t ev = { .window_ms = st.window_ms > UINT16_MAX ? UINT16_MAX : st.window_ms };
+	for (int core = 0; core < EV_LOAD_CORES; core++) {
+		ev.load_pm[core] = st.load_pm[core];
+		ev.budget_pm[core] = st.budget_pm[core];
+		ev.over_budget[core] = st.over_budget[core];
+	}
+	evstream_send(EV_LOAD, &ev, sizeof(ev));
+#endif
+}
+
+static sched_job_t cpuLoad = SCHED_JOB_INIT(cpuLoad_job, NULL, "cpuLoad");
+
+static void cpuload_start(void)
+{
+	uint16_t budget[portNUM_PROCESSORS];
+	for (int core = 0; core < portNUM_PROCESSORS; core++) budget[core] = CPULOAD_NO_BUDGET;
+	budget[RT_CORE] = CONFIG_RT_LOAD_BUDGET_PCT * 10;
+	cpuload_init(budget);
+	sched_add(&cpuLoad, CONFIG_CPU_LOAD_WINDOW_MS, CONFIG_CPU_LOAD_WINDOW_MS);
+
+	// The esp_timer task (display refresh) is pinned by sdkconfig, not here
+	TaskHandle_t timer_task = xTaskGetHandle("esp_timer");
+	if (timer_task && xTaskGetAffinity(timer_task) != RT_CORE) {
+		ESP_LOGW(TAG, "The esp_timer task is not on the real-time core %d, see sdkconfig.defaults.", RT_CORE);
+	}
+}
+#endif
+
+#if CONFIG_HEAP_GUARD
+/* Every periodic job has run at least once, newlib's lazy buffers are in place */
+static void guardArm_job(void *arg)
+{
+	heapguard_arm(CONFIG_HEAP_GUARD_ABORT);
+	DLOGI(TAG, "Heap guard armed, %u bytes free.", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+}
+
+static sched_job_t guardArm = SCHED_JOB_INIT(guardArm_job, NULL, "guardArm");
+#endif
+
+/* Log guarded heap allocations and static stacks running low */
+static void guardReport_job(void *arg)
+{
+#if CONFIG_HEAP_GUARD
+	static uint32_t reported;
+	heapguard_stats_t hg;
+	heapguard_get_stats(&hg);
+	if (hg.allocs != reported) {
+		reported = hg.allocs;
+		ESP_LOGW(TAG, "%" PRIu32 " heap allocations after boot on the real-time path, the last of %" PRIu32 " bytes by %s.",
+				 hg.allocs, hg.last_size, hg.last_task);
+	}
+#endif
+
+	// Deleted tasks are not listed, the clock tasks other than syncClock end
+	static bool first = true;
+	const TaskHandle_t tasks[] = { sched_task(), dlog_task(), store_task_handle, syncClock_task };
+	for (size_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+		if (!tasks[i]) continue;
+		UBaseType_t left = uxTaskGetStackHighWaterMark(tasks[i]);
+		if (left < STACK_MARGIN_MIN) ESP_LOGW(TAG, "Task %s had %u bytes of stack left at its deepest.", pcTaskGetName(tasks[i]), (unsigned)left);
+		else if (first) ESP_LOGI(TAG, "Task %s has %u bytes of stack left at its deepest.", pcTaskGetName(tasks[i]), (unsigned)left);
+	}
+
+	// Once, with every job having run: the numbers to compare builds by
+	if (first) {
+		ESP_LOGI(TAG, "Heap %u bytes free, %u at least, %u tasks.", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+				 (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (unsigned)uxTaskGetNumberOfTasks());
+		first = false;
+	}
+}
+
+static sched_job_t guardReport = SCHED_JOB_INIT(guardReport_job, NULL, "guardReport");
+
+static void heapguard_start(void)
+{
+#if CONFIG_HEAP_GUARD
+	// The display refresh and the scheduler jobs, and the log drain on the other core
+	heapguard_watch_core(RT_CORE);
+	heapguard_watch(dlog_task());
+	sched_add(&guardArm, CONFIG_HEAP_GUARD_SETTLE_S * 1000, 0);
+#endif
+	sched_add(&guardReport, GUARD_REPORT_S * 1000, GUARD_REPORT_S * 1000);
+}
+
+/* Timer callbacks */
+void mux_callback(void *param){
+#if CONFIG_EVSTREAM
+	refresh_account(esp_timer_get_time());
+#endif
+	if (display_blanked && !exercise_active) {
+		// Parked from the esp_timer task, so no phase can be latched after the blank
+		frame_account(esp_timer_get_time());
+#if CONFIG_EVSTREAM
+		refresh_last_us = 0;
+#endif
+		anim_kf = NULL;
+		shown_frame = &display_frame;
+		vfd_hold_blank(true);
+		esp_timer_stop(mux_timer_handle);
+		power_display_muxing(false);
+		return;
+	}
+    
+    if (exercise_active) {
+		bool done;
+		const vfd_frame_t *step = antipoison_tick(&exercise, &done);
+		if (step || done) {
+			frame_account(esp_timer_get_time());
+			shown_frame = done ? &display_frame : step;
+			exercise_active = !done; // A blanked display parks on the next phase
+		}
+	} else if (anim_kf) {
+		bool done;
+		const anim_keyframe_t *kf = anim_tick(&anim, &done);
+		if (kf || done) {
+			frame_account(esp_timer_get_time());
+			anim_kf = done ? NULL : kf;
+			shown_frame = done ? &display_frame : &kf->first;
+		}
+	}
+
+    // vfd_value(vfd_display_number, mux_select);
+	power_shift_begin();
+	vfd_show_frame(shown_frame, mux_select);
+	power_shift_end();
+
+	// Second half of a transition keyframe, scaled into the lit part of the phase
+	if (anim_kf && anim_kf->split < ANIM_LEVELS && !exercise_active) {
+		split_position = mux_select;
+		esp_timer_start_once(split_timer_handle, dim_phase_us * anim_kf->split / ANIM_LEVELS + 1);
+	}
+    mux_select = (mux_select + 1) % VFD_GRIDS;
+
+	// The exercise runs at full brightness
+	if (dim_phase_us < VFD_REFRESH_PERIOD && !exercise_active) esp_timer_start_once(dim_timer_handle, dim_phase_us);
+}
+
+/* Switches a transition keyframe over to its second frame */
+void split_callback(void *param){
+	if (!anim_kf) return;
+
+	power_shift_begin();
+	vfd_show_frame(&anim_kf->second, split_position);
+	power_shift_end();
+}
+
+/* Ends the lit part of a dimmed phase */
+void dim_callback(void *param){
+	vfd_blank_outputs();
+}
+
+/* Brings a parked display back. Runs on the esp_timer task like mux_callback, the display is up within one frame. */
+void resume_callback(void *param){
+	if (!esp_timer_is_active(second_timer_handle)) esp_timer_start_once(second_timer_handle, 1);
+	if (!esp_timer_is_active(mux_timer_handle)) {
+		frame_shown_us = esp_timer_get_time();
+		vfd_hold_blank(false);
+		power_display_muxing(true);
+		esp_timer_start_periodic(mux_timer_handle, VFD_REFRESH_PERIOD);
+	}
+}
+
+/* Starts a built exercise sequence on the esp_timer task, bringing a parked display up for it */
+void exercise_callback(void *param){
+	exercise_active = true;
+	resume_callback(NULL);
+}
+
+/* Re-render the display when a visible layer changed or timed out, with a transition if animate is set.
+ * Runs on the esp_timer task, shared with mux_callback, so no tearing. */
+static void display_compose(bool animate)
+{
+	static char shown_string[VFD_TUBES + 1];
+	static int64_t armed_expiry = 0;
+	char composed[VFD_TUBES + 1];
+	int64_t now = esp_timer_get_time();
+
+	frame_account(now);
+#if CONFIG_ANIM_TYPE > 0
+	vfd_frame_t from = *shown_frame;
+	if (comp_render(now, &display_frame, composed)) {
+		if (animate && !exercise_active && !display_blanked &&
+			anim_compile(&anim, CONFIG_ANIM_TYPE, &from, &display_frame, shown_string, composed,
+						 CONFIG_ANIM_DURATION_MS * 1000 / VFD_REFRESH_PERIOD)) {
+			anim_kf = &anim.kf[0]; // mux_callback picks up the first keyframe on its next phase
+		} else {
+			anim_kf = NULL;
+		}
+		shown_frame = &display_frame; // May have pointed into the old keyframes, nothing is shifted before the next phase
+		strcpy(shown_string, composed);
+	}
+#else
+	(void)shown_string;
+	comp_render(now, &display_frame, composed);
+#endif
+
+	// Wake up again for the next layer timeout, nothing runs while no layer has one
+	int64_t expiry = comp_next_expiry();
+	if (expiry == armed_expiry) return;
+	armed_expiry = expiry;
+	esp_timer_stop(compose_timer_handle);
+	if (expiry) esp_timer_start_once(compose_timer_handle, expiry > now ? expiry - now : 1);
+}
+
+void compose_callback(void *param){
+	display_compose(true);
+}
+
+/* Runs on every second boundary of the timebase. Shares the esp_timer task with mux_callback, so no tearing */
+void second_callback(void *param){
+	int64_t now = timebase_now_us();
+	time_t sec = now / 1000000;
+	struct tm timeinfo;
+	gmtime_r(&sec, &timeinfo); // The timebase already runs in local time
+
+	sprintf(vfd_display_string, "%02d%02d%02d", timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+
+	// Encode once per second at most, the mux phases only shift out the bytes
+	comp_set(COMP_LAYER_CLOCK, vfd_display_string, clock_dp, COMP_MASK_ALL, 0, esp_timer_get_time());
+	display_compose(true);
+
+	if (display_idle) return; // resume_callback restarts us
+
+	int64_t delay_us = timebase_timer_at((int64_t)(sec + 1) * 1000000) - esp_timer_get_time();
+	esp_timer_start_once(second_timer_handle, delay_us > 0 ? delay_us : 1);
+}
+
+#if CONFIG_STOPWATCH
+/* Stopwatch and countdown, see stopwatch.h.
+ * BTN4 switches clock -> stopwatch -> countdown -> clock, BTN3 starts and stops,
+ * BTN2 splits (running) or resets (stopped), BTN1 adds a minute to a stopped countdown. */
+#define STOPWATCH_REFRESH_US 10000 // Centiseconds
+#define BUTTON_DEBOUNCE_US 20000
+#define BUTTONS 4
+
+_Static_assert(VFD_TUBES >= 6, "The stopwatch needs six tubes");
+
+static const gpio_num_t button_pins[BUTTONS] = {BTN1, BTN2, BTN3, BTN4};
+static volatile int64_t button_edge_us[BUTTONS]; // First edge of a bounce, taken as the press time
+static volatile uint32_t button_pending = 0; // Buttons waiting out their bounce
+static uint32_t button_state = 0; // Debounced, bit set = pressed
+static portMUX_TYPE button_lock = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t button_timer_handle = NULL;
+esp_timer_handle_t stopwatch_timer_handle = NULL;
+
+static stopwatch_t watch;
+static bool watch_mode = false;
+static uint32_t watch_shown_cs = UINT32_MAX;
+static struct {
+	uint32_t updates; // Refresh callbacks
+	uint32_t renders; // ...that changed the digits
+	uint64_t busy_us;
+	uint32_t max_us;
+} watch_cost;
+
+/* Log what the 100 Hz refresh cost since the last report */
+static void watch_report(void)
+{
+	if (watch_cost.updates == 0) return;
+
+	uint32_t load = watch_cost.busy_us * 10000 / ((uint64_t)watch_cost.updates * STOPWATCH_REFRESH_US); // 0.01 %
+	ESP_LOGI(TAG, "Stopwatch refresh: %" PRIu32 " updates, %" PRIu32 " renders, %" PRIu32 " us mean, %" PRIu32 " us max, %" PRIu32 ".%02" PRIu32 " %% CPU",
+			 watch_cost.updates, watch_cost.renders, (uint32_t)(watch_cost.busy_us / watch_cost.updates), watch_cost.max_us,
+			 load / 100, load % 100);
+	memset(&watch_cost, 0, sizeof(watch_cost));
+}
+
+/* Put the watch on the timer layer if its digits changed */
+static void watch_render(int64_t now)
+{
+	if (stopwatch_expire(&watch, now)) {
+		esp_timer_stop(stopwatch_timer_handle);
+		display_show(COMP_LAYER_NOTIFY, "  End ", 0, COMP_MASK_ALL, notify_ms);
+	}
+
+	int64_t value = stopwatch_value(&watch, now);
+	uint32_t cs = value / 10000;
+	if (cs == watch_shown_cs) return;
+	watch_shown_cs = cs;
+
+	char text[VFD_TUBES + 1];
+	uint32_t dp;
+	stopwatch_format(value, text, &dp);
+	comp_set(COMP_LAYER_TIMER, text, dp, COMP_MASK_ALL, 0, now);
+	display_compose(false); // Digits change every 10 ms, no transitions
+	watch_cost.renders++;
+}
+
+/* Runs every 10 ms on the esp_timer task while the watch runs */
+void stopwatch_callback(void *param){
+	int64_t start = esp_timer_get_time();
+	if (display_blanked) {
+		stopwatch_expire(&watch, start); // Keep counting, but nobody sees the digits
+		return;
+	}
+	watch_render(start);
+
+	uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+	watch_cost.updates++;
+	watch_cost.busy_us += us;
+	if (us > watch_cost.max_us) watch_cost.max_us = us;
+}
+
+/* Refresh at 100 Hz while the watch runs, otherwise only show where it stands */
+static void watch_changed(int64_t now)
+{
+	if (watch_mode && watch.running) {
+		if (!esp_timer_is_active(stopwatch_timer_handle)) esp_timer_start_periodic(stopwatch_timer_handle, STOPWATCH_REFRESH_US);
+	} else {
+		esp_timer_stop(stopwatch_timer_handle);
+		watch_report();
+	}
+
+	if (!watch_mode) return;
+	watch_shown_cs = UINT32_MAX;
+	watch_render(now);
+}
+
+#if CONFIG_EVSTREAM
+/* EV_MACHINE_WATCH state */
+static uint8_t watch_state(void)
+{
+	return !watch_mode ? 0 : watch.dir == STOPWATCH_UP ? 1 : 2;
+}
+#endif
+
+static void watch_mode_next(void)
+{
+#if CONFIG_EVSTREAM
+	uint8_t from = watch_state();
+#endif
+	if (!watch_mode) {
+		watch_mode = true;
+		stopwatch_init(&watch, STOPWATCH_UP, 0);
+#if CONFIG_INFO_PAGES
+		info_pause(true); // Hidden under the watch anyway
+#endif
+	} else if (watch.dir == STOPWATCH_UP) {
+		stopwatch_init(&watch, STOPWATCH_DOWN, (int64_t)CONFIG_COUNTDOWN_MIN * 60 * 1000000);
+	} else {
+		watch_mode = false;
+		display_clear(COMP_LAYER_TIMER);
+#if CONFIG_INFO_PAGES
+		info_pause(false);
+#endif
+	}
+#if CONFIG_EVSTREAM
+	evstream_state(EV_MACHINE_WATCH, from, watch_state());
+#endif
+}
+
+/* A debounced press, at_us is the time of its first edge */
+static void button_press(int button, int64_t at_us)
+{
+	if (display_blanked) return; // This press only wakes the display, see night_job
+
+	switch (button_pins[button]) {
+		case BTN4:
+			watch_mode_next();
+			break;
+		case BTN3:
+			if (watch_mode) stopwatch_start_stop(&watch, at_us);
+			break;
+		case BTN2:
+			if (!watch_mode) break;
+			if (!watch.running) {
+				stopwatch_reset(&watch);
+			} else if (stopwatch_split(&watch, at_us)) {
+				ESP_LOGI(TAG, "Lap %u: %" PRId64 " ms", watch.laps, watch.lap_us[(watch.laps - 1) % STOPWATCH_MAX_LAPS] / 1000);
+			}
+			break;
+		case BTN1:
+			if (watch_mode && watch.dir == STOPWATCH_DOWN && !watch.running) {
+				int64_t preset = watch.preset_us + 60 * 1000000LL;
+				if (preset >= 100 * 60 * 1000000LL) preset = 60 * 1000000LL; // MMSScc tops out at 99 minutes
+				stopwatch_init(&watch, STOPWATCH_DOWN, preset);
+			}
+			break;
+		default:
+			break;
+	}
+	watch_changed(esp_timer_get_time());
+}
+
+/* Samples the buttons once their bounce is over. Runs on the esp_timer task. */
+void button_callback(void *param){
+	int64_t now = esp_timer_get_time();
+	int64_t wait_us = 0;
+
+	for (int i = 0; i < BUTTONS; i++) {
+		uint32_t bit = 1 << i;
+		if (!(button_pending & bit)) continue;
+
+		int64_t since = now - button_edge_us[i];
+		if (since < BUTTON_DEBOUNCE_US) {
+			if (BUTTON_DEBOUNCE_US - since > wait_us) wait_us = BUTTON_DEBOUNCE_US - since;
+			continue;
+		}
+
+		portENTER_CRITICAL(&button_lock);
+		button_pending &= ~bit;
+		portEXIT_CRITICAL(&button_lock);
+
+		bool pressed = gpio_get_level(button_pins[i]) == BUTTON_PRESSED;
+		if (pressed && !(button_state & bit)) button_press(i, button_edge_us[i]);
+		button_state = pressed ? button_state | bit : button_state & ~bit;
+	}
+
+	if (wait_us) esp_timer_start_once(button_timer_handle, wait_us);
+}
+
+/* Timer service task, hands the debounce over to the esp_timer task */
+static void button_defer(void *arg1, uint32_t arg2)
+{
+	esp_timer_start_once(button_timer_handle, BUTTON_DEBOUNCE_US); // Already armed: button_callback picks this one up too
+}
+
+/* Edge interrupt. Light sleep never lasts across a press while the mux runs (one phase is shorter than
+ * the idle time the sleep needs), and while the display is parked presses only wake it, see night_job. */
+static void button_isr(void *arg)
+{
+	int i = (intptr_t)arg;
+	BaseType_t woken = pdFALSE;
+	bool first;
+
+	portENTER_CRITICAL_ISR(&button_lock);
+	first = !(button_pending & (1 << i));
+	if (first) {
+		button_edge_us[i] = esp_timer_get_time();
+		button_pending |= 1 << i;
+	}
+	portEXIT_CRITICAL_ISR(&button_lock);
+
+	if (first) xTimerPendFunctionCallFromISR(button_defer, NULL, 0, &woken);
+	if (woken) portYIELD_FROM_ISR();
+}
+
+static void stopwatch_init_buttons(void)
+{
+	const esp_timer_create_args_t button_timer_args =
+		{
+			.callback = &button_callback,
+			.name = "Button Debounce"};
+
+	esp_timer_create(&button_timer_args, &button_timer_handle);
+
+	const esp_timer_create_args_t stopwatch_timer_args =
+		{
+			.callback = &stopwatch_callback,
+			.name = "Stopwatch Refresh"};
+
+	esp_timer_create(&stopwatch_timer_args, &stopwatch_timer_handle);
+
+	gpio_install_isr_service(0); // May already be installed for the RTC square wave
+	for (int i = 0; i < BUTTONS; i++) {
+		gpio_set_intr_type(button_pins[i], GPIO_INTR_ANYEDGE);
+		gpio_isr_handler_add(button_pins[i], button_isr, (void *)(intptr_t)i);
+		if (gpio_get_level(button_pins[i]) == BUTTON_PRESSED) button_state |= 1 << i;
+	}
+}
+#endif
+
+#if RTC_SQW_EDGES
+static void rtc_sqw_isr(void *arg)
+{
+	// The seconds register increments on the falling edge of the 1 Hz square wave
+	timebase_rtc_edge(esp_timer_get_time());
+}
+
+static void rtc_sqw_init(void)
+{
+	if (ds3231_enable_squarewave(&rtc_dev, DS3231_SQWAVE_1HZ) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not enable RTC square wave.");
+		return;
+	}
+
+	gpio_config_t GPIO_CONF_SQW =
+	{
+	.pin_bit_mask = (1ULL << CONFIG_RTC_SQW_GPIO),    // Bit mask
+	.mode = GPIO_MODE_INPUT,   // Pin mode
+	.pull_up_en = GPIO_PULLUP_ENABLE,  // INT/SQW is open drain
+	.pull_down_en = GPIO_PULLDOWN_DISABLE,
+	.intr_type = GPIO_INTR_NEGEDGE,
+	};
+	gpio_config(&GPIO_CONF_SQW);
+
+	gpio_install_isr_service(0);
+	gpio_isr_handler_add(CONFIG_RTC_SQW_GPIO, rtc_sqw_isr, NULL);
+}
+#endif
+
+
+#if CONFIG_RTC_ALARMS
+/* DS3231 alarms on INT. The RTC keeps the schedule, nothing runs between occurrences. */
+static void rtc_alarm_job(void *arg)
+{
+	ds3231_alarm_t fired;
+	if (ds3231_get_alarm_flags(&rtc_dev, &fired) != ESP_OK || fired == DS3231_ALARM_NONE) return;
+	ds3231_clear_alarm_flags(&rtc_dev, fired); // Releases INT for the next one
+	ESP_LOGI(TAG, "RTC alarm%s%s", fired & DS3231_ALARM_1 ? " 1" : "", fired & DS3231_ALARM_2 ? " 2" : "");
+
+#if CONFIG_ANTIPOISON
+	if (fired & DS3231_ALARM_1) sched_add(&antiPoison, 0, 0);
+#endif
+	// Alarm 2 only ends NIGHT_DEEP_SLEEP, waking up was all it had to do
+}
+
+static sched_job_t rtcAlarm = SCHED_JOB_INIT(rtc_alarm_job, NULL, "rtcAlarm");
+
+/* Timer service task, hands the alarm over to the scheduler, which may use I2C */
+static void rtc_alarm_defer(void *arg1, uint32_t arg2)
+{
+	sched_add(&rtcAlarm, 0, 0);
+}
+
+static void rtc_alarm_isr(void *arg)
+{
+	BaseType_t woken = pdFALSE;
+	xTimerPendFunctionCallFromISR(rtc_alarm_defer, NULL, 0, &woken);
+	if (woken) portYIELD_FROM_ISR();
+}
+
+/* Program the alarms and switch INT/SQW over to them. Call after sched_start(). */
+static void rtc_alarm_init(void)
+{
+	ds3231_alarm_t used = DS3231_ALARM_NONE;
+	struct tm exercise_at = { 0 };
+	struct tm wake_at = { 0 };
+#if CONFIG_ANTIPOISON
+	exercise_at.tm_hour = CONFIG_ANTIPOISON_HOUR;
+	used |= DS3231_ALARM_1;
+#endif
+#if CONFIG_NIGHT_DEEP_SLEEP
+	wake_at.tm_hour = night_end_h;
+	used |= DS3231_ALARM_2;
+#endif
+
+	if ((used != DS3231_ALARM_NONE &&
+		 ds3231_set_alarm(&rtc_dev, used, &exercise_at, DS3231_ALARM1_MATCH_SECMINHOUR, &wake_at, DS3231_ALARM2_MATCH_MINHOUR) != ESP_OK) ||
+		ds3231_enable_alarm_ints(&rtc_dev, used) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not set the RTC alarms.");
+		return;
+	}
+
+	gpio_config_t GPIO_CONF_INT =
+	{
+	.pin_bit_mask = (1ULL << CONFIG_RTC_SQW_GPIO),    // Bit mask
+	.mode = GPIO_MODE_INPUT,   // Pin mode
+	.pull_up_en = GPIO_PULLUP_ENABLE,  // INT/SQW is open drain
+	.pull_down_en = GPIO_PULLDOWN_DISABLE,
+	.intr_type = GPIO_INTR_NEGEDGE,
+	};
+	gpio_config(&GPIO_CONF_INT);
+
+	gpio_install_isr_service(0);
+	gpio_isr_handler_add(CONFIG_RTC_SQW_GPIO, rtc_alarm_isr, NULL);
+
+	// An alarm that fired while we were asleep (or off) holds INT low already, no edge will come for it
+	sched_add(&rtcAlarm, 0, 0);
+}
+#endif
+
+// Runtime settings, see settings.h. Kconfig holds the defaults.
+static const setting_t settings_table[] = {
+	{ "notify_ms", &notify_ms, 500, 30000, NULL, "How long a notification covers the clock" },
+#if CONFIG_NIGHT_MODE
+	{ "night_start", &night_start_h, 0, 23, night_settings_apply, "Hour the night schedule starts" },
+	{ "night_end", &night_end_h, 0, 23, night_settings_apply, "Hour it ends, the deep sleep alarm follows after a reset" },
+	{ "dim_level", &night_dim_level, 0, 4095, night_settings_apply, "Dim below this light level" },
+	{ "dark_level", &night_dark_level, 0, 4095, night_settings_apply, "Blank below this light level" },
+	{ "hysteresis", &night_hysteresis, 0, 1000, night_settings_apply, "Light level margin to leave a darker state" },
+	{ "dim_duty", &night_dim_duty, 5, 99, night_settings_apply, "Dimmed brightness (%)" },
+	{ "wake_s", &night_wake_s, 1, 3600, night_settings_apply, "Display stays up after a button press (s)" },
+#endif
+};
+
+#if CONFIG_SHELL
+static int cmd_i2c(int argc, char **argv)
+{
+	i2c_dev_stats_t st;
+	i2c_dev_get_stats(I2C_NUM_0, &st);
+	uint32_t attempts = st.transactions + st.retries;
+	printf("i2c %" PRIu32 " transactions, %" PRIu32 " retries, %" PRIu32 " failed\n", st.transactions, st.retries, st.failures);
+	printf("    %" PRIu32 " nacks, %" PRIu32 " timeouts, %" PRIu32 " other errors, %" PRIu32 " bus recoveries\n",
+		   st.nacks, st.timeouts, st.other, st.recoveries);
+	printf("    %" PRIu32 " us mean, %" PRIu32 " us max, %" PRIu32 " us last\n",
+		   attempts ? (uint32_t)(st.total_us / attempts) : 0, st.max_us, st.last_us);
+	return 0;
+}
+
+static int cmd_refresh(int argc, char **argv)
+{
+	ev_refresh_t total;
+	portENTER_CRITICAL(&refresh_lock);
+	total = refresh_total;
+	portEXIT_CRITICAL(&refresh_lock);
+
+	printf("refresh %" PRIu32 " phases of %d us, max deviation %" PRIu32 " us\n", total.phases, VFD_REFRESH_PERIOD, total.dev_max_us);
+	for (int i = 0; i < EV_REFRESH_BUCKETS; i++) {
+		if (!total.bucket[i]) continue;
+		uint32_t lo = i ? 1 << (i - 1) : 0;
+		printf("  %5" PRIu32 "%s us %10" PRIu32 "\n", lo, i == EV_REFRESH_BUCKETS - 1 ? "+" : " ", total.bucket[i]);
+	}
+	return 0;
+}
+
+static int cmd_stats(int argc, char **argv)
+{
+	sched_stats_t sched;
+	sched_get_stats(&sched);
+	printf("scheduler %" PRIu32 " wakeups, %" PRIu32 " runs, %" PRIu32 " armed\n", sched.wakeups, sched.runs, sched.armed);
+
+	timebase_stats_t tb;
+	timebase_get_stats(&tb);
+	printf("timebase %s, %" PRId32 " ppb, last error %" PRId32 " us, %" PRIu32 " edges, %" PRIu32 " steps\n",
+		   tb.valid ? "valid" : "not set", tb.freq_ppb, tb.last_error_us, tb.edges, tb.steps);
+
+	dlog_stats_t dl;
+	dlog_get_stats(&dl);
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		printf("dlog core %d %" PRIu32 " records, %" PRIu32 " dropped, %" PRIu32 " waiting at most, "
+			   "%" PRIu32 " cycles a record (%" PRIu32 " max, timestamp %" PRIu32 " max)\n",
+			   core, dl.records[core], dl.dropped[core], dl.high_water[core],
+			   dl.put_cycles_avg[core], dl.put_cycles_max[core], dl.stamp_cycles_max[core]);
+	}
+
+	evstream_stats_t ev;
+	evstream_get_stats(&ev);
+	printf("evstream %" PRIu32 " frames, %" PRIu32 " dropped, %" PRIu64 " bytes\n", ev.frames, ev.dropped, ev.bytes);
+
+#if CONFIG_HEAP_GUARD
+	heapguard_stats_t hg;
+	heapguard_get_stats(&hg);
+	printf("heap guard %s, %" PRIu32 " allocations, %" PRIu32 " bytes", hg.armed ? "armed" : "not armed", hg.allocs, hg.bytes);
+	if (hg.allocs) printf(", the last of %" PRIu32 " bytes by %s", hg.last_size, hg.last_task);
+	printf("\n");
+#endif
+
+#if CONFIG_FLEET_SYNC
+	static const char *roles[] = { "listening", "follower", "leader" };
+	fleet_stats_t fl;
+	fleet_get_stats(&fl);
+	printf("fleet %s, leader %08" PRIx32 " quality %u, delay %" PRId32 " us, last offset %" PRId32 " us\n",
+		   roles[fl.role], fl.leader, fl.leader_quality, fl.delay_us, fl.offset_us);
+	printf("fleet %" PRIu32 " beacons sent, %" PRIu32 " heard, %" PRIu32 " corrections, %" PRIu32 " elections, %" PRIu32 " bad\n",
+		   fl.beacons_sent, fl.beacons_heard, fl.corrections, fl.elections, fl.bad);
+#endif
+
+#if CONFIG_MQTT_PUBLISH
+	mqttpub_stats_t mq;
+	mqttpub_get_stats(&mq);
+	printf("mqtt %" PRIu32 " windows, %" PRIu32 " offline, %" PRIu32 " messages, %" PRIu32 " samples, %" PRIu32 " queued, last window %" PRIu32 " ms\n",
+		   mq.windows, mq.offline, mq.messages, mq.samples, mq.backlog, mq.last_window_ms);
+#endif
+
+#if CONFIG_SERVE_NTP
+	ntpserver_stats_t ntp;
+	ntpserver_get_stats(&ntp);
+	printf("time server %" PRIu32 " requests, %" PRIu32 " replies, %" PRIu32 " unsynchronized, %" PRIu32 " ignored, %" PRIu32 " failed\n",
+		   ntp.requests, ntp.replies, ntp.unsynced, ntp.ignored, ntp.send_failed);
+#endif
+	return 0;
+}
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define STRESS_PRIO 18 // The lwIP task's, stands in for a busy network stack
+#define STRESS_PERIOD_MS 100
+
+#define STRESS_STACK_SIZE 2048
+
+static volatile int64_t stress_until_us;
+static volatile uint32_t stress_pct;
+static StackType_t stress_stack[STRESS_STACK_SIZE];
+static StaticTask_t stress_task_buf;
+static TaskHandle_t stress_task_handle = NULL;
+
+/* Busy for stress_pct of every STRESS_PERIOD_MS on the network core until stress_until_us, then waits for the next run */
+static void stress_task(void *pvParameters)
+{
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		uint32_t busy_us = stress_pct * STRESS_PERIOD_MS * 10;
+		while (esp_timer_get_time() < stress_until_us) {
+			int64_t until = esp_timer_get_time() + busy_us;
+			while (esp_timer_get_time() < until) {
+			}
+			vTaskDelay(pdMS_TO_TICKS(STRESS_PERIOD_MS) - pdMS_TO_TICKS(busy_us / 1000));
+		}
+	}
+}
+
+static void print_load(const char *what, const uint16_t pm[portNUM_PROCESSORS])
+{
+	printf("%-8s", what);
+	for (int core = 0; core < portNUM_PROCESSORS; core++) printf("  core %d %3u.%u %%", core, pm[core] / 10, pm[core] % 10);
+	printf("\n");
+}
+
+static int cmd_load(int argc, char **argv)
+{
+	cpuload_stats_t st;
+	cpuload_get_stats(&st);
+	printf("%" PRIu32 " windows of %" PRIu32 " ms, real-time core %d\n", st.windows, st.window_ms, RT_CORE);
+	print_load("last", st.load_pm);
+	print_load("peak", st.peak_pm);
+	printf("core %d over its %u %% budget in %" PRIu32 " windows\n", RT_CORE, st.budget_pm[RT_CORE] / 10, st.over_budget[RT_CORE]);
+	return 0;
+}
+
+/* Load the network core and show what the real-time core and the refresh timing did meanwhile */
+static int cmd_stress(int argc, char **argv)
+{
+	uint32_t seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 10;
+	uint32_t pct = argc > 2 ? strtoul(argv[2], NULL, 10) : 90;
+	if (seconds < 1 || seconds > 600 || pct < 10 || pct > 90) {
+		printf("stress [1..600 s] [10..90 %%]\n");
+		return 1;
+	}
+	if (esp_timer_get_time() < stress_until_us) {
+		printf("Already running\n");
+		return 1;
+	}
+
+	cpuload_stats_t before, st;
+	ev_refresh_t refresh_before;
+	cpuload_get_stats(&before);
+	portENTER_CRITICAL(&refresh_lock);
+	refresh_before = refresh_total;
+	portEXIT_CRITICAL(&refresh_lock);
+
+	if (!stress_task_handle) {
+		stress_task_handle = xTaskCreateStaticPinnedToCore(stress_task, "stress", STRESS_STACK_SIZE, NULL, STRESS_PRIO,
+														   stress_stack, &stress_task_buf, NET_CORE);
+		if (!stress_task_handle) return 1;
+	}
+	stress_pct = pct;
+	stress_until_us = esp_timer_get_time() + seconds * 1000000LL;
+	xTaskNotifyGive(stress_task_handle);
+	printf("Core %d busy %" PRIu32 " %% for %" PRIu32 " s\n", NET_CORE, pct, seconds);
+
+	// Track the windows of the run, the peak in the stats is since boot
+	uint16_t peak[portNUM_PROCESSORS] = {0};
+	uint32_t seen = before.windows;
+	while (esp_timer_get_time() < stress_until_us) {
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_CPU_LOAD_WINDOW_MS));
+		cpuload_get_stats(&st);
+		if (st.windows == seen) continue;
+		seen = st.windows;
+		for (int core = 0; core < portNUM_PROCESSORS; core++) {
+			if (st.load_pm[core] > peak[core]) peak[core] = st.load_pm[core];
+		}
+	}
+
+	ev_refresh_t refresh;
+	portENTER_CRITICAL(&refresh_lock);
+	refresh = refresh_total;
+	portEXIT_CRITICAL(&refresh_lock);
+	int worst = -1;
+	for (int i = 0; i < EV_REFRESH_BUCKETS; i++) {
+		if (refresh.bucket[i] != refresh_before.bucket[i]) worst = i;
+	}
+
+	print_load("peak", peak);
+	printf("core %d over its %u %% budget in %" PRIu32 " of %" PRIu32 " windows\n", RT_CORE, st.budget_pm[RT_CORE] / 10,
+		   st.over_budget[RT_CORE] - before.over_budget[RT_CORE], st.windows - before.windows);
+	printf("%" PRIu32 " mux phases reported, worst deviation under %u us\n",
+		   refresh.phases - refresh_before.phases, worst < 0 ? 0 : 1u << worst);
+	return 0;
+}
+#endif
+
+#if CONFIG_STOPWATCH
+static esp_timer_handle_t mode_timer_handle = NULL;
+static volatile uint8_t mode_request; // watch_state() the shell asked for
+
+/* Switches the watch like BTN4 does, on the esp_timer task that owns it */
+void mode_callback(void *param){
+	for (int i = 0; i < 3 && watch_state() != mode_request; i++) watch_mode_next();
+	watch_changed(esp_timer_get_time());
+}
+
+static int cmd_mode(int argc, char **argv)
+{
+	static const char *const modes[] = { "clock", "stopwatch", "countdown" };
+	for (int i = 0; argc == 2 && i < 3; i++) {
+		if (strcmp(argv[1], modes[i])) continue;
+		mode_request = i;
+		esp_timer_start_once(mode_timer_handle, 0);
+		return 0;
+	}
+	printf("mode clock|stopwatch|countdown\n");
+	return 1;
+}
+#endif
+
+#if CONFIG_SET_CLOCK && ONLINE_MODE
+static int cmd_sync(int argc, char **argv)
+{
+	if (!syncClock_task) {
+		printf("No sync task, the first boot syncs anyway\n");
+		return 1;
+	}
+	sync_forced = true;
+	xTaskNotifyGive(syncClock_task);
+	printf("Syncing, see the log\n");
+	return 0;
+}
+#endif
+
+#if CONFIG_MQTT_PUBLISH
+static int cmd_publish(int argc, char **argv)
+{
+	mqttpub_trigger();
+	printf("Publishing, see mqtt in stats\n");
+	return 0;
+}
+#endif
+
+static void shell_init(void)
+{
+	if (shell_start(CONFIG_PRIO_SHELL, NET_CORE) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not start the shell.");
+		return;
+	}
+
+	const esp_console_cmd_t cmds[] = {
+		{ .command = "i2c", .help = "I2C bus counters", .func = cmd_i2c },
+		{ .command = "refresh", .help = "Mux phase timing histogram since boot", .func = cmd_refresh },
+		{ .command = "stats", .help = "Scheduler, timebase, deferred log and event stream counters", .func = cmd_stats },
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		{ .command = "load", .help = "CPU load per core and the real-time core budget", .func = cmd_load },
+		{ .command = "stress", .help = "Load the network core and report the real-time core and the refresh timing",
+		  .hint = "[s] [%]", .func = cmd_stress },
+#endif
+#if CONFIG_STOPWATCH
+		{ .command = "mode", .help = "Switch the display mode", .hint = "clock|stopwatch|countdown", .func = cmd_mode },
+#endif
+#if CONFIG_SET_CLOCK && ONLINE_MODE
+		{ .command = "sync", .help = "Sync the RTC with NTP now", .func = cmd_sync },
+#endif
+#if CONFIG_MQTT_PUBLISH
+		{ .command = "publish", .help = "Open an MQTT window now and send what is queued", .func = cmd_publish },
+#endif
+	};
+	for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) esp_console_cmd_register(&cmds[i]);
+
+#if CONFIG_STOPWATCH
+	const esp_timer_create_args_t mode_timer_args =
+		{
+			.callback = &mode_callback,
+			.name = "Shell Mode"};
+
+	esp_timer_create(&mode_timer_args, &mode_timer_handle);
+#endif
+}
+#endif
+
+#if CONFIG_SET_CLOCK || CONFIG_DIFF_CLOCK
+static StackType_t clock_stack[CLOCK_STACK_SIZE];
+static StaticTask_t clock_task_buf;
+static TaskHandle_t clock_task = NULL;
+
+/* setClock, syncClock and diffClock are alternatives, the one of this boot gets the clock stack */
+static TaskHandle_t clock_task_start(TaskFunction_t fn, const char *name)
+{
+	if (clock_task) {
+		ESP_LOGE(TAG, "%s: the clock stack is taken.", name);
+		return NULL;
+	}
+	clock_task = xTaskCreateStaticPinnedToCore(fn, name, CLOCK_STACK_SIZE, NULL, CONFIG_PRIO_NET,
+											   clock_stack, &clock_task_buf, NET_CORE);
+	return clock_task;
+}
+#endif
+
+void app_main()
+{
+	++boot_count;
+	DLOGI(TAG, "CONFIG_SCL_GPIO = %d", CONFIG_SCL_GPIO);
+	DLOGI(TAG, "CONFIG_SDA_GPIO = %d", CONFIG_SDA_GPIO);
+	DLOGI(TAG, "CONFIG_TIMEZONE= %d", CONFIG_TIMEZONE);
+	DLOGI(TAG, "Boot count: %d", boot_count);
+
+	esp_sleep_wakeup_cause_t wake = esp_sleep_get_wakeup_cause();
+	if (wake == ESP_SLEEP_WAKEUP_EXT0 || wake == ESP_SLEEP_WAKEUP_EXT1) {
+		ESP_LOGI(TAG, "Woken from deep sleep by %s.", wake == ESP_SLEEP_WAKEUP_EXT0 ? "an RTC alarm" : "a button");
+	}
+
+#if CONFIG_EVSTREAM
+	// Everything on J4 goes through the stream from here on, see tools/evstream.py
+	if (evstream_init() == ESP_OK) {
+#if CONFIG_EVSTREAM_LOGS
+		evstream_capture_logs();
+#endif
+	}
+	dlog_start(CONFIG_PRIO_DLOG, NET_CORE, CONFIG_DLOG_DRAIN_MS, dlog_sink);
+#else
+	dlog_start(CONFIG_PRIO_DLOG, NET_CORE, CONFIG_DLOG_DRAIN_MS, NULL);
+#endif
+
+	if (power_init() != ESP_OK) {
+		ESP_LOGE(TAG, "Running without power management.");
+	}
+
+	net_lock = xSemaphoreCreateMutexStatic(&net_lock_buf);
+
+	esp_err_t err = nvs_flash_init();
+	if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+		ESP_ERROR_CHECK( nvs_flash_erase() );
+		err = nvs_flash_init();
+	}
+	ESP_ERROR_CHECK( err );
+	settings_init(settings_table, sizeof(settings_table) / sizeof(settings_table[0]));
+	odometer_init();
+	store_init();
+
+	// Font and boot animation from the asset partition, the built-in font otherwise
+	uint32_t boot_anim_us = 0;
+	if (assets_init() == ESP_OK) {
+		size_t size;
+		const uint8_t *font = assets_find(ASSET_FONT, 0, &size);
+		if (font && size >= ASSETS_FONT_SIZE) vfd_set_font(font, font + 10);
+
+		const uint8_t *boot_anim = assets_find(ASSET_ANIM, 0, &size);
+		if (boot_anim) {
+			boot_anim_us = anim_load(&anim, boot_anim, size) * VFD_REFRESH_PERIOD;
+			if (boot_anim_us) anim_kf = &anim.kf[0];
+		}
+	}
+
+	// Initialize RTC
+	if (ds3231_init_desc(&rtc_dev, I2C_NUM_0, CONFIG_SDA_GPIO, CONFIG_SCL_GPIO) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not init device descriptor.");
+		clock_dp = STALE_DP_MASK;
+	}
+
+	// Start the timebase on an RTC second edge, the time registers alone only have second resolution
+	struct tm rtcinfo;
+	int64_t edge_us;
+	if (rtc_wait_edge(&rtc_dev, &rtcinfo, &edge_us, 1100000) == ESP_OK) {
+		timebase_set(edge_us, (int64_t)rtc_to_epoch(&rtcinfo) * 1000000);
+	} else {
+		ESP_LOGE(TAG, "Could not catch an RTC second edge.");
+	}
+#if RTC_SQW_EDGES
+	rtc_sqw_init();
+#endif
+
+	// Periodic jobs share one task, see scheduler.h
+	if (sched_start(sched_stack, SCHED_STACK_SIZE, CONFIG_PRIO_SCHEDULER, RT_CORE) != ESP_OK) {
+		ESP_LOGE(TAG, "Could not start the scheduler.");
+	}
+#if CONFIG_RTC_ALARMS
+	rtc_alarm_init();
+#endif
+
+#if CONFIG_SET_CLOCK
+	// Set clock & Get clock
+	if (boot_count == 1) {
+#if ONLINE_MODE
+		sync_sched_config_t cfg = sync_config();
+		sync_sched_init(&sync_state, &cfg);
+#endif
+		clock_task_start(setClock, "setClock");
+	} else {
+		sched_add(&getClock, 0, 1000);
+#if ONLINE_MODE
+		syncClock_task = clock_task_start(syncClock, "syncClock");
+#endif
+	}
+#endif
+
+#if CONFIG_GET_CLOCK
+	// Get clock
+	sched_add(&getClock, 0, 1000);
+#endif
+
+#if CONFIG_DIFF_CLOCK
+	// Diff clock
+	clock_task_start(diffClock, "diffClock");
+#endif
+
+	/* Timer config */
+	const esp_timer_create_args_t mux_timer_args =
+		{
+			.callback = &mux_callback,
+			.name = "Mux Timer Interrupt"};
+
+	esp_timer_create(&mux_timer_args, &mux_timer_handle);
+	esp_timer_start_periodic(mux_timer_handle, VFD_REFRESH_PERIOD);
+
+	const esp_timer_create_args_t dim_timer_args =
+		{
+			.callback = &dim_callback,
+			.name = "Dim Phase End"};
+
+	esp_timer_create(&dim_timer_args, &dim_timer_handle);
+
+	const esp_timer_create_args_t resume_timer_args =
+		{
+			.callback = &resume_callback,
+			.name = "Display Resume"};
+
+	esp_timer_create(&resume_timer_args, &resume_timer_handle);
+
+	const esp_timer_create_args_t exercise_timer_args =
+		{
+			.callback = &exercise_callback,
+			.name = "Cathode Exercise"};
+
+	esp_timer_create(&exercise_timer_args, &exercise_timer_handle);
+
+	const esp_timer_create_args_t split_timer_args =
+		{
+			.callback = &split_callback,
+			.name = "Transition Split"};
+
+	esp_timer_create(&split_timer_args, &split_timer_handle);
+
+	const esp_timer_create_args_t second_timer_args =
+		{
+			.callback = &second_callback,
+			.name = "Second Boundary"};
+
+	esp_timer_create(&second_timer_args, &second_timer_handle);
+
+	const esp_timer_create_args_t compose_timer_args =
+		{
+			.callback = &compose_callback,
+			.name = "Layer Timeout"};
+
+	esp_timer_create(&compose_timer_args, &compose_timer_handle);
+
+	const esp_timer_create_args_t compose_now_timer_args =
+		{
+			.callback = &compose_callback,
+			.name = "Layer Update"};
+
+	esp_timer_create(&compose_now_timer_args, &compose_now_timer_handle);
+	esp_timer_start_once(second_timer_handle, boot_anim_us + 1); // The clock takes over after the boot animation
+
+	/* Init */
+	GPIOConfig();
+	vfd_init();
+
+	// Turn Power LED on when "power is present"
+	gpio_set_level(LED_Power, 0);
+	sched_add(&ledBlink, 0, 1000);
+#if CONFIG_POWER_REPORT_PERIOD_S > 0
+	sched_add(&powerReport, CONFIG_POWER_REPORT_PERIOD_S * 1000, CONFIG_POWER_REPORT_PERIOD_S * 1000);
+#endif
+	sched_add(&odometerCheckpoint, CONFIG_ODOMETER_CHECKPOINT_MIN * 60 * 1000, CONFIG_ODOMETER_CHECKPOINT_MIN * 60 * 1000);
+#if CONFIG_ANTIPOISON && !CONFIG_RTC_ALARMS
+	sched_add(&antiPoison, exercise_delay_ms(), 0);
+#endif
+#if CONFIG_INFO_PAGES || CONFIG_TELEMETRY
+	sensors_init();
+#endif
+#if CONFIG_INFO_PAGES
+	info_init();
+#endif
+#if CONFIG_TELEMETRY
+	telemetry_start();
+#endif
+#if CONFIG_MQTT_PUBLISH
+	mqtt_init();
+#endif
+#if CONFIG_EVSTREAM
+	sched_add(&evRefresh, CONFIG_EVSTREAM_REFRESH_S * 1000, CONFIG_EVSTREAM_REFRESH_S * 1000);
+#endif
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	cpuload_start();
+#endif
+	heapguard_start();
+#if CONFIG_STOPWATCH
+	stopwatch_init_buttons();
+#endif
+#if CONFIG_NIGHT_MODE
+	night_init();
+#endif
+#if CONFIG_SHELL
+	shell_init();
+#endif
 
 	// xTaskCreate(
 	// 	CounterTask,	   // Task func
@@ -0,0 +1,6 @@
+#pragma once
+/* Host stand-in: esp_timer_get_time() is CLOCK_MONOTONIC in microseconds (host/esp_timer.c) */
+#include <stdint.h>
+#include "esp_err.h"
+
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,100 @@
+#include <time.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+struct host_task {
+	StaticTask_t buf;
+};
+
+static __thread StaticTask_t *current;	// NULL in threads the shim did not start
+
+static void *task_entry(void *arg)
+{
+	current = arg;
+	current->fn(current->arg);
+	return NULL;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(void (*fn)(void *), const char *name, uint32_t stack_depth, void *arg,
+										   UBaseType_t priority, StackType_t *stack, StaticTask_t *buf, BaseType_t core)
+{
+	pthread_mutex_init(&buf->lock, NULL);
+	pthread_cond_init(&buf->cond, NULL);
+	buf->notified = 0;
+	buf->fn = fn;
+	buf->arg = arg;
+	if (pthread_create(&buf->thread, NULL, task_entry, buf) != 0) return NULL;
+	pthread_detach(buf->thread);
+	return (TaskHandle_t)buf;
+}
+
+static struct timespec after(TickType_t ticks)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t ns = (uint64_t)ticks * (1000000000 / configTICK_RATE_HZ) + ts.tv_nsec;
+	ts.tv_sec += ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return ts;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	struct timespec ts = { ticks / configTICK_RATE_HZ, ticks % configTICK_RATE_HZ * (1000000000 / configTICK_RATE_HZ) };
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (TickType_t)((uint64_t)ts.tv_sec * configTICK_RATE_HZ + ts.tv_nsec / (1000000000 / configTICK_RATE_HZ));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	if (!current) {
+		vTaskDelay(ticks);
+		return 0;
+	}
+	struct timespec until = after(ticks);
+	pthread_mutex_lock(&current->lock);
+	while (!current->notified) {
+		if (ticks == portMAX_DELAY) pthread_cond_wait(&current->cond, &current->lock);
+		else if (pthread_cond_timedwait(&current->cond, &current->lock, &until) == ETIMEDOUT) break;
+	}
+	uint32_t value = current->notified;
+	if (value) current->notified = clear ? 0 : value - 1;
+	pthread_mutex_unlock(&current->lock);
+	return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	StaticTask_t *t = &task->buf;
+	pthread_mutex_lock(&t->lock);
+	t->notified++;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf)
+{
+	pthread_mutex_init(buf, NULL);
+	return buf;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	return pthread_mutex_lock(sem) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	return pthread_mutex_unlock(sem) == 0 ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,32 @@
+#pragma once
+/*
+    Host stand-in for the FreeRTOS API the network components use, on
+    pthreads (host/freertos.c). Tasks are threads, the core is ignored,
+    critical sections and semaphores are mutexes and ticks count at
+    configTICK_RATE_HZ like on the device.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define configTICK_RATE_HZ		100
+#define portTICK_PERIOD_MS		(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY			((TickType_t)0xffffffffUL)
+#define portNUM_PROCESSORS		2
+#define pdMS_TO_TICKS(ms)		((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+#define pdTRUE					1
+#define pdFALSE					0
+#define pdPASS					pdTRUE
+#define tskNO_AFFINITY			0x7fffffff
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux)		pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)		pthread_mutex_unlock(mux)
+#define portENTER_CRITICAL_SAFE(mux)	portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux)		portEXIT_CRITICAL(mux)
@@ -0,0 +1,9 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef pthread_mutex_t StaticSemaphore_t;
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buf);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
@@ -0,0 +1,20 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t notified;
+	void (*fn)(void *);
+	void *arg;
+} StaticTask_t;
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(void (*fn)(void *), const char *name, uint32_t stack_depth, void *arg,
+										   UBaseType_t priority, StackType_t *stack, StaticTask_t *buf, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
@@ -0,0 +1,42 @@
+#include "driver/gpio.h"
+
+void (*gpio_sim_hook)(gpio_num_t pin, uint32_t level);
+
+static uint8_t levels[GPIO_NUM_MAX];
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+	levels[pin] = level != 0;
+	if (gpio_sim_hook) gpio_sim_hook(pin, levels[pin]);
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+	return pin >= 0 && pin < GPIO_NUM_MAX ? levels[pin] : 0;
+}
+
+esp_err_t gpio_hold_en(gpio_num_t pin)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_hold_dis(gpio_num_t pin)
+{
+	return ESP_OK;
+}
+
+void gpio_deep_sleep_hold_en(void)
+{
+}
+
+esp_err_t gpio_sleep_sel_dis(gpio_num_t pin)
+{
+	return ESP_OK;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "mqtt_client.h"
+
+#define CLIENT_ID		"vfdclock-host"
+
+struct esp_mqtt_client {
+	char host[64];
+	char port[8];
+	esp_event_handler_t handler;
+	void *handler_arg;
+	pthread_t thread;
+	bool running;
+	pthread_mutex_t lock;	// Writes to sock, next_id
+	int sock;
+	volatile bool connected;
+	volatile bool stopping;
+	uint16_t next_id;
+};
+
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id)
+{
+	esp_mqtt_event_t event = { .event_id = id, .client = client, .msg_id = msg_id };
+	if (client->handler) client->handler(client->handler_arg, "MQTT_EVENTS", id, &event);
+}
+
+static bool send_all(esp_mqtt_client_handle_t client, const uint8_t *buf, size_t len)
+{
+	pthread_mutex_lock(&client->lock);
+	bool ok = true;
+	while (ok && len) {
+		ssize_t n = send(client->sock, buf, len, MSG_NOSIGNAL);
+		ok = n > 0;
+		if (ok) {
+			buf += n;
+			len -= n;
+		}
+	}
+	pthread_mutex_unlock(&client->lock);
+	return ok;
+}
+
+static bool recv_all(int sock, uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = recv(sock, buf, len, 0);
+		if (n <= 0) return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+/* Fixed header: type and flags, then the remaining length, 7 bits a byte */
+static size_t put_header(uint8_t *p, uint8_t type, size_t remaining)
+{
+	size_t n = 0;
+	p[n++] = type;
+	do {
+		p[n] = remaining & 0x7f;
+		remaining >>= 7;
+		if (remaining) p[n] |= 0x80;
+		n++;
+	} while (remaining);
+	return n;
+}
+
+static size_t put_string(uint8_t *p, const char *s, size_t len)
+{
+	p[0] = len >> 8;
+	p[1] = len;
+	memcpy(p + 2, s, len);
+	return len + 2;
+}
+
+/* One packet from the broker, false when the connection is gone */
+static bool read_packet(int sock, uint8_t *type, uint8_t *body, size_t size, size_t *len)
+{
+	uint8_t b;
+	if (!recv_all(sock, type, 1)) return false;
+	*len = 0;
+	for (int shift = 0;; shift += 7) {
+		if (shift > 21 || !recv_all(sock, &b, 1)) return false;
+		*len |= (size_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) break;
+	}
+	for (size_t left = *len; left;) { // Only acks are expected, anything longer is skipped
+		size_t n = left < size ? left : size;
+		if (!recv_all(sock, body, n)) return false;
+		left -= n;
+	}
+	return true;
+}
+
+static void *client_thread(void *arg)
+{
+	esp_mqtt_client_handle_t client = arg;
+	dispatch(client, MQTT_EVENT_BEFORE_CONNECT, -1);
+
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *ai;
+	if (getaddrinfo(client->host, client->port, &hints, &ai) != 0) {
+		dispatch(client, MQTT_EVENT_ERROR, -1);
+		return NULL;
+	}
+	bool ok = connect(client->sock, ai->ai_addr, ai->ai_addrlen) == 0;
+	freeaddrinfo(ai);
+
+	if (ok) { // CONNECT: protocol level 4, clean session, no keep alive
+		uint8_t pkt[64];
+		size_t id_len = strlen(CLIENT_ID), n = put_header(pkt, 0x10, 10 + 2 + id_len);
+		n += put_string(pkt + n, "MQTT", 4);
+		pkt[n++] = 4;
+		pkt[n++] = 0x02;
+		pkt[n++] = 0;
+		pkt[n++] = 0;
+		n += put_string(pkt + n, CLIENT_ID, id_len);
+		ok = send_all(client, pkt, n);
+	}
+
+	uint8_t type, body[16];
+	size_t len;
+	if (ok && read_packet(client->sock, &type, body, sizeof(body), &len) && type == 0x20 && len == 2 && body[1] == 0) {
+		client->connected = true;
+		dispatch(client, MQTT_EVENT_CONNECTED, -1);
+		while (read_packet(client->sock, &type, body, sizeof(body), &len)) {
+			if (type == 0x40 && len == 2) dispatch(client, MQTT_EVENT_PUBLISHED, body[0] << 8 | body[1]);
+		}
+	} else if (!client->stopping) {
+		dispatch(client, MQTT_EVENT_ERROR, -1);
+	}
+	if (!client->stopping) {
+		client->connected = false;
+		dispatch(client, MQTT_EVENT_DISCONNECTED, -1);
+	}
+	return NULL;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+	esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+	if (!client) return NULL;
+	int port = 1883;
+	if (!config->broker.address.uri ||
+		sscanf(config->broker.address.uri, "mqtt://%63[^:/]:%d", client->host, &port) < 1) {
+		free(client);
+		return NULL;
+	}
+	snprintf(client->port, sizeof(client->port), "%d", port);
+	pthread_mutex_init(&client->lock, NULL);
+	client->sock = -1;
+	return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+										 esp_event_handler_t handler, void *arg)
+{
+	if (event != MQTT_EVENT_ANY) return ESP_ERR_NOT_SUPPORTED;
+	client->handler = handler;
+	client->handler_arg = arg;
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+	if (client->running) return ESP_FAIL;
+	client->sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (client->sock < 0) return ESP_FAIL;
+	client->connected = false;
+	client->stopping = false;
+	if (pthread_create(&client->thread, NULL, client_thread, client) != 0) {
+		close(client->sock);
+		return ESP_FAIL;
+	}
+	client->running = true;
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+	if (!client->running) return ESP_FAIL;
+	client->stopping = true;
+	if (client->connected) {
+		static const uint8_t disconnect[] = { 0xe0, 0 };
+		send_all(client, disconnect, sizeof(disconnect));
+	}
+	shutdown(client->sock, SHUT_RDWR);
+	pthread_join(client->thread, NULL);
+	close(client->sock);
+	client->sock = -1;
+	client->connected = false;
+	client->running = false;
+	return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+							int qos, int retain)
+{
+	if (!client->connected || qos > 1) return -1;
+	if (len <= 0) len = strlen(data);
+
+	size_t topic_len = strlen(topic), remaining = 2 + topic_len + (qos ? 2 : 0) + len;
+	uint8_t *pkt = malloc(remaining + 5);
+	if (!pkt) return -1;
+	size_t n = put_header(pkt, 0x30 | qos << 1 | (retain ? 1 : 0), remaining);
+	n += put_string(pkt + n, topic, topic_len);
+
+	pthread_mutex_lock(&client->lock);
+	int msg_id = 0;
+	if (qos) {
+		if (++client->next_id == 0) client->next_id = 1;
+		msg_id = client->next_id;
+		pkt[n++] = msg_id >> 8;
+		pkt[n++] = msg_id;
+	}
+	pthread_mutex_unlock(&client->lock);
+	memcpy(pkt + n, data, len);
+	n += len;
+
+	bool ok = send_all(client, pkt, n);
+	free(pkt);
+	return ok ? msg_id : -1;
+}
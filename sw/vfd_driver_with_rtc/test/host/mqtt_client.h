@@ -0,0 +1,59 @@
+#pragma once
+/*
+    Host stand-in for the esp-mqtt client (host/mqtt_client.c): a real
+    MQTT 3.1.1 client over TCP, so the publishing code talks to a broker on
+    the host. Only plain mqtt://host:port, clean sessions, QoS 0 and 1 and no
+    reconnects, the rest of the configuration is accepted and ignored.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *data);
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum {
+	MQTT_EVENT_ANY = -1,
+	MQTT_EVENT_ERROR = 0,
+	MQTT_EVENT_CONNECTED,
+	MQTT_EVENT_DISCONNECTED,
+	MQTT_EVENT_SUBSCRIBED,
+	MQTT_EVENT_UNSUBSCRIBED,
+	MQTT_EVENT_PUBLISHED,
+	MQTT_EVENT_DATA,
+	MQTT_EVENT_BEFORE_CONNECT,
+	MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct {
+	esp_mqtt_event_id_t event_id;
+	esp_mqtt_client_handle_t client;
+	int msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct {
+	struct {
+		struct {
+			const char *uri;
+		} address;
+	} broker;
+	struct {
+		bool disable_auto_reconnect;
+	} network;
+	struct {
+		int size;
+		int out_size;
+	} buffer;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+										 esp_event_handler_t handler, void *arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len,
+							int qos, int retain);
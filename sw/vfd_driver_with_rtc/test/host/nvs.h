@@ -0,0 +1,17 @@
+#pragma once
+/* Host stand-in: NVS as a small table in RAM, u32 values only (host/nvs.c) */
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE		0x1100
+#define ESP_ERR_NVS_NOT_FOUND	(ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE	(ESP_ERR_NVS_BASE + 0x05)
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
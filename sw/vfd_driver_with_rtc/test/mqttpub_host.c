@@ -0,0 +1,115 @@
+/*
+    The MQTT publisher as a host program, for the README procedure against a
+    real broker. A made up sample every 10 s, a window every 30 s of at most
+    10 s; the "network" is always there, the program only logs it going up
+    and down.
+
+      make -C test build/mqttpub_host
+      mosquitto -v -c broker.conf &   (listener 1883, allow_anonymous true)
+      mosquitto_sub -v -t 'vfdclock/#' &
+      test/build/mqttpub_host mqtt://127.0.0.1:1883
+
+    Stop mosquitto for a few windows and start it again: the cursor stays
+    while it is gone and the backlog goes out with the next window.
+    Prints the statistics after every window.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "telemetry.h"
+#include "mqttpub.h"
+
+#define SAMPLE_S	10
+#define MAX_SAMPLES	4096
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static telemetry_sample_t samples[MAX_SAMPLES];	// Oldest ones overwritten, like the ring
+static uint32_t sample_count;
+static time_t up_at;
+static volatile bool net_is_up;
+
+uint32_t telemetry_read(uint32_t from, uint32_t to, telemetry_read_cb_t cb, void *arg)
+{
+	uint32_t passed = 0;
+	pthread_mutex_lock(&lock);
+	uint32_t i = sample_count > MAX_SAMPLES ? sample_count - MAX_SAMPLES : 0, end = sample_count;
+	pthread_mutex_unlock(&lock);
+	for (; i < end; i++) {
+		pthread_mutex_lock(&lock);
+		telemetry_sample_t s = samples[i % MAX_SAMPLES];
+		pthread_mutex_unlock(&lock);
+		if (s.time > to) break;
+		if (s.time < from) continue;
+		passed++;
+		if (!cb(&s, arg)) break;
+	}
+	return passed;
+}
+
+static uint32_t now_s(void)
+{
+	return time(NULL);
+}
+
+static bool net_up(void)
+{
+	up_at = time(NULL);
+	net_is_up = true;
+	printf("network up\n");
+	return true;
+}
+
+static void net_down(void)
+{
+	net_is_up = false;
+	printf("network down after %ld s\n", (long)(time(NULL) - up_at));
+}
+
+static int health(char *buf, size_t size)
+{
+	return snprintf(buf, size, "{\"samples\":%" PRIu32 "}", sample_count);
+}
+
+int main(int argc, char **argv)
+{
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	const mqttpub_config_t cfg = {
+		.uri = argc > 1 ? argv[1] : "mqtt://127.0.0.1:1883",
+		.topic = "vfdclock/host",
+		.interval_s = 30,
+		.window_s = 10,
+		.now_s = now_s,
+		.net_up = net_up,
+		.net_down = net_down,
+		.health = health,
+	};
+	if (mqttpub_start(&cfg, 5, tskNO_AFFINITY) != ESP_OK) return 1;
+
+	uint32_t windows = 0;
+	while (1) {
+		telemetry_sample_t s = { .time = now_s(), .valid = 0x0f };
+		s.value[TELEMETRY_RTC_TEMP] = 2150 + rand() % 50;
+		s.value[TELEMETRY_TEMP] = 2200 + rand() % 50;
+		s.value[TELEMETRY_HUMIDITY] = 4500 + rand() % 200;
+		s.value[TELEMETRY_LUX] = rand() % 500;
+		pthread_mutex_lock(&lock);
+		samples[sample_count++ % MAX_SAMPLES] = s;
+		pthread_mutex_unlock(&lock);
+
+		for (int i = 0; i < SAMPLE_S; i++) {
+			sleep(1);
+			mqttpub_stats_t st;
+			mqttpub_get_stats(&st);
+			if (st.windows == windows || net_is_up) continue;
+			windows = st.windows;
+			printf("%" PRIu32 " windows, %" PRIu32 " offline, %" PRIu32 " messages, %" PRIu32 " samples, %" PRIu32
+				   " left, window %" PRIu32 " ms\n", st.windows, st.offline, st.messages, st.samples, st.backlog,
+				   st.last_window_ms);
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/*
+    The SNTP server as a host program, for checking it with a real client.
+    The clock is gettimeofday(), the source claims stratum 2 synced at start.
+
+      make -C test build/ntpserver_host
+      test/build/ntpserver_host 12300 &
+      chronyd -Q 'server 127.0.0.1 port 12300 iburst maxsamples 4'
+      ntpdate -q -p 4 -u 127.0.0.1:12300  (or python -m ntplib, sntp -r ...)
+
+    Prints the server statistics every 10 s.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "ntpserver.h"
+
+static int64_t wall_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+	uint16_t port = argc > 1 ? atoi(argv[1]) : 12300;
+
+	const ntpserver_source_t src = {
+		.stratum = 2,
+		.ref_id = 0x0100007f,	// 127.0.0.1
+		.ref_us = wall_us(),
+		.root_delay_us = 10000,
+		.root_disp_us = 1000,
+		.disp_ppb = 2000,
+	};
+	ntpserver_set_source(&src);
+	if (ntpserver_start(port, wall_us, 5, tskNO_AFFINITY) != ESP_OK) return 1;
+	printf("serving on UDP port %u\n", port);
+
+	while (1) {
+		sleep(10);
+		ntpserver_stats_t s;
+		ntpserver_get_stats(&s);
+		printf("%" PRIu32 " requests, %" PRIu32 " replies, %" PRIu32 " ignored, %" PRIu32 " unsynced, %" PRIu32 " send failed\n",
+			   s.requests, s.replies, s.ignored, s.unsynced, s.send_failed);
+		fflush(stdout);
+	}
+}
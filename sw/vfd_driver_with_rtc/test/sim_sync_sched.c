@@ -0,0 +1,163 @@
+/*
+    Replays RTC drift traces through the sync scheduler.
+
+    A trace is a CSV of time_s, temp_c, drift_ppm, network rows, each one
+    holding until the next. The loop does what syncClock() does: ask the
+    scheduler, sync if it says so and the network is up, then sleep until the
+    next planned sync but at most SYNC_POLL_S. Between wakeups the RTC error
+    grows with the trace's drift. A sync measures it with a few ms of noise and
+    leaves a few ms behind.
+
+    Prints sync counts and the worst displayed error per trace. No schedule
+    holds the budget through a long enough outage, so the run only fails if
+    the error left the budget while the network was there all along since the
+    last sync.
+
+      sim_sync_sched traces/room.csv traces/outage.csv ...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "sync_sched.h"
+
+#define SYNC_POLL_S		600		// As in main.c
+#define MAX_ROWS		4096
+#define MEAS_NOISE_MS	5		// rtc_measure_offset() resolution
+#define WRITE_NOISE_MS	2		// Left after rtc_write_aligned()
+
+typedef struct {
+	int64_t time_s;
+	float temp_c;
+	float drift_ppm;
+	int network;
+} row_t;
+
+static row_t rows[MAX_ROWS];
+static size_t nrows;
+
+/* Defaults of the SYNC_* options in Kconfig.projbuild */
+static const sync_sched_config_t config = {
+	.error_budget_ms = 250,
+	.min_interval_s  = 900,
+	.max_interval_s  = 604800,
+	.retry_base_s    = 60,
+	.retry_max_s     = 21600,
+	.temp_coeff_ppm  = 0.1f,
+	.stable_count    = 3,
+};
+
+static uint32_t rng = 1;
+
+/* Uniform in [-range, range], the same sequence on every run */
+static float noise_ms(int range)
+{
+	rng = rng * 1103515245u + 12345u;
+	return (float)((rng >> 16) % (2 * range + 1)) - range;
+}
+
+static int load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	char line[128];
+	nrows = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n') continue;
+		row_t *r = &rows[nrows];
+		if (sscanf(line, "%" SCNd64 ",%f,%f,%d", &r->time_s, &r->temp_c, &r->drift_ppm, &r->network) != 4) {
+			fprintf(stderr, "%s: bad row: %s", path, line);
+			fclose(f);
+			return -1;
+		}
+		if (++nrows == MAX_ROWS) break;
+	}
+	fclose(f);
+	return nrows >= 2 ? 0 : -1;
+}
+
+/* Row in effect at t */
+static const row_t *at(int64_t t)
+{
+	static size_t i;
+	if (i >= nrows || rows[i].time_s > t) i = 0;
+	while (i + 1 < nrows && rows[i + 1].time_s <= t) i++;
+	return &rows[i];
+}
+
+static int replay(const char *path)
+{
+	if (load(path) != 0) return -1;
+
+	sync_sched_t s;
+	sync_sched_init(&s, &config);
+
+	const int64_t start = 1700000000; // Any epoch, the scheduler treats 0 as "never synced"
+	int64_t t = rows[0].time_s, end = rows[nrows - 1].time_s;
+	float error_ms = 0; // RTC minus true time, the RTC was set by hand at the start
+	float worst_ms = 0, worst_online_ms = 0;
+	bool outage = false; // Since the last successful sync
+	uint32_t attempts = 0;
+
+	while (t < end) {
+		const row_t *r = at(t);
+		int64_t now = start + t;
+
+		sync_action_t action = sync_sched_check(&s, now, r->temp_c);
+		if (action == SYNC_DUE) {
+			attempts++;
+			if (r->network) {
+				sync_sched_success(&s, now, (int32_t)(error_ms + noise_ms(MEAS_NOISE_MS)), r->temp_c);
+				error_ms = noise_ms(WRITE_NOISE_MS);
+				outage = false;
+			} else {
+				sync_sched_failure(&s, now);
+			}
+		}
+
+		if (!r->network) outage = true;
+
+		int64_t wait = sync_sched_wait_s(&s, now);
+		if (wait > SYNC_POLL_S) wait = SYNC_POLL_S;
+		if (wait == 0) wait = 1;
+		if (t + wait > end) wait = end - t;
+
+		error_ms += r->drift_ppm * wait / 1000.0f;
+		float abs_ms = error_ms < 0 ? -error_ms : error_ms;
+		if (abs_ms > worst_ms) worst_ms = abs_ms;
+		if (!outage && abs_ms > worst_online_ms) worst_online_ms = abs_ms;
+		t += wait;
+	}
+
+	float days = (end - rows[0].time_s) / 86400.0f;
+	printf("%-24s %5.1f d  %4" PRIu32 " syncs (%.1f/d)  %3" PRIu32 " failed  %3" PRIu32 " skipped  "
+		   "drift %+.2f ppm  worst %4.0f ms, %4.0f ms online, budget %" PRIu32 "\n",
+		   path, days, s.syncs, s.syncs / days, s.failures, s.skipped, s.drift_ppm, worst_ms, worst_online_ms,
+		   config.error_budget_ms);
+
+	return worst_online_ms <= config.error_budget_ms && attempts > 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace.csv...\n", argv[0]);
+		return 2;
+	}
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		int res = replay(argv[i]);
+		if (res < 0) return 2;
+		if (res) {
+			printf("%s: error left the budget with the network up\n", argv[i]);
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
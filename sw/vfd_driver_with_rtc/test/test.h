@@ -0,0 +1,38 @@
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+/*
+    Minimal checks for the host tests: a failed check prints where and what,
+    the test keeps going, and test_done() turns the count into the exit code.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+static int test_checks;
+static int test_failures;
+
+#define CHECK(cond) do { \
+		test_checks++; \
+		if (!(cond)) { \
+			test_failures++; \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) do { \
+		int64_t a_ = (int64_t)(a), b_ = (int64_t)(b); \
+		test_checks++; \
+		if (a_ != b_) { \
+			test_failures++; \
+			printf("%s:%d: %s == %s failed: %" PRId64 " != %" PRId64 "\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+		} \
+	} while (0)
+
+static inline int test_done(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+	return test_failures ? 1 : 0;
+}
+
+#endif /* TEST_TEST_H_ */
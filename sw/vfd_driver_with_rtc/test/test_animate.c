@@ -0,0 +1,292 @@
+/*
+    Transition keyframes against the segment masks they should hold, for the
+    default six tube topology. Every keyframe is checked, both of its frames,
+    its split and its phase count, and the replay through anim_tick() shows
+    each of them for exactly that many phases.
+*/
+
+#include <string.h>
+
+#include "animate.h"
+#include "test.h"
+
+static anim_t anim;
+
+static vfd_frame_t frame(const char *s, uint32_t dp)
+{
+	vfd_frame_t f;
+	vfd_set_dp(dp);
+	vfd_encode_str(&f, s);
+	vfd_set_dp(0);
+	return f;
+}
+
+static bool same(const vfd_frame_t *a, const vfd_frame_t *b)
+{
+	return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+/* Sub-phase slots out of ANIM_LEVELS that the segment is lit for */
+static int lit_levels(const anim_keyframe_t *kf, int tube, uint8_t bit)
+{
+	int n = 0;
+	for (int l = 0; l < ANIM_LEVELS; l++) {
+		const vfd_frame_t *f = l < kf->split ? &kf->first : &kf->second;
+		n += (f->seg[tube] & bit) != 0;
+	}
+	return n;
+}
+
+/* Replays the list, returns the phases until done and checks each keyframe comes up in order, for its phases */
+static uint32_t replay(void)
+{
+	uint32_t phases = 0;
+	int shown = -1, held = 0;
+	bool done = false;
+
+	while (phases < 100000) {
+		const anim_keyframe_t *kf = anim_tick(&anim, &done);
+		if (done) break;
+		if (kf) {
+			if (shown >= 0) CHECK_EQ(held, anim.kf[shown].phases);
+			CHECK(kf == &anim.kf[shown + 1]);
+			shown++;
+			held = 0;
+		}
+		held++;
+		phases++;
+	}
+	CHECK(done);
+	CHECK_EQ(shown, anim.count - 1);
+	if (shown >= 0) CHECK_EQ(held, anim.kf[shown].phases);
+	return phases;
+}
+
+static void test_no_change(void)
+{
+	vfd_frame_t a = frame("123456", 0x04);
+
+	for (anim_type_t type = ANIM_NONE; type <= ANIM_MORPH; type++) {
+		anim.count = 7;
+		CHECK(!anim_compile(&anim, type, &a, &a, "123456", "123456", 200));
+		CHECK_EQ(anim.count, 0);
+		CHECK_EQ(replay(), 0);
+	}
+
+	// A different DP is a change, but not one ROLL has digits for
+	vfd_frame_t b = frame("123456", 0x08);
+	CHECK(!anim_compile(&anim, ANIM_ROLL, &a, &b, "123456", "123456", 200));
+	CHECK(anim_compile(&anim, ANIM_CROSSFADE, &a, &b, "123456", "123456", 200));
+
+	// NONE never animates
+	b = frame("654321", 0);
+	CHECK(!anim_compile(&anim, ANIM_NONE, &a, &b, "123456", "654321", 200));
+}
+
+static void test_crossfade(void)
+{
+	vfd_frame_t from = frame("120959", 0x04), to = frame("121000", 0);
+
+	CHECK(anim_compile(&anim, ANIM_CROSSFADE, &from, &to, "120959", "121000", 60));
+	CHECK_EQ(anim.count, ANIM_LEVELS - 1);
+
+	for (int k = 0; k < anim.count; k++) {
+		const anim_keyframe_t *kf = &anim.kf[k];
+		CHECK(same(&kf->first, &to));
+		CHECK(same(&kf->second, &from));
+		CHECK_EQ(kf->split, k + 1);
+		CHECK_EQ(kf->phases, 4); // 60 / 15
+
+		// Kept segments stay fully lit, the new ones brighten as the old ones dim
+		for (int t = 0; t < VFD_TUBES; t++) {
+			for (int s = 0; s < 8; s++) {
+				uint8_t bit = 1 << s;
+				bool old = from.seg[t] & bit, new = to.seg[t] & bit;
+				int expect = old && new ? ANIM_LEVELS : new ? k + 1 : old ? ANIM_LEVELS - (k + 1) : 0;
+				CHECK_EQ(lit_levels(kf, t, bit), expect);
+			}
+		}
+	}
+	CHECK_EQ(replay(), 60);
+
+	// Too short a duration still shows every level for a whole frame
+	CHECK(anim_compile(&anim, ANIM_CROSSFADE, &from, &to, "120959", "121000", 10));
+	for (int k = 0; k < anim.count; k++) CHECK_EQ(anim.kf[k].phases, 2);
+	CHECK_EQ(replay(), 2 * (ANIM_LEVELS - 1));
+
+	// And too long a one is capped, at an even count
+	CHECK(anim_compile(&anim, ANIM_CROSSFADE, &from, &to, "120959", "121000", 100000));
+	CHECK_EQ(anim.kf[0].phases, UINT8_MAX - 1);
+}
+
+static void test_roll(void)
+{
+	// 0->1, 9->0 one step each, 5->0 five, the rest stays
+	vfd_frame_t from = frame("120959", 0x04), to = frame("121000", 0);
+	static const char *const expect[] = { "121060", "121070", "121080", "121090" };
+
+	CHECK(anim_compile(&anim, ANIM_ROLL, &from, &to, "120959", "121000", 40));
+	CHECK_EQ(anim.count, 4);
+	for (int k = 0; k < anim.count; k++) {
+		const anim_keyframe_t *kf = &anim.kf[k];
+		vfd_frame_t f = frame(expect[k], 0);
+		CHECK(same(&kf->first, &f));
+		CHECK(same(&kf->second, &f));
+		CHECK_EQ(kf->split, ANIM_LEVELS);
+		CHECK_EQ(kf->phases, 10);
+	}
+	CHECK_EQ(replay(), 40);
+
+	// Rolling digits keep their old DP until they land, letters switch at the end
+	from = frame("A90000", 0x03);
+	to = frame("b23000", 0);
+	static const char *const expect2[] = { "A01000", "A12000" };
+	CHECK(anim_compile(&anim, ANIM_ROLL, &from, &to, "A90000", "b23000", 40));
+	CHECK_EQ(anim.count, 2);
+	for (int k = 0; k < anim.count; k++) {
+		vfd_frame_t f = frame(expect2[k], 0x03);
+		CHECK(same(&anim.kf[k].first, &f));
+	}
+
+	// 0 -> 9 is the longest roll, nine steps and eight keyframes
+	from = frame("000000", 0);
+	to = frame("999999", 0);
+	CHECK(anim_compile(&anim, ANIM_ROLL, &from, &to, "000000", "999999", 16));
+	CHECK_EQ(anim.count, 8);
+	for (int k = 0; k < anim.count; k++) {
+		char s[VFD_TUBES + 1];
+		memset(s, '1' + k, VFD_TUBES);
+		s[VFD_TUBES] = '\0';
+		vfd_frame_t f = frame(s, 0);
+		CHECK(same(&anim.kf[k].first, &f));
+		CHECK_EQ(anim.kf[k].phases, 2);
+	}
+
+	// A single step lands at once, nothing in between
+	from = frame("123456", 0);
+	to = frame("123457", 0);
+	CHECK(!anim_compile(&anim, ANIM_ROLL, &from, &to, "123456", "123457", 40));
+}
+
+static void test_morph_masks(void)
+{
+	// 8 -> 1 takes G, E, D, B off (lowest bit first), A goes last and is the new frame
+	vfd_frame_t from = frame("888888", 0), to = frame("818888", 0);
+	static const uint8_t expect[] = { 0b11111100, 0b11110100, 0b11100100, 0b10100100 };
+
+	CHECK(anim_compile(&anim, ANIM_MORPH, &from, &to, NULL, NULL, 40));
+	CHECK_EQ(anim.count, 4);
+	for (int k = 0; k < anim.count; k++) {
+		vfd_frame_t f = from;
+		f.seg[1] = expect[k];
+		CHECK(same(&anim.kf[k].first, &f));
+		CHECK(same(&anim.kf[k].second, &f));
+		CHECK_EQ(anim.kf[k].split, ANIM_LEVELS);
+		CHECK_EQ(anim.kf[k].phases, 10);
+	}
+	CHECK_EQ(replay(), 40);
+
+	// 7 -> 4: B, D on, A off; the off pass comes first
+	from = frame("7", 0);
+	to = frame("4", 0);
+	static const uint8_t expect2[] = { 0b00100100, 0b00110100 };
+	CHECK(anim_compile(&anim, ANIM_MORPH, &from, &to, NULL, NULL, 40));
+	CHECK_EQ(anim.count, 2);
+	for (int k = 0; k < anim.count; k++) CHECK_EQ(anim.kf[k].first.seg[0], expect2[k]);
+
+	// One segment apart has no frame in between
+	from = frame("1", 0);
+	to = frame("7", 0);
+	CHECK(!anim_compile(&anim, ANIM_MORPH, &from, &to, NULL, NULL, 40));
+}
+
+/* Deterministic frames with every mix of kept, dropped and added segments */
+static uint32_t rng = 1;
+
+static uint8_t next_byte(void)
+{
+	rng = rng * 1103515245u + 12345u;
+	return rng >> 16;
+}
+
+static void test_morph_steps(void)
+{
+	int worst = 0;
+
+	for (int run = 0; run < 2000; run++) {
+		vfd_frame_t from, to;
+		for (int t = 0; t < VFD_TUBES; t++) {
+			from.seg[t] = next_byte();
+			to.seg[t] = run & 1 ? next_byte() : ~from.seg[t]; // Complement is the longest path
+		}
+		if (!anim_compile(&anim, ANIM_MORPH, &from, &to, NULL, NULL, 200)) continue;
+
+		bool on_pass = false;
+		vfd_frame_t prev = from;
+		for (int k = 0; k <= anim.count; k++) {
+			const vfd_frame_t *f = k < anim.count ? &anim.kf[k].first : &to;
+			bool any_on = false;
+			for (int t = 0; t < VFD_TUBES; t++) {
+				uint8_t off = prev.seg[t] & ~f->seg[t], on = f->seg[t] & ~prev.seg[t];
+				CHECK(!(off & (off - 1)) && !(on & (on - 1)));	// At most one segment per tube per step
+				CHECK(!(off && on));
+				CHECK(!(f->seg[t] & ~(from.seg[t] | to.seg[t])));	// Nothing that's in neither frame
+				CHECK(!(off & to.seg[t]) && !(on & ~to.seg[t]));	// Only ever towards the new frame
+				any_on |= on != 0;
+				if (on_pass) CHECK(!off);
+			}
+			on_pass |= any_on;
+			CHECK(k == anim.count || !same(f, &to));
+			prev = *f;
+		}
+		if (anim.count > worst) worst = anim.count;
+	}
+
+	// Eight steps off and eight on at most, the last one being the new frame itself
+	CHECK(worst <= 15);
+
+	vfd_frame_t from = frame("", 0), to = frame("", 0);
+	from.seg[0] = 0xff;
+	to.seg[1] = 0xff;
+	CHECK(anim_compile(&anim, ANIM_MORPH, &from, &to, NULL, NULL, 200));
+	CHECK_EQ(anim.count, 15);
+	CHECK(anim.count <= ANIM_MAX_KEYFRAMES);
+}
+
+static void test_load(void)
+{
+	uint8_t records[(ANIM_MAX_KEYFRAMES + 4) * ANIM_RECORD_SIZE];
+
+	for (int k = 0; k < ANIM_MAX_KEYFRAMES + 4; k++) {
+		uint8_t *r = &records[k * ANIM_RECORD_SIZE];
+		for (int t = 0; t < VFD_TUBES; t++) r[t] = k * VFD_TUBES + t;
+		r[VFD_TUBES] = k % 4; // 0 counts as one phase
+	}
+
+	// A partial record at the end is ignored
+	CHECK_EQ(anim_load(&anim, records, 3 * ANIM_RECORD_SIZE + 2), 1 + 1 + 2);
+	CHECK_EQ(anim.count, 3);
+	CHECK_EQ(anim.kf[2].first.seg[VFD_TUBES - 1], 3 * VFD_TUBES - 1);
+	CHECK_EQ(anim.kf[2].split, ANIM_LEVELS);
+	CHECK_EQ(replay(), 4);
+
+	// No more than ANIM_MAX_KEYFRAMES, however long the asset
+	uint32_t phases = anim_load(&anim, records, sizeof(records));
+	CHECK_EQ(anim.count, ANIM_MAX_KEYFRAMES);
+	CHECK_EQ(phases, ANIM_MAX_KEYFRAMES / 4 * (1 + 1 + 2 + 3));
+	CHECK_EQ(replay(), phases);
+
+	CHECK_EQ(anim_load(&anim, records, ANIM_RECORD_SIZE - 1), 0);
+	CHECK_EQ(anim.count, 0);
+}
+
+int main(void)
+{
+	test_no_change();
+	test_crossfade();
+	test_roll();
+	test_morph_masks();
+	test_morph_steps();
+	test_load();
+	return test_done("animate");
+}
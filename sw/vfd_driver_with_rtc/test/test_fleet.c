@@ -0,0 +1,202 @@
+/*
+    Fleet election and time transfer with several units on one host.
+
+    Every unit is a forked process running the fleet component with a clock
+    of its own: host time plus an offset, a rate error in ppm and the
+    corrections the fleet handed it. The units talk over the loopback
+    multicast path and report their role and clock error to the parent
+    through shared memory. The scenario:
+
+      1. A (best quality), B and C (30 ms fast, 50 ppm / 20 ms slow, 30 ppm)
+         start together: A leads, B and C follow it and take its time.
+      2. A dies: B, the lowest ID of equal quality, takes over and C
+         follows B.
+      3. A comes back: it is better than B by more than the margin, takes
+         over again and B steps down.
+
+    Without a multicast route (some containers) the units cannot join the
+    group and the test reports that it was skipped.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "fleet.h"
+#include "test.h"
+
+#define GROUP		"239.255.70.71"	// Not the firmware's default, a clock on the LAN stays out of it
+#define PORT		12371
+#define BEACON_MS	100
+#define UNITS		3
+#define SETTLE_S	4				// Time for an election and a few correction windows
+#define MATCH_US	2000			// Followers within this of the leader
+
+typedef struct {
+	uint32_t id;
+	uint8_t quality;
+	int64_t offset_us;
+	double rate_ppm;
+} unit_config_t;
+
+typedef struct {
+	volatile int state;		// 0 = starting, 1 = running, -1 = could not join
+	volatile int role;
+	volatile uint32_t leader;
+	volatile int32_t delay_us;
+	volatile uint32_t corrections;
+	volatile int64_t error_us;	// Fleet time minus host time
+} unit_status_t;
+
+static const unit_config_t units[UNITS] = {
+	{ .id = 1, .quality = 5, .offset_us = 0, .rate_ppm = 0 },
+	{ .id = 2, .quality = 20, .offset_us = 30000, .rate_ppm = 50 },
+	{ .id = 3, .quality = 20, .offset_us = -20000, .rate_ppm = -30 },
+};
+
+static unit_status_t *status;	// Shared with the units
+static pid_t pids[UNITS];
+
+// The unit's clock, each process has its own
+static const unit_config_t *self;
+static int64_t start_real_us, start_mono_us, slew_us;
+
+static int64_t clock_us(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t timer_us(void)
+{
+	return clock_us(CLOCK_MONOTONIC);
+}
+
+/* Fleet time at timer value t */
+static int64_t fleet_at(int64_t t)
+{
+	int64_t elapsed = t - start_mono_us;
+	return start_real_us + elapsed + (int64_t)(elapsed * self->rate_ppm / 1e6) + self->offset_us + slew_us;
+}
+
+static int64_t now_us(void)
+{
+	return fleet_at(timer_us());
+}
+
+/* Stepped rather than slewed like the timebase does, the test only looks at where the clock ends up */
+static void correct(int64_t timer, int64_t ref_us)
+{
+	slew_us += ref_us - fleet_at(timer);
+}
+
+static void run_unit(int n)
+{
+	prctl(PR_SET_PDEATHSIG, SIGKILL); // A failed run leaves no units behind
+	self = &units[n];
+	start_real_us = clock_us(CLOCK_REALTIME);
+	start_mono_us = timer_us();
+
+	const fleet_config_t cfg = {
+		.group = GROUP,
+		.port = PORT,
+		.id = self->id,
+		.beacon_ms = BEACON_MS,
+		.clock = { .now_us = now_us, .timer_us = timer_us, .correct = correct },
+	};
+	fleet_set_quality(self->quality);
+	if (fleet_start(&cfg, 5, tskNO_AFFINITY) != ESP_OK) {
+		status[n].state = -1;
+		_exit(1);
+	}
+	status[n].state = 1;
+
+	while (1) {
+		fleet_stats_t s;
+		fleet_get_stats(&s);
+		status[n].role = fleet_following() ? FLEET_FOLLOWER : s.role;
+		status[n].leader = s.leader;
+		status[n].delay_us = s.delay_us;
+		status[n].corrections = s.corrections;
+		status[n].error_us = now_us() - clock_us(CLOCK_REALTIME);
+		usleep(20000);
+	}
+}
+
+static bool start_unit(int n)
+{
+	memset((void *)&status[n], 0, sizeof(status[n]));
+	pids[n] = fork();
+	if (pids[n] == 0) run_unit(n);
+
+	while (status[n].state == 0) usleep(1000);
+	return status[n].state > 0;
+}
+
+static void stop_unit(int n)
+{
+	kill(pids[n], SIGKILL);
+	waitpid(pids[n], NULL, 0);
+	pids[n] = 0;
+}
+
+/* The leader leads, everyone else follows it with its time */
+static void check_fleet(const char *phase, int leader, uint32_t alive)
+{
+	printf("%s:\n", phase);
+	for (int n = 0; n < UNITS; n++) {
+		if (!(alive & (1u << n))) continue;
+		unit_status_t s = status[n];
+		printf("  unit %" PRIu32 ": role %d, leader %" PRIu32 ", delay %" PRId32 " us, %" PRIu32 " corrections, "
+			   "error %+" PRId64 " us, %+" PRId64 " us to the leader\n", units[n].id, s.role, s.leader, s.delay_us,
+			   s.corrections, s.error_us, s.error_us - status[leader].error_us);
+
+		CHECK_EQ(s.leader, units[leader].id);
+		if (n == leader) {
+			CHECK_EQ(s.role, FLEET_LEADER);
+		} else {
+			CHECK_EQ(s.role, FLEET_FOLLOWER);
+			CHECK(s.corrections > 0);
+			CHECK(s.delay_us >= 0);
+			CHECK(llabs(s.error_us - status[leader].error_us) < MATCH_US);
+		}
+	}
+}
+
+int main(void)
+{
+	status = mmap(NULL, sizeof(unit_status_t) * UNITS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (status == MAP_FAILED) return 2;
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	for (int n = 0; n < UNITS; n++) {
+		if (!start_unit(n)) {
+			printf("fleet: could not join %s here, no multicast route? Skipped.\n", GROUP);
+			for (int i = 0; i < n; i++) stop_unit(i);
+			return 0;
+		}
+	}
+
+	// B and C start tens of ms off, they end up on A's time
+	usleep(100000);
+	CHECK(llabs(status[1].error_us - status[0].error_us) > 10000);
+	sleep(SETTLE_S);
+	check_fleet("A, B and C", 0, 0x7);
+
+	stop_unit(0);
+	sleep(SETTLE_S);
+	check_fleet("A gone", 1, 0x6);
+
+	start_unit(0);
+	sleep(SETTLE_S);
+	check_fleet("A back", 0, 0x7);
+
+	for (int n = 0; n < UNITS; n++) stop_unit(n);
+	return test_done("fleet");
+}
@@ -0,0 +1,514 @@
+/*
+    Batch windows of the MQTT publisher against a broker on the host.
+
+    mqttpub.c runs as it is, with the esp-mqtt stand-in (a real MQTT 3.1.1
+    client over TCP) talking to the small broker below on a loopback port.
+    The broker records every PUBLISH and can be told to refuse clients, to
+    drop the connection instead of acknowledging, or to ack slowly. The
+    telemetry ring is an array of samples behind telemetry_read(). The
+    scenario follows the README procedure:
+
+      1. Samples since the start of the interval go out with QoS 1, the
+         cursor moves to the last acknowledged one and is kept in NVS.
+      2. The broker drops the connection instead of a PUBACK: the cursor
+         stays, the next window sends those samples again.
+      3. No broker for three windows and no network for one: nothing is
+         lost, the next window drains the backlog.
+      4. A slow broker: the window ends on time with samples left over,
+         which the next window sends.
+
+    After every window the network must be down again and no longer than
+    the window up (a refused connection releases it right away), and the
+    client gone from the broker. At the end the
+    acknowledged telemetry messages hold every sample once, in order.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nvs.h"
+#include "telemetry.h"
+#include "mqttpub.h"
+#include "test.h"
+
+#define T0				1760000000u		// Local time, some day in 2025
+#define UTC_OFFSET_S	3600
+#define INTERVAL_S		3600			// Only triggered windows during the test
+#define WINDOW_S		2
+#define SAMPLE_S		60
+#define TOPIC			"vfdclock/test"
+#define MAX_SAMPLES		1024
+#define MAX_MESSAGES	64
+
+/* ---- Broker ---- */
+
+typedef struct {
+	char topic[MQTTPUB_TOPIC_MAX];
+	char payload[MQTTPUB_PAYLOAD_MAX + 1];
+	bool acked;
+} message_t;
+
+static struct {
+	pthread_mutex_t lock;
+	int listen_sock;
+	uint16_t port;
+	bool down;			// Close connections before the CONNACK
+	int acks_left;		// Drop the connection instead of the next ack at 0, -1 for no limit
+	int ack_delay_ms;
+	int connections;
+	bool open;
+	message_t msgs[MAX_MESSAGES];
+	int count;
+} broker = { .lock = PTHREAD_MUTEX_INITIALIZER, .acks_left = -1 };
+
+static bool recv_all(int sock, uint8_t *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = recv(sock, buf, len, 0);
+		if (n <= 0) return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool read_packet(int sock, uint8_t *type, uint8_t *body, size_t size, size_t *len)
+{
+	uint8_t b;
+	if (!recv_all(sock, type, 1)) return false;
+	*len = 0;
+	for (int shift = 0;; shift += 7) {
+		if (shift > 21 || !recv_all(sock, &b, 1)) return false;
+		*len |= (size_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) break;
+	}
+	return *len <= size && recv_all(sock, body, *len);
+}
+
+static void serve(int sock)
+{
+	static uint8_t body[MQTTPUB_PAYLOAD_MAX + MQTTPUB_TOPIC_MAX + 16];
+	uint8_t type;
+	size_t len;
+
+	if (!read_packet(sock, &type, body, sizeof(body), &len) || type != 0x10) return;
+	pthread_mutex_lock(&broker.lock);
+	bool down = broker.down;
+	broker.connections++;
+	broker.open = !down;
+	pthread_mutex_unlock(&broker.lock);
+	if (down) return;
+
+	static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+	send(sock, connack, sizeof(connack), MSG_NOSIGNAL);
+
+	while (read_packet(sock, &type, body, sizeof(body), &len) && (type & 0xf0) == 0x30) {
+		int qos = type >> 1 & 3;
+		size_t topic_len = body[0] << 8 | body[1], at = 2 + topic_len + (qos ? 2 : 0);
+		if (topic_len >= MQTTPUB_TOPIC_MAX || at > len || len - at > MQTTPUB_PAYLOAD_MAX) break;
+
+		pthread_mutex_lock(&broker.lock);
+		message_t *m = broker.count < MAX_MESSAGES ? &broker.msgs[broker.count++] : NULL;
+		if (m) {
+			memcpy(m->topic, body + 2, topic_len);
+			m->topic[topic_len] = 0;
+			memcpy(m->payload, body + at, len - at);
+			m->payload[len - at] = 0;
+			m->acked = false;
+		}
+		int delay_ms = broker.ack_delay_ms;
+		bool drop = broker.acks_left == 0;
+		if (broker.acks_left > 0) broker.acks_left--;
+		pthread_mutex_unlock(&broker.lock);
+		if (!m || drop || !qos) break;
+
+		// A client that leaves while the ack is delayed does not get it
+		struct pollfd pfd = { .fd = sock, .events = POLLIN };
+		if (delay_ms && poll(&pfd, 1, delay_ms) != 0) break;
+		uint8_t puback[] = { 0x40, 2, body[2 + topic_len], body[3 + topic_len] };
+		if (send(sock, puback, sizeof(puback), MSG_NOSIGNAL) != sizeof(puback)) break;
+		pthread_mutex_lock(&broker.lock);
+		m->acked = true;
+		pthread_mutex_unlock(&broker.lock);
+	}
+}
+
+static void *broker_thread(void *arg)
+{
+	while (1) {
+		int sock = accept(broker.listen_sock, NULL, NULL);
+		if (sock < 0) continue;
+		serve(sock); // One client at a time, that is all mqttpub ever has
+		close(sock);
+		pthread_mutex_lock(&broker.lock);
+		broker.open = false;
+		pthread_mutex_unlock(&broker.lock);
+	}
+	return NULL;
+}
+
+static bool broker_start(void)
+{
+	broker.listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof(addr);
+	if (bind(broker.listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+		listen(broker.listen_sock, 4) != 0 ||
+		getsockname(broker.listen_sock, (struct sockaddr *)&addr, &addr_len) != 0) return false;
+	broker.port = ntohs(addr.sin_port);
+
+	pthread_t thread;
+	return pthread_create(&thread, NULL, broker_thread, NULL) == 0;
+}
+
+static void broker_set(bool down, int acks_left, int ack_delay_ms)
+{
+	pthread_mutex_lock(&broker.lock);
+	broker.down = down;
+	broker.acks_left = acks_left;
+	broker.ack_delay_ms = ack_delay_ms;
+	pthread_mutex_unlock(&broker.lock);
+}
+
+/* ---- Telemetry ring, network and clock ---- */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static telemetry_sample_t samples[MAX_SAMPLES];
+static int sample_count;
+static uint32_t clock_s = T0 + INTERVAL_S / 2;
+static bool net_available = true, net_is_up;
+static int net_ups, net_downs, windows_done;
+static int64_t up_at_ms, last_up_ms, longest_up_ms;
+
+static int64_t mono_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Like the real one: samples from..to in time order, counted before cb sees them */
+uint32_t telemetry_read(uint32_t from, uint32_t to, telemetry_read_cb_t cb, void *arg)
+{
+	uint32_t passed = 0;
+	for (int i = 0;; i++) {
+		telemetry_sample_t s;
+		pthread_mutex_lock(&lock);
+		bool more = i < sample_count;
+		if (more) s = samples[i];
+		pthread_mutex_unlock(&lock);
+
+		if (!more || s.time > to) break;
+		if (s.time < from) continue;
+		passed++;
+		if (!cb(&s, arg)) break;
+	}
+	return passed;
+}
+
+static void add_samples(int n)
+{
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < n && sample_count < MAX_SAMPLES; i++, sample_count++) {
+		telemetry_sample_t *s = &samples[sample_count];
+		int k = sample_count;
+		s->time = T0 + (k - 10) * SAMPLE_S; // Ten samples from before the first window
+		s->valid = k % 7 ? 0x0f : 0x07; // Now and then no lux reading
+		s->value[TELEMETRY_RTC_TEMP] = 2150 + k % 13;
+		s->value[TELEMETRY_TEMP] = 2210 - k % 17 * 5;
+		s->value[TELEMETRY_HUMIDITY] = 4500 + k * 3;
+		s->value[TELEMETRY_LUX] = k % 7 ? 120 + k : 0;
+	}
+	clock_s = samples[sample_count - 1].time + 1;
+	pthread_mutex_unlock(&lock);
+}
+
+static uint32_t now_s(void)
+{
+	pthread_mutex_lock(&lock);
+	uint32_t t = clock_s;
+	pthread_mutex_unlock(&lock);
+	return t;
+}
+
+static bool net_up(void)
+{
+	pthread_mutex_lock(&lock);
+	bool ok = net_available;
+	if (ok) {
+		net_ups++;
+		net_is_up = true;
+		up_at_ms = mono_ms();
+	} else {
+		windows_done++;
+	}
+	pthread_mutex_unlock(&lock);
+	return ok;
+}
+
+static void net_down(void)
+{
+	pthread_mutex_lock(&lock);
+	net_downs++;
+	net_is_up = false;
+	last_up_ms = mono_ms() - up_at_ms;
+	if (last_up_ms > longest_up_ms) longest_up_ms = last_up_ms;
+	windows_done++;
+	pthread_mutex_unlock(&lock);
+}
+
+static int health(char *buf, size_t size)
+{
+	return snprintf(buf, size, "{\"up_s\":%" PRIu32 "}", now_s() - T0);
+}
+
+/* ---- Checks ---- */
+
+/* Parse a telemetry payload into samples, -1 if it is not what the header describes */
+static int decode(const char *p, telemetry_sample_t *out, int max)
+{
+	unsigned t;
+	int n = 0, used;
+	if (sscanf(p, "{\"t\":%u,\"v\":[%n", &t, &used) != 1) return -1;
+	p += used;
+	while (*p == '[' && n < max) {
+		telemetry_sample_t *s = &out[n];
+		unsigned dt;
+		if (sscanf(p, "[%u%n", &dt, &used) != 1) return -1;
+		p += used;
+		s->time = t + UTC_OFFSET_S + dt;
+		s->valid = 0;
+		for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+			if (*p++ != ',') return -1;
+			if (strncmp(p, "null", 4) == 0) {
+				p += 4;
+				s->value[ch] = 0;
+				continue;
+			}
+			int v;
+			if (sscanf(p, "%d%n", &v, &used) != 1) return -1;
+			p += used;
+			s->value[ch] = v;
+			s->valid |= 1 << ch;
+		}
+		if (*p++ != ']') return -1;
+		n++;
+		if (*p == ',') p++;
+	}
+	return strcmp(p, "]}") == 0 && n ? n : -1;
+}
+
+/* Every acknowledged telemetry sample so far, in the order the broker took them */
+static int acked_samples(telemetry_sample_t *out, int max)
+{
+	int n = 0;
+	pthread_mutex_lock(&broker.lock);
+	for (int i = 0; i < broker.count; i++) {
+		const message_t *m = &broker.msgs[i];
+		if (!m->acked || strcmp(m->topic, TOPIC "/telemetry") != 0) continue;
+		int got = decode(m->payload, out + n, max - n);
+		CHECK(got > 0);
+		if (got > 0) n += got;
+	}
+	pthread_mutex_unlock(&broker.lock);
+	return n;
+}
+
+static int count_messages(const char *what, bool acked)
+{
+	int n = 0;
+	pthread_mutex_lock(&broker.lock);
+	for (int i = 0; i < broker.count; i++) {
+		const char *t = broker.msgs[i].topic;
+		if (broker.msgs[i].acked == acked && strncmp(t, TOPIC "/", sizeof(TOPIC)) == 0 &&
+			strcmp(t + sizeof(TOPIC), what) == 0) n++;
+	}
+	pthread_mutex_unlock(&broker.lock);
+	return n;
+}
+
+/* Samples 10.. (the ones after the first cursor) up to but not including end went out once, in order */
+static void check_delivered(int end)
+{
+	static telemetry_sample_t got[MAX_SAMPLES];
+	int n = acked_samples(got, MAX_SAMPLES);
+	CHECK_EQ(n, end - 10);
+	for (int i = 0; i < n && i < end - 10; i++) {
+		const telemetry_sample_t *want = &samples[10 + i];
+		CHECK_EQ(got[i].time, want->time);
+		CHECK_EQ(got[i].valid, want->valid);
+		for (int ch = 0; ch < TELEMETRY_CHANNELS; ch++) {
+			if (want->valid & (1 << ch)) CHECK_EQ(got[i].value[ch], want->value[ch]);
+		}
+	}
+}
+
+/* Open a window and wait until it is over, the network down again and the broker alone */
+static mqttpub_stats_t window(const char *what)
+{
+	pthread_mutex_lock(&lock);
+	int done = windows_done + 1;
+	pthread_mutex_unlock(&lock);
+	mqttpub_trigger();
+
+	int64_t give_up = mono_ms() + (WINDOW_S + 5) * 1000;
+	while (1) {
+		pthread_mutex_lock(&lock);
+		bool over = windows_done >= done;
+		pthread_mutex_unlock(&lock);
+		if (over || mono_ms() > give_up) break;
+		usleep(10000);
+	}
+	usleep(50000); // The stats are updated after net_down(), and the broker sees the client leave
+
+	mqttpub_stats_t s;
+	mqttpub_get_stats(&s);
+	pthread_mutex_lock(&lock);
+	printf("%-22s %2" PRIu32 " windows, %" PRIu32 " offline, %3" PRIu32 " messages, %4" PRIu32 " samples, "
+		   "%3" PRIu32 " left, cursor T0%+" PRId64 " s, network up %" PRId64 " ms at most\n", what, s.windows,
+		   s.offline, s.messages, s.samples, s.backlog, (int64_t)s.cursor - T0, longest_up_ms);
+	CHECK(windows_done >= done);
+	CHECK(!net_is_up);
+	CHECK_EQ(net_downs, net_ups);
+	CHECK(longest_up_ms <= WINDOW_S * 1000 + 300);
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_lock(&broker.lock);
+	CHECK(!broker.open);
+	pthread_mutex_unlock(&broker.lock);
+	return s;
+}
+
+static uint32_t saved_cursor(void)
+{
+	nvs_handle_t nvs;
+	uint32_t cursor = 0;
+	if (nvs_open("mqttpub", NVS_READONLY, &nvs) == ESP_OK) {
+		nvs_get_u32(nvs, "cursor", &cursor);
+		nvs_close(nvs);
+	}
+	return cursor;
+}
+
+int main(void)
+{
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if (!broker_start()) {
+		printf("mqttpub: no loopback TCP port here, skipped.\n");
+		return 0;
+	}
+	char uri[32];
+	snprintf(uri, sizeof(uri), "mqtt://127.0.0.1:%u", broker.port);
+
+	add_samples(10 + 200);
+	const mqttpub_config_t cfg = {
+		.uri = uri,
+		.topic = TOPIC,
+		.interval_s = INTERVAL_S,
+		.window_s = WINDOW_S,
+		.utc_offset_s = UTC_OFFSET_S,
+		.now_s = now_s,
+		.net_up = net_up,
+		.net_down = net_down,
+		.health = health,
+	};
+	// The first run starts one interval back, the ten older samples stay put
+	clock_s = T0 + INTERVAL_S - 30;
+	CHECK_EQ(mqttpub_start(&cfg, 5, tskNO_AFFINITY), ESP_OK);
+	usleep(50000);
+
+	// 1. Every sample acknowledged, the cursor on the last one and in NVS
+	mqttpub_stats_t s = window("acked");
+	uint32_t last = samples[sample_count - 1].time;
+	CHECK_EQ(s.offline, 0);
+	CHECK_EQ(s.samples, 200);
+	CHECK_EQ(s.backlog, 0);
+	CHECK_EQ(s.cursor, last);
+	CHECK_EQ(saved_cursor(), last);
+	CHECK_EQ(count_messages("health", true), 1);
+	CHECK_EQ(s.messages, 1 + count_messages("telemetry", true));
+	CHECK(count_messages("telemetry", true) >= 3);
+	CHECK_EQ(count_messages("telemetry", false), 0);
+	check_delivered(sample_count);
+
+	// 2. The connection drops where the first telemetry PUBACK should be
+	add_samples(100);
+	broker_set(false, 1, 0);
+	s = window("lost ack");
+	CHECK_EQ(s.samples, 200);
+	CHECK_EQ(s.backlog, 100);
+	CHECK_EQ(s.cursor, last);
+	CHECK_EQ(saved_cursor(), last);
+	CHECK_EQ(count_messages("telemetry", false), 1);
+	check_delivered(sample_count - 100);
+
+	broker_set(false, -1, 0);
+	s = window("resent");
+	last = samples[sample_count - 1].time;
+	CHECK_EQ(s.samples, 300);
+	CHECK_EQ(s.backlog, 0);
+	CHECK_EQ(s.cursor, last);
+	CHECK_EQ(saved_cursor(), last);
+	check_delivered(sample_count);
+
+	// 3. Outage: the broker is gone for three windows, then the network for one
+	broker_set(true, -1, 0);
+	uint32_t offline = s.offline, messages = s.messages;
+	for (int i = 0; i < 3; i++) {
+		add_samples(60);
+		s = window("broker down");
+		CHECK_EQ(s.offline, offline + i + 1);
+		CHECK_EQ(s.backlog, 60 * (i + 1));
+		CHECK_EQ(s.cursor, last);
+		CHECK(last_up_ms < 500); // Refused, no need to wait for the connect timeout
+	}
+	add_samples(60);
+	net_available = false;
+	s = window("no network");
+	CHECK_EQ(s.offline, offline + 4);
+	CHECK_EQ(s.messages, messages);
+	CHECK_EQ(s.cursor, last);
+	CHECK_EQ(saved_cursor(), last);
+
+	net_available = true;
+	broker_set(false, -1, 0);
+	s = window("back");
+	last = samples[sample_count - 1].time;
+	CHECK_EQ(s.offline, offline + 4);
+	CHECK_EQ(s.samples, 300 + 240);
+	CHECK_EQ(s.backlog, 0);
+	CHECK_EQ(s.cursor, last);
+	CHECK_EQ(saved_cursor(), last);
+	CHECK(s.messages >= messages + 1 + 3);
+	check_delivered(sample_count);
+
+	// 4. A slow broker: the window closes on time and leaves the rest for the next one
+	add_samples(400);
+	broker_set(false, -1, 800);
+	s = window("slow broker");
+	CHECK(s.backlog > 0);
+	CHECK(s.backlog < 400);
+	CHECK_EQ(s.samples, 540 + 400 - s.backlog);
+	CHECK_EQ(s.cursor, samples[sample_count - 1 - s.backlog].time);
+	CHECK_EQ(saved_cursor(), s.cursor);
+	CHECK(s.last_window_ms <= WINDOW_S * 1000 + 100);
+	check_delivered(sample_count - s.backlog);
+
+	broker_set(false, -1, 0);
+	s = window("caught up");
+	CHECK_EQ(s.backlog, 0);
+	CHECK_EQ(s.samples, 940);
+	CHECK_EQ(s.cursor, samples[sample_count - 1].time);
+	check_delivered(sample_count);
+
+	pthread_mutex_lock(&broker.lock);
+	printf("broker: %d connections, %d messages\n", broker.connections, broker.count);
+	pthread_mutex_unlock(&broker.lock);
+	return test_done("mqttpub");
+}
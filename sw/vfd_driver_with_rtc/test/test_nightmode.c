@@ -0,0 +1,192 @@
+/*
+    Night mode state machine on simulated time: the schedule, the light
+    thresholds with their hysteresis, the minimum dwell, button wake and deep
+    idle. The clock is stepped a second at a time like the nightMode job.
+*/
+
+#include "nightmode.h"
+#include "test.h"
+
+#define DAY0	(20000LL * 86400)	// Local midnight of some day
+#define AT(h, m, s)	(DAY0 + (h) * 3600 + (m) * 60 + (s))
+#define BRIGHT	500
+#define DARK	3
+
+static const nightmode_config_t config = {
+	.night_start_min = 23 * 60,
+	.night_end_min = 7 * 60,
+	.dim_level = 50,
+	.dark_level = 10,
+	.hysteresis = 5,
+	.wake_s = 60,
+	.deep_idle_s = 600,
+	.min_dwell_s = 30,
+};
+
+static nightmode_t nm;
+
+/* Step from..to without button presses, returns the first second the state differs from the one at from, or -1 */
+static int64_t first_change(int64_t from, int64_t to, int32_t light)
+{
+	nightmode_state_t start = nightmode_update(&nm, from, light, false);
+	for (int64_t t = from + 1; t <= to; t++) {
+		if (nightmode_update(&nm, t, light, false) != start) return t;
+	}
+	return -1;
+}
+
+/* Step from..to without button presses, returns the state at to */
+static nightmode_state_t run(int64_t from, int64_t to, int32_t light)
+{
+	for (int64_t t = from; t < to; t++) nightmode_update(&nm, t, light, false);
+	return nightmode_update(&nm, to, light, false);
+}
+
+static void test_schedule(void)
+{
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+
+	CHECK_EQ(first_change(AT(12, 0, 0), AT(22, 59, 59), BRIGHT), -1);
+	CHECK_EQ(nm.state, NIGHTMODE_ON);
+	CHECK_EQ(first_change(AT(22, 59, 59), AT(23, 0, 0), BRIGHT), AT(23, 0, 0));
+	CHECK_EQ(nm.state, NIGHTMODE_BLANKED);
+	CHECK(nightmode_is_night(&nm, AT(23, 0, 0)));
+
+	// Blanked for deep_idle_s enters deep idle, and it holds until the morning
+	CHECK_EQ(first_change(AT(23, 0, 0), AT(23, 30, 0), BRIGHT), AT(23, 10, 0));
+	CHECK_EQ(nm.state, NIGHTMODE_DEEP_IDLE);
+	CHECK_EQ(first_change(AT(23, 10, 0), AT(6, 59, 59) + 86400, BRIGHT), -1);
+	CHECK_EQ(run(AT(6, 59, 59) + 86400, AT(7, 0, 0) + 86400, BRIGHT), NIGHTMODE_ON);
+	CHECK(!nightmode_is_night(&nm, AT(7, 0, 0) + 86400));
+	CHECK_EQ(nm.transitions, 3);
+
+	// Time in each state adds up to the whole run
+	int64_t res[NIGHTMODE_STATES];
+	int64_t end = AT(8, 0, 0) + 86400;
+	run(AT(7, 0, 0) + 86400, end, BRIGHT);
+	nightmode_residency(&nm, end, res);
+	CHECK_EQ(res[NIGHTMODE_BLANKED], 600);
+	CHECK_EQ(res[NIGHTMODE_DEEP_IDLE], 8 * 3600 - 600);
+	CHECK_EQ(res[NIGHTMODE_ON] + res[NIGHTMODE_DIMMED] + res[NIGHTMODE_BLANKED] + res[NIGHTMODE_DEEP_IDLE], end - AT(12, 0, 0));
+}
+
+static void test_schedule_wraps(void)
+{
+	nightmode_config_t cfg = config;
+
+	cfg.night_start_min = 1 * 60;
+	cfg.night_end_min = 5 * 60;
+	nightmode_init(&nm, &cfg, AT(0, 0, 0));
+	CHECK(!nightmode_is_night(&nm, AT(0, 59, 59)));
+	CHECK(nightmode_is_night(&nm, AT(1, 0, 0)));
+	CHECK(!nightmode_is_night(&nm, AT(5, 0, 0)));
+
+	CHECK(nightmode_is_night(&nm, AT(4, 0, 0) - 86400)); // Before the epoch day too
+
+	cfg.night_end_min = cfg.night_start_min;
+	nightmode_init(&nm, &cfg, AT(0, 0, 0));
+	CHECK(!nightmode_is_night(&nm, AT(3, 0, 0)));
+	CHECK_EQ(first_change(AT(0, 0, 0), AT(23, 59, 59), BRIGHT), -1);
+}
+
+static void test_light_hysteresis(void)
+{
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+	int64_t t = AT(12, 5, 0); // Past the wake window of the init
+
+	CHECK_EQ(run(t, t, 100), NIGHTMODE_ON);
+	CHECK_EQ(run(t + 1, t + 1, 45), NIGHTMODE_DIMMED);
+
+	// Brighter than dim_level, but not by the hysteresis
+	CHECK_EQ(first_change(t + 1, t + 200, 52), -1);
+	CHECK_EQ(run(t + 201, t + 201, 55), NIGHTMODE_ON);
+
+	// Dark blanks, and only dark_level + hysteresis leaves it, into dimmed
+	t += 300;
+	CHECK_EQ(run(t, t, 5), NIGHTMODE_BLANKED);
+	CHECK_EQ(first_change(t + 30, t + 100, 14), -1);
+	CHECK_EQ(run(t + 101, t + 101, 15), NIGHTMODE_DIMMED);
+	CHECK_EQ(run(t + 131, t + 131, 60), NIGHTMODE_ON);
+
+	// Without a sensor only the schedule counts
+	t += 300;
+	CHECK_EQ(first_change(t, t + 600, NIGHTMODE_NO_LIGHT), -1);
+	CHECK_EQ(nm.state, NIGHTMODE_ON);
+}
+
+static void test_min_dwell(void)
+{
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+	int64_t t = AT(12, 5, 0);
+
+	CHECK_EQ(run(t, t, 20), NIGHTMODE_DIMMED);
+
+	// A passing shadow clears, but the state holds for min_dwell_s
+	CHECK_EQ(first_change(t, t + 100, BRIGHT), t + 30);
+	CHECK_EQ(nm.state, NIGHTMODE_ON);
+
+	// Flickering light inside the dwell changes nothing
+	t += 100;
+	CHECK_EQ(run(t, t, 20), NIGHTMODE_DIMMED);
+	for (int i = 1; i < 30; i++) CHECK_EQ(nightmode_update(&nm, t + i, i & 1 ? BRIGHT : 20, false), NIGHTMODE_DIMMED);
+	CHECK_EQ(nightmode_update(&nm, t + 30, BRIGHT, false), NIGHTMODE_ON);
+}
+
+static void test_button_wake(void)
+{
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+	CHECK_EQ(run(AT(22, 0, 0), AT(23, 5, 0), BRIGHT), NIGHTMODE_BLANKED);
+
+	// A press wakes at once, dwell or not, and the display goes back wake_s later
+	int64_t t = AT(23, 5, 0) + 1;
+	CHECK_EQ(nightmode_update(&nm, t, BRIGHT, true), NIGHTMODE_ON);
+	CHECK_EQ(first_change(t, t + 120, BRIGHT), t + 60);
+	CHECK_EQ(nm.state, NIGHTMODE_BLANKED);
+
+	// In a dark room it wakes dimmed
+	t += 200;
+	CHECK_EQ(nightmode_update(&nm, t, DARK, true), NIGHTMODE_DIMMED);
+	CHECK_EQ(first_change(t, t + 120, DARK), t + 60);
+	CHECK_EQ(nm.state, NIGHTMODE_BLANKED);
+
+	// Presses keep it up
+	t += 200;
+	for (int i = 0; i < 5; i++) CHECK_EQ(nightmode_update(&nm, t + i * 50, BRIGHT, true), NIGHTMODE_ON);
+	CHECK_EQ(first_change(t + 200, t + 400, BRIGHT), t + 260);
+}
+
+static void test_deep_idle(void)
+{
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+	CHECK_EQ(run(AT(22, 59, 0), AT(23, 10, 0), BRIGHT), NIGHTMODE_DEEP_IDLE);
+
+	// Deep idle skips the dwell on the way in and wakes straight to on
+	int64_t t = AT(23, 20, 0);
+	CHECK_EQ(run(AT(23, 10, 0), t, BRIGHT), NIGHTMODE_DEEP_IDLE);
+	CHECK_EQ(nightmode_update(&nm, t + 1, BRIGHT, true), NIGHTMODE_ON);
+	CHECK_EQ(first_change(t + 1, t + 2000, BRIGHT), t + 61);
+	CHECK_EQ(nm.state, NIGHTMODE_BLANKED);
+	CHECK_EQ(first_change(t + 61, t + 2000, BRIGHT), t + 661);
+	CHECK_EQ(nm.state, NIGHTMODE_DEEP_IDLE);
+
+	// A dark room in daytime idles the same way
+	nightmode_init(&nm, &config, AT(12, 0, 0));
+	CHECK_EQ(run(AT(12, 5, 0), AT(12, 5, 0), DARK), NIGHTMODE_BLANKED);
+	CHECK_EQ(first_change(AT(12, 5, 0), AT(12, 30, 0), DARK), AT(12, 15, 0));
+	CHECK_EQ(nm.state, NIGHTMODE_DEEP_IDLE);
+
+	// Lights on leaves deep idle without a press, after the dwell
+	CHECK_EQ(first_change(AT(12, 15, 0), AT(12, 20, 0), BRIGHT), AT(12, 15, 30));
+	CHECK_EQ(nm.state, NIGHTMODE_ON);
+}
+
+int main(void)
+{
+	test_schedule();
+	test_schedule_wraps();
+	test_light_hysteresis();
+	test_min_dwell();
+	test_button_wake();
+	test_deep_idle();
+	return test_done("nightmode");
+}
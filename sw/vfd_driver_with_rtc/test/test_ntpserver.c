@@ -0,0 +1,188 @@
+/*
+    The SNTP server on the host: ntpserver_reply() field by field, then the
+    whole server over loopback with a client like the one in every NTP
+    implementation (send mode 3, take T1..T4, offset and delay).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ntpserver.h"
+#include "test.h"
+
+#define NTP_UNIX_S	2208988800u
+#define T0_US		1760000000000000LL	// Some UTC time in 2025
+
+static uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int64_t get_timestamp(const uint8_t *p)
+{
+	return ((int64_t)get32(p) - NTP_UNIX_S) * 1000000 + (((uint64_t)get32(p + 4) * 1000000 + (1u << 31)) >> 32);
+}
+
+static void put_timestamp(uint8_t *p, int64_t unix_us)
+{
+	uint32_t s = unix_us / 1000000 + NTP_UNIX_S, f = ((uint64_t)(unix_us % 1000000) << 32) / 1000000;
+	uint8_t b[8] = { s >> 24, s >> 16, s >> 8, s, f >> 24, f >> 16, f >> 8, f };
+	memcpy(p, b, 8);
+}
+
+static void request(uint8_t *req, int version, int64_t tx_us)
+{
+	memset(req, 0, NTPSERVER_PACKET);
+	req[0] = version << 3 | 3;
+	req[2] = 6; // Poll 64 s
+	put_timestamp(req + 40, tx_us);
+}
+
+static const ntpserver_source_t synced = {
+	.stratum = 3,
+	.ref_id = 0x0100a8c0,	// 192.168.0.1 in network order on a little endian host
+	.ref_us = T0_US,
+	.root_delay_us = 20000,
+	.root_disp_us = 1000,
+	.disp_ppb = 2000,
+};
+
+static void test_reply(void)
+{
+	uint8_t req[NTPSERVER_PACKET + 8], resp[NTPSERVER_PACKET];
+	int64_t rx = T0_US + 100000000, tx = rx + 150;
+
+	// Not answered: short, not a client, unknown version
+	request(req, 4, rx - 1000);
+	CHECK_EQ(ntpserver_reply(req, NTPSERVER_PACKET - 1, rx, tx, &synced, resp), 0);
+	req[0] = 4 << 3 | 4;
+	CHECK_EQ(ntpserver_reply(req, NTPSERVER_PACKET, rx, tx, &synced, resp), 0);
+	req[0] = 5 << 3 | 3;
+	CHECK_EQ(ntpserver_reply(req, NTPSERVER_PACKET, rx, tx, &synced, resp), 0);
+	req[0] = 0 << 3 | 3;
+	CHECK_EQ(ntpserver_reply(req, NTPSERVER_PACKET, rx, tx, &synced, resp), 0);
+
+	// Synced, a v3 client with an extension field gets a v3 answer
+	request(req, 3, rx - 1000);
+	CHECK_EQ(ntpserver_reply(req, sizeof(req), rx, tx, &synced, resp), NTPSERVER_PACKET);
+	CHECK_EQ(resp[0], 0 << 6 | 3 << 3 | 4);
+	CHECK_EQ(resp[1], 3);
+	CHECK_EQ(resp[2], 6);
+	CHECK_EQ((int8_t)resp[3], NTPSERVER_PRECISION);
+	CHECK_EQ(get32(resp + 4), 20000 * 65536 / 1000000);
+	CHECK_EQ(get32(resp + 8), (1000 + 200) * 65536 / 1000000); // 100 s at 2000 ppb
+	CHECK(memcmp(resp + 12, &synced.ref_id, 4) == 0);
+	CHECK_EQ(get_timestamp(resp + 16), T0_US);
+	CHECK(memcmp(resp + 24, req + 40, 8) == 0);
+	CHECK_EQ(get_timestamp(resp + 32), rx);
+	CHECK_EQ(get_timestamp(resp + 40), tx);
+
+	// Sub-microsecond round trip of odd times
+	for (int64_t us = 0; us < 1000000; us += 999983 / 7) {
+		request(req, 4, 0);
+		ntpserver_reply(req, NTPSERVER_PACKET, T0_US + us, T0_US + us + 1, &synced, resp);
+		CHECK_EQ(get_timestamp(resp + 32), T0_US + us);
+		CHECK_EQ(get_timestamp(resp + 40), T0_US + us + 1);
+	}
+
+	// Never synced, and synced too long ago for the dispersion
+	ntpserver_source_t none = { .stratum = NTPSERVER_STRATUM_NONE };
+	request(req, 4, rx - 1000);
+	CHECK_EQ(ntpserver_reply(req, NTPSERVER_PACKET, rx, tx, &none, resp), NTPSERVER_PACKET);
+	CHECK_EQ(resp[0] >> 6, 3);
+	CHECK_EQ(resp[1], NTPSERVER_STRATUM_NONE);
+	CHECK_EQ(get32(resp + 8), (uint64_t)NTPSERVER_MAX_DISP_US * 65536 / 1000000);
+	CHECK(memcmp(resp + 12, "INIT", 4) == 0);
+	CHECK_EQ(get_timestamp(resp + 40), tx);
+
+	int64_t late = T0_US + (int64_t)(NTPSERVER_MAX_DISP_US - 1000) * 1000000000 / synced.disp_ppb;
+	ntpserver_reply(req, NTPSERVER_PACKET, late - 1000000, late, &synced, resp);
+	CHECK_EQ(resp[0] >> 6, 0);
+	ntpserver_reply(req, NTPSERVER_PACKET, late + 1000000, late + 1000001, &synced, resp);
+	CHECK_EQ(resp[0] >> 6, 3);
+	CHECK_EQ(resp[1], NTPSERVER_STRATUM_NONE);
+}
+
+static int64_t wall_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void test_loopback(void)
+{
+	uint16_t port = 12300;
+	while (ntpserver_start(port, wall_us, 5, tskNO_AFFINITY) != ESP_OK) {
+		if (++port == 12400) {
+			CHECK(!"no free port");
+			return;
+		}
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	struct timeval timeout = { .tv_sec = 1 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	uint8_t req[NTPSERVER_PACKET], resp[NTPSERVER_PACKET + 1];
+
+	// Before a source is set the server says so
+	request(req, 4, wall_us());
+	sendto(sock, req, sizeof(req), 0, (struct sockaddr *)&server, sizeof(server));
+	CHECK_EQ(recv(sock, resp, sizeof(resp), 0), NTPSERVER_PACKET);
+	CHECK_EQ(resp[0] >> 6, 3);
+
+	ntpserver_source_t src = synced;
+	src.ref_us = wall_us();
+	ntpserver_set_source(&src);
+
+	// Garbage first, it must not stop the server
+	sendto(sock, "hello", 5, 0, (struct sockaddr *)&server, sizeof(server));
+
+	int64_t worst_offset = 0, worst_delay = 0;
+	for (int i = 0; i < 20; i++) {
+		int64_t t1 = wall_us();
+		request(req, 4, t1);
+		sendto(sock, req, sizeof(req), 0, (struct sockaddr *)&server, sizeof(server));
+		ssize_t n = recv(sock, resp, sizeof(resp), 0);
+		int64_t t4 = wall_us();
+		CHECK_EQ(n, NTPSERVER_PACKET);
+		if (n != NTPSERVER_PACKET) continue;
+
+		CHECK_EQ(resp[0], 0 << 6 | 4 << 3 | 4);
+		CHECK_EQ(resp[1], 3);
+		CHECK(memcmp(resp + 24, req + 40, 8) == 0);
+		int64_t t2 = get_timestamp(resp + 32), t3 = get_timestamp(resp + 40);
+		CHECK(t3 >= t2);
+		int64_t offset = ((t2 - t1) + (t3 - t4)) / 2, delay = (t4 - t1) - (t3 - t2);
+		if (llabs(offset) > worst_offset) worst_offset = llabs(offset);
+		if (delay > worst_delay) worst_delay = delay;
+	}
+	close(sock);
+
+	// Same clock on both ends, only the timestamp rounding and the loopback asymmetry are left
+	printf("loopback port %u: worst offset %lld us, worst delay %lld us\n", port, (long long)worst_offset, (long long)worst_delay);
+	CHECK(worst_offset < 1000);
+	CHECK(worst_delay < 20000);
+
+	usleep(20000); // The server counts a reply after sending it
+	ntpserver_stats_t stats;
+	ntpserver_get_stats(&stats);
+	CHECK_EQ(stats.requests, 22);
+	CHECK_EQ(stats.replies, 21);
+	CHECK_EQ(stats.ignored, 1);
+	CHECK_EQ(stats.unsynced, 1);
+	CHECK_EQ(stats.send_failed, 0);
+}
+
+int main(void)
+{
+	test_reply();
+	test_loopback();
+	return test_done("ntpserver");
+}
@@ -0,0 +1,99 @@
+/*
+    The timebase on a simulated esp_timer: slewed corrections never take
+    timebase_now_us() backwards, steps and timebase_set() do and the clock
+    keeps running from the new time, and timebase_timer_at() agrees with it.
+*/
+
+#include <stdlib.h>
+
+#include "esp_timer.h"
+#include "timebase.h"
+#include "test.h"
+
+#define E0_US		1760000000000000LL	// Some local time in 2025
+#define SECOND		1000000LL
+
+static int64_t timer_us = 5 * SECOND;
+
+int64_t esp_timer_get_time(void)
+{
+	return timer_us;
+}
+
+/* Step the timer through span_us and check the timebase only ever moves forward, by about the elapsed time */
+static int64_t run(int64_t span_us, int64_t step_us)
+{
+	int64_t prev = timebase_now_us();
+	for (int64_t t = 0; t < span_us; t += step_us) {
+		timer_us += step_us;
+		int64_t now = timebase_now_us();
+		CHECK(now > prev);
+		CHECK(llabs(now - prev - step_us) <= step_us * TIMEBASE_SLEW_PPM / 1000000 + 1);
+		prev = now;
+	}
+	return prev;
+}
+
+/* The second boundary scheduling in main.c: the timer value of a time, and the time there */
+static void check_timer_at(void)
+{
+	int64_t next = (timebase_now_us() / SECOND + 1) * SECOND;
+	int64_t at = timebase_timer_at(next);
+	CHECK(at > timer_us);
+	CHECK(at - timer_us <= SECOND + 1000);
+	int64_t saved = timer_us;
+	timer_us = at;
+	CHECK(llabs(timebase_now_us() - next) <= 1);
+	timer_us = saved;
+}
+
+int main(void)
+{
+	timebase_set(timer_us, E0_US);
+	CHECK_EQ(timebase_now_us(), E0_US);
+	run(10 * SECOND, 100000);
+	CHECK_EQ(timebase_now_us(), E0_US + 10 * SECOND);
+
+	// 50 ms behind: slewed out at TIMEBASE_SLEW_PPM, never backwards
+	timebase_ntp(timer_us, timebase_now_us() - 50000);
+	timebase_stats_t st;
+	timebase_get_stats(&st);
+	CHECK_EQ(st.steps, 0);
+	CHECK_EQ(st.slew_us, -50000);
+	int64_t start = timebase_now_us();
+	int64_t end = run(120 * SECOND, 50000);
+	CHECK_EQ(end - start, 120 * SECOND - 50000);
+	check_timer_at();
+
+	// The RTC ran 30 s fast: NTP steps the clock back, it follows at once and keeps running
+	int64_t before = timebase_now_us();
+	timebase_ntp(timer_us, before - 30 * SECOND);
+	timebase_get_stats(&st);
+	CHECK_EQ(st.steps, 1);
+	CHECK_EQ(timebase_now_us(), before - 30 * SECOND);
+	start = timebase_now_us();
+	end = run(5 * SECOND, 10000);
+	CHECK_EQ(end - start, 5 * SECOND);
+	check_timer_at();
+
+	// Just beyond the step limit, backwards, through an RTC edge this time
+	timebase_rtc_written();
+	before = timebase_now_us();
+	timebase_ntp(timer_us, before - TIMEBASE_STEP_US - 1000);
+	CHECK_EQ(timebase_now_us(), before - TIMEBASE_STEP_US - 1000);
+	run(SECOND, 10000);
+
+	// Forward steps and timebase_set() both ways
+	before = timebase_now_us();
+	timebase_ntp(timer_us, before + 3 * SECOND);
+	CHECK_EQ(timebase_now_us(), before + 3 * SECOND);
+	timebase_set(timer_us, E0_US - 3600 * SECOND);
+	CHECK_EQ(timebase_now_us(), E0_US - 3600 * SECOND);
+	end = run(2 * SECOND, 100000);
+	CHECK_EQ(end, E0_US - 3598 * SECOND);
+	timebase_set(timer_us, E0_US);
+	CHECK_EQ(timebase_now_us(), E0_US);
+	check_timer_at();
+
+	return test_done("timebase");
+}
@@ -0,0 +1,212 @@
+/*
+    The driver's frame to pin mapping for one topology, built once per
+    VFD_TOPOLOGY_HEADER. The pins drive a model of the SN74HC595 chains (SER
+    into QA, each SRCLK rising edge moves every stage one on towards QH' and
+    the next register, RCLK latches, SRCLR low clears the shift stages) and
+    the test reads back what each tube's register outputs after a phase.
+*/
+
+#include <string.h>
+
+#include "vfd_driver.h"
+#include "test.h"
+
+#define STAGES (VFD_CHAIN_TUBES * 8)
+
+static const gpio_num_t chain_pins[VFD_CHAINS] = VFD_CHAIN_PINS;
+static const gpio_num_t grid_pins[VFD_GRIDS] = VFD_GRID_PINS;
+static const uint8_t seg_bit[8] = {	// Logical bit 0 (H) .. 7 (A)
+	VFD_SEG_BIT_H, VFD_SEG_BIT_G, VFD_SEG_BIT_F, VFD_SEG_BIT_E,
+	VFD_SEG_BIT_D, VFD_SEG_BIT_C, VFD_SEG_BIT_B, VFD_SEG_BIT_A,
+};
+
+static struct {
+	uint8_t ser[VFD_CHAINS];
+	uint8_t stage[VFD_CHAINS][STAGES];	// Register r is stages 8r (QA) .. 8r + 7 (QH), register 0 next to the MCU
+	uint8_t out[VFD_CHAINS][STAGES];
+	uint8_t grid[VFD_GRIDS];
+	uint8_t srclk, rclk, srclr;
+	uint32_t edges;
+} hc;
+
+static void pin_changed(gpio_num_t pin, uint32_t level)
+{
+	for (int c = 0; c < VFD_CHAINS; c++) {
+		if (pin == chain_pins[c]) hc.ser[c] = level;
+	}
+	for (int g = 0; g < VFD_GRIDS; g++) {
+		if (pin == grid_pins[g]) hc.grid[g] = level;
+	}
+
+	if (pin == SRCLR) {
+		hc.srclr = level;
+		if (!level) memset(hc.stage, 0, sizeof(hc.stage));
+	} else if (pin == SRCLK) {
+		if (level && !hc.srclk && hc.srclr) {
+			for (int c = 0; c < VFD_CHAINS; c++) {
+				memmove(&hc.stage[c][1], &hc.stage[c][0], STAGES - 1);
+				hc.stage[c][0] = hc.ser[c];
+			}
+			hc.edges++;
+		}
+		hc.srclk = level;
+	} else if (pin == RCLK) {
+		if (level && !hc.rclk) memcpy(hc.out, hc.stage, sizeof(hc.out));
+		hc.rclk = level;
+	}
+}
+
+/* Register bit b drives Q(7 - b): bit 0 is shifted in first and ends up on QH */
+static uint8_t reg_output(int chain, int slot, int reg_bit)
+{
+	return hc.out[chain][slot * 8 + 7 - reg_bit];
+}
+
+/* Every tube of the grid shows its frame byte on the outputs its segments are wired to, and only that grid is on */
+static void check_phase(const vfd_frame_t *frame, int grid)
+{
+	for (int g = 0; g < VFD_GRIDS; g++) CHECK_EQ(hc.grid[g], g == grid);
+
+	for (int c = 0; c < VFD_CHAINS; c++) {
+		for (int s = 0; s < VFD_CHAIN_TUBES; s++) {
+			uint8_t seg = frame->seg[VFD_TUBE(c, s, grid)];
+			for (int b = 0; b < 8; b++) CHECK_EQ(reg_output(c, s, seg_bit[b]), (seg >> b) & 1);
+		}
+	}
+}
+
+static void test_numbering(void)
+{
+	int seen[VFD_TUBES] = { 0 };
+
+	// Every tube is on exactly one chain, slot and grid
+	for (int c = 0; c < VFD_CHAINS; c++) {
+		for (int s = 0; s < VFD_CHAIN_TUBES; s++) {
+			for (int g = 0; g < VFD_GRIDS; g++) {
+				int t = VFD_TUBE(c, s, g);
+				CHECK(t >= 0 && t < VFD_TUBES);
+				if (t >= 0 && t < VFD_TUBES) seen[t]++;
+			}
+		}
+	}
+	for (int t = 0; t < VFD_TUBES; t++) CHECK_EQ(seen[t], 1);
+
+	// Neighbouring tubes share a register position on consecutive grids
+	CHECK_EQ(VFD_TUBE(0, 0, 0), 0);
+	CHECK_EQ(VFD_TUBE(0, 0, VFD_GRIDS - 1), VFD_GRIDS - 1);
+	CHECK_EQ(VFD_TUBE(VFD_CHAINS - 1, VFD_CHAIN_TUBES - 1, VFD_GRIDS - 1), VFD_TUBES - 1);
+}
+
+static void test_seg_map(void)
+{
+	uint8_t wired = 0;
+
+	for (int b = 0; b < 8; b++) {
+		CHECK(seg_bit[b] < 8);
+		wired |= 1 << seg_bit[b];
+		CHECK_EQ(VFD_SEG_MAP(1 << b), 1 << seg_bit[b]);
+	}
+	CHECK_EQ(wired, 0xff); // Every output once
+
+	// A byte maps bit by bit
+	for (int v = 0; v < 256; v++) {
+		uint8_t expect = 0;
+		for (int b = 0; b < 8; b++) {
+			if (v >> b & 1) expect |= 1 << seg_bit[b];
+		}
+		CHECK_EQ(VFD_SEG_MAP(v), expect);
+	}
+}
+
+static void test_show_frame(void)
+{
+	vfd_frame_t frame;
+	uint32_t rng = 7;
+
+	vfd_init();
+	CHECK_EQ(hc.srclr, 1);
+
+	for (int run = 0; run < 200; run++) {
+		for (int t = 0; t < VFD_TUBES; t++) {
+			rng = rng * 1103515245u + 12345u;
+			frame.seg[t] = rng >> 16;
+		}
+		for (int g = 0; g < VFD_GRIDS; g++) {
+			uint32_t edges = hc.edges;
+			vfd_show_frame(&frame, g);
+			CHECK_EQ(hc.edges - edges, STAGES); // One pass over the chains
+			check_phase(&frame, g);
+		}
+	}
+
+	// One segment on one tube lands on that tube alone
+	for (int t = 0; t < VFD_TUBES; t++) {
+		for (int b = 0; b < 8; b++) {
+			memset(&frame, 0, sizeof(frame));
+			frame.seg[t] = 1 << b;
+			for (int g = 0; g < VFD_GRIDS; g++) {
+				vfd_show_frame(&frame, g);
+				check_phase(&frame, g);
+			}
+		}
+	}
+}
+
+static void test_encode(void)
+{
+	vfd_frame_t frame;
+	char text[VFD_TUBES + 1];
+
+	for (int t = 0; t < VFD_TUBES; t++) text[t] = '0' + t % 10;
+	text[VFD_TUBES] = '\0';
+
+	vfd_set_dp(1u << (VFD_TUBES - 1));
+	vfd_encode_str(&frame, text);
+	vfd_set_dp(0);
+	for (int t = 0; t < VFD_TUBES; t++) {
+		CHECK_EQ(frame.seg[t], vfd_glyph(text[t]) | (t == VFD_TUBES - 1));
+	}
+
+	// Tubes past a short string stay blank
+	vfd_encode_str(&frame, "12");
+	for (int t = 2; t < VFD_TUBES; t++) CHECK_EQ(frame.seg[t], 0);
+
+	vfd_value_str(text, 0);
+	vfd_encode_str(&frame, text);
+	check_phase(&frame, 0);
+}
+
+static void test_blank(void)
+{
+	vfd_frame_t frame;
+
+	memset(&frame, 0xff, sizeof(frame));
+	vfd_show_frame(&frame, VFD_GRIDS - 1);
+	check_phase(&frame, VFD_GRIDS - 1);
+
+	vfd_blank_outputs();
+	memset(&frame, 0, sizeof(frame));
+	check_phase(&frame, VFD_GRIDS - 1);
+
+	// Held blank: storage stays clear whatever is shifted, all grids off
+	vfd_hold_blank(true);
+	for (int g = 0; g < VFD_GRIDS; g++) CHECK_EQ(hc.grid[g], 0);
+	CHECK_EQ(hc.srclr, 0);
+	vfd_hold_blank(false);
+	CHECK_EQ(hc.srclr, 1);
+}
+
+int main(void)
+{
+	gpio_sim_hook = pin_changed;
+
+	test_numbering();
+	test_seg_map();
+	test_show_frame();
+	test_encode();
+	test_blank();
+
+	char name[64];
+	snprintf(name, sizeof(name), "topology %d chains x %d x %d grids", VFD_CHAINS, VFD_CHAIN_TUBES, VFD_GRIDS);
+	return test_done(name);
+}
@@ -0,0 +1,29 @@
+#ifndef test_topology_chain
+#define test_topology_chain
+
+/*
+    Test topology for test_topology.c: one chain of three registers on two
+    grids, and segments wired in a different order than the registers, so
+    the slot order and the generated wiring table are exercised too.
+*/
+
+#define VFD_CHAINS          1
+#define VFD_CHAIN_TUBES     3
+#define VFD_GRIDS           2
+#define VFD_CHAIN_PINS      { GPIO_NUM_4 }
+#define VFD_GRID_PINS       { GPIO_NUM_8, GPIO_NUM_9 }
+
+#define SRCLR       GPIO_NUM_1
+#define SRCLK       GPIO_NUM_2
+#define RCLK        GPIO_NUM_3
+
+#define VFD_SEG_BIT_A   0
+#define VFD_SEG_BIT_B   2
+#define VFD_SEG_BIT_C   4
+#define VFD_SEG_BIT_D   6
+#define VFD_SEG_BIT_E   1
+#define VFD_SEG_BIT_F   3
+#define VFD_SEG_BIT_G   5
+#define VFD_SEG_BIT_H   7
+
+#endif
@@ -0,0 +1,293 @@
+#!/usr/bin/env python3
+"""
+Decode the binary event stream of the clock, see
+components/evstream/include/evstream.h for the framing and the events.
+
+    python tools/evstream.py /dev/ttyACM0          # Live, needs pyserial
+    python tools/evstream.py capture.bin           # A raw capture
+    python tools/evstream.py - --json < capture.bin
+    python tools/evstream.py /dev/ttyACM0 --shell  # Lines typed go to the shell
+
+Bytes outside of valid frames (the boot ROM and bootloader print text before
+the firmware takes the port over) are passed through as text.
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+import threading
+import zlib
+
+EV_TEXT = 1
+EV_SAMPLE = 2
+EV_REFRESH = 3
+EV_STATE = 4
+EV_LOG = 5
+EV_LOG_FMT = 6
+EV_LOAD = 7
+
+HEADER = struct.Struct('<BBI')           # type, seq, time_ms
+SAMPLE = struct.Struct('<IB4i')          # time, valid, value[4]
+REFRESH_BUCKETS = 12
+REFRESH = struct.Struct('<HII{}I'.format(REFRESH_BUCKETS))  # period_us, phases, dev_max_us, bucket[]
+STATE = struct.Struct('<BBB')            # machine, from, to
+LOG = struct.Struct('<IIBB')             # id, time_us, level, core, then the arguments
+LOG_FMT = struct.Struct('<I')            # id, then tag and format
+LOAD = struct.Struct('<H2H2H2I')        # window_ms, load_pm[2], budget_pm[2], over_budget[2]
+LEVELS = 'NEWIDV'
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|L|q|j|z|t)?([diouxXcp%])')
+
+CHANNELS = (('rtc_temp', 100, 'C'), ('temp', 100, 'C'), ('humidity', 100, '%'), ('lux', 1, 'lx'))
+MACHINES = {
+    1: ('night', ('on', 'dimmed', 'blanked', 'deep_idle')),
+    2: ('watch', ('clock', 'stopwatch', 'countdown')),
+    3: ('rtc', ('ok', 'lost')),
+}
+
+
+class FrameError(ValueError):
+    pass
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise FrameError('bad COBS code')
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def unframe(data):
+    """Payload of one frame (without the delimiter), FrameError if it is damaged"""
+    payload = cobs_decode(data)
+    if len(payload) < HEADER.size + 4:
+        raise FrameError('short frame')
+    body, crc = payload[:-4], struct.unpack('<I', payload[-4:])[0]
+    if zlib.crc32(body) != crc:
+        raise FrameError('CRC mismatch')
+    return body
+
+
+def printable(data):
+    return all(32 <= b < 127 or b in (9, 10, 13, 27) for b in data)
+
+
+def bucket_label(i):
+    if i == 0:
+        return '0'
+    lo, hi = 1 << (i - 1), (1 << i) - 1
+    if i == REFRESH_BUCKETS - 1:
+        return '{}+'.format(lo)
+    return str(lo) if lo == hi else '{}-{}'.format(lo, hi)
+
+
+def c_format(fmt, args):
+    """printf() a format of the firmware with its raw 32-bit arguments"""
+    args = iter(args)
+
+    def conversion(m):
+        flags, conv = m.groups()
+        if conv == '%':
+            return '%'
+        value = next(args, 0)
+        if conv in 'di':
+            value -= (value & 0x80000000) << 1
+        elif conv == 'c':
+            return chr(value & 0xff)
+        elif conv == 'p':
+            return '0x{:08x}'.format(value)
+        elif conv == 'u':
+            conv = 'd'
+        return ('%' + flags + conv) % value
+
+    return CONVERSION.sub(conversion, fmt)
+
+
+def decode_event(payload, formats):
+    ev_type, seq, time_ms = HEADER.unpack_from(payload)
+    body = payload[HEADER.size:]
+    event = {'type': ev_type, 'seq': seq, 'time_ms': time_ms}
+
+    if ev_type == EV_TEXT:
+        event.update(type='text', text=body.decode('utf-8', 'replace'))
+    elif ev_type == EV_SAMPLE and len(body) == SAMPLE.size:
+        t, valid, *values = SAMPLE.unpack(body)
+        event.update(type='sample', time=t)
+        for ch, (name, scale, _) in enumerate(CHANNELS):
+            event[name] = values[ch] / scale if valid & (1 << ch) else None
+    elif ev_type == EV_REFRESH and len(body) == REFRESH.size:
+        period_us, phases, dev_max_us, *buckets = REFRESH.unpack(body)
+        event.update(type='refresh', period_us=period_us, phases=phases, dev_max_us=dev_max_us,
+                     buckets={bucket_label(i): n for i, n in enumerate(buckets) if n})
+    elif ev_type == EV_STATE and len(body) == STATE.size:
+        machine, frm, to = STATE.unpack(body)
+        name, states = MACHINES.get(machine, (str(machine), ()))
+        label = lambda s: states[s] if s < len(states) else str(s)
+        event.update(type='state', machine=name, **{'from': label(frm), 'to': label(to)})
+    elif ev_type == EV_LOAD and len(body) == LOAD.size:
+        window_ms, *values = LOAD.unpack(body)
+        event.update(type='load', window_ms=window_ms, load=[v / 10 for v in values[0:2]],
+                     budget=[v / 10 for v in values[2:4]], over_budget=values[4:6])
+    elif ev_type == EV_LOG_FMT and len(body) > LOG_FMT.size:
+        fmt_id, = LOG_FMT.unpack_from(body)
+        tag, _, fmt = body[LOG_FMT.size:].rstrip(b'\0').partition(b'\0')
+        formats[fmt_id] = (tag.decode('utf-8', 'replace'), fmt.decode('utf-8', 'replace'))
+        event.update(type='log_fmt', id=fmt_id, tag=formats[fmt_id][0], fmt=formats[fmt_id][1])
+    elif ev_type == EV_LOG and len(body) >= LOG.size and (len(body) - LOG.size) % 4 == 0:
+        fmt_id, time_us, level, core = LOG.unpack_from(body)
+        args = struct.unpack_from('<{}I'.format((len(body) - LOG.size) // 4), body, LOG.size)
+        event.update(type='log', id=fmt_id, time_us=time_us, core=core,
+                     level=LEVELS[level] if level < len(LEVELS) else str(level))
+        if fmt_id in formats:
+            tag, fmt = formats[fmt_id]
+            event.update(tag=tag, text=c_format(fmt, args))
+        else:
+            event.update(tag=None, args=list(args))
+    else:
+        event.update(type='unknown', body=body.hex())
+    return event
+
+
+def format_event(event):
+    head = '{:10.3f} '.format(event['time_ms'] / 1000)
+    kind = event['type']
+    if kind == 'text':
+        return head + event['text']
+    if kind == 'sample':
+        fields = []
+        for name, _, unit in CHANNELS:
+            value = event[name]
+            fields.append('{} {}'.format(name, '-' if value is None else '{:g}{}'.format(value, unit)))
+        return head + 'SAMPLE @{} '.format(event['time']) + ', '.join(fields)
+    if kind == 'refresh':
+        hist = ' '.join('{}us:{}'.format(k, v) for k, v in event['buckets'].items())
+        return head + 'REFRESH {} phases of {} us, max dev {} us | {}'.format(
+            event['phases'], event['period_us'], event['dev_max_us'], hist)
+    if kind == 'state':
+        return head + 'STATE {} {} -> {}'.format(event['machine'], event['from'], event['to'])
+    if kind == 'load':
+        cores = []
+        for core, (load, budget, over) in enumerate(zip(event['load'], event['budget'], event['over_budget'])):
+            limit = ' of {:g}%, {} over'.format(budget, over) if budget < 100 else ''
+            cores.append('core {} {:5.1f}%{}'.format(core, load, limit))
+        return head + 'LOAD {} ms | '.format(event['window_ms']) + ', '.join(cores)
+    if kind == 'log':
+        # Time of the call, not of the frame
+        head = '{:10.3f} '.format(event['time_us'] / 1e6)
+        if event['tag'] is None:
+            return head + '{} format {:08x} {}'.format(event['level'], event['id'], event['args'])
+        return head + '{} {}: {}'.format(event['level'], event['tag'], event['text'])
+    return head + 'EVENT {} {}'.format(event['type'], event['body'])
+
+
+class Decoder:
+    def __init__(self, emit, text):
+        self.buf = bytearray()
+        self.emit = emit
+        self.text = text
+        self.last_seq = None
+        self.formats = {}  # Log format ID: (tag, format)
+        self.frames = self.lost = self.bad = 0
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            end = self.buf.find(b'\0')
+            if end < 0:
+                return
+            chunk, self.buf = bytes(self.buf[:end]), self.buf[end + 1:]
+            if chunk:
+                self.chunk(chunk)
+
+    def chunk(self, chunk):
+        try:
+            event = decode_event(unframe(chunk), self.formats)
+        except (FrameError, struct.error):
+            # Text before the firmware took over the port runs into the first frame
+            head, newline, tail = chunk.rpartition(b'\n')
+            if newline and printable(head):
+                self.text(head.decode('ascii'))
+                if tail:
+                    self.chunk(tail)
+            elif printable(chunk):
+                self.text(chunk.decode('ascii'))
+            else:
+                self.bad += 1
+            return
+
+        if self.last_seq is not None:
+            self.lost += (event['seq'] - self.last_seq - 1) & 0xff
+        self.last_seq = event['seq']
+        self.frames += 1
+        if event['type'] != 'log_fmt':
+            self.emit(event)
+
+
+def open_input(path):
+    if path == '-':
+        return sys.stdin.buffer, None
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import serial  # pyserial
+        port = serial.Serial(path, 115200, timeout=0.2)
+        return port, port
+    return open(path, 'rb'), None
+
+
+def forward_input(port):
+    """Send the lines typed on stdin to the firmware shell"""
+    for line in sys.stdin:
+        port.write(line.rstrip('\r\n').encode('utf-8') + b'\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='serial port, capture file or - for stdin')
+    parser.add_argument('--json', action='store_true', help='one JSON object per event')
+    parser.add_argument('--save', metavar='FILE', help='also write the raw bytes to FILE')
+    parser.add_argument('--shell', action='store_true', help='send the lines typed on stdin to the command shell')
+    args = parser.parse_args()
+
+    if args.json:
+        emit = lambda ev: print(json.dumps(ev), flush=True)
+        text = lambda t: print(json.dumps({'type': 'raw', 'text': t}), flush=True)
+    else:
+        emit = lambda ev: print(format_event(ev), flush=True)
+        text = lambda t: print(t.rstrip('\r\n'), flush=True)
+
+    decoder = Decoder(emit, text)
+    stream, port = open_input(args.input)
+    if args.shell:
+        if port is None:
+            parser.error('--shell needs a serial port')
+        threading.Thread(target=forward_input, args=(port,), daemon=True).start()
+    save = open(args.save, 'wb') if args.save else None
+    try:
+        while True:
+            data = stream.read(4096) if port is None else port.read(port.in_waiting or 1)
+            if not data:
+                if port is None:
+                    break
+                continue
+            if save:
+                save.write(data)
+            decoder.feed(data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if save:
+            save.close()
+
+    print('{} frames, {} lost, {} damaged'.format(decoder.frames, decoder.lost, decoder.bad), file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""
+Pack the display assets (fonts, animations, messages) into an image for the
+"assets" partition, see components/assets/include/assets.h for the layout.
+
+    python tools/pack_assets.py assets/assets.json assets.bin
+    parttool.py write_partition --partition-name assets --input assets.bin
+
+Segment bytes are written as ABCDEFGH bit strings ("11101110") or integers.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import zlib
+
+MAGIC = 0x41444656  # "VFDA"
+FORMAT_VERSION = 2
+TUBES = 6  # Default, VFD_TUBES of the board topology
+
+ASSET_FONT = 1
+ASSET_ANIM = 2
+ASSET_MESSAGE = 3
+
+HEADER = struct.Struct('<IHHIIIHH')  # magic, format, count, version, total_size, crc32, tubes, reserved
+ENTRY = struct.Struct('<HHII')     # type, id, offset, size
+
+
+def segments(value):
+    byte = int(value, 2) if isinstance(value, str) else int(value)
+    if not 0 <= byte <= 0xff:
+        raise ValueError('segment byte out of range: {}'.format(value))
+    return byte
+
+
+def pack_font(font):
+    if len(font['digits']) != 10 or len(font['letters']) != 26:
+        raise ValueError('a font needs 10 digits and 26 letters')
+    return bytes(segments(g) for g in font['digits'] + font['letters'])
+
+
+def pack_animation(keyframes, tubes):
+    out = bytearray()
+    for segs, phases in keyframes:
+        if len(segs) != tubes or not 1 <= phases <= 255:
+            raise ValueError('a keyframe needs {} segment bytes and 1..255 phases'.format(tubes))
+        out += bytes(segments(s) for s in segs) + bytes([phases])
+    return bytes(out)
+
+
+def pack_message(text):
+    return text.encode('ascii') + b'\0'
+
+
+def pack(manifest, tubes=TUBES):
+    assets = []
+    for key, font in manifest.get('fonts', {}).items():
+        assets.append((ASSET_FONT, int(key), pack_font(font)))
+    for key, keyframes in manifest.get('animations', {}).items():
+        assets.append((ASSET_ANIM, int(key), pack_animation(keyframes, tubes)))
+    for key, text in manifest.get('messages', {}).items():
+        assets.append((ASSET_MESSAGE, int(key), pack_message(text)))
+
+    directory = bytearray()
+    payloads = bytearray()
+    offset = HEADER.size + ENTRY.size * len(assets)
+    for asset_type, asset_id, payload in assets:
+        pad = -(offset + len(payloads)) % 4
+        payloads += b'\0' * pad
+        directory += ENTRY.pack(asset_type, asset_id, offset + len(payloads), len(payload))
+        payloads += payload
+
+    body = bytes(directory + payloads)
+    total = HEADER.size + len(body)
+    header = HEADER.pack(MAGIC, FORMAT_VERSION, len(assets), manifest.get('version', 0),
+                         total, zlib.crc32(body) & 0xffffffff, tubes, 0)
+    return header + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('manifest', help='asset description (JSON)')
+    parser.add_argument('output', help='partition image to write')
+    parser.add_argument('--size', type=lambda s: int(s, 0), default=0x40000,
+                        help='partition size, the image must fit (default 0x40000)')
+    parser.add_argument('--tubes', type=int, default=TUBES,
+                        help='tubes of the display topology, recorded in the header (default {})'.format(TUBES))
+    args = parser.parse_args()
+
+    with open(args.manifest) as f:
+        image = pack(json.load(f), args.tubes)
+    if len(image) > args.size:
+        sys.exit('assets take {} bytes, the partition holds {}'.format(len(image), args.size))
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('{}: {} bytes'.format(args.output, len(image)))
+
+
+if __name__ == '__main__':
+    main()